@@ -408,6 +408,156 @@ CREATE UNIQUE INDEX IF NOT EXISTS [idxClassPropertiesByMap]
   (ClassID, ColMap)
   WHERE [ColMap] IS NOT NULL AND Deleted = 0;
 
+------------------------------------------------------------------------------------------
+-- [.class_images] table
+------------------------------------------------------------------------------------------
+/*
+Compact binary image of normalized class definition (properties, ColMap, ctlv, index mappings, mixins).
+Used by native code to load class definition without re-parsing JSON.
+Image is a cache: it gets deleted whenever class or its properties are changed
+and re-created by native code when class is created, altered or renamed. Class loading never writes images,
+as it happens on reads. Classes without image are loaded from JSON
+*/
+CREATE TABLE IF NOT EXISTS [.class_images]
+(
+  [ClassID] INTEGER NOT NULL PRIMARY KEY CONSTRAINT [fkClassImagesToClasses]
+  REFERENCES [.classes] ([ClassID])
+    ON DELETE CASCADE
+    ON UPDATE CASCADE,
+
+  [Image]   BLOB    NOT NULL
+) WITHOUT ROWID;
+
+CREATE TRIGGER IF NOT EXISTS [trigClassesAfterUpdate_ClassImage]
+  AFTER UPDATE OF NameID, SystemClass, ctloMask, Data, VirtualTable, ColMapActive, Deleted
+  ON [.classes]
+  FOR EACH ROW
+BEGIN
+  DELETE FROM [.class_images]
+  WHERE ClassID = old.ClassID;
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigClassPropsAfterInsert_ClassImage]
+  AFTER INSERT
+  ON [.class_props]
+  FOR EACH ROW
+BEGIN
+  DELETE FROM [.class_images]
+  WHERE ClassID = new.ClassID;
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigClassPropsAfterUpdate_ClassImage]
+  AFTER UPDATE OF ClassID, NameID, ctlv, ctlvPlan, ColMap, Deleted
+  ON [.class_props]
+  FOR EACH ROW
+BEGIN
+  DELETE FROM [.class_images]
+  WHERE ClassID IN (old.ClassID, new.ClassID);
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigClassPropsAfterDelete_ClassImage]
+  AFTER DELETE
+  ON [.class_props]
+  FOR EACH ROW
+BEGIN
+  DELETE FROM [.class_images]
+  WHERE ClassID = old.ClassID;
+END;
+
+/*
+Images hold names of class, properties, mixins and referenced classes. Name can be referenced by any class,
+so renaming (or deleting) name invalidates all images. Names are not expected to be renamed often
+*/
+CREATE TRIGGER IF NOT EXISTS [trigSymNamesAfterUpdate_ClassImage]
+  AFTER UPDATE OF [Value], Deleted
+  ON [.sym_names]
+  FOR EACH ROW
+BEGIN
+  DELETE FROM [.class_images];
+END;
+
+CREATE TRIGGER IF NOT EXISTS [trigSymNamesAfterDelete_ClassImage]
+  AFTER DELETE
+  ON [.sym_names]
+  FOR EACH ROW
+BEGIN
+  DELETE FROM [.class_images];
+END;
+
+------------------------------------------------------------------------------------------
+-- [.class_stats] and [.prop_stats] tables
+------------------------------------------------------------------------------------------
+/*
+Statistics of class objects and property values, collected by flexi('analyze') and used for query planning
+(flexi_data best index, FilterDef). Analyze may process class objects incrementally (by chunks, in
+subsequent calls) and on sample of objects. [.class_stats] keeps progress of the current pass.
+*/
+CREATE TABLE IF NOT EXISTS [.class_stats]
+(
+  [ClassID]     INTEGER NOT NULL PRIMARY KEY CONSTRAINT [fkClassStatsToClasses]
+  REFERENCES [.classes] ([ClassID])
+    ON DELETE CASCADE
+    ON UPDATE CASCADE,
+
+  /*
+  Estimated number of objects in class
+   */
+  [ObjectCount] INTEGER NOT NULL DEFAULT 0,
+
+  /*
+  Last processed ObjectID of the current pass. 0 if pass is completed
+   */
+  [ScanPos]     INTEGER NOT NULL DEFAULT 0,
+
+  /*
+  Number of objects in ranges processed by the current pass, and how many of them were sampled
+   */
+  [PassObjects] INTEGER NOT NULL DEFAULT 0,
+  [PassSampled] INTEGER NOT NULL DEFAULT 0,
+
+  [SampleRate]  FLOAT   NOT NULL DEFAULT 1,
+  [Buckets]     INTEGER NOT NULL DEFAULT 16,
+
+  /*
+  Julian date of the last analyze
+   */
+  [AnalyzedAt]  FLOAT   NULL
+) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS [.prop_stats]
+(
+  [PropertyID]    INTEGER NOT NULL PRIMARY KEY CONSTRAINT [fkPropStatsToClassProps]
+  REFERENCES [.class_props] ([ID])
+    ON DELETE CASCADE
+    ON UPDATE CASCADE,
+
+  [ClassID]       INTEGER NOT NULL,
+
+  /*
+  Statistics of values sampled by the current pass, as returned by value_stats. Includes HyperLogLog sketch,
+  so that statistics of subsequent incremental runs can be merged (value_stats_merge)
+   */
+  [Stats]         JSON1   NOT NULL,
+
+  /*
+  Estimations for all class objects: number of non null values (also copied to [.class_props].NonNullCount)
+  and number of distinct values
+   */
+  [NonNullCount]  INTEGER NOT NULL DEFAULT 0,
+  [DistinctCount] INTEGER NOT NULL DEFAULT 0,
+
+  [MinValue]              NULL,
+  [MaxValue]              NULL,
+
+  /*
+  Equi-depth histogram: JSON array of N + 1 bounds. Bucket (b[i - 1], b[i]] holds ~1/N of values
+   */
+  [Histogram]     JSON1   NULL
+) WITHOUT ROWID;
+
+CREATE INDEX IF NOT EXISTS [idxPropStatsByClass]
+  ON [.prop_stats] (ClassID);
+
 ------------------------------------------------------------------------------------------
 -- [flexi_prop] view
 ------------------------------------------------------------------------------------------
@@ -28,24 +28,6 @@ public:
 
     sqlite3_stmt *pStmts[STMT_DEL_FTS + 1] = {};
 
-    /*
-     * In-memory database used for certain operations, e.g. MATCH function on non-FTS indexed columns.
-     * Lazy-opened and initialized on demand, on first attempt to use it.
-     */
-    sqlite3 *pMemDB = nullptr;
-
-    /*
-     * Prepared SQL statement used by MATCH function on non-FTS indexed columns to insert temporary rows
-     * into full text index table
-     */
-    sqlite3_stmt *pMatchFuncInsStmt = nullptr;
-
-    /*
-     * Prepared SQL statement used by MATCH function on non-FTS indexed columns to select temporary rows
-     * from full text index table
-     */
-    sqlite3_stmt *pMatchFuncSelStmt = nullptr;
-
     /*
      * Info on current user
      */
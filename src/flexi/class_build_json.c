@@ -379,7 +379,7 @@ int flexi_buildInternalClassDefJSON(struct flexi_ClassDef_t *pClassDef, const ch
     StringBuilder_appendRaw(&ctx.sb, ":{", 2);
 
     // 'properties'
-    HashTable_each(&pClassDef->propsByName, (void *) _buildPropDefJSON, &ctx);
+    FlatHash_each(&pClassDef->propsByName, (void *) _buildPropDefJSON, &ctx);
 
     // 'fullTextIndexing'
     StringBuilder_appendRaw(&ctx.sb, "},", -1);
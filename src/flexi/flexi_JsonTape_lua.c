@@ -0,0 +1,128 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Lua binding for JsonTape: 'flexi_JsonTape' module.
+ * Decodes JSON payloads of flexi_data and flexi('import data') in one pass, building Lua values
+ * directly from tape nodes. Result is the same as of cjson.decode: objects and arrays become tables,
+ * null becomes cjson.null (light userdata NULL), numbers become Lua numbers.
+ *
+ * local JsonTape = require 'flexi_JsonTape'
+ * local data = JsonTape.decode(payload)
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "flexi_JsonTape_lua.h"
+#include "../util/JsonTape.h"
+
+#define FLEXI_JSON_TAPE_MT "flexi.JsonTape"
+
+/*
+ * Pushes value of node, with all its descendants
+ */
+static void _pushNode(lua_State *L, const JsonTape_t *pTape, u32 iNode)
+{
+    const JsonTapeNode_t *pNode = &pTape->aNodes[iNode];
+
+    // Table, key and value for every nesting level
+    luaL_checkstack(L, 3, "JSON is too deep");
+
+    switch (pNode->type)
+    {
+        case JSON_TRUE:
+            lua_pushboolean(L, 1);
+            break;
+
+        case JSON_FALSE:
+            lua_pushboolean(L, 0);
+            break;
+
+        case JSON_INT:
+            lua_pushnumber(L, (lua_Number) pNode->v.i);
+            break;
+
+        case JSON_REAL:
+            lua_pushnumber(L, pNode->v.d);
+            break;
+
+        case JSON_STRING:
+            lua_pushlstring(L, pNode->v.s.z, pNode->v.s.n);
+            break;
+
+        case JSON_ARRAY:
+        {
+            lua_createtable(L, (int) pNode->nChildren, 0);
+            int idx = 1;
+            for (u32 ii = JsonTape_firstChild(pTape, iNode); ii != JSON_TAPE_NONE;
+                 ii = JsonTape_nextSibling(pTape, ii))
+            {
+                _pushNode(L, pTape, ii);
+                lua_rawseti(L, -2, idx++);
+            }
+            break;
+        }
+
+        case JSON_OBJECT:
+            lua_createtable(L, 0, (int) pNode->nChildren);
+            for (u32 ii = JsonTape_firstChild(pTape, iNode); ii != JSON_TAPE_NONE;
+                 ii = JsonTape_nextSibling(pTape, ii))
+            {
+                lua_pushlstring(L, pTape->aNodes[ii].zKey, pTape->aNodes[ii].nKey);
+                _pushNode(L, pTape, ii);
+                lua_rawset(L, -3);
+            }
+            break;
+
+        default:
+            lua_pushlightuserdata(L, NULL);
+            break;
+    }
+}
+
+/*
+ * JsonTape.decode(json) -> value. Raises error with position of invalid JSON.
+ * Tape is kept in upvalue, so its memory is reused by subsequent calls
+ */
+static int _decode(lua_State *L)
+{
+    size_t nJson;
+    const char *zJson = luaL_checklstring(L, 1, &nJson);
+    JsonTape_t *pTape = (JsonTape_t *) lua_touserdata(L, lua_upvalueindex(1));
+
+    int result = JsonTape_parse(pTape, zJson, (int) nJson);
+    if (result == SQLITE_ERROR)
+        return luaL_error(L, "Invalid JSON at position %d", (int) pTape->iErrorPos);
+    if (result != SQLITE_OK)
+        return luaL_error(L, "Out of memory");
+
+    _pushNode(L, pTape, 0);
+    return 1;
+}
+
+static int _gc(lua_State *L)
+{
+    JsonTape_free((JsonTape_t *) luaL_checkudata(L, 1, FLEXI_JSON_TAPE_MT));
+    return 0;
+}
+
+int luaopen_flexi_JsonTape(lua_State *L)
+{
+    luaL_newmetatable(L, FLEXI_JSON_TAPE_MT);
+    lua_pushcfunction(L, _gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+
+    JsonTape_t *pTape = (JsonTape_t *) lua_newuserdata(L, sizeof(JsonTape_t));
+    JsonTape_init(pTape);
+    luaL_getmetatable(L, FLEXI_JSON_TAPE_MT);
+    lua_setmetatable(L, -2);
+    lua_pushcclosure(L, _decode, 1);
+    lua_setfield(L, -2, "decode");
+
+    return 1;
+}
@@ -0,0 +1,24 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_JSONTAPE_LUA_H
+#define FLEXILITE_FLEXI_JSONTAPE_LUA_H
+
+#include <lua.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Opens 'flexi_JsonTape' module: single pass JSON decoder for Lua code.
+ * Intended to be registered in package.preload
+ */
+int luaopen_flexi_JsonTape(lua_State *L);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_JSONTAPE_LUA_H
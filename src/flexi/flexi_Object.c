@@ -7,12 +7,23 @@
  */
 
 #include "flexi_Object.h"
+#include "flexi_eav.h"
+#include "flexi_db_ctx.h"
 
 static void
 _reset(flexi_Object_t *self)
 {
     HashTable_clear(&self->existingPropsByIDs);
     HashTable_clear(&self->newPropsByNames);
+
+    Arena_reset(&self->arena);
+    self->lClassID = 0;
+    self->lCtlo = 0;
+    self->lVTypes = 0;
+    self->zMetaData = NULL;
+    self->nMetaData = 0;
+    self->nValues = 0;
+    memset(self->aColValues, 0, sizeof(self->aColValues));
 }
 
 /*
@@ -26,6 +37,7 @@ int flexi_Object_init(flexi_Object_t *self, struct flexi_Context_t *pCtx)
     self->pCtx = pCtx;
     HashTable_init(&self->existingPropsByIDs, DICT_INT, (void *) sqlite3_value_free);
     HashTable_init(&self->newPropsByNames, DICT_STRING, (void *) flexi_PropValue_free);
+    Arena_init(&self->arena);
 
     return result;
 }
@@ -61,54 +73,187 @@ int flexi_Object_free(flexi_Object_t *self)
     if (self)
     {
         flexi_Object_clear(self);
+        Arena_clear(&self->arena);
+        sqlite3_free(self->aValues);
         sqlite3_free(self);
     }
 
     return 0;
 }
 
+/*
+ * Copies column value of statement's current row to pValue. Text and blob data are copied to object's arena
+ */
+static int _readColumnValue(flexi_Object_t *self, sqlite3_stmt *pStmt, int iCol, flexi_ObjValue_t *pValue)
+{
+    pValue->iType = sqlite3_column_type(pStmt, iCol);
+    pValue->nBytes = 0;
+    switch (pValue->iType)
+    {
+        case SQLITE_INTEGER:
+            pValue->v.i = sqlite3_column_int64(pStmt, iCol);
+            break;
+
+        case SQLITE_FLOAT:
+            pValue->v.d = sqlite3_column_double(pStmt, iCol);
+            break;
+
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+        {
+            const void *pData = pValue->iType == SQLITE_TEXT ? (const void *) sqlite3_column_text(pStmt, iCol)
+                                                             : sqlite3_column_blob(pStmt, iCol);
+            pValue->nBytes = sqlite3_column_bytes(pStmt, iCol);
+            pValue->v.z = Arena_dup(&self->arena, pData, (u32) pValue->nBytes, pValue->iType == SQLITE_TEXT);
+            if (pValue->v.z == NULL)
+                return SQLITE_NOMEM;
+            break;
+        }
+
+        default:
+            pValue->iType = SQLITE_NULL;
+            break;
+    }
+
+    return SQLITE_OK;
+}
+
 /*
  * Loads object data and non references properties
  */
 int flexi_Object_load(flexi_Object_t *self, sqlite3_int64 lObjectID)
 {
     int result;
+    sqlite3_stmt *pOStmt = NULL;
+    sqlite3_stmt *pRVStmt = NULL;
 
     assert(self->pCtx);
 
     _reset(self);
 
     self->lObjectID = lObjectID;
-    sqlite3_stmt *pOStmt;
-    sqlite3_stmt *pRVStmt;
 
     // Load .objects
-    CHECK_CALL(flexi_Context_stmtInit(self->pCtx, STMT_SEL_OBJ, "select "
-            "* from [.objects] where ID=:1;", &pOStmt));
+    CHECK_CALL(flexi_Context_stmtInit(self->pCtx, STMT_SEL_OBJ, "select ClassID, ctlo, vtypes, "
+            "A, B, C, D, E, F, G, H, I, J, K, L, M, N, O, P, MetaData "
+            "from [.objects] where ObjectID = :1;", &pOStmt));
     sqlite3_bind_int64(pOStmt, 1, lObjectID);
-    result = sqlite3_step(pOStmt);
-    if (result == SQLITE_ROW)
+    CHECK_STMT_STEP(pOStmt, self->pCtx->db);
+    if (result == SQLITE_DONE)
+    {
+        result = SQLITE_NOTFOUND;
+        goto EXIT;
+    }
+
+    self->lClassID = sqlite3_column_int64(pOStmt, 0);
+    self->lCtlo = sqlite3_column_int64(pOStmt, 1);
+    self->lVTypes = sqlite3_column_int64(pOStmt, 2);
+
+    for (int iCol = 0; iCol < FLEXI_OBJ_COL_COUNT; iCol++)
     {
+        flexi_ObjValue_t *pValue = &self->aColValues[iCol];
+        CHECK_CALL(_readColumnValue(self, pOStmt, 3 + iCol, pValue));
+
+        /*
+         * ctlv for mapped column: value type - from 3 bits of vtypes, unique and index flags - from ctlo
+         * (see Constants.CTLO_FLAGS)
+         */
+        pValue->ctlv = (int) ((self->lVTypes >> (iCol * 3)) & CTLV_VTYPE_MASK);
+        if (self->lCtlo & (1LL << (CTLO_UNIQUE_SHIFT + iCol)))
+            pValue->ctlv |= CTLV_UNIQUE;
+        if (self->lCtlo & (1LL << (CTLO_INDEX_SHIFT + iCol)))
+            pValue->ctlv |= CTLV_INDEX;
+    }
 
+    if (sqlite3_column_type(pOStmt, 3 + FLEXI_OBJ_COL_COUNT) != SQLITE_NULL)
+    {
+        self->nMetaData = sqlite3_column_bytes(pOStmt, 3 + FLEXI_OBJ_COL_COUNT);
+        self->zMetaData = Arena_dup(&self->arena, sqlite3_column_text(pOStmt, 3 + FLEXI_OBJ_COL_COUNT),
+                                    (u32) self->nMetaData, true);
+        CHECK_NULL(self->zMetaData);
     }
-    else
-        if (result != SQLITE_DONE)
-            goto ONERROR;
 
     // Load .ref-values
-    CHECK_CALL(flexi_Context_stmtInit(self->pCtx, STMT_SEL_REF_VALUES, "select"
-            ""
-            " from [.ref-values] where ObjectID=:1;", &pRVStmt));
+    CHECK_CALL(flexi_Context_stmtInit(self->pCtx, STMT_SEL_REF_VALUES,
+                                      "select PropertyID, PropIndex, ctlv, [Value] from [.ref-values] "
+                                              "where ObjectID = :1 order by PropertyID, PropIndex;", &pRVStmt));
+    sqlite3_bind_int64(pRVStmt, 1, lObjectID);
+    while (true)
+    {
+        CHECK_STMT_STEP(pRVStmt, self->pCtx->db);
+        if (result == SQLITE_DONE)
+            break;
+
+        if (self->nValues == self->nValuesAlloc)
+        {
+            int nNewAlloc = self->nValuesAlloc == 0 ? 16 : self->nValuesAlloc * 2;
+            flexi_ObjValue_t *aNew = sqlite3_realloc(self->aValues, (int) sizeof(flexi_ObjValue_t) * nNewAlloc);
+            CHECK_NULL(aNew);
+            self->aValues = aNew;
+            self->nValuesAlloc = nNewAlloc;
+        }
+
+        flexi_ObjValue_t *pValue = &self->aValues[self->nValues];
+        pValue->lPropID = sqlite3_column_int64(pRVStmt, 0);
+        pValue->lPropIndex = sqlite3_column_int64(pRVStmt, 1);
+        pValue->ctlv = sqlite3_column_int(pRVStmt, 2);
+        CHECK_CALL(_readColumnValue(self, pRVStmt, 3, pValue));
+        self->nValues++;
+    }
 
     result = SQLITE_OK;
     goto EXIT;
 
     ONERROR:
+    _reset(self);
 
     EXIT:
+    if (pOStmt != NULL)
+        sqlite3_reset(pOStmt);
+    if (pRVStmt != NULL)
+        sqlite3_reset(pRVStmt);
     return result;
 }
 
+/*
+ * Returns index of the first value in aValues which is not less than (lPropID, lPropIndex)
+ */
+static int _lowerBound(flexi_Object_t *self, sqlite3_int64 lPropID, sqlite3_int64 lPropIndex)
+{
+    int lo = 0;
+    int hi = self->nValues;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        flexi_ObjValue_t *pValue = &self->aValues[mid];
+        if (pValue->lPropID < lPropID || (pValue->lPropID == lPropID && pValue->lPropIndex < lPropIndex))
+            lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+const flexi_ObjValue_t *flexi_Object_findValue(flexi_Object_t *self, sqlite3_int64 lPropID,
+                                               sqlite3_int64 lPropIndex)
+{
+    int idx = _lowerBound(self, lPropID, lPropIndex);
+    if (idx < self->nValues && self->aValues[idx].lPropID == lPropID && self->aValues[idx].lPropIndex == lPropIndex)
+        return &self->aValues[idx];
+    return NULL;
+}
+
+int flexi_Object_findPropValues(flexi_Object_t *self, sqlite3_int64 lPropID, int *piFirst)
+{
+    int iFirst = _lowerBound(self, lPropID, INT64_MIN);
+    int iLast = iFirst;
+    while (iLast < self->nValues && self->aValues[iLast].lPropID == lPropID)
+        iLast++;
+
+    if (piFirst != NULL)
+        *piFirst = iFirst;
+    return iLast - iFirst;
+}
+
 /*
  * Validates object data. Returns SQLITE_OK if data is valid
  * Returns SQLITE_ERROR otherwise and sets specific error pzError
@@ -6,11 +6,48 @@
 #define FLEXILITE_FLEXI_OBJECT_H
 
 #include "flexi_PropValue.h"
+#include "../util/Arena.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Number of mapped columns in [.objects] (A - P)
+ */
+#define FLEXI_OBJ_COL_COUNT 16
+
+/*
+ * Single value of loaded object: either from mapped column of [.objects] or from [.ref-values] row.
+ * Text and blob data are kept in object's arena
+ */
+typedef struct flexi_ObjValue_t
+{
+    /*
+     * 0 for mapped columns
+     */
+    sqlite3_int64 lPropID;
+    sqlite3_int64 lPropIndex;
+    int ctlv;
+
+    /*
+     * SQLITE_NULL, SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT or SQLITE_BLOB
+     */
+    int iType;
+
+    /*
+     * Length of text or blob
+     */
+    int nBytes;
+
+    union
+    {
+        sqlite3_int64 i;
+        double d;
+        const char *z;
+    } v;
+} flexi_ObjValue_t;
+
 /*
  * Structure for individual object data
  *
@@ -35,6 +72,36 @@ typedef struct flexi_Object_t
      * Raw property map - as it comes from input JSON.
      */
     Hash newPropsByNames;
+
+    /*
+     * Data loaded by flexi_Object_load
+     */
+    sqlite3_int64 lCtlo;
+    sqlite3_int64 lVTypes;
+
+    /*
+     * Raw MetaData JSON or NULL. It is not parsed here, consumers decode it on demand
+     */
+    const char *zMetaData;
+    int nMetaData;
+
+    /*
+     * Values of mapped columns A - P. ctlv is built from ctlo and vtypes
+     */
+    flexi_ObjValue_t aColValues[FLEXI_OBJ_COL_COUNT];
+
+    /*
+     * Values from [.ref-values], sorted by property ID and property index.
+     * Array is reused by subsequent loads
+     */
+    flexi_ObjValue_t *aValues;
+    int nValues;
+    int nValuesAlloc;
+
+    /*
+     * Storage for text and blob values and MetaData. Reset on every load
+     */
+    Arena_t arena;
 } flexi_Object_t;
 
 /*
@@ -58,10 +125,23 @@ int flexi_Object_clear(flexi_Object_t *self);
 int flexi_Object_free(flexi_Object_t *self);
 
 /*
- * Loads object data and non references properties
+ * Loads object data and non references properties.
+ * Returns SQLITE_NOTFOUND if object does not exist
  */
 int flexi_Object_load(flexi_Object_t *self, sqlite3_int64 lObjectID);
 
+/*
+ * Finds value loaded from [.ref-values] by property ID and index. Returns NULL if not found
+ */
+const flexi_ObjValue_t *flexi_Object_findValue(flexi_Object_t *self, sqlite3_int64 lPropID,
+                                               sqlite3_int64 lPropIndex);
+
+/*
+ * Finds range of values of given property in aValues. Returns number of values, and index of
+ * the first one in piFirst
+ */
+int flexi_Object_findPropValues(flexi_Object_t *self, sqlite3_int64 lPropID, int *piFirst);
+
 /*
  * Validates object data. Returns SQLITE_OK if data is valid
  * Returns SQLITE_ERROR otherwise and sets specific error pzError
@@ -0,0 +1,284 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Lua binding for flexi_Object_load: 'flexi_ObjectLoader' module.
+ * Gives Lua code (DBQuery filtering) read access to object data loaded natively,
+ * without creating DBObject/DBProperty/DBValue tables per object.
+ *
+ * local ObjectLoader = require 'flexi_ObjectLoader'
+ * local loader = ObjectLoader.new(db:get_ptr())
+ * if loader:load(objectID) then
+ *     local v, ctlv = loader:value(propID, propIndex, colIdx)
+ * end
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "flexi_Object_lua.h"
+#include "flexi_Object.h"
+#include "flexi_db_ctx.h"
+
+#define FLEXI_OBJECT_LOADER_MT "flexi.ObjectLoader"
+
+typedef struct ObjectLoader_t
+{
+    /*
+     * Own connection context, so that prepared statements are not shared with virtual tables
+     */
+    struct flexi_Context_t *pCtx;
+
+    /*
+     * Object instance, reused by every load
+     */
+    flexi_Object_t *pObj;
+
+    /*
+     * true if pObj holds successfully loaded object
+     */
+    bool bLoaded;
+} ObjectLoader_t;
+
+static ObjectLoader_t *_checkLoader(lua_State *L)
+{
+    return (ObjectLoader_t *) luaL_checkudata(L, 1, FLEXI_OBJECT_LOADER_MT);
+}
+
+static ObjectLoader_t *_checkLoaded(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoader(L);
+    if (!self->bLoaded)
+        luaL_error(L, "No object loaded");
+    return self;
+}
+
+static void _pushValue(lua_State *L, const flexi_ObjValue_t *pValue)
+{
+    switch (pValue->iType)
+    {
+        case SQLITE_INTEGER:
+            lua_pushinteger(L, (lua_Integer) pValue->v.i);
+            break;
+
+        case SQLITE_FLOAT:
+            lua_pushnumber(L, pValue->v.d);
+            break;
+
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+            lua_pushlstring(L, pValue->v.z, (size_t) pValue->nBytes);
+            break;
+
+        default:
+            lua_pushnil(L);
+            break;
+    }
+}
+
+/*
+ * ObjectLoader.new(dbPtr)
+ */
+static int _new(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+    sqlite3 *db = (sqlite3 *) lua_touserdata(L, 1);
+
+    ObjectLoader_t *self = (ObjectLoader_t *) lua_newuserdata(L, sizeof(ObjectLoader_t));
+    memset(self, 0, sizeof(*self));
+    luaL_getmetatable(L, FLEXI_OBJECT_LOADER_MT);
+    lua_setmetatable(L, -2);
+
+    self->pCtx = flexi_Context_new(db);
+    if (self->pCtx == NULL)
+        return luaL_error(L, "Out of memory");
+
+    self->pObj = flexi_Object_new(self->pCtx);
+    if (self->pObj == NULL)
+        return luaL_error(L, "Out of memory");
+
+    return 1;
+}
+
+/*
+ * loader:load(objectID) -> true if object was found, false otherwise
+ */
+static int _load(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoader(L);
+    sqlite3_int64 lObjectID = (sqlite3_int64) luaL_checknumber(L, 2);
+
+    if (self->pObj == NULL)
+        return luaL_error(L, "Loader is closed");
+
+    self->bLoaded = false;
+    int result = flexi_Object_load(self->pObj, lObjectID);
+    if (result == SQLITE_NOTFOUND)
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    if (result != SQLITE_OK)
+        return luaL_error(L, "Error %d loading object %d: %s", result, (int) lObjectID,
+                          sqlite3_errmsg(self->pCtx->db));
+
+    self->bLoaded = true;
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int _objectID(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoaded(L);
+    lua_pushinteger(L, (lua_Integer) self->pObj->lObjectID);
+    return 1;
+}
+
+static int _classID(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoaded(L);
+    lua_pushinteger(L, (lua_Integer) self->pObj->lClassID);
+    return 1;
+}
+
+static int _ctlo(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoaded(L);
+    lua_pushnumber(L, (lua_Number) self->pObj->lCtlo);
+    return 1;
+}
+
+static int _vtypes(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoaded(L);
+    lua_pushnumber(L, (lua_Number) self->pObj->lVTypes);
+    return 1;
+}
+
+/*
+ * loader:metaData() -> raw MetaData JSON or nil
+ */
+static int _metaData(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoaded(L);
+    if (self->pObj->zMetaData != NULL)
+        lua_pushlstring(L, self->pObj->zMetaData, (size_t) self->pObj->nMetaData);
+    else lua_pushnil(L);
+    return 1;
+}
+
+/*
+ * loader:value(propID, propIndex, colIdx) -> value, ctlv
+ * colIdx (0 based, optional) is index of mapped column. Mapped column holds value for property index 1.
+ * If mapped column is NULL, value is looked up in [.ref-values]
+ */
+static int _value(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoaded(L);
+    sqlite3_int64 lPropID = (sqlite3_int64) luaL_checknumber(L, 2);
+    sqlite3_int64 lPropIndex = (sqlite3_int64) luaL_optnumber(L, 3, 1);
+    int iColIdx = (int) luaL_optinteger(L, 4, -1);
+
+    const flexi_ObjValue_t *pValue = NULL;
+    if (lPropIndex == 1 && iColIdx >= 0 && iColIdx < FLEXI_OBJ_COL_COUNT
+        && self->pObj->aColValues[iColIdx].iType != SQLITE_NULL)
+        pValue = &self->pObj->aColValues[iColIdx];
+    else pValue = flexi_Object_findValue(self->pObj, lPropID, lPropIndex);
+
+    if (pValue == NULL)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    _pushValue(L, pValue);
+    lua_pushinteger(L, pValue->ctlv);
+    return 2;
+}
+
+/*
+ * loader:values(propID, colIdx) -> array of property values, ordered by property index
+ */
+static int _values(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoaded(L);
+    sqlite3_int64 lPropID = (sqlite3_int64) luaL_checknumber(L, 2);
+    int iColIdx = (int) luaL_optinteger(L, 3, -1);
+
+    int iFirst = 0;
+    int nCount = flexi_Object_findPropValues(self->pObj, lPropID, &iFirst);
+    int n = 0;
+
+    lua_createtable(L, nCount + 1, 0);
+    if (iColIdx >= 0 && iColIdx < FLEXI_OBJ_COL_COUNT && self->pObj->aColValues[iColIdx].iType != SQLITE_NULL)
+    {
+        _pushValue(L, &self->pObj->aColValues[iColIdx]);
+        lua_rawseti(L, -2, ++n);
+    }
+
+    for (int ii = iFirst; ii < iFirst + nCount; ii++)
+    {
+        // Mapped column already returned as the first item
+        if (n > 0 && ii == iFirst && self->pObj->aValues[ii].lPropIndex == 1)
+            continue;
+        _pushValue(L, &self->pObj->aValues[ii]);
+        lua_rawseti(L, -2, ++n);
+    }
+
+    return 1;
+}
+
+/*
+ * loader:close() - frees loaded object and connection context with its prepared statements.
+ * Loader cannot be used after close
+ */
+static int _gc(lua_State *L)
+{
+    ObjectLoader_t *self = _checkLoader(L);
+    self->bLoaded = false;
+    if (self->pObj != NULL)
+    {
+        flexi_Object_free(self->pObj);
+        self->pObj = NULL;
+    }
+    if (self->pCtx != NULL)
+    {
+        flexi_Context_free(self->pCtx);
+        self->pCtx = NULL;
+    }
+    return 0;
+}
+
+static const luaL_Reg _methods[] = {
+        {"load",     _load},
+        {"objectID", _objectID},
+        {"classID",  _classID},
+        {"ctlo",     _ctlo},
+        {"vtypes",   _vtypes},
+        {"metaData", _metaData},
+        {"value",    _value},
+        {"values",   _values},
+        {"close",    _gc},
+        {"__gc",     _gc},
+        {NULL, NULL}
+};
+
+static const luaL_Reg _functions[] = {
+        {"new", _new},
+        {NULL, NULL}
+};
+
+int luaopen_flexi_ObjectLoader(lua_State *L)
+{
+    luaL_newmetatable(L, FLEXI_OBJECT_LOADER_MT);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_register(L, NULL, _methods);
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+    luaL_register(L, NULL, _functions);
+    return 1;
+}
@@ -0,0 +1,24 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_OBJECT_LUA_H
+#define FLEXILITE_FLEXI_OBJECT_LUA_H
+
+#include <lua.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Opens 'flexi_ObjectLoader' module: native object loader for Lua code.
+ * Intended to be registered in package.preload
+ */
+int luaopen_flexi_ObjectLoader(lua_State *L);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_OBJECT_LUA_H
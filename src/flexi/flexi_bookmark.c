@@ -0,0 +1,224 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Binary layout of bookmark (encoded as hex string):
+ * version (1 byte), order (1 byte), property ID (8 bytes), object ID (8 bytes), key type (1 byte),
+ * followed by key: 8 bytes for integer and float, 4 bytes of length and data for text and blob, nothing for NULL.
+ * Numbers are stored in big-endian byte order
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include "../project_defs.h"
+#include "flexi_bookmark.h"
+
+SQLITE_EXTENSION_INIT3
+
+#define FLEXI_BOOKMARK_VERSION 1
+
+// Size of fixed part: version, order, property ID, object ID and key type
+#define FLEXI_BOOKMARK_HEADER_SIZE 19
+
+static const char _hexDigits[] = "0123456789ABCDEF";
+
+static void _putU64(unsigned char *p, sqlite3_uint64 u)
+{
+    for (int ii = 7; ii >= 0; ii--)
+    {
+        p[ii] = (unsigned char) (u & 0xFF);
+        u >>= 8;
+    }
+}
+
+static sqlite3_uint64 _getU64(const unsigned char *p)
+{
+    sqlite3_uint64 result = 0;
+    for (int ii = 0; ii < 8; ii++)
+        result = (result << 8) | p[ii];
+    return result;
+}
+
+static int _hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+char *flexi_Bookmark_encode(const flexi_Bookmark_t *self)
+{
+    const KeyHeapItem_t *pKey = &self->pos;
+    bool bVarKey = pKey->iType == SQLITE_TEXT || pKey->iType == SQLITE_BLOB;
+    int nKeyBytes = pKey->iType == SQLITE_NULL ? 0 : (bVarKey ? 4 + pKey->nBytes : 8);
+    int nBytes = FLEXI_BOOKMARK_HEADER_SIZE + nKeyBytes;
+
+    unsigned char *pData = sqlite3_malloc(nBytes);
+    char *zResult = sqlite3_malloc(nBytes * 2 + 1);
+    if (pData == NULL || zResult == NULL)
+    {
+        sqlite3_free(pData);
+        sqlite3_free(zResult);
+        return NULL;
+    }
+
+    pData[0] = FLEXI_BOOKMARK_VERSION;
+    pData[1] = (unsigned char) self->eOrder;
+    _putU64(&pData[2], (sqlite3_uint64) self->lPropID);
+    _putU64(&pData[10], (sqlite3_uint64) pKey->lID);
+    pData[18] = (unsigned char) pKey->iType;
+
+    unsigned char *p = &pData[FLEXI_BOOKMARK_HEADER_SIZE];
+    switch (pKey->iType)
+    {
+        case SQLITE_INTEGER:
+            _putU64(p, (sqlite3_uint64) pKey->v.i);
+            break;
+
+        case SQLITE_FLOAT:
+        {
+            sqlite3_uint64 u;
+            memcpy(&u, &pKey->v.d, sizeof(u));
+            _putU64(p, u);
+            break;
+        }
+
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+            p[0] = (unsigned char) ((u32) pKey->nBytes >> 24);
+            p[1] = (unsigned char) ((u32) pKey->nBytes >> 16);
+            p[2] = (unsigned char) ((u32) pKey->nBytes >> 8);
+            p[3] = (unsigned char) pKey->nBytes;
+            if (pKey->nBytes > 0)
+                memcpy(p + 4, pKey->v.z, (size_t) pKey->nBytes);
+            break;
+
+        default:
+            break;
+    }
+
+    for (int ii = 0; ii < nBytes; ii++)
+    {
+        zResult[ii * 2] = _hexDigits[pData[ii] >> 4];
+        zResult[ii * 2 + 1] = _hexDigits[pData[ii] & 0x0F];
+    }
+    zResult[nBytes * 2] = 0;
+
+    sqlite3_free(pData);
+    return zResult;
+}
+
+int flexi_Bookmark_decode(flexi_Bookmark_t *self, sqlite3_value *pValue)
+{
+    int result;
+
+    flexi_Bookmark_clear(self);
+
+    if (sqlite3_value_type(pValue) != SQLITE_TEXT)
+    {
+        result = SQLITE_MISMATCH;
+        goto ONERROR;
+    }
+
+    const char *zHex = (const char *) sqlite3_value_text(pValue);
+    int nHex = sqlite3_value_bytes(pValue);
+    if (zHex == NULL || nHex % 2 != 0 || nHex < FLEXI_BOOKMARK_HEADER_SIZE * 2)
+    {
+        result = SQLITE_MISMATCH;
+        goto ONERROR;
+    }
+
+    int nBytes = nHex / 2;
+    CHECK_MALLOC(self->pData, nBytes);
+    for (int ii = 0; ii < nBytes; ii++)
+    {
+        int hi = _hexValue(zHex[ii * 2]);
+        int lo = _hexValue(zHex[ii * 2 + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            result = SQLITE_MISMATCH;
+            goto ONERROR;
+        }
+        self->pData[ii] = (unsigned char) (hi << 4 | lo);
+    }
+
+    const unsigned char *pData = self->pData;
+    if (pData[0] != FLEXI_BOOKMARK_VERSION || pData[1] < FLEXI_BOOKMARK_BY_ID
+        || pData[1] > FLEXI_BOOKMARK_BY_VALUE_DESC)
+    {
+        result = SQLITE_MISMATCH;
+        goto ONERROR;
+    }
+
+    self->eOrder = (FLEXI_BOOKMARK_ORDER) pData[1];
+    self->lPropID = (sqlite3_int64) _getU64(&pData[2]);
+    self->pos.lID = (sqlite3_int64) _getU64(&pData[10]);
+    self->pos.iType = pData[18];
+    self->pos.nBytes = 0;
+
+    const unsigned char *p = &pData[FLEXI_BOOKMARK_HEADER_SIZE];
+    int nKeyBytes = nBytes - FLEXI_BOOKMARK_HEADER_SIZE;
+    switch (self->pos.iType)
+    {
+        case SQLITE_NULL:
+            result = nKeyBytes == 0 ? SQLITE_OK : SQLITE_MISMATCH;
+            break;
+
+        case SQLITE_INTEGER:
+            self->pos.v.i = (sqlite3_int64) _getU64(p);
+            result = nKeyBytes == 8 ? SQLITE_OK : SQLITE_MISMATCH;
+            break;
+
+        case SQLITE_FLOAT:
+        {
+            sqlite3_uint64 u = _getU64(p);
+            memcpy(&self->pos.v.d, &u, sizeof(u));
+            result = nKeyBytes == 8 ? SQLITE_OK : SQLITE_MISMATCH;
+            break;
+        }
+
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+            if (nKeyBytes < 4)
+            {
+                result = SQLITE_MISMATCH;
+                break;
+            }
+            self->pos.nBytes = (int) ((u32) p[0] << 24 | (u32) p[1] << 16 | (u32) p[2] << 8 | p[3]);
+            self->pos.v.z = (const char *) (p + 4);
+            result = self->pos.nBytes == nKeyBytes - 4 ? SQLITE_OK : SQLITE_MISMATCH;
+            break;
+
+        default:
+            result = SQLITE_MISMATCH;
+            break;
+    }
+
+    // Ordering by object ID has no key
+    if (result == SQLITE_OK && self->eOrder <= FLEXI_BOOKMARK_BY_ID_DESC
+        && (self->lPropID != 0 || self->pos.iType != SQLITE_NULL))
+        result = SQLITE_MISMATCH;
+
+    if (result != SQLITE_OK)
+        goto ONERROR;
+
+    goto EXIT;
+
+    ONERROR:
+    flexi_Bookmark_clear(self);
+
+    EXIT:
+    return result;
+}
+
+void flexi_Bookmark_clear(flexi_Bookmark_t *self)
+{
+    sqlite3_free(self->pData);
+    memset(self, 0, sizeof(*self));
+}
@@ -0,0 +1,71 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_BOOKMARK_H
+#define FLEXILITE_FLEXI_BOOKMARK_H
+
+#include "../util/KeyHeap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Ordering which bookmark position belongs to. Ordering by value is the same regardless of how it is
+ * served by flexi_data (index scan, sorted lookup or heap): NULLs first, equal values ordered by object ID,
+ * all in the same direction
+ */
+typedef enum
+{
+    FLEXI_BOOKMARK_BY_ID = 1,
+    FLEXI_BOOKMARK_BY_ID_DESC = 2,
+    FLEXI_BOOKMARK_BY_VALUE = 3,
+    FLEXI_BOOKMARK_BY_VALUE_DESC = 4
+} FLEXI_BOOKMARK_ORDER;
+
+/*
+ * Position of object in ordered results of flexi_data: (sort key, object ID). Query with bookmark continues
+ * right after this position, so pages are found by index seek rather than by skipping rows,
+ * and objects inserted or deleted before the position do not shift following pages.
+ * Bookmark is passed around as opaque hex string
+ */
+typedef struct flexi_Bookmark_t
+{
+    FLEXI_BOOKMARK_ORDER eOrder;
+
+    /*
+     * ID of property to order by (0 for ordering by object ID). Property ID, not column index, is kept,
+     * so that bookmark stays valid after properties are added to class
+     */
+    sqlite3_int64 lPropID;
+
+    /*
+     * Object ID (pos.lID) and sort key. Key is NULL for ordering by object ID
+     */
+    KeyHeapItem_t pos;
+
+    /*
+     * Decoded bookmark data, which text or blob key points to
+     */
+    unsigned char *pData;
+} flexi_Bookmark_t;
+
+/*
+ * Encodes bookmark into hex string. Result must be freed by sqlite3_free. Returns NULL if out of memory
+ */
+char *flexi_Bookmark_encode(const flexi_Bookmark_t *self);
+
+/*
+ * Decodes bookmark from string returned by flexi_Bookmark_encode. Previous data of self are released.
+ * Returns SQLITE_OK, SQLITE_NOMEM or SQLITE_MISMATCH if value is not a valid bookmark
+ */
+int flexi_Bookmark_decode(flexi_Bookmark_t *self, sqlite3_value *pValue);
+
+void flexi_Bookmark_clear(flexi_Bookmark_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_BOOKMARK_H
@@ -0,0 +1,403 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Native change capture for [.change_log].
+ * Rows of [.objects] are logged by triggers, for every writer. Property values are not, so flexi_data records
+ * compact deltas of values it writes (object ID, property ID, property index, old and new value) into
+ * ring buffer. Deltas are written by multi-row inserts, when ring gets full and when transaction is being
+ * committed (xSync of flexi_data virtual table, which is the last point when database can be still modified
+ * by the transaction). On rollback pending deltas are simply dropped.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../common/common.h"
+#include "flexi_change_log.h"
+#include "../util/StringBuilder.h"
+
+#ifndef SQLITE_CORE
+
+SQLITE_EXTENSION_INIT3
+
+#endif
+
+/*
+ * Key format (both for OldKey and KEY): @ClassID.ObjectID for objects, @ClassID.ObjectID#PropertyID[PropIndex]
+ * for property values. OldKey is not set for created objects/values, KEY - for deleted ones.
+ * ChangedBy is set directly, so that trigChangeLogAfterInsert does not need to update inserted row
+ */
+static const char *_zInsChangeLogPrefix =
+        "insert into [.change_log] ([OldKey], [OldValue], [KEY], [Value], [ChangedBy]) "
+        "select case when column1 <> 'C' then k end, column6, case when column1 <> 'D' then k end, column7, "
+        "var('CurrentUserID') from (select *, '@' || column2 || '.' || column3 || "
+        "case when column4 is null then '' else '#' || column4 || '[' || column5 || ']' end as k from (values ";
+
+#define CHANGE_LOG_PARAMS_PER_ROW 7
+
+void flexi_ChangeLog_init(flexi_ChangeLog_t *pLog, sqlite3 *db)
+{
+    memset(pLog, 0, sizeof(*pLog));
+    pLog->db = db;
+}
+
+static void _freeEntry(flexi_ChangeLogEntry_t *pEntry)
+{
+    sqlite3_value_free(pEntry->pOldValue);
+    sqlite3_value_free(pEntry->pNewValue);
+    pEntry->pOldValue = NULL;
+    pEntry->pNewValue = NULL;
+}
+
+void flexi_ChangeLog_discard(flexi_ChangeLog_t *pLog)
+{
+    for (int ii = 0; ii < pLog->nCount; ii++)
+    {
+        _freeEntry(&pLog->aRing[(pLog->iHead + ii) % FLEXI_CHANGE_LOG_RING_SIZE]);
+    }
+    pLog->iHead = 0;
+    pLog->nCount = 0;
+    pLog->lNextSeq = 0;
+    pLog->nSavepoints = 0;
+    pLog->bInTransaction = false;
+}
+
+void flexi_ChangeLog_begin(flexi_ChangeLog_t *pLog)
+{
+    if (pLog->bInTransaction)
+        // Another flexi_data table has joined transaction which is already in progress
+        return;
+
+    // Leftovers of previous transaction, if any, do not belong to this one
+    flexi_ChangeLog_discard(pLog);
+    pLog->bInTransaction = true;
+}
+
+void flexi_ChangeLog_clear(flexi_ChangeLog_t *pLog)
+{
+    flexi_ChangeLog_discard(pLog);
+    sqlite3_free(pLog->aRing);
+    sqlite3_free(pLog->aSavepoints);
+    sqlite3_finalize(pLog->pInsBatchStmt);
+    sqlite3_finalize(pLog->pSelOldValueStmt);
+    pLog->aRing = NULL;
+    pLog->aSavepoints = NULL;
+    pLog->pInsBatchStmt = NULL;
+    pLog->pSelOldValueStmt = NULL;
+}
+
+/*
+ * Prepares multi-row insert into [.change_log] for nRows
+ */
+static int _prepareInsert(flexi_ChangeLog_t *pLog, int nRows, sqlite3_stmt **ppStmt)
+{
+    int result;
+    StringBuilder_t sb;
+    StringBuilder_init(&sb);
+    StringBuilder_appendRaw(&sb, _zInsChangeLogPrefix, -1);
+    for (int ii = 0; ii < nRows; ii++)
+    {
+        StringBuilder_appendRaw(&sb, ii == 0 ? "(?, ?, ?, ?, ?, ?, ?)" : ", (?, ?, ?, ?, ?, ?, ?)", -1);
+    }
+    StringBuilder_appendRaw(&sb, "));", -1);
+    if (sb.bErr)
+    {
+        result = SQLITE_NOMEM;
+        goto ONERROR;
+    }
+
+    CHECK_STMT_PREPARE(pLog->db, sb.zBuf, ppStmt);
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    StringBuilder_clear(&sb);
+    return result;
+}
+
+/*
+ * Writes nRows oldest changes from the ring and removes them
+ */
+static int _writeRows(flexi_ChangeLog_t *pLog, int nRows)
+{
+    int result;
+    sqlite3_stmt *pStmt = NULL;
+    sqlite3_stmt *pAdhocStmt = NULL;
+
+    if (nRows == FLEXI_CHANGE_LOG_BATCH_SIZE)
+    {
+        if (pLog->pInsBatchStmt == NULL)
+        {
+            CHECK_CALL(_prepareInsert(pLog, nRows, &pLog->pInsBatchStmt));
+        }
+        pStmt = pLog->pInsBatchStmt;
+    }
+    else
+    {
+        // Remainder of the last batch in transaction
+        CHECK_CALL(_prepareInsert(pLog, nRows, &pAdhocStmt));
+        pStmt = pAdhocStmt;
+    }
+
+    for (int ii = 0; ii < nRows; ii++)
+    {
+        flexi_ChangeLogEntry_t *pEntry = &pLog->aRing[(pLog->iHead + ii) % FLEXI_CHANGE_LOG_RING_SIZE];
+        int iParam = ii * CHANGE_LOG_PARAMS_PER_ROW;
+        char zOp[2] = {pEntry->cOp, 0};
+        sqlite3_bind_text(pStmt, iParam + 1, zOp, 1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(pStmt, iParam + 2, pEntry->lClassID);
+        sqlite3_bind_int64(pStmt, iParam + 3, pEntry->lObjectID);
+        if (pEntry->lPropID != 0)
+        {
+            sqlite3_bind_int64(pStmt, iParam + 4, pEntry->lPropID);
+            sqlite3_bind_int64(pStmt, iParam + 5, pEntry->lPropIndex);
+        }
+        else
+        {
+            sqlite3_bind_null(pStmt, iParam + 4);
+            sqlite3_bind_null(pStmt, iParam + 5);
+        }
+
+        if (pEntry->pOldValue != NULL)
+            sqlite3_bind_value(pStmt, iParam + 6, pEntry->pOldValue);
+        else sqlite3_bind_null(pStmt, iParam + 6);
+
+        if (pEntry->pNewValue != NULL)
+            sqlite3_bind_value(pStmt, iParam + 7, pEntry->pNewValue);
+        else sqlite3_bind_null(pStmt, iParam + 7);
+    }
+
+    CHECK_STMT_STEP(pStmt, pLog->db);
+
+    for (int ii = 0; ii < nRows; ii++)
+    {
+        _freeEntry(&pLog->aRing[(pLog->iHead + ii) % FLEXI_CHANGE_LOG_RING_SIZE]);
+    }
+    pLog->iHead = (pLog->iHead + nRows) % FLEXI_CHANGE_LOG_RING_SIZE;
+    pLog->nCount -= nRows;
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    if (pLog->pInsBatchStmt != NULL)
+    {
+        sqlite3_reset(pLog->pInsBatchStmt);
+        sqlite3_clear_bindings(pLog->pInsBatchStmt);
+    }
+    sqlite3_finalize(pAdhocStmt);
+    return result;
+}
+
+int flexi_ChangeLog_flush(flexi_ChangeLog_t *pLog)
+{
+    int result = SQLITE_OK;
+
+    while (pLog->nCount > 0)
+    {
+        int nRows = pLog->nCount < FLEXI_CHANGE_LOG_BATCH_SIZE ? pLog->nCount : FLEXI_CHANGE_LOG_BATCH_SIZE;
+        CHECK_CALL(_writeRows(pLog, nRows));
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+int flexi_ChangeLog_add(flexi_ChangeLog_t *pLog, char cOp, sqlite3_int64 lClassID, sqlite3_int64 lObjectID,
+                        sqlite3_int64 lPropID, sqlite3_int64 lPropIndex,
+                        sqlite3_value *pOldValue, sqlite3_value *pNewValue)
+{
+    int result;
+    flexi_ChangeLogEntry_t *pEntry = NULL;
+
+    if (pLog->aRing == NULL)
+    {
+        CHECK_MALLOC(pLog->aRing, sizeof(flexi_ChangeLogEntry_t) * FLEXI_CHANGE_LOG_RING_SIZE);
+        memset(pLog->aRing, 0, sizeof(flexi_ChangeLogEntry_t) * FLEXI_CHANGE_LOG_RING_SIZE);
+    }
+
+    if (pLog->nCount == FLEXI_CHANGE_LOG_RING_SIZE)
+    {
+        // Ring is full. Write oldest batch to make room
+        CHECK_CALL(_writeRows(pLog, FLEXI_CHANGE_LOG_BATCH_SIZE));
+    }
+
+    pEntry = &pLog->aRing[(pLog->iHead + pLog->nCount) % FLEXI_CHANGE_LOG_RING_SIZE];
+    pEntry->lSeq = pLog->lNextSeq;
+    pEntry->cOp = cOp;
+    pEntry->lClassID = lClassID;
+    pEntry->lObjectID = lObjectID;
+    pEntry->lPropID = lPropID;
+    pEntry->lPropIndex = lPropIndex;
+    pEntry->pOldValue = NULL;
+    pEntry->pNewValue = NULL;
+
+    if (pOldValue != NULL && sqlite3_value_type(pOldValue) != SQLITE_NULL)
+    {
+        pEntry->pOldValue = sqlite3_value_dup(pOldValue);
+        CHECK_NULL(pEntry->pOldValue);
+    }
+
+    if (pNewValue != NULL && sqlite3_value_type(pNewValue) != SQLITE_NULL)
+    {
+        pEntry->pNewValue = sqlite3_value_dup(pNewValue);
+        CHECK_NULL(pEntry->pNewValue);
+    }
+
+    pLog->nCount++;
+    pLog->lNextSeq++;
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    if (pEntry != NULL)
+        _freeEntry(pEntry);
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Compares 2 values by type and content. NULL pointer is treated as SQL NULL
+ */
+static bool _valuesEqual(sqlite3_value *pA, sqlite3_value *pB)
+{
+    int iTypeA = pA != NULL ? sqlite3_value_type(pA) : SQLITE_NULL;
+    int iTypeB = pB != NULL ? sqlite3_value_type(pB) : SQLITE_NULL;
+    if (iTypeA != iTypeB)
+        return false;
+
+    switch (iTypeA)
+    {
+        case SQLITE_NULL:
+            return true;
+
+        case SQLITE_INTEGER:
+            return sqlite3_value_int64(pA) == sqlite3_value_int64(pB);
+
+        case SQLITE_FLOAT:
+            return sqlite3_value_double(pA) == sqlite3_value_double(pB);
+
+        default:
+        {
+            const void *pBufA = iTypeA == SQLITE_TEXT ? (const void *) sqlite3_value_text(pA) : sqlite3_value_blob(pA);
+            int nA = sqlite3_value_bytes(pA);
+            const void *pBufB = iTypeB == SQLITE_TEXT ? (const void *) sqlite3_value_text(pB) : sqlite3_value_blob(pB);
+            int nB = sqlite3_value_bytes(pB);
+            return nA == nB && (nA == 0 || memcmp(pBufA, pBufB, (size_t) nA) == 0);
+        }
+    }
+}
+
+int flexi_ChangeLog_addPropValue(flexi_ChangeLog_t *pLog, sqlite3_int64 lClassID, sqlite3_int64 lObjectID,
+                                 sqlite3_int64 lPropID, sqlite3_int64 lPropIndex, sqlite3_value *pNewValue)
+{
+    int result;
+    sqlite3_value *pOldValue = NULL;
+
+    if (pLog->pSelOldValueStmt == NULL)
+    {
+        CHECK_STMT_PREPARE(pLog->db, "select [Value] from [.ref-values] "
+                "where ObjectID = :1 and PropertyID = :2 and PropIndex = :3;", &pLog->pSelOldValueStmt);
+    }
+
+    sqlite3_bind_int64(pLog->pSelOldValueStmt, 1, lObjectID);
+    sqlite3_bind_int64(pLog->pSelOldValueStmt, 2, lPropID);
+    sqlite3_bind_int64(pLog->pSelOldValueStmt, 3, lPropIndex);
+    CHECK_STMT_STEP(pLog->pSelOldValueStmt, pLog->db);
+    if (result == SQLITE_ROW)
+        pOldValue = sqlite3_column_value(pLog->pSelOldValueStmt, 0);
+
+    if (!_valuesEqual(pOldValue, pNewValue))
+    {
+        char cOp = pOldValue == NULL ? 'C' : (pNewValue == NULL || sqlite3_value_type(pNewValue) == SQLITE_NULL
+                                              ? 'D' : 'U');
+        CHECK_CALL(flexi_ChangeLog_add(pLog, cOp, lClassID, lObjectID, lPropID, lPropIndex, pOldValue, pNewValue));
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    if (pLog->pSelOldValueStmt != NULL)
+        sqlite3_reset(pLog->pSelOldValueStmt);
+    return result;
+}
+
+int flexi_ChangeLog_savepoint(flexi_ChangeLog_t *pLog, int iSavepoint)
+{
+    int result;
+
+    assert(iSavepoint >= 0);
+
+    /*
+     * Log is shared by all flexi_data tables in transaction, and every one of them gets xSavepoint.
+     * Savepoint which is already open keeps its original position. Table joining transaction gets xSavepoint
+     * for the innermost savepoint only, so outer ones are opened here too (nothing has been logged since then)
+     */
+    if (iSavepoint < pLog->nSavepoints)
+        return SQLITE_OK;
+
+    sqlite3_int64 *aNew = sqlite3_realloc(pLog->aSavepoints, (int) sizeof(sqlite3_int64) * (iSavepoint + 1));
+    CHECK_NULL(aNew);
+    pLog->aSavepoints = aNew;
+    for (int ii = pLog->nSavepoints; ii <= iSavepoint; ii++)
+    {
+        pLog->aSavepoints[ii] = pLog->lNextSeq;
+    }
+    pLog->nSavepoints = iSavepoint + 1;
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+void flexi_ChangeLog_release(flexi_ChangeLog_t *pLog, int iSavepoint)
+{
+    if (iSavepoint < pLog->nSavepoints)
+        pLog->nSavepoints = iSavepoint;
+}
+
+void flexi_ChangeLog_rollbackTo(flexi_ChangeLog_t *pLog, int iSavepoint)
+{
+    if (iSavepoint >= pLog->nSavepoints)
+        return;
+
+    /*
+     * Drop pending changes made after savepoint. Changes which have been already written to [.change_log]
+     * are rolled back by SQLite itself
+     */
+    sqlite3_int64 lSeq = pLog->aSavepoints[iSavepoint];
+    while (pLog->nCount > 0)
+    {
+        flexi_ChangeLogEntry_t *pEntry = &pLog->aRing[(pLog->iHead + pLog->nCount - 1) % FLEXI_CHANGE_LOG_RING_SIZE];
+        if (pEntry->lSeq < lSeq)
+            break;
+        _freeEntry(pEntry);
+        pLog->nCount--;
+    }
+    pLog->lNextSeq = lSeq;
+
+    // Savepoint itself remains open after ROLLBACK TO
+    pLog->nSavepoints = iSavepoint + 1;
+}
@@ -0,0 +1,147 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_CHANGE_LOG_H
+#define FLEXILITE_FLEXI_CHANGE_LOG_H
+
+#include <stdbool.h>
+#include <sqlite3ext.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Number of pending changes kept in memory. When ring gets full, oldest changes are written
+ * to [.change_log] right away (this is done within the same transaction, so it does not affect atomicity)
+ */
+#define FLEXI_CHANGE_LOG_RING_SIZE 1024
+
+/*
+ * Number of changes written by single multi-row insert into [.change_log].
+ * Every change takes 7 parameters, so batch fits into default SQLITE_MAX_VARIABLE_NUMBER (999)
+ */
+#define FLEXI_CHANGE_LOG_BATCH_SIZE 128
+
+/*
+ * Single captured change: object (lPropID == 0) or property value
+ */
+typedef struct flexi_ChangeLogEntry_t
+{
+    /*
+     * Sequential number of change within transaction. Used to discard changes on ROLLBACK TO savepoint
+     */
+    sqlite3_int64 lSeq;
+
+    /*
+     * Operation: 'C' (create), 'U' (update), 'D' (delete)
+     */
+    char cOp;
+
+    sqlite3_int64 lClassID;
+    sqlite3_int64 lObjectID;
+    sqlite3_int64 lPropID;
+    sqlite3_int64 lPropIndex;
+
+    /*
+     * Copies of old and new values (made by sqlite3_value_dup). NULL if not applicable
+     */
+    sqlite3_value *pOldValue;
+    sqlite3_value *pNewValue;
+} flexi_ChangeLogEntry_t;
+
+/*
+ * Connection wide collector of property value changes ([.objects] rows are logged by triggers).
+ * Changes are accumulated during transaction and written to [.change_log] in batches, at the latest
+ * when transaction gets committed (from flexi_data xSync). On rollback pending changes are discarded
+ */
+typedef struct flexi_ChangeLog_t
+{
+    sqlite3 *db;
+
+    /*
+     * Ring buffer of pending changes (allocated on first change)
+     */
+    flexi_ChangeLogEntry_t *aRing;
+    int iHead;
+    int nCount;
+
+    /*
+     * Sequential number for the next change
+     */
+    sqlite3_int64 lNextSeq;
+
+    /*
+     * lNextSeq at the moment when savepoint with given index was opened (as passed to xSavepoint)
+     */
+    sqlite3_int64 *aSavepoints;
+    int nSavepoints;
+
+    /*
+     * Set by flexi_ChangeLog_begin, cleared when transaction is committed or rolled back
+     */
+    bool bInTransaction;
+
+    /*
+     * Multi-row insert for full batch (FLEXI_CHANGE_LOG_BATCH_SIZE rows)
+     */
+    sqlite3_stmt *pInsBatchStmt;
+
+    /*
+     * Loads current value of property, to be logged as old value
+     */
+    sqlite3_stmt *pSelOldValueStmt;
+} flexi_ChangeLog_t;
+
+void flexi_ChangeLog_init(flexi_ChangeLog_t *pLog, sqlite3 *db);
+
+/*
+ * Discards pending changes and releases all resources
+ */
+void flexi_ChangeLog_clear(flexi_ChangeLog_t *pLog);
+
+/*
+ * Adds change to the log. Values are copied. If ring is full, oldest changes get written to database
+ */
+int flexi_ChangeLog_add(flexi_ChangeLog_t *pLog, char cOp, sqlite3_int64 lClassID, sqlite3_int64 lObjectID,
+                        sqlite3_int64 lPropID, sqlite3_int64 lPropIndex,
+                        sqlite3_value *pOldValue, sqlite3_value *pNewValue);
+
+/*
+ * Adds property value change to the log. Old value is loaded from [.ref-values].
+ * Nothing is added if value has not changed
+ */
+int flexi_ChangeLog_addPropValue(flexi_ChangeLog_t *pLog, sqlite3_int64 lClassID, sqlite3_int64 lObjectID,
+                                 sqlite3_int64 lPropID, sqlite3_int64 lPropIndex, sqlite3_value *pNewValue);
+
+/*
+ * Writes all pending changes to [.change_log]
+ */
+int flexi_ChangeLog_flush(flexi_ChangeLog_t *pLog);
+
+/*
+ * Starts transaction (from xBegin of virtual table). Called by every flexi_data table which joins
+ * transaction, only the first call resets the log
+ */
+void flexi_ChangeLog_begin(flexi_ChangeLog_t *pLog);
+
+/*
+ * Discards pending changes and ends transaction (on commit, after xSync, and on rollback)
+ */
+void flexi_ChangeLog_discard(flexi_ChangeLog_t *pLog);
+
+/*
+ * Savepoint handling, to be called from xSavepoint, xRelease and xRollbackTo of virtual table
+ */
+int flexi_ChangeLog_savepoint(flexi_ChangeLog_t *pLog, int iSavepoint);
+
+void flexi_ChangeLog_release(flexi_ChangeLog_t *pLog, int iSavepoint);
+
+void flexi_ChangeLog_rollbackTo(flexi_ChangeLog_t *pLog, int iSavepoint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_CHANGE_LOG_H
@@ -7,6 +7,9 @@
  */
 
 #include "flexi_class.h"
+#include "flexi_data.h"
+#include "flexi_class_cache.h"
+#include "flexi_class_image.h"
 
 /*
  * Create new class record in the database. Data field is not saved at this point yet
@@ -64,7 +67,7 @@ static int _parseSpecialProperties(struct flexi_ClassDef_t *pClassDef, const cha
         sqlite3_free(zTemp);
     }
 
-    CHECK_STMT_PREPARE(pClassDef->pCtx->db, zSql, &pStmt);
+    CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx, zSql, &pStmt));
     CHECK_SQLITE(pClassDef->pCtx->db, sqlite3_bind_text(pStmt, 1, zClassDefJson, -1, NULL));
     CHECK_STMT_STEP(pStmt, pClassDef->pCtx->db);
     if (result == SQLITE_ROW)
@@ -89,7 +92,7 @@ static int _parseSpecialProperties(struct flexi_ClassDef_t *pClassDef, const cha
     ONERROR:
 
     EXIT:
-    sqlite3_finalize(pStmt);
+    sqlite3_reset(pStmt);
     sqlite3_free(zSql);
 
     return result;
@@ -114,7 +117,7 @@ static int _parseRangeProperties(struct flexi_ClassDef_t *pClassDef, const char
         sep = ',';
     }
 
-    CHECK_STMT_PREPARE(pClassDef->pCtx->db, zSql, &pStmt);
+    CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx, zSql, &pStmt));
     CHECK_SQLITE(pClassDef->pCtx->db, sqlite3_bind_text(pStmt, 1, zClassDefJson, -1, NULL));
     CHECK_STMT_STEP(pStmt, pClassDef->pCtx->db);
     if (result == SQLITE_ROW)
@@ -134,7 +137,7 @@ static int _parseRangeProperties(struct flexi_ClassDef_t *pClassDef, const char
     ONERROR:
     EXIT:
     sqlite3_free(zSql);
-    sqlite3_finalize(pStmt);
+    sqlite3_reset(pStmt);
     return result;
 }
 
@@ -158,7 +161,7 @@ static int _parseFullTextProperties(struct flexi_ClassDef_t *pClassDef, const ch
     }
 
     sqlite3_stmt *pStmt = NULL;
-    CHECK_STMT_PREPARE(pClassDef->pCtx->db, zSql, &pStmt);
+    CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx, zSql, &pStmt));
     CHECK_SQLITE(pClassDef->pCtx->db, sqlite3_bind_text(pStmt, 1, zClassDefJson, -1, NULL));
     CHECK_STMT_STEP(pStmt, pClassDef->pCtx->db);
     if (result == SQLITE_ROW)
@@ -177,7 +180,7 @@ static int _parseFullTextProperties(struct flexi_ClassDef_t *pClassDef, const ch
     ONERROR:
 
     EXIT:
-    sqlite3_finalize(pStmt);
+    sqlite3_reset(pStmt);
     sqlite3_free(zSql);
 
     return result;
@@ -197,7 +200,7 @@ static int _parseMixins(struct flexi_ClassDef_t *pClassDef, const char *zClassDe
             "json_extract(value, '$.dynamic.selectorProp.name'), " // 3
             "json_extract(value, '$.dynamic.rules') " // 4
             "from json_each(:1, '$.mixins')";
-    CHECK_STMT_PREPARE(pClassDef->pCtx->db, zSql, &pStmt);
+    CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx, zSql, &pStmt));
     CHECK_CALL(sqlite3_bind_text(pStmt, 1, zClassDefJson, -1, NULL));
     while (true)
     {
@@ -232,7 +235,7 @@ static int _parseMixins(struct flexi_ClassDef_t *pClassDef, const char *zClassDe
                 "json_extract(value, '$.classRef.id') as classId," // 1
                 "json_extract(value, '$.classRef.name') as className" // 2
                 "from json_each(:1);";
-        CHECK_STMT_PREPARE(pClassDef->pCtx->db, zRulesSql, &pRulesStmt);
+        CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx, zRulesSql, &pRulesStmt));
         CHECK_CALL(sqlite3_bind_text(pRulesStmt, 1, zRulesJson, -1, NULL));
         while (true)
         {
@@ -266,18 +269,87 @@ static int _parseMixins(struct flexi_ClassDef_t *pClassDef, const char *zClassDe
 
     EXIT:
     sqlite3_free(zRulesJson);
-    sqlite3_finalize(pStmt);
-    sqlite3_finalize(pRulesStmt);
+    sqlite3_reset(pStmt);
+    sqlite3_reset(pRulesStmt);
+    return result;
+}
+
+/*
+ * Loads statistics of class and its properties (NonNullCount and [.class_stats], [.prop_stats] collected by
+ * flexi('analyze')). Statistics is not part of class definition (and class image), as it changes without
+ * changing class definition.
+ * Databases created before statistics tables were added have NonNullCount only
+ */
+int flexi_ClassDef_loadStats(struct flexi_ClassDef_t *pClassDef)
+{
+    int result;
+    sqlite3_stmt *pStmt = NULL;
+    bool bHasStatsTables = true;
+
+    pClassDef->lObjectCount = 0;
+
+    result = flexi_Context_getStmt(pClassDef->pCtx,
+                                   "select cp.ID, cp.NonNullCount, ps.DistinctCount from [.class_props] cp "
+                                           "left join [.prop_stats] ps on ps.PropertyID = cp.ID "
+                                           "where cp.ClassID = :1 and cp.Deleted = 0;", &pStmt);
+    if (result != SQLITE_OK)
+    {
+        bHasStatsTables = false;
+        CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx,
+                                         "select ID, NonNullCount, null from [.class_props] "
+                                                 "where ClassID = :1 and Deleted = 0;", &pStmt));
+    }
+
+    CHECK_SQLITE(pClassDef->pCtx->db, sqlite3_bind_int64(pStmt, 1, pClassDef->lClassID));
+    while (true)
+    {
+        CHECK_STMT_STEP(pStmt, pClassDef->pCtx->db);
+        if (result == SQLITE_DONE)
+            break;
+
+        struct flexi_PropDef_t *pProp = NULL;
+        if (flexi_ClassDef_getPropDefById(pClassDef, sqlite3_column_int64(pStmt, 0), &pProp))
+        {
+            pProp->lNonNullCount = sqlite3_column_int64(pStmt, 1);
+            pProp->lDistinctCount = sqlite3_column_int64(pStmt, 2);
+            if (pProp->lNonNullCount > pClassDef->lObjectCount)
+                pClassDef->lObjectCount = pProp->lNonNullCount;
+        }
+    }
+    sqlite3_reset(pStmt);
+    pStmt = NULL;
+
+    // Number of objects estimated by analyze is preferred over max NonNullCount
+    if (bHasStatsTables)
+    {
+        CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx,
+                                         "select ObjectCount from [.class_stats] where ClassID = :1;", &pStmt));
+        CHECK_SQLITE(pClassDef->pCtx->db, sqlite3_bind_int64(pStmt, 1, pClassDef->lClassID));
+        CHECK_STMT_STEP(pStmt, pClassDef->pCtx->db);
+        if (result == SQLITE_ROW && sqlite3_column_int64(pStmt, 0) > 0)
+            pClassDef->lObjectCount = sqlite3_column_int64(pStmt, 0);
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    if (pStmt != NULL)
+        sqlite3_reset(pStmt);
     return result;
 }
 
 /*
  * Processes properties in prepared pStmt statement.
  * Columns returned by pStmt are defined by iPropNameCol and iPropDefCol (required).
- * Also, optionally iNameCol, ctlvCol and ictlvPlanCol can be passed
+ * Also, optionally iPropIDCol, iNameCol, ctlvCol, ictlvPlanCol and iColMapCol can be passed.
+ * Property statistics is loaded separately, by flexi_ClassDef_loadStats
  */
 static int _parseProperties(struct flexi_ClassDef_t *pClassDef, sqlite3_stmt *pStmt, int iPropNameCol,
-                            int iPropDefCol, int iNameCol, int ictlvCol, int ictlvPlanCol)
+                            int iPropDefCol, int iPropIDCol, int iNameCol, int ictlvCol, int ictlvPlanCol,
+                            int iColMapCol)
 {
     int result;
 
@@ -304,6 +376,11 @@ static int _parseProperties(struct flexi_ClassDef_t *pClassDef, sqlite3_stmt *pS
         CHECK_CALL(getColumnAsText(&pProp->name.name, pStmt, iPropNameCol));
         CHECK_CALL(flexi_prop_def_parse(pProp, pProp->name.name, zPropDefJson));
 
+        if (iPropIDCol >= 0)
+        {
+            pProp->iPropID = sqlite3_column_int64(pStmt, iPropIDCol);
+        }
+
         if (iNameCol >= 0)
         {
             pProp->name.id = sqlite3_column_int64(pStmt, iNameCol);
@@ -319,8 +396,13 @@ static int _parseProperties(struct flexi_ClassDef_t *pClassDef, sqlite3_stmt *pS
             pProp->xCtlvPlan = sqlite3_column_int(pStmt, ictlvPlanCol);
         }
 
-        HashTable_set(&pClassDef->propsByName, (DictionaryKey_t) {.pKey=pProp->name.name}, pProp);
-        HashTable_set(&pClassDef->propsByID, (DictionaryKey_t) {.iKey = pProp->iPropID}, pProp);
+        if (iColMapCol >= 0 && sqlite3_column_type(pStmt, iColMapCol) == SQLITE_TEXT)
+        {
+            pProp->cColMapped = (unsigned char) toupper(sqlite3_column_text(pStmt, iColMapCol)[0]);
+        }
+
+        FlatHash_set(&pClassDef->propsByName, (DictionaryKey_t) {.pKey=pProp->name.name}, pProp);
+        FlatHash_set(&pClassDef->propsByID, (DictionaryKey_t) {.iKey = pProp->iPropID}, pProp);
     }
 
     if (result != SQLITE_DONE)
@@ -348,9 +430,9 @@ static int _parseClassDefAux(struct flexi_ClassDef_t *pClassDef, const char *zCl
     CHECK_CALL(_parseSpecialProperties(pClassDef, zClassDefJson));
 
     // Get other properties
-    CHECK_STMT_PREPARE(pClassDef->pCtx->db, "select "
+    CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx, "select "
             "json_extract(:1, '$.allowAnyProps') as allowAnyProps", // 0
-                       &pAuxAttrs);
+                                     &pAuxAttrs));
     CHECK_CALL(sqlite3_bind_text(pAuxAttrs, 1, zClassDefJson, -1, NULL));
     result = sqlite3_step(pAuxAttrs);
     if (result == SQLITE_ROW)
@@ -363,7 +445,7 @@ static int _parseClassDefAux(struct flexi_ClassDef_t *pClassDef, const char *zCl
     goto EXIT;
     ONERROR:
     EXIT:
-    sqlite3_finalize(pAuxAttrs);
+    sqlite3_reset(pAuxAttrs);
     return result;
 }
 
@@ -387,9 +469,11 @@ struct flexi_ClassDef_t *flexi_class_def_new(struct flexi_Context_t *pCtx)
     memset(result, 0, sizeof(*result));
 
     result->pCtx = pCtx;
-    HashTable_init(&result->propsByName, DICT_STRING_NO_FREE,
+    FlatHash_init(&result->propsByName, DICT_STRING_NO_FREE,
                    reinterpret_cast<void (*)(void *) > ( flexi_PropDef_free));
-    HashTable_init(&result->propsByID, DICT_INT, reinterpret_cast<void (*)(void *) > (_dummy_ptr));
+    FlatHash_init(&result->propsByID, DICT_INT, reinterpret_cast<void (*)(void *) > (_dummy_ptr));
+    HashTable_init(&result->filterPlans, DICT_STRING,
+                   reinterpret_cast<void (*)(void *) > (flexi_FilterPlan_free));
     return result;
 }
 
@@ -700,6 +784,9 @@ int flexi_class_rename(struct flexi_Context_t *pCtx, sqlite3_int64 iOldClassID,
     sqlite3_bind_int64(pStmt, 1, lNewNameID);
     sqlite3_bind_int64(pStmt, 2, iOldClassID);
     CHECK_STMT_STEP(pStmt, pCtx->db);
+
+    // Image holds class name, and it was deleted by trigger on [.classes]
+    CHECK_CALL(flexi_ClassDef_saveImage(pCtx, iOldClassID));
     result = SQLITE_OK;
     goto EXIT;
 
@@ -817,12 +904,20 @@ void flexi_ClassDef_free(struct flexi_ClassDef_t *self)
         if (self->nRefCount > 0)
             self->nRefCount--;
 
-        if (self->nRefCount == 0)
+        if (self->nRefCount == 0 && self->pSnapshot != NULL)
+        {
+            // Copy from shared snapshot: parsed metadata is owned by snapshot
+            HashTable_clear(&self->filterPlans);
+            flexi_ClassSnapshot_release(self->pSnapshot);
+            sqlite3_free(self);
+        }
+        else if (self->nRefCount == 0)
         {
             sqlite3_free((void *) self->zHash);
 
-            HashTable_clear(&self->propsByName);
-            HashTable_clear(&self->propsByID);
+            FlatHash_clear(&self->propsByName);
+            FlatHash_clear(&self->propsByID);
+            HashTable_clear(&self->filterPlans);
 
             Array_free(self->aMixins);
 
@@ -931,12 +1026,12 @@ int flexi_ClassDef_parse(struct flexi_ClassDef_t *pClassDef, const char *zClassD
 
     // Load properties
     char *zPropSql = "select key as Name, value as Definition from json_each(:1, '$.properties');";
-    CHECK_STMT_PREPARE(pClassDef->pCtx->db, zPropSql, &pStmt);
+    CHECK_CALL(flexi_Context_getStmt(pClassDef->pCtx, zPropSql, &pStmt));
     CHECK_SQLITE(pClassDef->pCtx->db, sqlite3_bind_text(pStmt, 1, zClassDefJson, -1, NULL));
-    CHECK_SQLITE(pClassDef->pCtx->db, _parseProperties(pClassDef, pStmt, 0, 1, -1, -1, -1));
+    CHECK_SQLITE(pClassDef->pCtx->db, _parseProperties(pClassDef, pStmt, 0, 1, -1, -1, -1, -1, -1));
 
     // Get property name IDs
-    HashTable_each(&pClassDef->propsByName,  _getPropNameID, pClassDef);
+    FlatHash_each(&pClassDef->propsByName,  _getPropNameID, pClassDef);
 
     // Process other elements of class definition
     CHECK_CALL(_parseClassDefAux(pClassDef, zClassDefJson));
@@ -946,26 +1041,57 @@ int flexi_ClassDef_parse(struct flexi_ClassDef_t *pClassDef, const char *zClassD
     ONERROR:
 
     EXIT:
-    sqlite3_finalize(pStmt);
+    sqlite3_reset(pStmt);
     return result;
 }
 
 /*
  * Loads class definition (as defined in [.classes] and [flexi_prop] tables)
  * First checks if class def has been already loaded, and if so, simply returns it
- * Otherwise, will load class definition from database and add it to the context class def collection
+ * Otherwise, will get class definition from process wide class cache and add it to the context class def collection
  * If class is not found, will return the error
  */
 int flexi_ClassDef_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, struct flexi_ClassDef_t **pClassDef)
 {
     int result;
-    char *zClassDefJson = nullptr;
-    char *zClassDef = nullptr;
 
-    *pClassDef = static_cast<struct flexi_ClassDef_t *> (HashTable_get(&pCtx->classDefsById, (DictionaryKey_t) {.iKey = lClassID}));
+    *pClassDef = static_cast<struct flexi_ClassDef_t *> (FlatHash_get(&pCtx->classDefsById, (DictionaryKey_t) {.iKey = lClassID}));
     if (*pClassDef != NULL)
         return SQLITE_OK;
 
+    result = flexi_ClassCache_getClassDef(pCtx, lClassID, pClassDef);
+    if (result == SQLITE_NOTFOUND)
+        // Class is not in snapshot yet (e.g. created by this connection in current transaction)
+        result = flexi_ClassDef_loadFromDB(pCtx, lClassID, pClassDef);
+    if (result != SQLITE_OK)
+        goto ONERROR;
+    CHECK_CALL(flexi_Context_addClassDef(pCtx, *pClassDef));
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    if (*pClassDef)
+    {
+        flexi_ClassDef_free(*pClassDef);
+        *pClassDef = NULL;
+    }
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Loads class definition by parsing class JSON and [flexi_prop]
+ */
+static int _loadFromJSON(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, struct flexi_ClassDef_t **pClassDef)
+{
+    int result;
+    char *zClassDefJson = nullptr;
+    char *zClassDef = nullptr;
+    sqlite3_stmt *pGetClassStmt = NULL;
+    const char *zGetClassSQL;
+
     *pClassDef = flexi_class_def_new(pCtx);
     if (!*pClassDef)
     {
@@ -973,12 +1099,9 @@ int flexi_ClassDef_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, st
         goto ONERROR;
     }
 
-    // Initialize variables
-    sqlite3_stmt *pGetClassStmt = NULL;
-
     // TODO Use context statements
     // Init property metadata
-    const char *zGetClassSQL = "select "
+    zGetClassSQL = "select "
             "ClassID, " // 0
             "NameID, " // 1
             "SystemClass, " // 2
@@ -988,7 +1111,7 @@ int flexi_ClassDef_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, st
             "(select [Value] from [.names_props] np where np.ID = [.classes].NameID limit 1) as Name " // 6
             "from [.classes] "
             "where ClassID = :1;";
-    CHECK_STMT_PREPARE(pCtx->db, zGetClassSQL, &pGetClassStmt);
+    CHECK_CALL(flexi_Context_getStmt(pCtx, zGetClassSQL, &pGetClassStmt));
     sqlite3_bind_int64(pGetClassStmt, 1, lClassID);
     result = sqlite3_step(pGetClassStmt);
     if (result == SQLITE_DONE)
@@ -1008,7 +1131,7 @@ int flexi_ClassDef_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, st
     (*pClassDef)->name.bOwnName = true;
 
     (*pClassDef)->bSystemClass = (bool) sqlite3_column_int(pGetClassStmt, 2);
-    (*pClassDef)->xCtloMask = sqlite3_column_int(pGetClassStmt, 3);
+    (*pClassDef)->xCtloMask = sqlite3_column_int64(pGetClassStmt, 3);
 
     // TODO Temp
     getColumnAsText(&zClassDef, pGetClassStmt, 5);
@@ -1021,15 +1144,15 @@ int flexi_ClassDef_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, st
             "Property," // 3
             "ctlv," // 4
             "ctlvPlan," // 5
-            "Definition" // 6
+            "Definition," // 6
+            "(select ColMap from [.class_props] cp where cp.ID = PropertyID limit 1) as ColMap" // 7
             " from [flexi_prop] where ClassID=:1", NULL));
     CHECK_SQLITE(pCtx->db, sqlite3_bind_int64(pCtx->pStmts[STMT_LOAD_CLS_PROP], 1, lClassID));
-    CHECK_CALL(_parseProperties(*pClassDef, pCtx->pStmts[STMT_LOAD_CLS_PROP], 3, 6, 2, 4, 5));
+    CHECK_CALL(_parseProperties(*pClassDef, pCtx->pStmts[STMT_LOAD_CLS_PROP], 3, 6, 0, 2, 4, 5, 7));
 
     CHECK_CALL(getColumnAsText(&zClassDefJson, pGetClassStmt, 5));
     CHECK_CALL(_parseClassDefAux(*pClassDef, zClassDefJson));
-
-    CHECK_CALL(flexi_Context_addClassDef(pCtx, *pClassDef));
+    CHECK_CALL(flexi_ClassDef_loadStats(*pClassDef));
 
     result = SQLITE_OK;
     goto EXIT;
@@ -1043,7 +1166,7 @@ int flexi_ClassDef_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, st
     flexi_Context_setError(pCtx, result, NULL);
 
     EXIT:
-    sqlite3_finalize(pGetClassStmt);
+    sqlite3_reset(pGetClassStmt);
     sqlite3_free(zClassDefJson);
 
     sqlite3_free(zClassDef);
@@ -1051,6 +1174,45 @@ int flexi_ClassDef_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, st
     return result;
 }
 
+int flexi_ClassDef_loadFromDB(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, struct flexi_ClassDef_t **pClassDef)
+{
+    int result;
+
+    /*
+     * Binary image of class definition, if available, does not need JSON parsing.
+     * Image is not written here: loading happens on reads (xConnect, SELECT), which must not take write lock.
+     * Images are written when class is created or altered (see flexi_ClassDef_saveImage)
+     */
+    result = flexi_ClassImage_load(pCtx, lClassID, pClassDef);
+    if (result == SQLITE_NOTFOUND)
+        return _loadFromJSON(pCtx, lClassID, pClassDef);
+
+    if (result != SQLITE_OK)
+        flexi_Context_setError(pCtx, result, NULL);
+    return result;
+}
+
+int flexi_ClassDef_saveImage(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID)
+{
+    int result;
+    struct flexi_ClassDef_t *pClassDef = NULL;
+
+    // Image is built from what is stored, so that it is the same as class loaded from JSON
+    CHECK_CALL(_loadFromJSON(pCtx, lClassID, &pClassDef));
+    CHECK_CALL(flexi_ClassImage_save(pCtx, pClassDef));
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    flexi_Context_setError(pCtx, result, NULL);
+
+    EXIT:
+    if (pClassDef != NULL)
+        flexi_ClassDef_free(pClassDef);
+    return result;
+}
+
 int flexi_schema_func(sqlite3_context *context,
                       int argc,
                       sqlite3_value **argv)
@@ -1122,7 +1284,7 @@ int flexi_schema_func(sqlite3_context *context,
 bool flexi_ClassDef_getPropDefById(struct flexi_ClassDef_t *pClassDef,
                                    sqlite3_int64 lPropID, struct flexi_PropDef_t **propDef)
 {
-    *propDef = HashTable_get(&pClassDef->propsByID, (DictionaryKey_t) {.iKey = lPropID});
+    *propDef = FlatHash_get(&pClassDef->propsByID, (DictionaryKey_t) {.iKey = lPropID});
     return *propDef != NULL;
 }
 
@@ -1132,7 +1294,7 @@ bool flexi_ClassDef_getPropDefById(struct flexi_ClassDef_t *pClassDef,
 bool flexi_ClassDef_getPropDefByName(struct flexi_ClassDef_t *pClassDef,
                                      const char *zPropName, struct flexi_PropDef_t **propDef)
 {
-    *propDef = HashTable_get(&pClassDef->propsByName, (DictionaryKey_t) {.pKey = zPropName});
+    *propDef = FlatHash_get(&pClassDef->propsByName, (DictionaryKey_t) {.pKey = zPropName});
     return *propDef != NULL;
 }
 
@@ -6,6 +6,7 @@
 #define FLEXILITE_FLEXI_CLASS_H
 
 #include "../util/hash.h"
+#include "../util/FlatHash.h"
 #include "../util/Array.h"
 #include "flexi_prop.h"
 #include "class_ref_def.h"
@@ -107,7 +108,7 @@ typedef struct flexi_ClassDef_t
     /*
      * Bitmask for various aspects of class storage (indexing etc.)
      */
-    int xCtloMask;
+    sqlite3_int64 xCtloMask;
 
     /*
      * Shortcut to Flexilite connection wide context
@@ -135,10 +136,16 @@ typedef struct flexi_ClassDef_t
      * propsByName is considered as principal container
      *
      */
-    Hash propsByName;
-    Hash propsByID;
+    FlatHash propsByName;
+    FlatHash propsByID;
     struct flexi_PropDef_t *pProps;
 
+    /*
+     * Cache of compiled object lookups (flexi_FilterPlan_t), by idxNum and idxStr
+     * generated by virtual table's xBestIndex
+     */
+    Hash filterPlans;
+
     /*
      * Array of flexi_ClassRefDef
      */
@@ -149,6 +156,13 @@ typedef struct flexi_ClassDef_t
      */
     int nRefCount;
 
+    /*
+     * If not NULL, this is connection's copy of class definition from shared snapshot
+     * (see flexi_class_cache.h). Properties, mixins and other parsed metadata are owned by snapshot
+     * and must not be modified. Copy holds a reference to snapshot
+     */
+    struct flexi_ClassSnapshot_t *pSnapshot;
+
     /*
      * If true, any JSON is allowed to be inserted/updated
      */
@@ -158,6 +172,12 @@ typedef struct flexi_ClassDef_t
      * If true, class is not completely resolved. CRUD operations are not allowed.
      */
     bool bUnresolved;
+
+    /*
+     * Estimated number of objects in class. Collected by flexi('analyze') ([.class_stats].ObjectCount),
+     * or computed from properties' NonNullCount when class is loaded. 0 if statistics is not available
+     */
+    sqlite3_int64 lObjectCount;
 } flexi_ClassDef_t;
 
 int flexi_ClassDef_create(struct flexi_Context_t *pCtx, const char *zClassName, const char *zOriginalClassDef,
@@ -247,6 +267,23 @@ void flexi_ClassDef_free(struct flexi_ClassDef_t *self);
  */
 int flexi_ClassDef_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID, struct flexi_ClassDef_t **pClassDef);
 
+/*
+ * Loads and parses class definition from database, bypassing connection and shared caches
+ */
+int flexi_ClassDef_loadFromDB(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID,
+                              struct flexi_ClassDef_t **pClassDef);
+
+/*
+ * Writes binary image of class definition to [.class_images], parsing class from JSON.
+ * Called when class is created, altered or renamed. Class loading only reads images
+ */
+int flexi_ClassDef_saveImage(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID);
+
+/*
+ * Loads statistics of class and its properties, used by query planner
+ */
+int flexi_ClassDef_loadStats(struct flexi_ClassDef_t *pClassDef);
+
 int
 flexi_ClassDef_loadByName(struct flexi_Context_t *pCtx, const char *zClassName, struct flexi_ClassDef_t **pClassDef);
 
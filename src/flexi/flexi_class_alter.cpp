@@ -346,7 +346,7 @@ _validatePropChange(const char *zPropName, int index, struct flexi_PropDef_t *p,
         return;
 
     // Check if class2 has the same property
-    auto pProp2 = static_cast<struct flexi_PropDef_t *>( HashTable_get(&alterCtx->pExistingClassDef->propsByName,
+    auto pProp2 = static_cast<struct flexi_PropDef_t *>( FlatHash_get(&alterCtx->pExistingClassDef->propsByName,
                                                                        (DictionaryKey_t) {.pKey= zPropName}));
 
     if (pProp2)
@@ -513,7 +513,7 @@ _validateClassData(_ClassAlterContext_t *alterCtx)
 
     // Iterate
 
-    HashTable_each(&alterCtx->pNewClassDef->propsByName, _validateProp, &params);
+    FlatHash_each(&alterCtx->pNewClassDef->propsByName, _validateProp, &params);
 
 
     return result;
@@ -530,11 +530,11 @@ _copyExistingProp(const char *zPropName, int idx, struct flexi_PropDef_t *prop,
     UNUSED_PARAM(idx);
     UNUSED_PARAM(propMap);
 
-    auto pNewProp = reinterpret_cast<struct flexi_PropDef_t *> (HashTable_get(&alterCtx->pNewClassDef->propsByName,
+    auto pNewProp = reinterpret_cast<struct flexi_PropDef_t *> (FlatHash_get(&alterCtx->pNewClassDef->propsByName,
                                                                               (DictionaryKey_t) {.pKey = zPropName}));
     if (!pNewProp)
     {
-        HashTable_set(&alterCtx->pNewClassDef->propsByName, (DictionaryKey_t) {.pKey=zPropName}, prop);
+        FlatHash_set(&alterCtx->pNewClassDef->propsByName, (DictionaryKey_t) {.pKey=zPropName}, prop);
         prop->eChangeStatus = CHNG_STATUS_NOT_MODIFIED;
         prop->nRefCount++;
     }
@@ -586,7 +586,7 @@ _processSpecialProps(_ClassAlterContext_t *alterCtx)
 }
 
 static void
-_compPropByIdAndName(const char *zKey, const sqlite3_int64 idx, struct flexi_PropDef_t *pProp, Hash *pPropMap,
+_compPropByIdAndName(const char *zKey, const sqlite3_int64 idx, struct flexi_PropDef_t *pProp, FlatHash *pPropMap,
                      flexi_MetadataRef_t *pRef,
                      bool *bStop)
 {
@@ -609,12 +609,12 @@ _findPropByMetadataRef(struct flexi_ClassDef_t *pClassDef, flexi_MetadataRef_t *
 {
     if (pRef->id != 0)
     {
-        *pProp = static_cast<struct flexi_PropDef_t *> (HashTable_each(&pClassDef->propsByName,
+        *pProp = static_cast<struct flexi_PropDef_t *> (FlatHash_each(&pClassDef->propsByName,
                                                                        reinterpret_cast<iterateeFunc > (_compPropByIdAndName),
                                                                        pRef));
     }
     else
-        *pProp = static_cast<struct flexi_PropDef_t *> (HashTable_get(&pClassDef->propsByName,
+        *pProp = static_cast<struct flexi_PropDef_t *> (FlatHash_get(&pClassDef->propsByName,
                                                                       (DictionaryKey_t) {.pKey=pRef->name}));
 
     return *pProp != NULL;
@@ -709,12 +709,12 @@ _mergeClassSchemas(_ClassAlterContext_t *alterCtx)
 
     // Copy existing properties if they are not defined in new schema
     // These properties will get eChangeStatus NONMODIFIED
-    HashTable_each(&alterCtx->pExistingClassDef->propsByName, (void *) _copyExistingProp, alterCtx);
+    FlatHash_each(&alterCtx->pExistingClassDef->propsByName, (void *) _copyExistingProp, alterCtx);
     if (alterCtx->pCtx->iLastErrorCode != SQLITE_OK)
         goto ONERROR;
 
     // Iterate through properties. Find props: to be renamed, to be deleted, to be updated, to be added
-    HashTable_each(&alterCtx->pNewClassDef->propsByName, (void *) _validatePropChange, alterCtx);
+    FlatHash_each(&alterCtx->pNewClassDef->propsByName, (void *) _validatePropChange, alterCtx);
     if (alterCtx->pCtx->iLastErrorCode != SQLITE_OK)
         goto ONERROR;
 
@@ -777,7 +777,7 @@ _createClassDefFromDefJSON(struct flexi_Context_t *pCtx, const char *zClassDefJs
  */
 static void
 _upsertPropDef(const char *zPropName, const sqlite3_int64 index, struct flexi_PropDef_t *propDef,
-               const Hash *propMap, _ClassAlterContext_t *alterCtx, bool *bStop)
+               const FlatHash *propMap, _ClassAlterContext_t *alterCtx, bool *bStop)
 {
     UNUSED_PARAM(zPropName);
     UNUSED_PARAM(propMap);
@@ -841,7 +841,7 @@ _fixupPropName(_ClassAlterContext_t *alterCtx, flexi_MetadataRef_t *pRef)
 {
     if (pRef->id == 0 && pRef->name != NULL)
     {
-        struct flexi_PropDef_t *prop = HashTable_get(&alterCtx->pNewClassDef->propsByName,
+        struct flexi_PropDef_t *prop = FlatHash_get(&alterCtx->pNewClassDef->propsByName,
                                                      (DictionaryKey_t) {.pKey = pRef->name});
         if (prop != NULL)
         {
@@ -903,7 +903,7 @@ _applyClassSchema(_ClassAlterContext_t *alterCtx, const char *zNewClassDef)
     List_each(&alterCtx->preActions, (void *) _processAction, alterCtx);
 
     // Ensure properties exist and updated
-    if (HashTable_each(&alterCtx->pNewClassDef->propsByName, (void *) _upsertPropDef, alterCtx) != NULL)
+    if (FlatHash_each(&alterCtx->pNewClassDef->propsByName, (void *) _upsertPropDef, alterCtx) != NULL)
     {
         result = alterCtx->nSqlResult;
         CHECK_CALL(result);
@@ -1014,6 +1014,9 @@ int _flexi_ClassDef_applyNewDef(struct flexi_Context_t *pCtx, sqlite3_int64 lCla
 
     CHECK_CALL(_applyClassSchema(&alterCtx, zNewClassDef));
 
+    // Class definition is final here, and previous image was deleted by triggers
+    CHECK_CALL(flexi_ClassDef_saveImage(pCtx, lClassID));
+
     //    flexi_ClassDef_free(alterCtx.pExistingClassDef);
     alterCtx.pExistingClassDef = NULL;
 
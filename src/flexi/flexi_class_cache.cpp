@@ -0,0 +1,267 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Process wide cache of class definitions, shared by connections to the same database file
+ */
+
+#include "flexi_class_cache.h"
+#include "flexi_class.h"
+#include "flexi_data.h"
+
+/*
+ * List of published snapshots, one per database file. List holds a reference to every snapshot in it
+ */
+static flexi_ClassSnapshot_t *pPublished = NULL;
+
+static sqlite3_mutex *_mutex()
+{
+    return sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+}
+
+void flexi_ClassSnapshot_addRef(flexi_ClassSnapshot_t *self)
+{
+    sqlite3_mutex_enter(_mutex());
+    self->nRefCount++;
+    sqlite3_mutex_leave(_mutex());
+}
+
+static void _freeSnapshot(flexi_ClassSnapshot_t *self)
+{
+    FlatHash_clear(&self->classDefsById);
+    sqlite3_free(self->zFileName);
+    sqlite3_free(self);
+}
+
+void flexi_ClassSnapshot_release(flexi_ClassSnapshot_t *self)
+{
+    if (self == NULL)
+        return;
+
+    sqlite3_mutex_enter(_mutex());
+    bool bFree = --self->nRefCount == 0;
+    sqlite3_mutex_leave(_mutex());
+
+    if (bFree)
+        _freeSnapshot(self);
+}
+
+static void _detachPropDef(const char *zKey, const sqlite3_int64 index, void *pData,
+                           const var collection, var param, bool *bStop)
+{
+    UNUSED_PARAM(zKey);
+    UNUSED_PARAM(index);
+    UNUSED_PARAM(collection);
+    UNUSED_PARAM(param);
+    UNUSED_PARAM(bStop);
+
+    static_cast<struct flexi_PropDef_t *>(pData)->pCtx = NULL;
+}
+
+/*
+ * Loads and parses all class definitions into new snapshot.
+ * Class definitions get detached from connection as they will be used by other connections
+ */
+static int _buildSnapshot(struct flexi_Context_t *pCtx, sqlite3_int64 lUserVersion,
+                          flexi_ClassSnapshot_t **ppSnapshot)
+{
+    int result;
+    sqlite3_stmt *pStmt = NULL;
+    struct flexi_ClassDef_t *pClassDef = NULL;
+
+    auto pSnapshot = static_cast<flexi_ClassSnapshot_t *>(sqlite3_malloc(sizeof(flexi_ClassSnapshot_t)));
+    CHECK_NULL(pSnapshot);
+    memset(pSnapshot, 0, sizeof(*pSnapshot));
+    pSnapshot->lUserVersion = lUserVersion;
+    pSnapshot->nRefCount = 1;
+    FlatHash_init(&pSnapshot->classDefsById, DICT_INT, reinterpret_cast<void (*)(void *) > (flexi_ClassDef_free));
+
+    CHECK_STMT_PREPARE(pCtx->db, "select ClassID from [.classes];", &pStmt);
+    while (true)
+    {
+        CHECK_STMT_STEP(pStmt, pCtx->db);
+        if (result == SQLITE_DONE)
+            break;
+
+        CHECK_CALL(flexi_ClassDef_loadFromDB(pCtx, sqlite3_column_int64(pStmt, 0), &pClassDef));
+        pClassDef->pCtx = NULL;
+        FlatHash_each(&pClassDef->propsByID, _detachPropDef, NULL);
+        pClassDef->nRefCount = 1;
+        FlatHash_set(&pSnapshot->classDefsById, (DictionaryKey_t) {.iKey = pClassDef->lClassID}, pClassDef);
+        pClassDef = NULL;
+    }
+
+    *ppSnapshot = pSnapshot;
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    flexi_ClassDef_free(pClassDef);
+    if (pSnapshot != NULL)
+        _freeSnapshot(pSnapshot);
+
+    EXIT:
+    sqlite3_finalize(pStmt);
+    return result;
+}
+
+/*
+ * Finds published snapshot for database file and schema version. Returned snapshot has its reference count incremented.
+ * Must be called under cache mutex
+ */
+static flexi_ClassSnapshot_t *_findPublished(const char *zFileName, sqlite3_int64 lUserVersion)
+{
+    for (flexi_ClassSnapshot_t *p = pPublished; p != NULL; p = p->pNext)
+    {
+        if (strcmp(p->zFileName, zFileName) == 0)
+        {
+            if (p->lUserVersion != lUserVersion)
+                return NULL;
+
+            p->nRefCount++;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Replaces published snapshot for the same database file (if any) with pSnapshot.
+ * Must be called under cache mutex. Returns replaced snapshot, to be released by caller outside of mutex
+ */
+static flexi_ClassSnapshot_t *_publish(flexi_ClassSnapshot_t *pSnapshot)
+{
+    flexi_ClassSnapshot_t **pp = &pPublished;
+    flexi_ClassSnapshot_t *pReplaced = NULL;
+    while (*pp != NULL)
+    {
+        if (strcmp((*pp)->zFileName, pSnapshot->zFileName) == 0)
+        {
+            pReplaced = *pp;
+            *pp = pReplaced->pNext;
+            break;
+        }
+        pp = &(*pp)->pNext;
+    }
+
+    pSnapshot->nRefCount++;
+    pSnapshot->pNext = pPublished;
+    pPublished = pSnapshot;
+    return pReplaced;
+}
+
+int flexi_ClassCache_acquire(struct flexi_Context_t *pCtx)
+{
+    int result;
+    sqlite3_int64 lUserVersion;
+    flexi_ClassSnapshot_t *pSnapshot = NULL;
+    flexi_ClassSnapshot_t *pReplaced = NULL;
+
+    CHECK_CALL(flexi_Context_userVersion(pCtx, &lUserVersion, false));
+    if (pCtx->pClassSnapshot != NULL && pCtx->pClassSnapshot->lUserVersion == lUserVersion)
+    {
+        result = SQLITE_OK;
+        goto EXIT;
+    }
+
+    {
+        /*
+         * Snapshot can be shared only if it is built from committed data of database file
+         */
+        const char *zFileName = sqlite3_db_filename(pCtx->db, "main");
+        bool bShared = zFileName != NULL && zFileName[0] != 0 && sqlite3_get_autocommit(pCtx->db);
+
+        if (bShared)
+        {
+            sqlite3_mutex_enter(_mutex());
+            pSnapshot = _findPublished(zFileName, lUserVersion);
+            sqlite3_mutex_leave(_mutex());
+        }
+
+        if (pSnapshot == NULL)
+        {
+            // Build outside of mutex, so that other connections are not blocked
+            CHECK_CALL(_buildSnapshot(pCtx, lUserVersion, &pSnapshot));
+
+            if (bShared)
+            {
+                CHECK_CALL(String_copy(zFileName, &pSnapshot->zFileName));
+
+                sqlite3_mutex_enter(_mutex());
+                flexi_ClassSnapshot_t *pOther = _findPublished(zFileName, lUserVersion);
+                if (pOther == NULL)
+                    pReplaced = _publish(pSnapshot);
+                sqlite3_mutex_leave(_mutex());
+
+                // Other connection has published the same version in the meantime
+                if (pOther != NULL)
+                {
+                    flexi_ClassSnapshot_release(pSnapshot);
+                    pSnapshot = pOther;
+                }
+            }
+        }
+    }
+
+    flexi_ClassSnapshot_release(pCtx->pClassSnapshot);
+    pCtx->pClassSnapshot = pSnapshot;
+    pSnapshot = NULL;
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    flexi_ClassSnapshot_release(pSnapshot);
+
+    EXIT:
+    flexi_ClassSnapshot_release(pReplaced);
+    return result;
+}
+
+int flexi_ClassCache_getClassDef(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID,
+                                 struct flexi_ClassDef_t **ppClassDef)
+{
+    int result;
+
+    *ppClassDef = NULL;
+
+    CHECK_CALL(flexi_ClassCache_acquire(pCtx));
+
+    {
+        auto pShared = static_cast<struct flexi_ClassDef_t *>(FlatHash_get(
+                &pCtx->pClassSnapshot->classDefsById, (DictionaryKey_t) {.iKey = lClassID}));
+        if (pShared == NULL)
+        {
+            result = SQLITE_NOTFOUND;
+            flexi_Context_setError(pCtx, result,
+                                   sqlite3_mprintf("Cannot find Flexilite class with ID [%lld]", lClassID));
+            goto ONERROR;
+        }
+
+        /*
+         * Copy shares parsed metadata with snapshot's class definition.
+         * Virtual table base, connection and filter plans are per connection
+         */
+        auto pClassDef = static_cast<struct flexi_ClassDef_t *>(sqlite3_malloc(sizeof(struct flexi_ClassDef_t)));
+        CHECK_NULL(pClassDef);
+        memcpy(pClassDef, pShared, sizeof(*pClassDef));
+        memset(&pClassDef->base, 0, sizeof(pClassDef->base));
+        pClassDef->pCtx = pCtx;
+        pClassDef->nRefCount = 0;
+        HashTable_init(&pClassDef->filterPlans, DICT_STRING,
+                       reinterpret_cast<void (*)(void *) > (flexi_FilterPlan_free));
+        pClassDef->pSnapshot = pCtx->pClassSnapshot;
+        flexi_ClassSnapshot_addRef(pClassDef->pSnapshot);
+
+        *ppClassDef = pClassDef;
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
@@ -0,0 +1,73 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_CLASS_CACHE_H
+#define FLEXILITE_FLEXI_CLASS_CACHE_H
+
+#include "../util/hash.h"
+#include "../util/FlatHash.h"
+
+/*
+ * Process wide cache of class definitions, shared by all connections to the same database file.
+ *
+ * Class definitions are loaded and parsed once per schema version (PRAGMA user_version) and
+ * published as immutable snapshot. Snapshot is replaced atomically when newer schema version is
+ * detected. Connections do not parse class definitions themselves - they get lightweight copies of
+ * snapshot's class definitions (see flexi_ClassDef_t.pSnapshot), which share properties and other
+ * parsed metadata with snapshot and hold a reference to it. So, snapshot stays alive while any
+ * statement still uses class definitions from it.
+ *
+ * In-memory and temporary databases, as well as connections inside an explicit transaction,
+ * get private snapshots, which are not visible to other connections.
+ */
+typedef struct flexi_ClassSnapshot_t
+{
+    /*
+     * Database file name. NULL for private snapshot
+     */
+    char *zFileName;
+
+    sqlite3_int64 lUserVersion;
+
+    /*
+     * Class definitions by class ID. Read-only after snapshot is published
+     */
+    FlatHash classDefsById;
+
+    /*
+     * Protected by cache mutex
+     */
+    int nRefCount;
+
+    /*
+     * Next snapshot in process wide list
+     */
+    struct flexi_ClassSnapshot_t *pNext;
+} flexi_ClassSnapshot_t;
+
+struct flexi_Context_t;
+struct flexi_ClassDef_t;
+
+/*
+ * Ensures that connection has snapshot for the current schema version (pCtx->pClassSnapshot).
+ * Uses snapshot published by other connection, if available. Otherwise, loads all classes
+ * and publishes new snapshot
+ */
+int flexi_ClassCache_acquire(struct flexi_Context_t *pCtx);
+
+/*
+ * Returns connection bound copy of class definition from connection's snapshot.
+ * Returns SQLITE_NOTFOUND if class does not exist
+ */
+int flexi_ClassCache_getClassDef(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID,
+                                 struct flexi_ClassDef_t **ppClassDef);
+
+void flexi_ClassSnapshot_addRef(flexi_ClassSnapshot_t *self);
+
+/*
+ * Decrements reference count and frees snapshot when it is not used anymore
+ */
+void flexi_ClassSnapshot_release(flexi_ClassSnapshot_t *self);
+
+#endif //FLEXILITE_FLEXI_CLASS_CACHE_H
@@ -0,0 +1,519 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Binary image of class definition. See flexi_class_image.h for layout
+ */
+
+#include "flexi_class_image.h"
+#include "../util/StringBuilder.h"
+
+static const char IMAGE_MAGIC[4] = {'F', 'X', 'C', 'I'};
+
+/*
+ * Length of NULL string
+ */
+#define IMAGE_NULL_STR 0xFFFFFFFFu
+
+/*
+ * Image writer helpers. Errors (out of memory) are accumulated in StringBuilder_t.bErr
+ */
+static void _putU8(StringBuilder_t *w, unsigned char v)
+{
+    StringBuilder_appendRaw(w, reinterpret_cast<const char *>(&v), 1);
+}
+
+static void _putU32(StringBuilder_t *w, uint32_t v)
+{
+    unsigned char buf[4];
+    for (int ii = 0; ii < 4; ii++)
+        buf[ii] = (unsigned char) (v >> (ii * 8));
+    StringBuilder_appendRaw(w, reinterpret_cast<const char *>(buf), sizeof(buf));
+}
+
+static void _putI64(StringBuilder_t *w, sqlite3_int64 v)
+{
+    unsigned char buf[8];
+    auto u = (sqlite3_uint64) v;
+    for (int ii = 0; ii < 8; ii++)
+        buf[ii] = (unsigned char) (u >> (ii * 8));
+    StringBuilder_appendRaw(w, reinterpret_cast<const char *>(buf), sizeof(buf));
+}
+
+static void _putDouble(StringBuilder_t *w, double v)
+{
+    sqlite3_int64 i;
+    memcpy(&i, &v, sizeof(i));
+    _putI64(w, i);
+}
+
+static void _putString(StringBuilder_t *w, const char *z)
+{
+    if (z == NULL)
+    {
+        _putU32(w, IMAGE_NULL_STR);
+        return;
+    }
+
+    auto n = (uint32_t) strlen(z);
+    _putU32(w, n);
+    StringBuilder_appendRaw(w, z, n);
+}
+
+static void _putRef(StringBuilder_t *w, const flexi_MetadataRef_t *pRef)
+{
+    _putI64(w, pRef->id);
+    _putString(w, pRef->name);
+}
+
+static void _putRefs(StringBuilder_t *w, const flexi_MetadataRef_t *aRefs, int nCount)
+{
+    _putU32(w, (uint32_t) nCount);
+    for (int ii = 0; ii < nCount; ii++)
+        _putRef(w, &aRefs[ii]);
+}
+
+static void _putPropDef(const char *zKey, const sqlite3_int64 index, void *pData,
+                        const var collection, var param, bool *bStop)
+{
+    UNUSED_PARAM(zKey);
+    UNUSED_PARAM(index);
+    UNUSED_PARAM(collection);
+    UNUSED_PARAM(bStop);
+
+    auto w = static_cast<StringBuilder_t *>(param);
+    auto pProp = static_cast<struct flexi_PropDef_t *>(pData);
+
+    _putI64(w, pProp->iPropID);
+    _putRef(w, &pProp->name);
+    _putString(w, pProp->zType);
+    _putString(w, pProp->zIndex);
+    _putString(w, pProp->zSubType);
+    _putString(w, pProp->zRenameTo);
+    _putString(w, pProp->regex);
+    _putString(w, pProp->zEnumDef);
+    _putString(w, pProp->zRefDef);
+    _putU32(w, (uint32_t) pProp->minOccurences);
+    _putU32(w, (uint32_t) pProp->maxOccurences);
+    _putU32(w, (uint32_t) pProp->maxLength);
+    _putU32(w, (uint32_t) pProp->xCtlv);
+    _putU32(w, (uint32_t) pProp->xCtlvPlan);
+    _putDouble(w, pProp->minValue);
+    _putDouble(w, pProp->maxValue);
+    _putU32(w, (uint32_t) (unsigned short) pProp->type);
+    _putU32(w, (uint32_t) (unsigned short) pProp->xRole);
+    _putU8(w, (unsigned char) pProp->bIndexed);
+    _putU8(w, (unsigned char) pProp->bUnique);
+    _putU8(w, (unsigned char) pProp->bFullTextIndex);
+    _putU8(w, (unsigned char) pProp->bNoTrackChanges);
+    _putU8(w, pProp->cRangeColumn);
+    _putU8(w, pProp->cColMapped);
+    _putU8(w, pProp->cRngBound);
+    _putU8(w, (unsigned char) pProp->eChangeStatus);
+}
+
+int flexi_ClassImage_encode(struct flexi_ClassDef_t *pClassDef, unsigned char **ppImage, int *pnImage)
+{
+    int result;
+    StringBuilder_t w;
+
+    StringBuilder_init(&w);
+
+    *ppImage = NULL;
+    *pnImage = 0;
+
+    StringBuilder_appendRaw(&w, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    _putU32(&w, FLEXI_CLASS_IMAGE_VERSION);
+
+    _putI64(&w, pClassDef->lClassID);
+    _putRef(&w, &pClassDef->name);
+    _putU8(&w, (unsigned char) pClassDef->bSystemClass);
+    _putU8(&w, (unsigned char) pClassDef->bAsTable);
+    _putU8(&w, (unsigned char) pClassDef->bAllowAnyProps);
+    _putI64(&w, pClassDef->xCtloMask);
+
+    _putRefs(&w, pClassDef->aSpecProps, ARRAY_LEN(pClassDef->aSpecProps));
+    _putRefs(&w, pClassDef->aFtsProps, ARRAY_LEN(pClassDef->aFtsProps));
+    _putRefs(&w, pClassDef->aRangeProps, ARRAY_LEN(pClassDef->aRangeProps));
+
+    {
+        u32 nMixins = pClassDef->aMixins != NULL ? pClassDef->aMixins->iCnt : 0;
+        _putU32(&w, nMixins);
+        for (u32 ii = 0; ii < nMixins; ii++)
+        {
+            auto mixin = static_cast<struct flexi_ClassRefDef *>(Array_getNth(pClassDef->aMixins, ii));
+            _putRef(&w, &mixin->classRef);
+            _putRef(&w, &mixin->dynSelectorProp);
+            _putU32(&w, mixin->rules.iCnt);
+            for (u32 jj = 0; jj < mixin->rules.iCnt; jj++)
+            {
+                auto rule = static_cast<struct flexi_ClassRefRule *>(Array_getNth(&mixin->rules, jj));
+                _putString(&w, rule->regex);
+                _putRef(&w, &rule->classRef);
+            }
+        }
+    }
+
+    _putU32(&w, pClassDef->propsByName.count);
+    FlatHash_each(&pClassDef->propsByName, _putPropDef, &w);
+
+    if (w.bErr)
+    {
+        result = SQLITE_NOMEM;
+        goto ONERROR;
+    }
+
+    {
+        auto pImage = static_cast<unsigned char *>(sqlite3_malloc((int) w.nUsed));
+        CHECK_NULL(pImage);
+        memcpy(pImage, w.zBuf, (size_t) w.nUsed);
+        *ppImage = pImage;
+        *pnImage = (int) w.nUsed;
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    StringBuilder_clear(&w);
+    return result;
+}
+
+/*
+ * Bounds checked image reader. Reading past end of image sets bErr and returns zeros,
+ * so that decoder checks bErr once per logical block instead of after every field
+ */
+typedef struct ImageReader_t
+{
+    const unsigned char *p;
+    const unsigned char *pEnd;
+    bool bErr;
+} ImageReader_t;
+
+static bool _has(ImageReader_t *r, size_t n)
+{
+    if (r->bErr || (size_t) (r->pEnd - r->p) < n)
+    {
+        r->bErr = true;
+        return false;
+    }
+    return true;
+}
+
+static unsigned char _getU8(ImageReader_t *r)
+{
+    if (!_has(r, 1))
+        return 0;
+    return *r->p++;
+}
+
+static uint32_t _getU32(ImageReader_t *r)
+{
+    if (!_has(r, 4))
+        return 0;
+    uint32_t v = 0;
+    for (int ii = 0; ii < 4; ii++)
+        v |= (uint32_t) r->p[ii] << (ii * 8);
+    r->p += 4;
+    return v;
+}
+
+static sqlite3_int64 _getI64(ImageReader_t *r)
+{
+    if (!_has(r, 8))
+        return 0;
+    sqlite3_uint64 v = 0;
+    for (int ii = 0; ii < 8; ii++)
+        v |= (sqlite3_uint64) r->p[ii] << (ii * 8);
+    r->p += 8;
+    return (sqlite3_int64) v;
+}
+
+static double _getDouble(ImageReader_t *r)
+{
+    sqlite3_int64 i = _getI64(r);
+    double v;
+    memcpy(&v, &i, sizeof(v));
+    return v;
+}
+
+/*
+ * Reads string into new buffer allocated by sqlite3_malloc. NULL string is returned as NULL
+ */
+static int _getString(ImageReader_t *r, char **pzOut)
+{
+    *pzOut = NULL;
+    uint32_t n = _getU32(r);
+    if (n == IMAGE_NULL_STR || !_has(r, n))
+        return SQLITE_OK;
+
+    auto z = static_cast<char *>(sqlite3_malloc((int) n + 1));
+    if (z == NULL)
+        return SQLITE_NOMEM;
+    memcpy(z, r->p, n);
+    z[n] = 0;
+    r->p += n;
+    *pzOut = z;
+    return SQLITE_OK;
+}
+
+static int _getRef(ImageReader_t *r, flexi_MetadataRef_t *pRef)
+{
+    pRef->id = _getI64(r);
+    pRef->bOwnName = true;
+    return _getString(r, &pRef->name);
+}
+
+static int _getRefs(ImageReader_t *r, flexi_MetadataRef_t *aRefs, int nCount)
+{
+    int result;
+
+    if (_getU32(r) != (uint32_t) nCount)
+    {
+        r->bErr = true;
+        return SQLITE_OK;
+    }
+
+    for (int ii = 0; ii < nCount; ii++)
+    {
+        CHECK_CALL(_getRef(r, &aRefs[ii]));
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+static int _getMixins(ImageReader_t *r, struct flexi_ClassDef_t *pClassDef)
+{
+    int result;
+
+    uint32_t nMixins = _getU32(r);
+    if (nMixins > 0)
+    {
+        pClassDef->aMixins = Array_new(sizeof(struct flexi_ClassRefDef), flexi_ClassRefDef_dispose);
+        CHECK_NULL(pClassDef->aMixins);
+    }
+
+    for (uint32_t ii = 0; ii < nMixins && !r->bErr; ii++)
+    {
+        auto mixin = static_cast<struct flexi_ClassRefDef *>(Array_append(pClassDef->aMixins));
+        CHECK_NULL(mixin);
+        flexi_ClassRefDef_init(mixin);
+
+        CHECK_CALL(_getRef(r, &mixin->classRef));
+        CHECK_CALL(_getRef(r, &mixin->dynSelectorProp));
+
+        uint32_t nRules = _getU32(r);
+        for (uint32_t jj = 0; jj < nRules && !r->bErr; jj++)
+        {
+            auto rule = static_cast<struct flexi_ClassRefRule *>(Array_append(&mixin->rules));
+            CHECK_NULL(rule);
+            CHECK_CALL(_getString(r, &rule->regex));
+            CHECK_CALL(_getRef(r, &rule->classRef));
+        }
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+static int _getPropDef(ImageReader_t *r, struct flexi_ClassDef_t *pClassDef)
+{
+    int result;
+
+    struct flexi_PropDef_t *pProp = flexi_PropDef_new(pClassDef->lClassID);
+    CHECK_NULL(pProp);
+    pProp->pCtx = pClassDef->pCtx;
+
+    pProp->iPropID = _getI64(r);
+    CHECK_CALL(_getRef(r, &pProp->name));
+    CHECK_CALL(_getString(r, &pProp->zType));
+    CHECK_CALL(_getString(r, &pProp->zIndex));
+    CHECK_CALL(_getString(r, &pProp->zSubType));
+    CHECK_CALL(_getString(r, &pProp->zRenameTo));
+    CHECK_CALL(_getString(r, &pProp->regex));
+    CHECK_CALL(_getString(r, &pProp->zEnumDef));
+    CHECK_CALL(_getString(r, &pProp->zRefDef));
+    pProp->minOccurences = (int) _getU32(r);
+    pProp->maxOccurences = (int) _getU32(r);
+    pProp->maxLength = (int) _getU32(r);
+    pProp->xCtlv = (int) _getU32(r);
+    pProp->xCtlvPlan = (int) _getU32(r);
+    pProp->minValue = _getDouble(r);
+    pProp->maxValue = _getDouble(r);
+    pProp->type = (short int) _getU32(r);
+    pProp->xRole = (short int) _getU32(r);
+    pProp->bIndexed = (char) _getU8(r);
+    pProp->bUnique = (char) _getU8(r);
+    pProp->bFullTextIndex = (char) _getU8(r);
+    pProp->bNoTrackChanges = _getU8(r) != 0;
+    pProp->cRangeColumn = _getU8(r);
+    pProp->cColMapped = _getU8(r);
+    pProp->cRngBound = _getU8(r);
+    pProp->eChangeStatus = (CHANGE_STATUS) _getU8(r);
+
+    if (r->bErr || pProp->name.name == NULL)
+    {
+        r->bErr = true;
+        flexi_PropDef_free(pProp);
+        result = SQLITE_OK;
+        goto EXIT;
+    }
+
+    FlatHash_set(&pClassDef->propsByName, (DictionaryKey_t) {.pKey = pProp->name.name}, pProp);
+    FlatHash_set(&pClassDef->propsByID, (DictionaryKey_t) {.iKey = pProp->iPropID}, pProp);
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    if (pProp != NULL)
+        flexi_PropDef_free(pProp);
+
+    EXIT:
+    return result;
+}
+
+int flexi_ClassImage_decode(struct flexi_Context_t *pCtx, const unsigned char *pImage, int nImage,
+                            struct flexi_ClassDef_t **ppClassDef)
+{
+    int result;
+    ImageReader_t r = {pImage, pImage + nImage, false};
+
+    *ppClassDef = NULL;
+
+    if (!_has(&r, sizeof(IMAGE_MAGIC)) || memcmp(r.p, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+        return SQLITE_CORRUPT;
+    r.p += sizeof(IMAGE_MAGIC);
+    if (_getU32(&r) != FLEXI_CLASS_IMAGE_VERSION)
+        return SQLITE_MISMATCH;
+
+    struct flexi_ClassDef_t *pClassDef = flexi_class_def_new(pCtx);
+    CHECK_NULL(pClassDef);
+
+    pClassDef->lClassID = _getI64(&r);
+    CHECK_CALL(_getRef(&r, &pClassDef->name));
+    pClassDef->bSystemClass = _getU8(&r) != 0;
+    pClassDef->bAsTable = _getU8(&r) != 0;
+    pClassDef->bAllowAnyProps = _getU8(&r) != 0;
+    pClassDef->xCtloMask = _getI64(&r);
+
+    CHECK_CALL(_getRefs(&r, pClassDef->aSpecProps, ARRAY_LEN(pClassDef->aSpecProps)));
+    CHECK_CALL(_getRefs(&r, pClassDef->aFtsProps, ARRAY_LEN(pClassDef->aFtsProps)));
+    CHECK_CALL(_getRefs(&r, pClassDef->aRangeProps, ARRAY_LEN(pClassDef->aRangeProps)));
+    CHECK_CALL(_getMixins(&r, pClassDef));
+
+    {
+        uint32_t nProps = _getU32(&r);
+        for (uint32_t ii = 0; ii < nProps && !r.bErr; ii++)
+        {
+            CHECK_CALL(_getPropDef(&r, pClassDef));
+        }
+    }
+
+    // Whole image must be consumed
+    if (r.bErr || r.p != r.pEnd)
+    {
+        result = SQLITE_CORRUPT;
+        goto ONERROR;
+    }
+
+    *ppClassDef = pClassDef;
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    flexi_ClassDef_free(pClassDef);
+
+    EXIT:
+    return result;
+}
+
+int flexi_ClassImage_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID,
+                          struct flexi_ClassDef_t **ppClassDef)
+{
+    int result;
+    sqlite3_stmt *pStmt = NULL;
+
+    *ppClassDef = NULL;
+
+    CHECK_CALL(flexi_Context_stmtInit(pCtx, STMT_SEL_CLS_IMAGE,
+                                      "select Image from [.class_images] where ClassID = :1;", &pStmt));
+    CHECK_SQLITE(pCtx->db, sqlite3_bind_int64(pStmt, 1, lClassID));
+    CHECK_STMT_STEP(pStmt, pCtx->db);
+    if (result == SQLITE_DONE)
+    {
+        result = SQLITE_NOTFOUND;
+        goto EXIT;
+    }
+
+    result = flexi_ClassImage_decode(pCtx, static_cast<const unsigned char *>(sqlite3_column_blob(pStmt, 0)),
+                                     sqlite3_column_bytes(pStmt, 0), ppClassDef);
+
+    // Image from older version or damaged. Class will be loaded from JSON and image will be replaced
+    if (result == SQLITE_CORRUPT || result == SQLITE_MISMATCH || (result == SQLITE_OK && (*ppClassDef)->lClassID != lClassID))
+    {
+        flexi_ClassDef_free(*ppClassDef);
+        *ppClassDef = NULL;
+        result = SQLITE_NOTFOUND;
+        goto EXIT;
+    }
+
+    if (result != SQLITE_OK)
+        goto ONERROR;
+
+    CHECK_CALL(flexi_ClassDef_loadStats(*ppClassDef));
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    flexi_ClassDef_free(*ppClassDef);
+    *ppClassDef = NULL;
+
+    EXIT:
+    if (pStmt != NULL)
+        sqlite3_reset(pStmt);
+    return result;
+}
+
+int flexi_ClassImage_save(struct flexi_Context_t *pCtx, struct flexi_ClassDef_t *pClassDef)
+{
+    int result;
+    sqlite3_stmt *pStmt = NULL;
+    unsigned char *pImage = NULL;
+    int nImage = 0;
+
+    CHECK_CALL(flexi_ClassImage_encode(pClassDef, &pImage, &nImage));
+
+    CHECK_CALL(flexi_Context_stmtInit(pCtx, STMT_INS_CLS_IMAGE,
+                                      "insert or replace into [.class_images] (ClassID, Image) values (:1, :2);",
+                                      &pStmt));
+    CHECK_SQLITE(pCtx->db, sqlite3_bind_int64(pStmt, 1, pClassDef->lClassID));
+    CHECK_SQLITE(pCtx->db, sqlite3_bind_blob(pStmt, 2, pImage, nImage, NULL));
+    CHECK_STMT_STEP(pStmt, pCtx->db);
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    if (pStmt != NULL)
+        sqlite3_reset(pStmt);
+    sqlite3_free(pImage);
+    return result;
+}
@@ -0,0 +1,56 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_CLASS_IMAGE_H
+#define FLEXILITE_FLEXI_CLASS_IMAGE_H
+
+#include "flexi_class.h"
+
+/*
+ * Compact binary image of normalized class definition, stored in [.class_images].
+ *
+ * Image holds everything what flexi_ClassDef_loadFromDB gets from parsing class JSON and [flexi_prop]:
+ * class attributes, special, full text and range property mappings, mixins and property definitions
+ * (IDs, types, ColMap, ctlv etc.). Loading class from image is a sequential bounds-checked decode
+ * with no SQL JSON functions involved.
+ *
+ * Layout (all integers are little endian):
+ * 'FXCI' magic, u32 version, class attributes, u32 count + metadata refs for special, full text and
+ * range properties, u32 count + mixins, u32 count + properties.
+ * Strings are stored as u32 length + bytes (0xFFFFFFFF for NULL), metadata refs as i64 ID + string.
+ *
+ * Property statistics (NonNullCount, DistinctCount) is not part of image, as it changes without changing class
+ * definition. It is loaded separately, by flexi_ClassDef_loadStats.
+ */
+
+#define FLEXI_CLASS_IMAGE_VERSION 1
+
+/*
+ * Serializes class definition to binary image. *ppImage is allocated by sqlite3_malloc and
+ * should be freed by caller
+ */
+int flexi_ClassImage_encode(struct flexi_ClassDef_t *pClassDef, unsigned char **ppImage, int *pnImage);
+
+/*
+ * Creates class definition from binary image.
+ * Returns SQLITE_CORRUPT if image is malformed or SQLITE_MISMATCH if image has unsupported version
+ */
+int flexi_ClassImage_decode(struct flexi_Context_t *pCtx, const unsigned char *pImage, int nImage,
+                            struct flexi_ClassDef_t **ppClassDef);
+
+/*
+ * Loads class definition from its image in [.class_images].
+ * Returns SQLITE_NOTFOUND if there is no usable image for the class, so that
+ * class definition should be loaded from JSON
+ */
+int flexi_ClassImage_load(struct flexi_Context_t *pCtx, sqlite3_int64 lClassID,
+                          struct flexi_ClassDef_t **ppClassDef);
+
+/*
+ * Saves image of class definition to [.class_images]. Writes to database, so it is called only when class
+ * definition is changed (see flexi_ClassDef_saveImage), not on class loading
+ */
+int flexi_ClassImage_save(struct flexi_Context_t *pCtx, struct flexi_ClassDef_t *pClassDef);
+
+#endif //FLEXILITE_FLEXI_CLASS_IMAGE_H
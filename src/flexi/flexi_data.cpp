@@ -46,6 +46,7 @@
 
 #include "flexi_class.h"
 #include "flexi_data.h"
+#include "../fts/fts3_match.h"
 
 
 /*
@@ -329,7 +330,12 @@ static int _bestIndex(
 static int _open(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor)
 {
     auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>( pVTab);
+
+    // Cursor is a request scope, until it gets closed
+    flexi_Context_beginRequest(proxyVTab->pCtx);
     int result = proxyVTab->pApi->xOpen(pVTab, ppCursor);
+    if (result != SQLITE_OK)
+        flexi_Context_endRequest(proxyVTab->pCtx);
     return result;
 }
 
@@ -352,6 +358,7 @@ static int _close(sqlite3_vtab_cursor *pCursor)
 {
     auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>(pCursor->pVtab);
     int result = proxyVTab->pApi->xClose(pCursor);
+    flexi_Context_endRequest(proxyVTab->pCtx);
     return result;
 }
 
@@ -451,7 +458,9 @@ static int _update(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv, sqlite_i
             printf("%d: %s\n", ii, sqlite3_value_text(v));
     }
 
+    flexi_Context_beginRequest(proxyVTab->pCtx);
     int result = proxyVTab->pApi->xUpdate(pVTab, argc, argv, pRowid);
+    flexi_Context_endRequest(proxyVTab->pCtx);
     return result;
 }
 
@@ -482,9 +491,64 @@ static int _rename(sqlite3_vtab *pVtab, const char *zNew)
     return result;
 }
 
+/*
+ * Transaction methods. Pending [.change_log] records are kept in connection context,
+ * so they are handled here regardless of proxied module
+ */
+static int _begin(sqlite3_vtab *pVTab)
+{
+    auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>( pVTab);
+    flexi_ChangeLog_begin(&proxyVTab->pCtx->changeLog);
+    return SQLITE_OK;
+}
+
+static int _sync(sqlite3_vtab *pVTab)
+{
+    auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>( pVTab);
+    return flexi_ChangeLog_flush(&proxyVTab->pCtx->changeLog);
+}
+
+static int _rollback(sqlite3_vtab *pVTab)
+{
+    auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>( pVTab);
+    flexi_ChangeLog_discard(&proxyVTab->pCtx->changeLog);
+
+    // Names inserted by rolled back transaction do not exist anymore
+    flexi_NameCache_clear(&proxyVTab->pCtx->nameCache);
+    return SQLITE_OK;
+}
+
+static int _commit(sqlite3_vtab *pVTab)
+{
+    auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>( pVTab);
+    flexi_ChangeLog_discard(&proxyVTab->pCtx->changeLog);
+    return SQLITE_OK;
+}
+
+static int _savepoint(sqlite3_vtab *pVTab, int iSavepoint)
+{
+    auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>( pVTab);
+    return flexi_ChangeLog_savepoint(&proxyVTab->pCtx->changeLog, iSavepoint);
+}
+
+static int _release(sqlite3_vtab *pVTab, int iSavepoint)
+{
+    auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>( pVTab);
+    flexi_ChangeLog_release(&proxyVTab->pCtx->changeLog, iSavepoint);
+    return SQLITE_OK;
+}
+
+static int _rollbackTo(sqlite3_vtab *pVTab, int iSavepoint)
+{
+    auto proxyVTab = reinterpret_cast<struct FlexiDataProxyVTab_t *>( pVTab);
+    flexi_ChangeLog_rollbackTo(&proxyVTab->pCtx->changeLog, iSavepoint);
+    flexi_NameCache_clear(&proxyVTab->pCtx->nameCache);
+    return SQLITE_OK;
+}
+
 /* The methods of the flexi virtual table */
 static sqlite3_module flexi_data_module = {
-        .iVersion = 0,
+        .iVersion = 2,
         .xCreate = _createOrConnect,
         .xConnect =_createOrConnect,
         .xBestIndex = _bestIndex,
@@ -498,73 +562,17 @@ static sqlite3_module flexi_data_module = {
         .xColumn = _column,
         .xRowid = _row_id,
         .xUpdate = _update,
-        .xBegin = 0,
-        .xSync =0,
-        .xCommit = 0,
-        .xRollback =0,
+        .xBegin = _begin,
+        .xSync = _sync,
+        .xCommit = _commit,
+        .xRollback = _rollback,
         .xFindFunction = _find_method,
         .xRename = _rename,
-        .xSavepoint = 0,
-        .xRelease = 0,
-        .xRollbackTo = 0
+        .xSavepoint = _savepoint,
+        .xRelease = _release,
+        .xRollbackTo = _rollbackTo
 };
 
-/*
- * Implementation of MATCH function for non-FTS-indexed columns.
- * For the sake of simplicity function uses in-memory FTS4 table with 1 row, which
- * gets replaced for every call. In future this method should be re-implemented
- * and use more efficient direct calls to Sqlite FTS3/4 API. For now,
- * this looks like a reasonable compromise which should work OK for smaller sets
- * of data.
- */
-static void _matchTextFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
-{
-    // TODO Update lookup statistics
-    int result;
-    auto pDBEnv = static_cast<struct flexi_Context_t *>(sqlite3_user_data(context));
-    sqlite3_int64 lDocID;
-
-    assert(pDBEnv);
-
-    if (pDBEnv->pMemDB == nullptr)
-    {
-        CHECK_CALL(sqlite3_open_v2(":memory:", &pDBEnv->pMemDB, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL));
-
-        CHECK_SQLITE(pDBEnv->pMemDB, sqlite3_exec(pDBEnv->pMemDB, "PRAGMA journal_mode = OFF;"
-                                                          "create virtual table if not exists [.match_func] using 'fts4' (txt, tokenize=unicode61);", NULL,
-                                                  nullptr,
-                                                  nullptr));
-
-        CHECK_STMT_PREPARE(pDBEnv->pMemDB, "insert or replace into [.match_func] (docid, txt) values (1, :1);",
-                           &pDBEnv->pMatchFuncInsStmt);
-
-        CHECK_STMT_PREPARE(pDBEnv->pMemDB, "select docid from [.match_func] where txt match :1;",
-                           &pDBEnv->pMatchFuncSelStmt);
-
-    }
-
-    sqlite3_reset(pDBEnv->pMatchFuncInsStmt);
-
-    sqlite3_bind_value(pDBEnv->pMatchFuncInsStmt, 1, argv[1]);
-    CHECK_STMT_STEP(pDBEnv->pMatchFuncInsStmt, pDBEnv->pMemDB);
-
-    sqlite3_reset(pDBEnv->pMatchFuncSelStmt);
-    sqlite3_bind_value(pDBEnv->pMatchFuncSelStmt, 1, argv[0]);
-    CHECK_STMT_STEP(pDBEnv->pMatchFuncSelStmt, pDBEnv->pMemDB);
-    lDocID = sqlite3_column_int64(pDBEnv->pMatchFuncSelStmt, 0);
-    if (lDocID == 1)
-        sqlite3_result_int(context, 1);
-    else
-        sqlite3_result_int(context, 0);
-
-    goto EXIT;
-
-    ONERROR:
-    sqlite3_result_error_code(context, result);
-    EXIT:
-    {}
-}
-
 /*
  * Registers 'flexi_data' function and virtual table module
  */
@@ -588,7 +596,7 @@ int flexi_data_init(
      * Register match_text function, used for searching on non-FTS indexed columns
      */
     CHECK_CALL(sqlite3_create_function_v2(db, "match_text", 2, SQLITE_UTF8, pCtx,
-                                          _matchTextFunction, 0, 0, NULL));
+                                          flexi_match_text_func, 0, 0, NULL));
 
     result = SQLITE_OK;
     goto EXIT;
@@ -5,6 +5,11 @@
 #ifndef FLEXILITE_FLEXI_DATA_H
 #define FLEXILITE_FLEXI_DATA_H
 
+#include "../util/IdSet.h"
+#include "../util/Arena.h"
+#include "../util/KeyHeap.h"
+#include "flexi_bookmark.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,6 +33,120 @@ typedef enum
 
 } FLEXI_DATA_COLUMNS;
 
+/*
+ * Class virtual table has property columns (in order of property ID), followed by hidden bookmark column.
+ * Bookmark of row is its position in ordered results (see flexi_Bookmark_t). Constraint bookmark = :bookmark,
+ * with bookmark of the last row of previous page, makes query continue right after that row
+ */
+#define FLEXI_DATA_VTAB_BOOKMARK_COL(pClassDef) ((pClassDef)->propsByName.count)
+
+/*
+ * Search strategies for Flexilite class virtual table, sorted from most efficient to least efficient.
+ * Strategy is chosen by xBestIndex and passed to xFilter in lower byte of idxNum
+ */
+typedef enum
+{
+    FLEXI_DATA_PLAN_FULL_SCAN = 0,
+    FLEXI_DATA_PLAN_ROWID = 1,
+    FLEXI_DATA_PLAN_INDEX_EQ = 2,
+    FLEXI_DATA_PLAN_RTREE = 3,
+    FLEXI_DATA_PLAN_INDEX_RANGE = 4,
+    FLEXI_DATA_PLAN_FTS = 5,
+    FLEXI_DATA_PLAN_LINEAR_EQ = 6,
+    FLEXI_DATA_PLAN_LINEAR_RANGE = 7,
+    FLEXI_DATA_PLAN_LINEAR_MATCH = 8
+} FLEXI_DATA_PLAN;
+
+/*
+ * Order of object IDs returned by xFilter, when ORDER BY is consumed by xBestIndex.
+ * Passed to xFilter in second byte of idxNum. Column to order by is passed in upper 2 bytes of idxNum
+ * (column index + 1)
+ */
+typedef enum
+{
+    FLEXI_DATA_ORDER_NONE = 0,
+    FLEXI_DATA_ORDER_BY_ID = 1,
+    FLEXI_DATA_ORDER_BY_ID_DESC = 2,
+
+    /*
+     * Single lookup on the ordering column, sorted by value
+     */
+    FLEXI_DATA_ORDER_BY_VALUE = 3,
+    FLEXI_DATA_ORDER_BY_VALUE_DESC = 4,
+
+    /*
+     * Full scan replaced with scan of value index of the ordering column, plus objects without value
+     */
+    FLEXI_DATA_ORDER_BY_INDEX = 5,
+    FLEXI_DATA_ORDER_BY_INDEX_DESC = 6,
+
+    /*
+     * Found objects are ordered by value of the ordering column via heap (see KeyHeap_t)
+     */
+    FLEXI_DATA_ORDER_BY_HEAP = 7,
+    FLEXI_DATA_ORDER_BY_HEAP_DESC = 8
+} FLEXI_DATA_ORDER;
+
+#define FLEXI_DATA_IDX_NUM(plan, order, orderCol) ((int)(plan) | ((int)(order) << 8) | (((orderCol) + 1) << 16))
+#define FLEXI_DATA_IDX_PLAN(idxNum) ((FLEXI_DATA_PLAN)((idxNum) & 0xFF))
+#define FLEXI_DATA_IDX_ORDER(idxNum) ((FLEXI_DATA_ORDER)(((idxNum) >> 8) & 0xFF))
+#define FLEXI_DATA_IDX_ORDER_COL(idxNum) ((((idxNum) >> 16) & 0x7FFF) - 1)
+
+/*
+ * Single lookup query of filter plan, with its prepared statement
+ */
+typedef struct flexi_FilterProbe_t
+{
+    /*
+     * Generated lookup SQL
+     */
+    char *zSQL;
+
+    /*
+     * Prepared statement for zSQL which is not used by any cursor at the moment.
+     * NULL if statement is currently borrowed by cursor (or was not prepared yet)
+     */
+    sqlite3_stmt *pStmt;
+} flexi_FilterProbe_t;
+
+/*
+ * Compiled object lookup for Flexilite class. Created by xFilter for every distinct
+ * (idxNum, idxStr) pair and kept in class definition (flexi_ClassDef_t.filterPlans).
+ * Plan with single probe is streamed by cursor directly. When plan has multiple probes
+ * (multiple constraints), every probe is run separately, results get collected into ID sets
+ * and intersected. Probes are ordered by estimated cost, so that most selective lookup goes first
+ */
+typedef struct flexi_FilterPlan_t
+{
+    int nProbes;
+    flexi_FilterProbe_t *aProbes;
+
+    /*
+     * If true, probes are streamed by cursor one after another instead of intersection
+     * (ordered index scan followed by objects without value, see FLEXI_DATA_ORDER_BY_INDEX)
+     */
+    bool bConcat;
+
+    /*
+     * If true, single probe returns sort key in the second column (see FLEXI_DATA_ORDER_BY_HEAP)
+     */
+    bool bKeyed;
+} flexi_FilterPlan_t;
+
+void flexi_FilterPlan_free(struct flexi_FilterPlan_t *pPlan);
+
+/*
+ * Number of objects prefetched by cursor at once. Properties of all objects in batch
+ * are loaded by single [.ref-values] scan
+ */
+#define FLEXI_DATA_BATCH_SIZE 256
+
+struct flexi_BatchIndex_t
+{
+    sqlite3_int64 lObjectID;
+    int iBatchPos;
+};
+
 typedef struct flexi_VTabCursor
 {
     struct sqlite3_vtab_cursor base;
@@ -39,21 +158,91 @@ typedef struct flexi_VTabCursor
     sqlite3_stmt *pObjectIterator;
 
     /*
-     * This statement will be used to iterating through properties of object (by its ID)
+     * Plan which pObjectIterator was borrowed from. Statement is returned to the plan
+     * on next filter or when cursor gets closed
+     */
+    struct flexi_FilterPlan_t *pPlan;
+
+    /*
+     * Index of plan's probe which pObjectIterator was borrowed from
+     */
+    int iProbe;
+
+    /*
+     * Intersection of object IDs found by multi-probe plan, and iterator over it.
+     * Used instead of pObjectIterator when plan has more than 1 probe
+     */
+    IdSet_t ids;
+    IdSetIterator_t idsIter;
+
+    /*
+     * Found object IDs with their sort keys, when ORDER BY is served by heap.
+     * bHeap is true when object IDs are popped from heap
+     */
+    KeyHeap_t heap;
+    bool bHeap;
+
+    /*
+     * Ordering of results and column to order by (-1 if ordered by object ID), as passed to xFilter
+     */
+    FLEXI_DATA_ORDER eOrder;
+    int iOrderCol;
+
+    /*
+     * Position to continue after, if query has bookmark constraint. eOrder is 0 if there is no bookmark
+     */
+    flexi_Bookmark_t bookmark;
+
+    /*
+     * This statement will be used to load properties of batch of objects (by their IDs).
+     * Has FLEXI_DATA_BATCH_SIZE parameters, unused ones are left NULL
      */
     sqlite3_stmt *pPropertyIterator;
     sqlite3_int64 lObjectID;
 
     /*
-     * Actually fetched number of column values.
-     * Reset to 0 on every next object fetch
+     * aBatchIds, aBatchIndex and pCols are owned by cursor and allocated once, in xOpen.
+     * Context's request arena is not used for them: it is reset only when the outermost request ends,
+     * so cursors opened by nested statements (e.g. from xUpdate) would keep growing it
+     */
+
+    /*
+     * IDs of prefetched objects in the order they were returned by filter
+     */
+    sqlite3_int64 *aBatchIds;
+
+    /*
+     * Batch positions sorted by object ID, for merging with properties ordered by ObjectID
+     */
+    struct flexi_BatchIndex_t *aBatchIndex;
+
+    /*
+     * Number of objects in current batch and position of current object in batch
+     */
+    int nBatchCount;
+    int iBatchPos;
+
+    /*
+     * Set when all object IDs were fetched from filter results
+     */
+    bool bObjectsDone;
+
+    /*
+     * Set when properties of current batch were loaded. Properties are loaded on first column
+     * request, so that objects skipped by OFFSET or not read because of LIMIT are never materialized
+     */
+    bool bBatchLoaded;
+
+    /*
+     * Columnar buffer of property values for current batch. Value of column N for object at batch
+     * position I is at pCols[N * FLEXI_DATA_BATCH_SIZE + I]. iType is 0 if object does not have value
      */
-    int iReadCol;
+    struct flexi_ObjValue_t *pCols;
 
     /*
-     * Array of retrieved column data, by column index as it is defined in pVTab->pProps
+     * Storage for text and blob values of current batch. Reset when next batch is loaded
      */
-    sqlite3_value **pCols;
+    Arena_t batchArena;
 
     /*
      * Indicator of end of file
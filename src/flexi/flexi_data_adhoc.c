@@ -30,10 +30,12 @@
  */
 
 #include "../project_defs.h"
-//#include "flexi_data.h"
-//#include "flexi_class.h"
+#include "../util/JsonTape.h"
+#include "flexi_data.h"
+#include "flexi_class.h"
 //#include "../util/StringBuilder.h"
-//#include "flexi_Object.h"
+#include "flexi_Object.h"
+#include "flexi_ref_expand.h"
 //#include "../util/json_proc.h"
 
 
@@ -51,27 +53,12 @@
 #define FLEXI_PROP_NAME       "$name"
 #define FLEXI_PROP_VERSION       "$version"
 
-/*
- * Column numbers for result of json_tree call
- */
-enum UPSERT_JSON_COLUMNS
-{
-    JSON_TREE_KEY = 0,
-    JSON_TREE_VALUE = 1,
-    JSON_TREE_TYPE = 2,
-    JSON_TREE_ATOM = 3,
-    JSON_TREE_ID = 4,
-    JSON_TREE_PARENT = 5,
-    JSON_TREE_FULLKEY = 6,
-    JSON_TREE_PATH = 7
-};
-
 typedef struct _UpsertParams_t
 {
     /*
      * virtual table for adhoc processing
      */
-//    FlexiDataProxyVTab_t *dataVTab;
+    FlexiDataProxyVTab_t *dataVTab;
 
     /*
      * If class name was passed in ClassName, its ID will be passed here
@@ -94,20 +81,15 @@ typedef struct _UpsertParams_t
     bool insert;
 
     /*
-     * Cursor to get JSON values
+     * Parsed JSON payload
      */
-    sqlite3_stmt *pDataSource;
+    JsonTape_t *pTape;
 
 //    /*
 //     * Root level JSON node
 //     */
 //    JSON_Value *pRootNode;
 
-    /*
-     * Scope of parent ID
-     */
-    int parent;
-
 //    /*
 //     * Parent JSON node
 //     */
@@ -127,9 +109,21 @@ typedef struct _UpsertParams_t
  */
 typedef struct _GetDataParams_t
 {
-//    StringBuilder_t sb;
+    StringBuilder_t sb;
 //    flexi_VTabCursor *cur;
     enum FLEXI_DATA_LOAD_ROW_MODES eLoadRowMode;
+
+    /*
+     * Page of object IDs to output, in order of results
+     */
+    const sqlite3_int64 *aObjectIDs;
+    int nObjectCount;
+
+    /*
+     * Loads objects of page and objects referenced by them up to fetch depth, one query per level
+     * (see flexi_ref_expand.h). Initialized with eLoadRowMode and fetchDepth
+     */
+    flexi_RefExpand_t refs;
 } _GetDataParams_t;
 
 /*
@@ -267,17 +261,60 @@ static int _eof(sqlite3_vtab_cursor *pCursor)
     return 1;
 }
 
+/*
+ * Builds JSON for page of objects: single object for LOAD_ROW_MODE_ROW_PER_OBJECT, object with object IDs as keys
+ * for LOAD_ROW_MODE_JSON_OBJECT, or array of objects.
+ * All objects of page, with referenced objects, are loaded before JSON is built, so that references are
+ * expanded with one query per level rather than with query per object
+ */
 static int
 _buildDataColumn(_GetDataParams_t *p)
 {
     int result;
 
-    // Assume array of items. Depending on actual number of items and load mode, starting position may change
-//    StringBuilder_appendRaw(&p->sb, "[", 1);
+    CHECK_CALL(flexi_RefExpand_load(&p->refs, p->aObjectIDs, p->nObjectCount));
 
+    switch (p->eLoadRowMode)
+    {
+        case LOAD_ROW_MODE_ROW_PER_OBJECT:
+            if (p->nObjectCount > 0)
+            {
+                CHECK_CALL(flexi_RefExpand_appendJson(&p->refs, p->aObjectIDs[0], &p->sb));
+            }
+            else StringBuilder_appendRaw(&p->sb, "null", 4);
+            break;
 
-    result = SQLITE_OK;
+        case LOAD_ROW_MODE_JSON_OBJECT:
+            StringBuilder_appendRaw(&p->sb, "{", 1);
+            for (int ii = 0; ii < p->nObjectCount; ii++)
+            {
+                char zKey[32];
+                sqlite3_snprintf(sizeof(zKey), zKey, ii > 0 ? ",\"%lld\":" : "\"%lld\":", p->aObjectIDs[ii]);
+                StringBuilder_appendRaw(&p->sb, zKey, -1);
+                CHECK_CALL(flexi_RefExpand_appendJson(&p->refs, p->aObjectIDs[ii], &p->sb));
+            }
+            StringBuilder_appendRaw(&p->sb, "}", 1);
+            break;
+
+        default:
+            StringBuilder_appendRaw(&p->sb, "[", 1);
+            for (int ii = 0; ii < p->nObjectCount; ii++)
+            {
+                if (ii > 0)
+                    StringBuilder_appendRaw(&p->sb, ",", 1);
+                CHECK_CALL(flexi_RefExpand_appendJson(&p->refs, p->aObjectIDs[ii], &p->sb));
+            }
+            StringBuilder_appendRaw(&p->sb, "]", 1);
+            break;
+    }
 
+    result = p->sb.bErr ? SQLITE_NOMEM : SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    flexi_RefExpand_reset(&p->refs);
     return result;
 }
 
@@ -336,9 +373,9 @@ static int _row_id(sqlite3_vtab_cursor *pCursor, sqlite_int64 *pRowid)
 
 /*
  * Following set of _upsert* methods are to handle update/insert operations for different types of data
- * They have similar set of arguments and all follow the same pattern of navigation over JSON tokens in json_tree output.
- * They expect first item already positioned and when exiting, they leave position immediately after last processed item (if more items exist),
- * thus allowing next handler to start from established position
+ * They have similar set of arguments and all follow the same pattern of navigation over JSON tape (see JsonTape.h).
+ * They get index of node to process and iterate over its children directly (first child, next sibling),
+ * so no parsing state is shared between handlers
  *
  * These functions are:
  * _upsertObject - to process individual object
@@ -405,7 +442,7 @@ static int _row_id(sqlite3_vtab_cursor *pCursor, sqlite_int64 *pRowid)
  */
 
 static int
-_upsertObject(_UpsertParams_t *pp);
+_upsertObject(_UpsertParams_t *pp, u32 iObject);
 
 /*
  *
@@ -424,40 +461,33 @@ _loadObjPropsFromJSON(_UpsertParams_t *p)
 
 /*
  * Inserts or updates array of atoms/objects
- * pDataSource is result of select from json_tree and is expected to be positioned on the first row with given parent
+ * iNode is index of array node on JSON tape
  */
 //static int
 //_upsertPropertyArray(FlexiDataProxyVTab_t *dataVTab, sqlite3_int64 lClassID,
 //                     struct flexi_PropDef_t *propDef,
-//                     bool insert, sqlite3_stmt *pDataSource, int parent)
+//                     bool insert, JsonTape_t *pTape, u32 iNode)
 //{
 //    return 0;
 //}
 
 /*
  * Inserts or update data into single object
- * pDataSource is result of select from json_tree and is expected to be positioned on the current row
+ * iNode is index of object member on JSON tape. Key of node is property name
  */
 static int
-_upsertProperty(_UpsertParams_t *pp)
+_upsertProperty(_UpsertParams_t *pp, u32 iNode)
 {
     int result;
-    char *zPropName = NULL;
+    const JsonTapeNode_t *pNode = &pp->pTape->aNodes[iNode];
+    const char *zPropName = pNode->zKey;
     flexi_ClassDef_t *pClassDef;
 
 //    CHECK_CALL(flexi_ClassDef_load(pp->dataVTab->pCtx, pp->lExpectedClassID, &pClassDef));
 
-    int thisParent = sqlite3_column_int(pp->pDataSource, JSON_TREE_PARENT);
-    if (thisParent != pp->parent)
-        goto EXIT;
-
-    sqlite3_free(zPropName);
-    getColumnAsText(&zPropName, pp->pDataSource, JSON_TREE_KEY);
-
-    sqlite3_int64 lPropID;
+    sqlite3_int64 lPropID = -1;
 //    CHECK_CALL(flexi_Context_getPropIdByClassIdAndName(pp->dataVTab->pCtx, pp->lExpectedClassID, zPropName, &lPropID));
-    bool bAtom = sqlite3_column_int(pp->pDataSource, JSON_TREE_ATOM) == 0;
-    const char *zType = (const char *) sqlite3_column_text(pp->pDataSource, JSON_TREE_TYPE);
+    bool bAtom = pNode->type != JSON_ARRAY && pNode->type != JSON_OBJECT;
 
     if (lPropID == -1)
         // Property not found
@@ -483,10 +513,7 @@ _upsertProperty(_UpsertParams_t *pp)
         }
         else
         {
-            if (strcmp(zType, "") == 0)
-            {
 
-            }
         }
 
     }
@@ -499,29 +526,24 @@ _upsertProperty(_UpsertParams_t *pp)
         // Check if this is an atomic value
         if (bAtom)
         {
-            sqlite3_value *vv = sqlite3_column_value(pp->pDataSource, JSON_TREE_VALUE);
-            CHECK_CALL(flexi_PropDef_validateValue(prop, pClassDef, vv));
+            // TODO Validate node value (type, range, length) against prop
 
-            // If property is not mapped to fixed column, save it in [.ref-values]
+            // If property is not mapped to fixed column, save it in [.ref-values],
+            // binding value from tape (JsonTape_bindValue), without copying
 
             // otherwise, assign to object save
         }
         else
             // Possibly, nested object or array of values or nested objects
         {
-            if (strcmp(zType, "array") == 0)
+            if (pNode->type == JSON_ARRAY)
             {
 
             }
             else
-                if (strcmp(zType, "object") == 0)
-                {
+            {
 
-                }
-                else
-                {
-                    // TODO Invalid element type
-                }
+            }
         }
 
     }
@@ -532,35 +554,32 @@ _upsertProperty(_UpsertParams_t *pp)
     ONERROR:
 
     EXIT:
-    sqlite3_free(zPropName);
     return result;
 }
 
 /*
  * Updates or inserts array of objects
- * By convention, at the time of call, pDataSource is positioned at first object row (type == 'object')
+ * iArray is index of array node on JSON tape
  */
 static int
-_upsertObjectArray(_UpsertParams_t *pp)
+_upsertObjectArray(_UpsertParams_t *pp, u32 iArray)
 {
     int result;
 
-    // Iterate over all items until parent == parent or parent == id
-    int currentScope = sqlite3_column_int(pp->pDataSource, JSON_TREE_ID);
-
-    while ((result = sqlite3_step(pp->pDataSource)) == SQLITE_ROW)
+    for (u32 ii = JsonTape_firstChild(pp->pTape, iArray); ii != JSON_TAPE_NONE;
+         ii = JsonTape_nextSibling(pp->pTape, ii))
     {
-        int currentParent = sqlite3_column_int(pp->pDataSource, JSON_TREE_PARENT);
-        int currentID = sqlite3_column_int(pp->pDataSource, JSON_TREE_ID);
-        if (currentParent != pp->parent && currentID != currentScope)
-            break;
-        CHECK_CALL(_upsertObject(pp));
+        if (pp->pTape->aNodes[ii].type != JSON_OBJECT)
+        {
+            result = SQLITE_ERROR;
+            flexi_Context_setError(pp->dataVTab->pCtx, result,
+                                   sqlite3_mprintf("Array item is expected to be object"));
+            goto ONERROR;
+        }
 
+        CHECK_CALL(_upsertObject(pp, ii));
     }
 
-    if (result != SQLITE_DONE && result != SQLITE_ROW)
-        goto ONERROR;
-
     result = SQLITE_OK;
     goto EXIT;
 
@@ -571,12 +590,11 @@ _upsertObjectArray(_UpsertParams_t *pp)
 
 // TODO ???
 static int
-_getProp(_UpsertParams_t *pp, flexi_Object_t *obj)
+_getProp(_UpsertParams_t *pp, u32 iNode, flexi_Object_t *obj)
 {
     int result;
 
-    int thisId = sqlite3_column_int(pp->pDataSource, JSON_TREE_ID);
-    int thisParent = sqlite3_column_int(pp->pDataSource, JSON_TREE_PARENT);
+    const JsonTapeNode_t *pNode = &pp->pTape->aNodes[iNode];
 
 
     result = SQLITE_OK;
@@ -599,31 +617,25 @@ _saveObject(_UpsertParams_t *pp, flexi_Object_t *obj)
 
 /*
  * Process top level object in _upsertOrDelete function
+ * iObject is index of object node on JSON tape
  */
 static int
-_upsertObject(_UpsertParams_t *pp)
+_upsertObject(_UpsertParams_t *pp, u32 iObject)
 {
     int result;
 
     pp->level++;
 
-    int objectScopeId = sqlite3_column_int(pp->pDataSource, JSON_TREE_ID);
-    int savedParent = pp->parent;
-    pp->parent = objectScopeId;
-
     // Init [.objects] row
     // TODO
 
     flexi_Object_t obj;
     flexi_Object_init(&obj, pp->dataVTab->pCtx);
 
-    while ((result = sqlite3_step(pp->pDataSource)) == SQLITE_ROW)
+    for (u32 ii = JsonTape_firstChild(pp->pTape, iObject); ii != JSON_TAPE_NONE;
+         ii = JsonTape_nextSibling(pp->pTape, ii))
     {
-        result = (_upsertProperty(pp));
-        if (result == SQLITE_DONE)
-            break;
-
-        CHECK_CALL(result);
+        CHECK_CALL(_upsertProperty(pp, ii));
     }
 
     // Save object
@@ -637,9 +649,6 @@ _upsertObject(_UpsertParams_t *pp)
         CHECK_CALL(_saveObject(pp, &obj));
     }
 
-    if (result != SQLITE_DONE)
-        goto ONERROR;
-
     result = SQLITE_OK;
     goto EXIT;
 
@@ -649,7 +658,6 @@ _upsertObject(_UpsertParams_t *pp)
     pp->level--;
 
     flexi_Object_clear(&obj);
-    pp->parent = savedParent;
     return result;
 }
 
@@ -657,33 +665,22 @@ _upsertObject(_UpsertParams_t *pp)
  *
  */
 static int
-_upsertData(_UpsertParams_t *pp)
+_upsertData(_UpsertParams_t *pp, u32 iNode)
 {
     int result;
-    int parent = sqlite3_column_int(pp->pDataSource, JSON_TREE_PARENT);
-    bool bAtom = sqlite3_column_int(pp->pDataSource, JSON_TREE_ATOM) == 0;
-    if (bAtom)
+    const JsonTapeNode_t *pNode = &pp->pTape->aNodes[iNode];
+    switch (pNode->type)
     {
+        case JSON_ARRAY:
+            CHECK_CALL(_upsertObjectArray(pp, iNode));
+            break;
 
-    }
-    else
-    {
-        const char *zType = (const char *) sqlite3_column_text(pp->pDataSource, JSON_TREE_TYPE);
-        if (strcmp(zType, "array") == 0)
-        {
-            CHECK_CALL(_upsertObjectArray(pp));
-        }
-        else
-            if (strcmp(zType, "object") == 0)
-            {
+        case JSON_OBJECT:
+            break;
 
-            }
-            else
-            {
-                result = SQLITE_ERROR;
-                flexi_Context_setError(pp->dataVTab->pCtx, result, sqlite3_mprintf("Invalid token type %s", zType));
-                goto ONERROR;
-            }
+        default:
+            // Atom
+            break;
     }
 
     result = SQLITE_OK;
@@ -740,19 +737,16 @@ UPDATE table SET rowid=rowid+1 WHERE ...;
  2) array - of atoms, objects or references
  3) object (nested or referenced)
 
- First row in result of json_tree will have parent null. This is specilal item.
- It can be array or object (of given class)
+ Data JSON is parsed into tape in one pass. Root node can be array or object (of given class)
  */
 static int _upsertOrDelete(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv, sqlite_int64 *pRowid)
 {
     int result;
 
-    sqlite3_stmt *pDataSource = NULL; // Parsed JSON data
-//    JSON_Value *jsonData = NULL;
+    JsonTape_t tape; // Parsed JSON data
+    JsonTape_init(&tape);
 
     FlexiDataProxyVTab_t *dataVTab = (void *) pVTab;
-    JsonProcessor_t jsonProc;
-    JsonProcessor_init(&jsonProc, dataVTab->pCtx);
 
     char *zClassName = (char *) sqlite3_value_text(argv[FLEXI_DATA_COL_CLASS_NAME + 2]);
     if (!zClassName || strlen(zClassName) == 0)
@@ -803,7 +797,7 @@ static int _upsertOrDelete(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv,
 //
 
         _UpsertParams_t pp = {};
-        pp.pDataSource = pDataSource;
+        pp.pTape = &tape;
         pp.lExpectedClassID = pClassDef->lClassID;
         pp.dataVTab = dataVTab;
         pp.insert = argv[0] == NULL;
@@ -825,59 +819,46 @@ static int _upsertOrDelete(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv,
         /*
         * Parse data JSON
         */
-        CHECK_STMT_PREPARE(dataVTab->pCtx->db,
-                           "select "
-                                   "key, " // 0
-                                   "value, " // 1
-                                   "type, " // 2
-                                   "atom, " // 3
-                                   "id, " // 4
-                                   "parent, " // 5
-                                   "fullkey, " // 6 todo needed?
-                                   "path " // 7
-                                   "from json_tree(:1);", &pDataSource);
-        CHECK_CALL(sqlite3_bind_text(pDataSource, 1,
-                                     (const char *) sqlite3_value_text(argv[FLEXI_DATA_COL_DATA + 2]), -1,
-                                     NULL));
-        result = sqlite3_step(pDataSource);
-        if (result == SQLITE_ROW)
+        sqlite3_value *pData = argv[FLEXI_DATA_COL_DATA + 2];
+        const char *zData = (const char *) sqlite3_value_text(pData);
+        if (zData == NULL)
         {
+            result = SQLITE_ERROR;
+            flexi_Context_setError(dataVTab->pCtx, result, sqlite3_mprintf("Data is expected"));
+            goto ONERROR;
+        }
 
-            int scopeID = sqlite3_column_int(pDataSource, JSON_TREE_ID);
-            pp.parent = scopeID;
+        result = JsonTape_parse(&tape, zData, sqlite3_value_bytes(pData));
+        if (result == SQLITE_ERROR)
+            flexi_Context_setError(dataVTab->pCtx, result,
+                                   sqlite3_mprintf("Invalid data JSON at position %u", tape.iErrorPos));
+        CHECK_CALL(result);
 
-            // First row is only used for determining data processing flow.
-            char *zType = (char *) sqlite3_column_text(pDataSource, JSON_TREE_TYPE);
-            if (strcmp(zType, "object") == 0)
-            {
-                CHECK_STMT_STEP(pDataSource, dataVTab->pCtx->db);
-                CHECK_CALL(_upsertObject(&pp));
-            }
-            else
-                if (strcmp(zType, "array") == 0)
-                {
-                    if (!insert)
-                    {
-                        result = SQLITE_ERROR;
-                        flexi_Context_setError(dataVTab->pCtx, result,
-                                               sqlite3_mprintf("Cannot update array of objects"));
-                        goto ONERROR;
-                    }
-
-                    CHECK_STMT_STEP(pDataSource, dataVTab->pCtx->db);
-                    CHECK_CALL(_upsertObjectArray(&pp));
-                }
-                else
+        // Root node determines data processing flow
+        switch (tape.aNodes[0].type)
+        {
+            case JSON_OBJECT:
+                CHECK_CALL(_upsertObject(&pp, 0));
+                break;
+
+            case JSON_ARRAY:
+                if (!insert)
                 {
                     result = SQLITE_ERROR;
                     flexi_Context_setError(dataVTab->pCtx, result,
-                                           sqlite3_mprintf("Data is expected to be object or array"));
+                                           sqlite3_mprintf("Cannot update array of objects"));
                     goto ONERROR;
                 }
-        }
-        else
-            if (result != SQLITE_DONE)
+
+                CHECK_CALL(_upsertObjectArray(&pp, 0));
+                break;
+
+            default:
+                result = SQLITE_ERROR;
+                flexi_Context_setError(dataVTab->pCtx, result,
+                                       sqlite3_mprintf("Data is expected to be object or array"));
                 goto ONERROR;
+        }
     }
 
     result = SQLITE_OK;
@@ -886,10 +867,7 @@ static int _upsertOrDelete(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv,
     ONERROR:
 
     EXIT:
-    sqlite3_finalize(pDataSource);
-
-
-    JsonProcessor_clear(&jsonProc);
+    JsonTape_free(&tape);
     return result;
 }
 
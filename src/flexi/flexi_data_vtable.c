@@ -2,13 +2,18 @@
 // Created by slanska on 2017-04-08.
 //
 
+#include <math.h>
+
 #include "../project_defs.h"
 #include "flexi_data.h"
 
 SQLITE_EXTENSION_INIT3
 
 #include "../misc/regexp.h"
+#include "../util/StringBuilder.h"
 #include "flexi_class.h"
+#include "flexi_eav.h"
+#include "flexi_Object.h"
 
 static int _disconnect(sqlite3_vtab *pVTab)
 {
@@ -31,6 +36,201 @@ static void setEstimatedRows(sqlite3_index_info *pIdxInfo, sqlite3_int64 nRow)
 #endif
 }
 
+/*
+ * Default number of objects in class, used by planner when class statistics
+ * was not collected yet
+ */
+#define FLEXI_DATA_DEFAULT_ROW_COUNT 100000
+
+/*
+ * Selectivity of single constraint, depending on op code, when no better statistics is available
+ */
+#define FLEXI_DATA_EQ_SELECTIVITY 0.1
+#define FLEXI_DATA_RANGE_SELECTIVITY 0.25
+#define FLEXI_DATA_MATCH_SELECTIVITY 0.05
+
+/*
+ * LIMIT and OFFSET are passed to xBestIndex as constraints since SQLite 3.38, bundled sqlite3.h does not have them.
+ * Older SQLite never passes these op codes
+ */
+#ifndef SQLITE_INDEX_CONSTRAINT_LIMIT
+#define SQLITE_INDEX_CONSTRAINT_LIMIT 73
+#define SQLITE_INDEX_CONSTRAINT_OFFSET 74
+#endif
+
+/*
+ * Bounds of object ID, used to continue after bookmark
+ */
+#define FLEXI_DATA_MIN_ID ((sqlite3_int64) (((sqlite3_uint64) 1) << 63))
+#define FLEXI_DATA_MAX_ID ((sqlite3_int64) ((((sqlite3_uint64) 1) << 63) - 1))
+
+/*
+ * Estimation for single usable constraint
+ */
+typedef struct _ConstraintPlan_t
+{
+    /*
+     * Index in pIdxInfo->aConstraint
+     */
+    int iConstraint;
+
+    FLEXI_DATA_PLAN ePlan;
+
+    /*
+     * Estimated number of object IDs found by this constraint alone
+     */
+    double dRows;
+
+    /*
+     * Estimated cost of lookup
+     */
+    double dCost;
+
+    /*
+     * If true, constraint must be passed to xFilter regardless of its cost
+     * (MATCH is not evaluated by SQLite)
+     */
+    bool bRequired;
+
+    bool bUsed;
+} _ConstraintPlan_t;
+
+/*
+ * Rough estimate of log2(N), as number of steps to find value in B-tree
+ */
+static double _estLog(double N)
+{
+    double result = 1;
+    for (double x = 2; x < N; x *= 2)
+        result++;
+    return result;
+}
+
+static bool _isSupportedOp(unsigned char op)
+{
+    switch (op)
+    {
+        case SQLITE_INDEX_CONSTRAINT_EQ:
+        case SQLITE_INDEX_CONSTRAINT_GT:
+        case SQLITE_INDEX_CONSTRAINT_LE:
+        case SQLITE_INDEX_CONSTRAINT_LT:
+        case SQLITE_INDEX_CONSTRAINT_GE:
+        case SQLITE_INDEX_CONSTRAINT_MATCH:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * Estimates lookup for single constraint on column iCol (-1 for rowid)
+ * dObjCount - estimated number of objects in class
+ * dValueCount - estimated number of values in [.ref-values] for the class (cost of linear scan)
+ */
+static void _estimateConstraint(struct flexi_ClassDef_t *vtab, int iCol, unsigned char op,
+                                double dObjCount, double dValueCount, _ConstraintPlan_t *pPlan)
+{
+    if (iCol == -1)
+        // Search by object ID
+    {
+        pPlan->ePlan = FLEXI_DATA_PLAN_ROWID;
+        pPlan->dRows = op == SQLITE_INDEX_CONSTRAINT_EQ ? 1 : dObjCount * FLEXI_DATA_RANGE_SELECTIVITY;
+        pPlan->dCost = _estLog(dObjCount) + pPlan->dRows;
+        return;
+    }
+
+    struct flexi_PropDef_t *prop = &vtab->pProps[iCol];
+    double dPropCount = prop->lNonNullCount > 0 ? (double) prop->lNonNullCount : dObjCount;
+
+    /*
+     * Linear scan goes through the whole [.ref-values] range for the class, also for columns mapped
+     * to [.objects] (A-P): _buildFilterProbes reads values from [.ref-values] for all properties
+     */
+    double dScanCost = dValueCount;
+
+    if (op == SQLITE_INDEX_CONSTRAINT_MATCH)
+    {
+        /*
+         * match_text is evaluated for every value, also for properties with full text index:
+         * [.full_text_data] is not maintained by flexi_data writes, so _buildFilterProbes does not use it
+         */
+        pPlan->bRequired = true;
+        pPlan->dRows = dPropCount * FLEXI_DATA_MATCH_SELECTIVITY;
+        pPlan->ePlan = FLEXI_DATA_PLAN_LINEAR_MATCH;
+        pPlan->dCost = dScanCost * 4;
+        return;
+    }
+
+    if (IS_RANGE_PROPERTY(prop->type))
+    {
+        pPlan->ePlan = FLEXI_DATA_PLAN_RTREE;
+        pPlan->dRows = dObjCount * FLEXI_DATA_RANGE_SELECTIVITY;
+        pPlan->dCost = _estLog(dObjCount) + pPlan->dRows;
+        return;
+    }
+
+    bool bUnique = prop->bUnique || (prop->xCtlv & CTLV_UNIQUE_INDEX);
+    bool bIndexed = bUnique || prop->bIndexed || (prop->xCtlv & CTLV_INDEX);
+
+    if (op == SQLITE_INDEX_CONSTRAINT_EQ)
+    {
+        /*
+         * Values are assumed to be evenly distributed among distinct values (collected by flexi('analyze')).
+         * Range constraints use fixed selectivity, as constraint values are not known at this point
+         */
+        if (bUnique)
+            pPlan->dRows = 1;
+        else
+            pPlan->dRows = prop->lDistinctCount > 0 ? dPropCount / (double) prop->lDistinctCount
+                                                    : dPropCount * FLEXI_DATA_EQ_SELECTIVITY;
+        if (bIndexed)
+        {
+            pPlan->ePlan = FLEXI_DATA_PLAN_INDEX_EQ;
+            pPlan->dCost = _estLog(dPropCount) + pPlan->dRows;
+        }
+        else
+        {
+            pPlan->ePlan = FLEXI_DATA_PLAN_LINEAR_EQ;
+            pPlan->dCost = dScanCost;
+        }
+    }
+    else
+    {
+        pPlan->dRows = dPropCount * FLEXI_DATA_RANGE_SELECTIVITY;
+        if (bIndexed)
+        {
+            pPlan->ePlan = FLEXI_DATA_PLAN_INDEX_RANGE;
+            pPlan->dCost = _estLog(dPropCount) + pPlan->dRows;
+        }
+        else
+        {
+            pPlan->ePlan = FLEXI_DATA_PLAN_LINEAR_RANGE;
+            pPlan->dCost = dScanCost;
+        }
+    }
+
+    if (pPlan->dRows < 1)
+        pPlan->dRows = 1;
+}
+
+/*
+ * Returns true if property has no default value, i.e. objects without value have NULL in property column
+ */
+static bool _hasNoDefault(struct flexi_PropDef_t *prop)
+{
+    return prop->defaultValue == NULL || sqlite3_value_type(prop->defaultValue) == SQLITE_NULL;
+}
+
+static int _compareConstraintPlans(const void *a, const void *b)
+{
+    const _ConstraintPlan_t *pA = a;
+    const _ConstraintPlan_t *pB = b;
+    if (pA->dCost != pB->dCost)
+        return pA->dCost < pB->dCost ? -1 : 1;
+    return (int) pA->ePlan - (int) pB->ePlan;
+}
+
 /*
  * Finds best existing index for the given criteria, based on index definition for class' properties.
  * There are few search strategies. They fall into one of following groups:
@@ -50,44 +250,294 @@ static void setEstimatedRows(sqlite3_index_info *pIdxInfo, sqlite3_int64 nRow)
  * 2) exact value by indexed or unique column (=)
  * 3) lookup in rtree (by set of fields)
  * 4) range search on indexed or unique column (>, <, >=, <=, <>)
- * 5) full text search by text column indexed for FTS
+ * 5) full text search by text column indexed for FTS (not used yet, see _estimateConstraint)
  * 6) linear scan for exact value
  * 7) linear scan for range
  * 8) linear search for MATCH/REGEX/prefixed LIKE
  *
- *  # of scenario corresponds to idxNum value in output
- *  idxNum will have best found determines format of idxStr.
- *  1) idxStr is not used (null)
- *  2-8) idxStr consists of 6 char tuples with op & column index (+1) encoded
- *  into 2 and 4 hex characters respectively
- *  (e.g. "020003" means EQ operator for column #3). Position of every tuple
- *  corresponds to argvIndex, so that tupleIndex = (argvIndex - 1) * 6
+ * Every usable constraint is estimated (using properties' NonNullCount and DistinctCount, index flags and column
+ * mapping) and the cheapest one becomes the driving lookup. Other constraints are added to the lookup (intersected)
+ * only when their cost is lower than cost of checking them by SQLite on the rows already found.
+ * MATCH constraints are always passed to xFilter.
+ *
+ *  # of scenario of the driving lookup corresponds to lower byte of idxNum value in output
+ *  (see FLEXI_DATA_PLAN). Second byte has ordering of results (see FLEXI_DATA_ORDER), if ORDER BY was consumed,
+ *  upper 2 bytes - index of column to order by (+1).
+ *  0) full scan, idxStr is not used (null)
+ *  1-8) idxStr consists of 8 char tuples with op & column index (+1) encoded
+ *  into 2 and 4 hex characters respectively, separated by '|'
+ *  (e.g. " 2|   3|" means EQ operator for column #3). Position of every tuple
+ *  corresponds to argvIndex, so that tupleIndex = (argvIndex - 1) * 8
+ *  Bookmark constraint (bookmark = :bookmark) is not a lookup. If present, it is passed as the last tuple and
+ *  argument, and makes results ordered (by object ID, unless ORDER BY is consumed)
  *   */
 static int _best_index(
         sqlite3_vtab *tab,
         sqlite3_index_info *pIdxInfo
 )
 {
-    int result = SQLITE_OK;
+    int result;
+
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) tab;
+    _ConstraintPlan_t *aPlans = NULL;
+    int nPlans = 0;
+
+    double dObjCount = vtab->lObjectCount > 0 ? (double) vtab->lObjectCount : FLEXI_DATA_DEFAULT_ROW_COUNT;
+    double dValueCount = dObjCount * (vtab->propsByName.count > 0 ? vtab->propsByName.count : 1);
 
+    // Cost of fetching object properties to check constraint or to return row
+    double dRowCost = _estLog(dValueCount) + vtab->propsByName.count;
+
+    double dRows = dObjCount;
+    double dCost = 0;
     int argCount = 0;
 
+    // Number of lookup queries which will be generated by xFilter (rtree constraints share one)
+    int nProbes = 0;
+    FLEXI_DATA_PLAN eDrivingPlan = FLEXI_DATA_PLAN_FULL_SCAN;
+    FLEXI_DATA_ORDER eOrder = FLEXI_DATA_ORDER_NONE;
+    int iOrderCol = -1;
+    bool bRtreeUsed = false;
+    int iBookmarkConstraint = -1;
+    bool bBookmarkUsed = false;
+    int iLimitConstraint = -1;
+    int iOffsetConstraint = -1;
+
     pIdxInfo->idxStr = NULL;
+    pIdxInfo->idxNum = FLEXI_DATA_IDX_NUM(FLEXI_DATA_PLAN_FULL_SCAN, FLEXI_DATA_ORDER_NONE, -1);
+
+    if (pIdxInfo->nConstraint > 0)
+    {
+        CHECK_MALLOC(aPlans, pIdxInfo->nConstraint * sizeof(*aPlans));
+        memset(aPlans, 0, pIdxInfo->nConstraint * sizeof(*aPlans));
+    }
+
     for (int jj = 0; jj < pIdxInfo->nConstraint; jj++)
     {
-        if (pIdxInfo->aConstraint[jj].usable)
+        int iCol = pIdxInfo->aConstraint[jj].iColumn;
+        unsigned char op = pIdxInfo->aConstraint[jj].op;
+        if (iCol == FLEXI_DATA_VTAB_BOOKMARK_COL(vtab) && op == SQLITE_INDEX_CONSTRAINT_EQ
+            && pIdxInfo->aConstraint[jj].usable)
+        {
+            iBookmarkConstraint = jj;
+            continue;
+        }
+
+        if (op == SQLITE_INDEX_CONSTRAINT_LIMIT || op == SQLITE_INDEX_CONSTRAINT_OFFSET)
+        {
+            if (pIdxInfo->aConstraint[jj].usable)
+            {
+                if (op == SQLITE_INDEX_CONSTRAINT_LIMIT)
+                    iLimitConstraint = jj;
+                else iOffsetConstraint = jj;
+            }
+            continue;
+        }
+
+        if (!pIdxInfo->aConstraint[jj].usable || !_isSupportedOp(op) || iCol >= vtab->propsByName.count)
+            continue;
+
+        if (iCol == -1 && op == SQLITE_INDEX_CONSTRAINT_MATCH)
+            continue;
+
+        _ConstraintPlan_t *pPlan = &aPlans[nPlans++];
+        pPlan->iConstraint = jj;
+        _estimateConstraint(vtab, iCol, op, dObjCount, dValueCount, pPlan);
+    }
+
+    if (nPlans > 1)
+        qsort(aPlans, (size_t) nPlans, sizeof(*aPlans), _compareConstraintPlans);
+
+    for (int ii = 0; ii < nPlans; ii++)
+    {
+        _ConstraintPlan_t *pPlan = &aPlans[ii];
+
+        /*
+         * Additional rtree constraints go to the same rtree lookup, so they only
+         * make it more restrictive
+         */
+        bool bFree = bRtreeUsed && pPlan->ePlan == FLEXI_DATA_PLAN_RTREE;
+        if (argCount > 0 && !pPlan->bRequired && !bFree && pPlan->dCost >= dRows * dRowCost)
+            continue;
+
+        pPlan->bUsed = true;
+        if (!bFree)
+        {
+            dCost += pPlan->dCost;
+            nProbes++;
+        }
+        if (argCount == 0)
+        {
+            eDrivingPlan = pPlan->ePlan;
+            dRows = pPlan->dRows;
+        }
+        else
+        {
+            dRows *= pPlan->dRows / dObjCount;
+        }
+        if (pPlan->ePlan == FLEXI_DATA_PLAN_RTREE)
+            bRtreeUsed = true;
+
+        int iCol = pIdxInfo->aConstraint[pPlan->iConstraint].iColumn;
+        unsigned char op = pIdxInfo->aConstraint[pPlan->iConstraint].op;
+        pIdxInfo->aConstraintUsage[pPlan->iConstraint].argvIndex = ++argCount;
+
+        // Object ID lookup is exact. MATCH is not evaluated by SQLite anyway
+        pIdxInfo->aConstraintUsage[pPlan->iConstraint].omit =
+                (unsigned char) (iCol == -1 || op == SQLITE_INDEX_CONSTRAINT_MATCH);
+
+        void *pTmp = pIdxInfo->idxStr;
+        pIdxInfo->idxStr = sqlite3_mprintf("%s%2X|%4X|", pTmp, op, iCol + 1);
+        sqlite3_free(pTmp);
+        CHECK_NULL(pIdxInfo->idxStr);
+        pIdxInfo->needToFreeIdxStr = 1;
+    }
+
+    if (argCount == 0)
+    {
+        // Full scan of class objects
+        dCost = dObjCount;
+    }
+
+    if (dRows < 1)
+        dRows = 1;
+
+    /*
+     * ORDER BY on single column can be consumed:
+     * - by object ID
+     * - by indexed property which is the only lookup constraint: lookup is sorted by value
+     * - by indexed property without default value, when there are no lookup constraints: class scan is replaced
+     * with scan of value index, so that first rows are returned without reading entire class
+     * - by any other property, when there is single lookup: found objects are ordered via heap by values of this
+     * property only, so that properties are loaded only for objects actually read by SQLite (LIMIT/OFFSET)
+     * Ordering by range properties is left to SQLite
+     */
+    if (pIdxInfo->nOrderBy == 1)
+    {
+        int iCol = pIdxInfo->aOrderBy[0].iColumn;
+        bool bDesc = pIdxInfo->aOrderBy[0].desc != 0;
+        if (iCol == -1)
+        {
+            eOrder = bDesc ? FLEXI_DATA_ORDER_BY_ID_DESC : FLEXI_DATA_ORDER_BY_ID;
+
+            // Full scan and object ID lookups return objects in ID order. Others require sorting
+            if (eDrivingPlan != FLEXI_DATA_PLAN_FULL_SCAN && eDrivingPlan != FLEXI_DATA_PLAN_ROWID)
+                dCost += dRows * _estLog(dRows);
+        }
+        else
+            if (iCol >= 0 && iCol < vtab->propsByName.count && !IS_RANGE_PROPERTY(vtab->pProps[iCol].type))
+            {
+                struct flexi_PropDef_t *pOrderProp = &vtab->pProps[iCol];
+
+                if (argCount == 1 && (eDrivingPlan == FLEXI_DATA_PLAN_INDEX_EQ
+                                      || eDrivingPlan == FLEXI_DATA_PLAN_INDEX_RANGE))
+                {
+                    for (int ii = 0; ii < nPlans; ii++)
+                    {
+                        if (aPlans[ii].bUsed
+                            && pIdxInfo->aConstraint[aPlans[ii].iConstraint].iColumn == iCol)
+                        {
+                            eOrder = bDesc ? FLEXI_DATA_ORDER_BY_VALUE_DESC : FLEXI_DATA_ORDER_BY_VALUE;
+                            break;
+                        }
+                    }
+                }
+
+                if (eOrder == FLEXI_DATA_ORDER_NONE && argCount == 0
+                    && (pOrderProp->bIndexed || pOrderProp->bUnique) && _hasNoDefault(pOrderProp))
+                {
+                    eOrder = bDesc ? FLEXI_DATA_ORDER_BY_INDEX_DESC : FLEXI_DATA_ORDER_BY_INDEX;
+
+                    // Objects without value are found by primary key of [.ref-values]
+                    dCost += dObjCount * _estLog(dValueCount) / 2;
+                }
+
+                if (eOrder == FLEXI_DATA_ORDER_NONE && nProbes <= 1)
+                {
+                    eOrder = bDesc ? FLEXI_DATA_ORDER_BY_HEAP_DESC : FLEXI_DATA_ORDER_BY_HEAP;
+
+                    // Sort key lookup for every found object, heap build and selection
+                    dCost += dRows * (_estLog(dValueCount) + 1);
+                }
+
+                if (eOrder != FLEXI_DATA_ORDER_NONE)
+                    iOrderCol = iCol;
+            }
+    }
+
+    pIdxInfo->orderByConsumed = eOrder != FLEXI_DATA_ORDER_NONE;
+
+    /*
+     * Bookmark is position in ordered results, so results with bookmark must be ordered. Paging by bookmark
+     * requires ORDER BY to be consumed here (or to be omitted): otherwise position is taken in object ID
+     * order, while SQLite returns rows sorted by something else
+     */
+    bBookmarkUsed = iBookmarkConstraint >= 0;
+#if SQLITE_VERSION_NUMBER >= 3010000
+    // Bit 63 of colUsed stands for all columns starting from 63
+    if (pIdxInfo->colUsed & ((sqlite3_uint64) 1 << (FLEXI_DATA_VTAB_BOOKMARK_COL(vtab) < 63
+                                                    ? FLEXI_DATA_VTAB_BOOKMARK_COL(vtab) : 63)))
+        bBookmarkUsed = true;
+#endif
+    if (bBookmarkUsed && eOrder == FLEXI_DATA_ORDER_NONE)
+    {
+        eOrder = FLEXI_DATA_ORDER_BY_ID;
+        if (eDrivingPlan != FLEXI_DATA_PLAN_FULL_SCAN && eDrivingPlan != FLEXI_DATA_PLAN_ROWID)
+            dCost += dRows * _estLog(dRows);
+    }
+
+    /*
+     * Heap keeps only LIMIT + OFFSET first objects. LIMIT and OFFSET are not omitted, SQLite still applies them
+     * to returned rows. They are passed after lookups, before bookmark
+     */
+    if ((eOrder == FLEXI_DATA_ORDER_BY_HEAP || eOrder == FLEXI_DATA_ORDER_BY_HEAP_DESC) && iLimitConstraint >= 0)
+    {
+        int aPaging[] = {iLimitConstraint, iOffsetConstraint};
+        for (int ii = 0; ii < ARRAY_LEN(aPaging) && aPaging[ii] >= 0; ii++)
         {
-            pIdxInfo->aConstraintUsage[jj].argvIndex = ++argCount;
+            pIdxInfo->aConstraintUsage[aPaging[ii]].argvIndex = ++argCount;
+
             void *pTmp = pIdxInfo->idxStr;
-            pIdxInfo->idxStr = sqlite3_mprintf("%s%2X|%4X|", pTmp, pIdxInfo->aConstraint[jj].op,
-                                               pIdxInfo->aConstraint[jj].iColumn + 1);
-            pIdxInfo->needToFreeIdxStr = 1;
-            pIdxInfo->idxNum = 1; // TODO
+            pIdxInfo->idxStr = sqlite3_mprintf("%s%2X|%4X|", pTmp, pIdxInfo->aConstraint[aPaging[ii]].op, 0);
             sqlite3_free(pTmp);
-            pIdxInfo->estimatedCost = 0; // TODO
+            CHECK_NULL(pIdxInfo->idxStr);
+            pIdxInfo->needToFreeIdxStr = 1;
         }
     }
 
+    if (iBookmarkConstraint >= 0)
+    {
+        pIdxInfo->aConstraintUsage[iBookmarkConstraint].argvIndex = ++argCount;
+        pIdxInfo->aConstraintUsage[iBookmarkConstraint].omit = 1;
+
+        void *pTmp = pIdxInfo->idxStr;
+        pIdxInfo->idxStr = sqlite3_mprintf("%s%2X|%4X|", pTmp, SQLITE_INDEX_CONSTRAINT_EQ,
+                                           FLEXI_DATA_VTAB_BOOKMARK_COL(vtab) + 1);
+        sqlite3_free(pTmp);
+        CHECK_NULL(pIdxInfo->idxStr);
+        pIdxInfo->needToFreeIdxStr = 1;
+
+        /*
+         * Scan starts from bookmark position. Besides, plan must win over plan without bookmark constraint,
+         * as SQLite would compare bookmarks itself then
+         */
+        dCost /= 2;
+        dRows /= 2;
+        if (dRows < 1)
+            dRows = 1;
+    }
+
+    pIdxInfo->idxNum = FLEXI_DATA_IDX_NUM(eDrivingPlan, eOrder, iOrderCol);
+    pIdxInfo->estimatedCost = dCost + dRows * dRowCost;
+    setEstimatedRows(pIdxInfo, (sqlite3_int64) dRows);
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    sqlite3_free(aPlans);
     return result;
 }
 
@@ -119,25 +569,63 @@ static int _open(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor)
 
     cur->iEof = -1;
     cur->lObjectID = -1;
-
-    const char *zPropSql = "select ObjectID, PropertyID, PropIndex, ctlv, [Value] from [.ref-values] "
-            "where ObjectID = :1 order by ObjectID, PropertyID, PropIndex;";
-
-    // TODO
-    //    CHECK_STMT_PREPARE(vtab->pCtx->db, zPropSql, &cur->pPropertyIterator);
+    IdSet_init(&cur->ids);
+    KeyHeap_init(&cur->heap, false);
+    Arena_init(&cur->batchArena);
+
+    int nCols = vtab->propsByName.count > 0 ? vtab->propsByName.count : 1;
+    CHECK_MALLOC(cur->aBatchIds, FLEXI_DATA_BATCH_SIZE * sizeof(*cur->aBatchIds));
+    CHECK_MALLOC(cur->aBatchIndex, FLEXI_DATA_BATCH_SIZE * sizeof(*cur->aBatchIndex));
+    CHECK_MALLOC(cur->pCols, nCols * FLEXI_DATA_BATCH_SIZE * sizeof(*cur->pCols));
+    memset(cur->pCols, 0, nCols * FLEXI_DATA_BATCH_SIZE * sizeof(*cur->pCols));
+
+    /*
+     * Properties for the whole batch of objects are loaded by one statement:
+     * select ObjectID, PropertyID, PropIndex, ctlv, [Value] from [.ref-values]
+     * where ObjectID in (:1, :2, ... :FLEXI_DATA_BATCH_SIZE) order by ObjectID, PropertyID, PropIndex;
+     */
+    StringBuilder_t sbPropSql;
+    StringBuilder_init(&sbPropSql);
+    StringBuilder_appendRaw(&sbPropSql, "select ObjectID, PropertyID, PropIndex, ctlv, [Value] from [.ref-values] "
+            "where ObjectID in (", -1);
+    for (int ii = 1; ii <= FLEXI_DATA_BATCH_SIZE; ii++)
+    {
+        char zParam[16];
+        sqlite3_snprintf(sizeof(zParam), zParam, ii == 1 ? ":%d" : ", :%d", ii);
+        StringBuilder_appendRaw(&sbPropSql, zParam, -1);
+    }
+    StringBuilder_appendRaw(&sbPropSql, ") order by ObjectID, PropertyID, PropIndex;", -1);
+    if (sbPropSql.bErr)
+    {
+        StringBuilder_clear(&sbPropSql);
+        result = SQLITE_NOMEM;
+        goto ONERROR;
+    }
+    result = sqlite3_prepare_v2(vtab->pCtx->db, sbPropSql.zBuf, -1, &cur->pPropertyIterator, NULL);
+    StringBuilder_clear(&sbPropSql);
+    if (result != SQLITE_OK)
+        goto ONERROR;
 
     result = SQLITE_OK;
     goto EXIT;
 
     ONERROR:
     printf("%s", sqlite3_errmsg(vtab->pCtx->db));
+    if (cur != NULL)
+    {
+        sqlite3_free(cur->aBatchIds);
+        sqlite3_free(cur->aBatchIndex);
+        sqlite3_free(cur->pCols);
+        sqlite3_free(cur);
+        *ppCursor = NULL;
+    }
 
     EXIT:
     return result;
 }
 
 /*
- * Cleans up column values left after last Next/Column calls.
+ * Cleans up column values left after last batch.
  * Return 1 if cur->pCols is not null.
  * Otherwise, 0
  */
@@ -148,12 +636,9 @@ int flexi_free_cursor_values(struct flexi_VTabCursor *cur)
         struct flexi_ClassDef_t *vtab = (void *) cur->base.pVtab;
         for (int ii = 0; ii < vtab->propsByName.count; ii++)
         {
-            if (cur->pCols[ii] != NULL)
-            {
-                sqlite3_value_free(cur->pCols[ii]);
-                cur->pCols[ii] = NULL;
-            }
+            memset(&cur->pCols[ii * FLEXI_DATA_BATCH_SIZE], 0, cur->nBatchCount * sizeof(*cur->pCols));
         }
+        Arena_reset(&cur->batchArena);
 
         return 1;
     }
@@ -161,254 +646,1121 @@ int flexi_free_cursor_values(struct flexi_VTabCursor *cur)
     return 0;
 }
 
+/*
+ * Returns cursor's object iterator back to the probe of the plan it was borrowed from, so that
+ * next xFilter with the same plan can reuse prepared statement.
+ * If probe already has spare statement (e.g. the same plan was used by multiple cursors), iterator is finalized
+ */
+static void _returnProbeStmt(struct flexi_VTabCursor *cur)
+{
+    if (cur->pObjectIterator != NULL)
+    {
+        if (cur->pPlan != NULL && cur->pPlan->aProbes[cur->iProbe].pStmt == NULL)
+        {
+            sqlite3_reset(cur->pObjectIterator);
+            sqlite3_clear_bindings(cur->pObjectIterator);
+            cur->pPlan->aProbes[cur->iProbe].pStmt = cur->pObjectIterator;
+        }
+        else sqlite3_finalize(cur->pObjectIterator);
+
+        cur->pObjectIterator = NULL;
+    }
+}
 
-int flexi_VTabCursor_free(struct flexi_VTabCursor *cur)
+/*
+ * Returns cursor's object iterator back to the plan (see _returnProbeStmt).
+ * Also releases IDs collected by multi-probe plan or by heap
+ */
+static void _releaseObjectIterator(struct flexi_VTabCursor *cur)
 {
+    _returnProbeStmt(cur);
+    cur->pPlan = NULL;
+    cur->iProbe = 0;
+    IdSet_clear(&cur->ids);
+    KeyHeap_clear(&cur->heap);
+    cur->heap.pAfter = NULL;
+    cur->heap.nLimit = 0;
+    cur->bHeap = false;
+    flexi_Bookmark_clear(&cur->bookmark);
+
     flexi_free_cursor_values(cur);
+    cur->nBatchCount = 0;
+    cur->iBatchPos = 0;
+    cur->bObjectsDone = false;
+    cur->bBatchLoaded = false;
+}
+
+void flexi_FilterPlan_free(struct flexi_FilterPlan_t *pPlan)
+{
+    if (pPlan != NULL)
+    {
+        if (pPlan->aProbes != NULL)
+        {
+            for (int ii = 0; ii < pPlan->nProbes; ii++)
+            {
+                sqlite3_finalize(pPlan->aProbes[ii].pStmt);
+                sqlite3_free(pPlan->aProbes[ii].zSQL);
+            }
+            sqlite3_free(pPlan->aProbes);
+        }
+        sqlite3_free(pPlan);
+    }
+}
+
+int flexi_VTabCursor_free(struct flexi_VTabCursor *cur)
+{
+    _releaseObjectIterator(cur);
+    Arena_clear(&cur->batchArena);
+    sqlite3_free(cur->aBatchIds);
+    sqlite3_free(cur->aBatchIndex);
     sqlite3_free(cur->pCols);
 
-    sqlite3_finalize(cur->pObjectIterator);
+    sqlite3_finalize(cur->pPropertyIterator);
+    sqlite3_free(cur);
+    return SQLITE_OK;
+}
+
+/*
+ * Finishes SELECT
+ */
+static int _close(sqlite3_vtab_cursor *pCursor)
+{
+    struct flexi_VTabCursor *cur = (void *) pCursor;
+    return flexi_VTabCursor_free(cur);
+
+}
+
+static int _borrowProbeStmt(struct flexi_ClassDef_t *vtab, flexi_FilterProbe_t *pProbe, sqlite3_stmt **ppStmt);
+
+static int _bindScanParams(struct flexi_VTabCursor *cur, sqlite3_stmt *pStmt);
+
+/*
+ * Gets next object ID from filter results: from heap, from object iterator
+ * or from IDs found by multi-probe plan. When object iterator of concatenated plan is done,
+ * iteration continues with the next probe.
+ * Returns SQLITE_ROW, SQLITE_DONE or error code
+ */
+static int _nextObjectID(struct flexi_VTabCursor *cur, sqlite3_int64 *plObjectID)
+{
+    int result;
+    if (cur->bHeap)
+        result = KeyHeap_pop(&cur->heap, plObjectID) ? SQLITE_ROW : SQLITE_DONE;
+    else
+        if (cur->pObjectIterator != NULL)
+        {
+            result = sqlite3_step(cur->pObjectIterator);
+            while (result == SQLITE_DONE && cur->pPlan->bConcat && cur->iProbe + 1 < cur->pPlan->nProbes)
+            {
+                struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) cur->base.pVtab;
+                int iNext = cur->iProbe + 1;
+                _returnProbeStmt(cur);
+                result = _borrowProbeStmt(vtab, &cur->pPlan->aProbes[iNext], &cur->pObjectIterator);
+                if (result != SQLITE_OK)
+                    return result;
+                cur->iProbe = iNext;
+
+                // Probes of concatenated plan scan entire class
+                result = _bindScanParams(cur, cur->pObjectIterator);
+                if (result != SQLITE_OK)
+                    return result;
+                result = sqlite3_step(cur->pObjectIterator);
+            }
+            if (result == SQLITE_ROW)
+                *plObjectID = sqlite3_column_int64(cur->pObjectIterator, 0);
+        }
+        else
+            result = IdSet_next(&cur->idsIter, plObjectID) ? SQLITE_ROW : SQLITE_DONE;
+    return result;
+}
+
+static int _compareBatchIndex(const void *p1, const void *p2)
+{
+    sqlite3_int64 l1 = ((const struct flexi_BatchIndex_t *) p1)->lObjectID;
+    sqlite3_int64 l2 = ((const struct flexi_BatchIndex_t *) p2)->lObjectID;
+    return l1 < l2 ? -1 : (l1 > l2 ? 1 : 0);
+}
+
+/*
+ * Finds column index by property ID. Column properties (pProps) are sorted by property ID.
+ * Returns -1 if property is not mapped to column
+ */
+static int _findColumnByPropID(struct flexi_ClassDef_t *vtab, sqlite3_int64 lPropID)
+{
+    int iLo = 0;
+    int iHi = vtab->propsByName.count - 1;
+    while (iLo <= iHi)
+    {
+        int iMid = (iLo + iHi) / 2;
+        if (vtab->pProps[iMid].iPropID == lPropID)
+            return iMid;
+        if (vtab->pProps[iMid].iPropID < lPropID)
+            iLo = iMid + 1;
+        else iHi = iMid - 1;
+    }
+    return -1;
+}
+
+/*
+ * Copies value of column iCol of property iterator to pValue. Text and blob data are copied to batch arena
+ */
+static int _readBatchValue(struct flexi_VTabCursor *cur, int iCol, flexi_ObjValue_t *pValue)
+{
+    sqlite3_stmt *pStmt = cur->pPropertyIterator;
+    pValue->iType = sqlite3_column_type(pStmt, iCol);
+    switch (pValue->iType)
+    {
+        case SQLITE_INTEGER:
+            pValue->v.i = sqlite3_column_int64(pStmt, iCol);
+            break;
+
+        case SQLITE_FLOAT:
+            pValue->v.d = sqlite3_column_double(pStmt, iCol);
+            break;
+
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+        {
+            const void *pData = pValue->iType == SQLITE_TEXT ? (const void *) sqlite3_column_text(pStmt, iCol)
+                                                             : sqlite3_column_blob(pStmt, iCol);
+            pValue->nBytes = sqlite3_column_bytes(pStmt, iCol);
+            pValue->v.z = Arena_dup(&cur->batchArena, pData, (u32) pValue->nBytes, pValue->iType == SQLITE_TEXT);
+            if (pValue->v.z == NULL)
+                return SQLITE_NOMEM;
+            break;
+        }
+
+        default:
+            pValue->iType = SQLITE_NULL;
+            break;
+    }
+
+    return SQLITE_OK;
+}
+
+/*
+ * Prefetches next batch of up to FLEXI_DATA_BATCH_SIZE object IDs. Properties of batch are loaded
+ * later, on first column request (see _loadBatchProps).
+ * cur->nBatchCount is set to 0 when there are no more objects
+ */
+static int _loadBatch(struct flexi_VTabCursor *cur)
+{
+    int result;
+
+    flexi_free_cursor_values(cur);
+    cur->nBatchCount = 0;
+    cur->iBatchPos = 0;
+    cur->bBatchLoaded = false;
+
+    while (cur->nBatchCount < FLEXI_DATA_BATCH_SIZE)
+    {
+        sqlite3_int64 lObjectID;
+        result = _nextObjectID(cur, &lObjectID);
+        if (result == SQLITE_DONE)
+        {
+            // Object iterator must not be stepped after it is done, as it would restart
+            cur->bObjectsDone = true;
+            break;
+        }
+        if (result != SQLITE_ROW)
+            goto ONERROR;
+
+        cur->aBatchIds[cur->nBatchCount] = lObjectID;
+        cur->aBatchIndex[cur->nBatchCount].lObjectID = lObjectID;
+        cur->aBatchIndex[cur->nBatchCount].iBatchPos = cur->nBatchCount;
+        cur->nBatchCount++;
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Loads properties of all objects in current batch in one ordered [.ref-values] scan into
+ * columnar buffer (cur->pCols).
+ * Objects in batch keep filter order, so properties (ordered by ObjectID) are merged via
+ * batch index sorted by object ID
+ */
+static int _loadBatchProps(struct flexi_VTabCursor *cur)
+{
+    int result;
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) cur->base.pVtab;
+
+    // Position in aBatchIndex, for merging with properties
+    int iIndex = 0;
+
+    cur->bBatchLoaded = true;
+    if (cur->nBatchCount == 0 || vtab->propsByName.count == 0)
+    {
+        result = SQLITE_OK;
+        goto EXIT;
+    }
+
+    qsort(cur->aBatchIndex, (size_t) cur->nBatchCount, sizeof(*cur->aBatchIndex), _compareBatchIndex);
+
+    CHECK_CALL(sqlite3_reset(cur->pPropertyIterator));
+    CHECK_CALL(sqlite3_clear_bindings(cur->pPropertyIterator));
+    for (int ii = 0; ii < cur->nBatchCount; ii++)
+    {
+        CHECK_CALL(sqlite3_bind_int64(cur->pPropertyIterator, ii + 1, cur->aBatchIds[ii]));
+    }
+
+    while ((result = sqlite3_step(cur->pPropertyIterator)) == SQLITE_ROW)
+    {
+        sqlite3_int64 lObjectID = sqlite3_column_int64(cur->pPropertyIterator, 0);
+        while (iIndex < cur->nBatchCount && cur->aBatchIndex[iIndex].lObjectID < lObjectID)
+            iIndex++;
+        if (iIndex >= cur->nBatchCount)
+            break;
+
+        int iCol = _findColumnByPropID(vtab, sqlite3_column_int64(cur->pPropertyIterator, 1));
+        if (iCol < 0)
+            continue;
+
+        // The same object may appear in batch more than once
+        for (int jj = iIndex; jj < cur->nBatchCount && cur->aBatchIndex[jj].lObjectID == lObjectID; jj++)
+        {
+            flexi_ObjValue_t *pValue = &cur->pCols[iCol * FLEXI_DATA_BATCH_SIZE + cur->aBatchIndex[jj].iBatchPos];
+
+            // Rows are ordered by PropIndex, so only first value of property is taken
+            if (pValue->iType == 0)
+            {
+                CHECK_CALL(_readBatchValue(cur, 4, pValue));
+            }
+        }
+    }
+    if (result != SQLITE_ROW && result != SQLITE_DONE)
+        goto ONERROR;
+
+    sqlite3_reset(cur->pPropertyIterator);
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    sqlite3_reset(cur->pPropertyIterator);
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Advances to the next found object. Objects are fetched in batches
+ */
+static int _next(sqlite3_vtab_cursor *pCursor)
+{
+    int result;
+    struct flexi_VTabCursor *cur = (void *) pCursor;
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) cur->base.pVtab;
+
+    if (cur->iEof == 1)
+    {
+        result = SQLITE_OK;
+        goto EXIT;
+    }
+
+    if (cur->iEof == -1 || ++cur->iBatchPos >= cur->nBatchCount)
+    {
+        if (!cur->bObjectsDone)
+        {
+            CHECK_CALL(_loadBatch(cur));
+        }
+        else
+        {
+            flexi_free_cursor_values(cur);
+            cur->nBatchCount = 0;
+        }
+    }
+
+    if (cur->nBatchCount == 0)
+    {
+        cur->iEof = 1;
+    }
+    else
+    {
+        cur->iEof = 0;
+        cur->lObjectID = cur->aBatchIds[cur->iBatchPos];
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+    ONERROR:
+    {
+        // Release resources because of errors (catch)
+        printf("%s", sqlite3_errmsg(vtab->pCtx->db));
+    }
+    EXIT:
+    return result;
+}
+
+/*
+ * Returns true if the last constraint passed to xFilter is bookmark (see _best_index)
+ */
+static bool _hasBookmarkArg(struct flexi_ClassDef_t *vtab, const char *idxStr, int argc)
+{
+    int op;
+    int colIdx;
+    if (argc == 0 || idxStr == NULL)
+        return false;
+    sscanf(idxStr + (argc - 1) * 8, "%2X|%4X|", &op, &colIdx);
+    return colIdx - 1 == FLEXI_DATA_VTAB_BOOKMARK_COL(vtab);
+}
+
+/*
+ * Finds LIMIT and OFFSET arguments, which follow lookups among the first nArgs arguments (see _best_index).
+ * Returns number of these arguments. If argv is passed, *pnRows gets number of objects to be read from heap
+ * (LIMIT + OFFSET), or 0 if it is not limited
+ */
+static int _getPagingArgs(const char *idxStr, int nArgs, sqlite3_value **argv, u32 *pnRows)
+{
+    int nPaging = 0;
+    sqlite3_int64 lLimit = -1;
+    sqlite3_int64 lOffset = 0;
+
+    for (int ii = nArgs - 1; ii >= 0 && idxStr != NULL; ii--)
+    {
+        int op;
+        int colIdx;
+        sscanf(idxStr + ii * 8, "%2X|%4X|", &op, &colIdx);
+        if (op != SQLITE_INDEX_CONSTRAINT_LIMIT && op != SQLITE_INDEX_CONSTRAINT_OFFSET)
+            break;
+
+        nPaging++;
+        if (argv != NULL)
+        {
+            if (op == SQLITE_INDEX_CONSTRAINT_LIMIT)
+                lLimit = sqlite3_value_int64(argv[ii]);
+            else lOffset = sqlite3_value_int64(argv[ii]);
+        }
+    }
+
+    if (pnRows != NULL)
+    {
+        if (lOffset < 0)
+            lOffset = 0;
+        *pnRows = lLimit > 0 && lLimit + lOffset < UINT32_MAX ? (u32) (lLimit + lOffset) : 0;
+    }
+
+    return nPaging;
+}
+
+/*
+ * Generates dynamic SQL to find list of object IDs. Result is returned in pPlan->aProbes.
+ * Lower byte of idxNum is search strategy (FLEXI_DATA_PLAN). When it is not full scan, idxStr will have
+ * constraints selected by xBestIndex, ordered by their estimated cost. Second byte of idxNum defines
+ * ordering (FLEXI_DATA_ORDER).
+ * Every constraint gets its own lookup query (probe), except rtree constraints which are combined into
+ * one probe:
+ * 1. Unique index: select ObjectID from [.ref-values] where PropertyID = :1 and Value OP :2 and ctlv =
+ * 2. Index: select ObjectID from [.ref-values] where PropertyID = :1 and Value OP :2 and ctlv =
+ * 3. Linear scan without index:
+ * select ObjectID from [.ref-values] where PropertyID = :1 and Value OP :2
+ * 4. Match, by linear scan (see _estimateConstraint):
+ * select ObjectID from [.ref-values] where PropertyID = :1 and match_text(:2, Value)
+ * 5. Search by rtree:
+ * select id from [.range_data] where ClassID = :1 and A0 OP :2 and A1 OP :3 and...
+ *
+ * Parameter names in probes match positions of argv passed to xFilter (:1 for argv[0] and so on).
+ * If there is only one probe, it will be streamed by cursor directly, and gets ORDER BY clause.
+ * Otherwise, results of probes are intersected in memory (see _filter).
+ *
+ * Ordering by property value (upper 2 bytes of idxNum have ordering column):
+ * 1. Full scan ordered by indexed property is replaced with 2 probes streamed one after another: scan of
+ * the property's value index and scan of objects which do not have indexed value (NULLs go first in ascending order)
+ * 2. Ordering via heap: single probe is wrapped to return sort key (first value of property, as
+ * returned by xColumn) together with object ID
+ * Objects with equal values are ordered by object ID, in the same direction.
+ *
+ * If the last constraint is bookmark, probes get condition to continue after bookmark position
+ * (see _bindBookmark): ObjectID > :bmID when ordered by object ID, ([Value], ObjectID) > (:bmValue, :bmValueID)
+ * when ordered by value, ObjectID > :bmNullID for objects without value (< for descending order).
+ * These conditions match order of probes, so that scan starts with index seek.
+ * Heap applies bookmark itself, when it is filled
+ */
+static int _buildFilterProbes(struct flexi_ClassDef_t *vtab, int idxNum, const char *idxStr, int argc,
+                              struct flexi_FilterPlan_t *pPlan)
+{
+    static char *range_columns[] = {"A0", "A1", "B0", "B1", "C0", "C1", "D0", "D1"};
+
+    int result;
+
+    // Subquery for [.range_data]
+    char *zRangeSQL = NULL;
+
+    // Ordering by index and by heap is not done by ORDER BY clause of probe
+    static const char *order_clauses[] = {"", " order by 1", " order by 1 desc", " order by [Value], 1",
+                                          " order by [Value] desc, 1 desc", "", "", "", ""};
+    FLEXI_DATA_ORDER eOrder = FLEXI_DATA_IDX_ORDER(idxNum);
+    int iOrderCol = FLEXI_DATA_IDX_ORDER_COL(idxNum);
+    assert(eOrder < ARRAY_LEN(order_clauses));
+
+    // Bookmark, LIMIT and OFFSET are not lookups
+    bool bBookmark = _hasBookmarkArg(vtab, idxStr, argc);
+    int nLookups = bBookmark ? argc - 1 : argc;
+    nLookups -= _getPagingArgs(idxStr, nLookups, NULL, NULL);
+
+    // Condition to continue after bookmark, for probes which are not ordered by value
+    const char *zIdResume = "";
+    if (bBookmark && eOrder == FLEXI_DATA_ORDER_BY_ID)
+        zIdResume = " and ObjectID > :bmID";
+    else
+        if (bBookmark && eOrder == FLEXI_DATA_ORDER_BY_ID_DESC)
+            zIdResume = " and ObjectID < :bmID";
+
+    // Number of probes never exceeds number of constraints, except ordered scan of index
+    int nAlloc = nLookups > 2 ? nLookups : 2;
+    CHECK_MALLOC(pPlan->aProbes, nAlloc * sizeof(flexi_FilterProbe_t));
+    memset(pPlan->aProbes, 0, nAlloc * sizeof(flexi_FilterProbe_t));
+    pPlan->nProbes = 0;
+
+    if (eOrder == FLEXI_DATA_ORDER_BY_INDEX || eOrder == FLEXI_DATA_ORDER_BY_INDEX_DESC)
+        // Full scan ordered by value index
+    {
+        assert(iOrderCol >= 0 && iOrderCol < vtab->propsByName.count);
+        struct flexi_PropDef_t *prop = &vtab->pProps[iOrderCol];
+        bool bDesc = eOrder == FLEXI_DATA_ORDER_BY_INDEX_DESC;
+
+        // Term (ctlv & mask) matches WHERE clause of partial index, so that SQLite can use it
+        int iFlag = prop->bIndexed ? CTLV_INDEX : CTLV_UNIQUE_INDEX;
+        const char *zDesc = bDesc ? " desc" : "";
+        char *zValuesSQL = sqlite3_mprintf("select ObjectID from [.ref-values] where [PropertyID] = %lld "
+                                                   "and [PropIndex] = 0 and ([ctlv] & %s) and (ctlv & %d) = %d%s "
+                                                   "order by [Value]%s, ObjectID%s",
+                                           prop->iPropID, prop->bIndexed ? "0xF0" : "8", iFlag, iFlag,
+                                           !bBookmark ? "" : (bDesc ? " and ([Value], ObjectID) < (:bmValue, :bmValueID)"
+                                                                    : " and ([Value], ObjectID) > (:bmValue, :bmValueID)"),
+                                           zDesc, zDesc);
+        CHECK_NULL(zValuesSQL);
+        pPlan->aProbes[bDesc ? 0 : 1].zSQL = zValuesSQL;
+
+        char *zNullsSQL = sqlite3_mprintf("select ObjectID from [.objects] o where ClassID = :1%s and not exists "
+                                                  "(select 1 from [.ref-values] v where v.ObjectID = o.ObjectID "
+                                                  "and v.PropertyID = %lld and v.PropIndex = 0 and (v.ctlv & %d) = %d) "
+                                                  "order by ObjectID%s",
+                                          !bBookmark ? "" : (bDesc ? " and ObjectID < :bmNullID"
+                                                                   : " and ObjectID > :bmNullID"),
+                                          prop->iPropID, iFlag, iFlag, zDesc);
+        CHECK_NULL(zNullsSQL);
+        pPlan->aProbes[bDesc ? 1 : 0].zSQL = zNullsSQL;
+
+        pPlan->nProbes = 2;
+        pPlan->bConcat = true;
+    }
+    else
+        if (FLEXI_DATA_IDX_PLAN(idxNum) == FLEXI_DATA_PLAN_FULL_SCAN || nLookups == 0)
+            // No special index used. Apply linear scan
+        {
+            char *zSQL = sqlite3_mprintf("select ObjectID from [.objects] where ClassID = :1%s%s",
+                                         zIdResume, order_clauses[eOrder]);
+            CHECK_NULL(zSQL);
+            pPlan->aProbes[pPlan->nProbes++].zSQL = zSQL;
+        }
+    else
+    {
+        assert(argc * 8 == strlen(idxStr));
+
+        const char *zIdxTuple = idxStr;
+        for (int i = 0; i < nLookups; i++)
+        {
+            int op;
+            int colIdx;
+            char *zSQL = NULL;
+            sscanf(zIdxTuple, "%2X|%4X|", &op, &colIdx);
+            colIdx--;
+            zIdxTuple += 8;
+
+            assert(colIdx >= -1 && colIdx < vtab->propsByName.count);
+
+            char *zOp;
+            switch (op)
+            {
+                case SQLITE_INDEX_CONSTRAINT_EQ:
+                    zOp = "=";
+                    break;
+                case SQLITE_INDEX_CONSTRAINT_GT:
+                    zOp = ">";
+                    break;
+                case SQLITE_INDEX_CONSTRAINT_LE:
+                    zOp = "<=";
+                    break;
+                case SQLITE_INDEX_CONSTRAINT_LT:
+                    zOp = "<";
+                    break;
+                case SQLITE_INDEX_CONSTRAINT_GE:
+                    zOp = ">=";
+                    break;
+                default:
+                    assert(op == SQLITE_INDEX_CONSTRAINT_MATCH);
+                    zOp = "match";
+                    break;
+            }
+
+            if (colIdx == -1)
+                // Search by rowid / ObjectID
+            {
+                zSQL = sqlite3_mprintf(
+                        "select ObjectID from [.objects] where ObjectID %s :%d and ClassID = %lld",
+                        zOp, i + 1, vtab->lClassID);
+            }
+            else
+            {
+                struct flexi_PropDef_t *prop = &vtab->pProps[colIdx];
+                if (IS_RANGE_PROPERTY(prop->type))
+                    // Special case: range data request. Collected into single rtree probe
+                {
+                    assert(prop->cRangeColumn > 0);
+
+                    if (zRangeSQL == NULL)
+                    {
+                        zRangeSQL = sqlite3_mprintf(
+                                "select id as ObjectID from [.range_data] where ClassID0 = %lld and ClassID1 = %lld ",
+                                vtab->lClassID, vtab->lClassID);
+                    }
+                    void *pTmp = zRangeSQL;
+                    zRangeSQL = sqlite3_mprintf("%s and %s %s :%d", pTmp, range_columns[prop->cRangeColumn - 1],
+                                                zOp, i + 1);
+                    sqlite3_free(pTmp);
+                    CHECK_NULL(zRangeSQL);
+                    continue;
+                }
+
+                // Normal column
+                // TODO Generate lookup on [.full_text_data] for MATCH on FTS indexed properties, once
+                // flexi_data writes maintain it. Until then, full text search is linear match (and costed so)
+                if (op != SQLITE_INDEX_CONSTRAINT_MATCH)
+                {
+                    /*
+                     * Lookup sorted by value continues after bookmark by index seek. Bound of lookup
+                     * in the direction of ordering is hidden from index (unary +), so that seek is done
+                     * by bookmark position. All values found by equality are the same, so it continues by object ID
+                     */
+                    const char *zValue = "[Value]";
+                    char zValueResume[256] = "";
+                    if (bBookmark && (eOrder == FLEXI_DATA_ORDER_BY_VALUE || eOrder == FLEXI_DATA_ORDER_BY_VALUE_DESC))
+                    {
+                        bool bDesc = eOrder == FLEXI_DATA_ORDER_BY_VALUE_DESC;
+                        if (op == SQLITE_INDEX_CONSTRAINT_EQ)
+                            sqlite3_snprintf(sizeof(zValueResume), zValueResume,
+                                             " and ObjectID %s (case when :%d = :bmValue then :bmValueID "
+                                                     "when :%d %s :bmValue then %lld else %lld end)",
+                                             bDesc ? "<" : ">", i + 1, i + 1, bDesc ? "<" : ">",
+                                             bDesc ? FLEXI_DATA_MAX_ID : FLEXI_DATA_MIN_ID,
+                                             bDesc ? FLEXI_DATA_MIN_ID : FLEXI_DATA_MAX_ID);
+                        else
+                        {
+                            if (bDesc ? (op == SQLITE_INDEX_CONSTRAINT_LT || op == SQLITE_INDEX_CONSTRAINT_LE)
+                                      : (op == SQLITE_INDEX_CONSTRAINT_GT || op == SQLITE_INDEX_CONSTRAINT_GE))
+                                zValue = "+[Value]";
+                            sqlite3_snprintf(sizeof(zValueResume), zValueResume,
+                                             " and ([Value], ObjectID) %s (:bmValue, :bmValueID)", bDesc ? "<" : ">");
+                        }
+                    }
+
+                    // Term ([ctlv] & mask) matches WHERE clause of partial index, so that SQLite can use it
+                    if (prop->bIndexed)
+                    {
+                        zSQL = sqlite3_mprintf("select ObjectID from [.ref-values] where "
+                                                       "[PropertyID] = %lld and [PropIndex] = 0 and %s %s :%d "
+                                                       "and ([ctlv] & 0xF0) and (ctlv & %d) = %d%s",
+                                               prop->iPropID, zValue, zOp, i + 1, CTLV_INDEX, CTLV_INDEX,
+                                               zValueResume);
+                    }
+                    else
+                        if (prop->bUnique)
+                        {
+                            zSQL = sqlite3_mprintf("select ObjectID from [.ref-values] where "
+                                                           "[PropertyID] = %lld and [PropIndex] = 0 and %s %s :%d "
+                                                           "and ([ctlv] & 8) and (ctlv & %d) = %d%s",
+                                                   prop->iPropID, zValue, zOp, i + 1, CTLV_UNIQUE_INDEX,
+                                                   CTLV_UNIQUE_INDEX, zValueResume);
+                        }
+                        else
+                        {
+                            zSQL = sqlite3_mprintf("select ObjectID from [.ref-values] where "
+                                                           "[PropertyID] = %lld and [PropIndex] = 0 and %s %s :%d%s",
+                                                   prop->iPropID, zValue, zOp, i + 1, zValueResume);
+                        }
+                }
+                else
+                {
+                    zSQL = sqlite3_mprintf("select ObjectID from [.ref-values] where "
+                                                   "[PropertyID] = %lld and [PropIndex] = 0 and match_text(:%d, [Value])",
+                                           prop->iPropID, i + 1);
+                }
+            }
+
+            CHECK_NULL(zSQL);
+            pPlan->aProbes[pPlan->nProbes++].zSQL = zSQL;
+        }
+
+        if (zRangeSQL != NULL)
+        {
+            pPlan->aProbes[pPlan->nProbes++].zSQL = zRangeSQL;
+            zRangeSQL = NULL;
+        }
+
+        // Every probe is limited by bookmark, so that intersection is limited too
+        if (*zIdResume != 0)
+        {
+            for (int ii = 0; ii < pPlan->nProbes; ii++)
+            {
+                void *pTmp = pPlan->aProbes[ii].zSQL;
+                pPlan->aProbes[ii].zSQL = sqlite3_mprintf("%s%s", pTmp, zIdResume);
+                sqlite3_free(pTmp);
+                CHECK_NULL(pPlan->aProbes[ii].zSQL);
+            }
+        }
+
+        if (pPlan->nProbes == 1 && eOrder != FLEXI_DATA_ORDER_NONE)
+        {
+            void *pTmp = pPlan->aProbes[0].zSQL;
+            pPlan->aProbes[0].zSQL = sqlite3_mprintf("%s%s", pTmp, order_clauses[eOrder]);
+            sqlite3_free(pTmp);
+            CHECK_NULL(pPlan->aProbes[0].zSQL);
+        }
+
+        // Ordering by value is consumed by xBestIndex only for single lookup
+        assert(pPlan->nProbes == 1 || eOrder == FLEXI_DATA_ORDER_NONE || eOrder == FLEXI_DATA_ORDER_BY_ID
+               || eOrder == FLEXI_DATA_ORDER_BY_ID_DESC);
+    }
+
+    if (eOrder == FLEXI_DATA_ORDER_BY_HEAP || eOrder == FLEXI_DATA_ORDER_BY_HEAP_DESC)
+    {
+        assert(pPlan->nProbes == 1);
+        assert(iOrderCol >= 0 && iOrderCol < vtab->propsByName.count);
+
+        void *pTmp = pPlan->aProbes[0].zSQL;
+        pPlan->aProbes[0].zSQL = sqlite3_mprintf("select p.ObjectID, (select [Value] from [.ref-values] v "
+                                                         "where v.ObjectID = p.ObjectID and v.PropertyID = %lld "
+                                                         "order by v.PropIndex limit 1) from (%s) p",
+                                                 vtab->pProps[iOrderCol].iPropID, pTmp);
+        sqlite3_free(pTmp);
+        CHECK_NULL(pPlan->aProbes[0].zSQL);
+        pPlan->bKeyed = true;
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    sqlite3_free(zRangeSQL);
+
+    return result;
+}
+
+/*
+ * Binds xFilter arguments to probe statement. Probes use parameters named by
+ * 1-based position of argument in argv (:1, :2...), but not every probe uses all arguments.
+ * Bookmark parameters (:bm...) are bound by _bindBookmark
+ */
+static int _bindFilterArgs(sqlite3_stmt *pStmt, int argc, sqlite3_value **argv)
+{
+    int result;
+    int nParams = sqlite3_bind_parameter_count(pStmt);
+    for (int ii = 1; ii <= nParams; ii++)
+    {
+        const char *zName = sqlite3_bind_parameter_name(pStmt, ii);
+        assert(zName != NULL);
+        if (!isdigit(zName[1]))
+            continue;
+        int iArg = atoi(zName + 1) - 1;
+        assert(iArg >= 0 && iArg < argc);
+        CHECK_CALL(sqlite3_bind_value(pStmt, ii, argv[iArg]));
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Binds sort key of bookmark position to parameter
+ */
+static int _bindKey(sqlite3_stmt *pStmt, int iParam, const KeyHeapItem_t *pKey)
+{
+    switch (pKey->iType)
+    {
+        case SQLITE_INTEGER:
+            return sqlite3_bind_int64(pStmt, iParam, pKey->v.i);
+
+        case SQLITE_FLOAT:
+            return sqlite3_bind_double(pStmt, iParam, pKey->v.d);
+
+        case SQLITE_TEXT:
+            return sqlite3_bind_text(pStmt, iParam, pKey->v.z, pKey->nBytes, SQLITE_TRANSIENT);
+
+        case SQLITE_BLOB:
+            return sqlite3_bind_blob(pStmt, iParam, pKey->v.z, pKey->nBytes, SQLITE_TRANSIENT);
+
+        default:
+            return sqlite3_bind_null(pStmt, iParam);
+    }
+}
+
+/*
+ * Binds cursor's bookmark position to resume conditions of probe (see _buildFilterProbes).
+ * Objects without value (NULL key) go before all values in ascending order and after them in descending order,
+ * so for NULL key value condition is bound to the lowest possible key, and for non-NULL key condition on
+ * objects without value is bound to the highest object ID. Irrelevant probe of ordered index scan is skipped
+ * entirely (see _filter)
+ */
+static int _bindBookmark(struct flexi_VTabCursor *cur, sqlite3_stmt *pStmt)
+{
+    int result;
+    const KeyHeapItem_t *pPos = &cur->bookmark.pos;
+    int iParam;
+
+    if (cur->bookmark.eOrder == 0)
+    {
+        result = SQLITE_OK;
+        goto EXIT;
+    }
+
+    if ((iParam = sqlite3_bind_parameter_index(pStmt, ":bmID")) > 0)
+    {
+        CHECK_CALL(sqlite3_bind_int64(pStmt, iParam, pPos->lID));
+    }
+
+    if ((iParam = sqlite3_bind_parameter_index(pStmt, ":bmValue")) > 0)
+    {
+        if (pPos->iType == SQLITE_NULL)
+        {
+            CHECK_CALL(sqlite3_bind_double(pStmt, iParam, -HUGE_VAL));
+        }
+        else
+        {
+            CHECK_CALL(_bindKey(pStmt, iParam, pPos));
+        }
+    }
+
+    if ((iParam = sqlite3_bind_parameter_index(pStmt, ":bmValueID")) > 0)
+    {
+        CHECK_CALL(sqlite3_bind_int64(pStmt, iParam, pPos->iType == SQLITE_NULL ? FLEXI_DATA_MIN_ID : pPos->lID));
+    }
+
+    if ((iParam = sqlite3_bind_parameter_index(pStmt, ":bmNullID")) > 0)
+    {
+        CHECK_CALL(sqlite3_bind_int64(pStmt, iParam, pPos->iType == SQLITE_NULL ? pPos->lID : FLEXI_DATA_MAX_ID));
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Binds parameters of probe which scans entire class: class ID (:1) and bookmark
+ */
+static int _bindScanParams(struct flexi_VTabCursor *cur, sqlite3_stmt *pStmt)
+{
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) cur->base.pVtab;
+    int iParam = sqlite3_bind_parameter_index(pStmt, ":1");
+    if (iParam > 0)
+    {
+        int result = sqlite3_bind_int64(pStmt, iParam, vtab->lClassID);
+        if (result != SQLITE_OK)
+            return result;
+    }
+    return _bindBookmark(cur, pStmt);
+}
+
+/*
+ * Borrows prepared statement for plan's probe. Statement must be returned to the plan
+ * (see _returnProbeStmt) or finalized
+ */
+static int _borrowProbeStmt(struct flexi_ClassDef_t *vtab, flexi_FilterProbe_t *pProbe, sqlite3_stmt **ppStmt)
+{
+    int result;
+
+    if (pProbe->pStmt != NULL)
+    {
+        *ppStmt = pProbe->pStmt;
+        pProbe->pStmt = NULL;
+    }
+    else
+    {
+        CHECK_STMT_PREPARE(vtab->pCtx->db, pProbe->zSQL, ppStmt);
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Runs multi-probe plan: every probe is fully read into ID set, and sets are intersected one by one.
+ * Probes go in order of their estimated cost, so intersection shrinks quickly and is stopped as soon as
+ * it gets empty. Result is stored in cursor's ids
+ */
+static int _runProbes(struct flexi_VTabCursor *cur, struct flexi_FilterPlan_t *pPlan, int argc,
+                      sqlite3_value **argv)
+{
+    int result;
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) cur->base.pVtab;
+    sqlite3_stmt *pStmt = NULL;
+    IdSet_t probeIds;
+    IdSet_t tmpIds;
+
+    IdSet_init(&probeIds);
+    IdSet_init(&tmpIds);
+
+    for (int iProbe = 0; iProbe < pPlan->nProbes; iProbe++)
+    {
+        flexi_FilterProbe_t *pProbe = &pPlan->aProbes[iProbe];
+
+        CHECK_CALL(_borrowProbeStmt(vtab, pProbe, &pStmt));
+        CHECK_CALL(_bindFilterArgs(pStmt, argc, argv));
+        CHECK_CALL(_bindBookmark(cur, pStmt));
+
+        // First probe gets collected into result directly
+        IdSet_t *pIds = iProbe == 0 ? &cur->ids : &probeIds;
+        while ((result = sqlite3_step(pStmt)) == SQLITE_ROW)
+        {
+            CHECK_CALL(IdSet_add(pIds, sqlite3_column_int64(pStmt, 0)));
+        }
+        if (result != SQLITE_DONE)
+            goto ONERROR;
+
+        // Return statement to plan
+        sqlite3_reset(pStmt);
+        sqlite3_clear_bindings(pStmt);
+        if (pProbe->pStmt == NULL)
+            pProbe->pStmt = pStmt;
+        else sqlite3_finalize(pStmt);
+        pStmt = NULL;
+
+        CHECK_CALL(IdSet_seal(pIds));
+
+        if (iProbe > 0)
+        {
+            CHECK_CALL(IdSet_intersect(&tmpIds, &cur->ids, &probeIds));
+            IdSet_move(&cur->ids, &tmpIds);
+            IdSet_clear(&probeIds);
+        }
+
+        if (cur->ids.nCount == 0)
+            break;
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    sqlite3_finalize(pStmt);
+
+    EXIT:
+    IdSet_clear(&probeIds);
+    IdSet_clear(&tmpIds);
+    return result;
+}
+
+/*
+ * Reads all object IDs with their sort keys from object iterator into heap and returns iterator to the plan.
+ * Objects without value get default value of property as sort key, the same value as returned by xColumn.
+ * If there is bookmark, objects which do not go after its position are not added.
+ * If nLimit is not 0 (LIMIT + OFFSET), only nLimit first objects are kept
+ */
+static int _fillHeap(struct flexi_VTabCursor *cur, int idxNum, u32 nLimit)
+{
+    int result;
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) cur->base.pVtab;
+    sqlite3_value *pDefault = vtab->pProps[FLEXI_DATA_IDX_ORDER_COL(idxNum)].defaultValue;
+
+    KeyHeap_clear(&cur->heap);
+    cur->heap.bDesc = FLEXI_DATA_IDX_ORDER(idxNum) == FLEXI_DATA_ORDER_BY_HEAP_DESC;
+    cur->heap.pAfter = cur->bookmark.eOrder != 0 ? &cur->bookmark.pos : NULL;
+    cur->heap.nLimit = nLimit;
+
+    while ((result = sqlite3_step(cur->pObjectIterator)) == SQLITE_ROW)
+    {
+        sqlite3_value *pKey = sqlite3_column_type(cur->pObjectIterator, 1) == SQLITE_NULL
+                              ? pDefault : sqlite3_column_value(cur->pObjectIterator, 1);
+        CHECK_CALL(KeyHeap_add(&cur->heap, sqlite3_column_int64(cur->pObjectIterator, 0), pKey));
+    }
+    if (result != SQLITE_DONE)
+        goto ONERROR;
+
+    KeyHeap_build(&cur->heap);
+    cur->bHeap = true;
+    _returnProbeStmt(cur);
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
 
-    sqlite3_finalize(cur->pPropertyIterator);
-    sqlite3_free(cur);
-    return SQLITE_OK;
+    EXIT:
+    return result;
 }
 
 /*
- * Finishes SELECT
+ * Returns bookmark ordering which corresponds to ordering of results
  */
-static int _close(sqlite3_vtab_cursor *pCursor)
+static FLEXI_BOOKMARK_ORDER _bookmarkOrder(FLEXI_DATA_ORDER eOrder)
 {
-    struct flexi_VTabCursor *cur = (void *) pCursor;
-    return flexi_VTabCursor_free(cur);
+    switch (eOrder)
+    {
+        case FLEXI_DATA_ORDER_BY_ID_DESC:
+            return FLEXI_BOOKMARK_BY_ID_DESC;
+
+        case FLEXI_DATA_ORDER_BY_VALUE:
+        case FLEXI_DATA_ORDER_BY_INDEX:
+        case FLEXI_DATA_ORDER_BY_HEAP:
+            return FLEXI_BOOKMARK_BY_VALUE;
 
+        case FLEXI_DATA_ORDER_BY_VALUE_DESC:
+        case FLEXI_DATA_ORDER_BY_INDEX_DESC:
+        case FLEXI_DATA_ORDER_BY_HEAP_DESC:
+            return FLEXI_BOOKMARK_BY_VALUE_DESC;
+
+        default:
+            return FLEXI_BOOKMARK_BY_ID;
+    }
 }
 
 /*
- * Advances to the next found object
+ * Decodes bookmark passed to xFilter into cur->bookmark. Bookmark must have been
+ * returned by query with the same ordering
  */
-static int _next(sqlite3_vtab_cursor *pCursor)
+static int _setBookmark(struct flexi_VTabCursor *cur, sqlite3_value *pBookmark)
 {
-    int result;
-    struct flexi_VTabCursor *cur = (void *) pCursor;
     struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) cur->base.pVtab;
 
-    cur->iReadCol = -1;
-    result = sqlite3_step(cur->pObjectIterator);
-    if (result == SQLITE_DONE)
+    int result = flexi_Bookmark_decode(&cur->bookmark, pBookmark);
+    if (result == SQLITE_OK)
     {
-        cur->iEof = 1;
+        sqlite3_int64 lPropID = cur->iOrderCol >= 0 ? vtab->pProps[cur->iOrderCol].iPropID : 0;
+        if (cur->bookmark.eOrder != _bookmarkOrder(cur->eOrder) || cur->bookmark.lPropID != lPropID)
+            result = SQLITE_MISMATCH;
     }
-    else
-        if (result == SQLITE_ROW)
-        {
-            // Cleanup after last record
-            if (flexi_free_cursor_values(cur) == 0)
-            {
-                CHECK_MALLOC(cur->pCols, vtab->propsByName.count * sizeof(sqlite3_value *));
-            }
-            memset(cur->pCols, 0, vtab->propsByName.count * sizeof(sqlite3_value *));
 
-            cur->lObjectID = sqlite3_column_int64(cur->pObjectIterator, 0);
-            cur->iEof = 0;
-            CHECK_CALL(sqlite3_reset(cur->pPropertyIterator));
-            sqlite3_bind_int64(cur->pPropertyIterator, 1, cur->lObjectID);
-        }
-        else goto ONERROR;
-
-    result = SQLITE_OK;
-    goto EXIT;
-    ONERROR:
+    if (result == SQLITE_MISMATCH)
     {
-        // Release resources because of errors (catch)
-        printf("%s", sqlite3_errmsg(vtab->pCtx->db));
+        flexi_Bookmark_clear(&cur->bookmark);
+        sqlite3_free(vtab->base.zErrMsg);
+        vtab->base.zErrMsg = sqlite3_mprintf("Invalid bookmark or bookmark does not match order of query");
+        result = SQLITE_ERROR;
     }
-    EXIT:
+
     return result;
 }
 
 /*
- * Generates dynamic SQL to find list of object IDs.
- * idxNum may be 0 or 1. When 1, idxStr will have all constraints appended by FindBestIndex.
- * Depending on number of constraint arguments in idxStr generated SQL will have of the following constructs:
- * 1. argc == 1 or all argv are for rtree search
- * 1.1. Unique index: select ObjectID from [.ref-values] where PropertyID = :1 and Value OP :2 and ctlv =
- * 1.2. Index: select ObjectID from [.ref-values] where PropertyID = :1 and Value OP :2 and ctlv =
- * 1.3. Match for full text search with index:
- * select id from [.full_text_data] where PropertyID = :1 and Value match :2
- * 1.4. Linear scan without index:
- * select ObjectID from [.ref-values] where PropertyID = :1 and Value OP :2
- * 1.5. Search by rtree:
- * select id from [.range_data] where ClassID = :1 and A0 OP :2 and A1 OP :3 and...
- *
- * 2.argc > 1
- * General pattern would be:
- * <SQL for argv == 0> intersect <SQL for argv == 1>...
+ * Starts search for objects. Lookup SQL for the given idxNum and idxStr is generated once per class
+ * and kept in class' filterPlans, together with prepared statements. Subsequent calls
+ * (e.g. inner loop of join) only rebind arguments.
+ * Plan with single lookup is streamed via cursor's pObjectIterator. For plans with multiple lookups, IDs are
+ * intersected in memory (sorted array merge or bitmap AND), instead of using compound INTERSECT SELECT.
+ * When ORDER BY is served by heap, all found IDs with sort keys are read at once and then popped in order
+ * on demand, so that only objects actually read by SQLite get sorted.
+ * If query has bookmark (the last argument), results start right after bookmark position. NULL bookmark
+ * matches nothing, as any other constraint = NULL
  */
 static int _filter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr,
                    int argc, sqlite3_value **argv)
 {
-    static char *range_columns[] = {"A0", "A1", "B0", "B1", "C0", "C1", "D0", "D1"};
-
     int result;
     struct flexi_VTabCursor *cur = (void *) pCursor;
     struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) cur->base.pVtab;
-    char *zSQL = NULL;
+    struct flexi_FilterPlan_t *pPlan = NULL;
+    char *zKey = NULL;
 
-    // Subquery for [.range_data]
-    char *zRangeSQL = NULL;
+    _releaseObjectIterator(cur);
+    cur->eOrder = FLEXI_DATA_IDX_ORDER(idxNum);
+    cur->iOrderCol = FLEXI_DATA_IDX_ORDER_COL(idxNum);
 
-    if (idxNum == 0 || argc == 0)
-        // No special index used. Apply linear scan
+    if (_hasBookmarkArg(vtab, idxStr, argc))
     {
-        CHECK_STMT_PREPARE(
-                vtab->pCtx->db, "select ObjectID from [.objects] where ClassID = :1;",
-                &cur->pObjectIterator);
-        sqlite3_bind_int64(cur->pObjectIterator, 1, vtab->lClassID);
-    }
-    else
-    {
-        assert(argc * 8 == strlen(idxStr));
-
-        const char *zIdxTuple = idxStr;
-        for (int i = 0; i < argc; i++)
+        if (sqlite3_value_type(argv[argc - 1]) == SQLITE_NULL)
         {
-            int op;
-            int colIdx;
-            sscanf(zIdxTuple, "%2X|%4X|", &op, &colIdx);
-            colIdx--;
-            zIdxTuple += 8;
-
-            assert(colIdx >= -1 && colIdx < vtab->propsByName.count);
+            cur->iEof = 1;
+            result = SQLITE_OK;
+            goto EXIT;
+        }
 
-            if (zSQL != NULL)
-            {
-                void *pTmp = zSQL;
-                zSQL = sqlite3_mprintf("%s intersect ", pTmp);
-                sqlite3_free(pTmp);
-            }
+        CHECK_CALL(_setBookmark(cur, argv[argc - 1]));
+    }
 
-            char *zOp;
-            switch (op)
-            {
-                case SQLITE_INDEX_CONSTRAINT_EQ:
-                    zOp = "=";
-                    break;
-                case SQLITE_INDEX_CONSTRAINT_GT:
-                    zOp = ">";
-                    break;
-                case SQLITE_INDEX_CONSTRAINT_LE:
-                    zOp = "<=";
-                    break;
-                case SQLITE_INDEX_CONSTRAINT_LT:
-                    zOp = "<";
-                    break;
-                case SQLITE_INDEX_CONSTRAINT_GE:
-                    zOp = ">=";
-                    break;
-                default:
-                    assert(op == SQLITE_INDEX_CONSTRAINT_MATCH);
-                    zOp = "match";
-                    break;
-            }
+    zKey = sqlite3_mprintf("%X|%s", idxNum, idxStr);
+    CHECK_NULL(zKey);
 
-            if (colIdx == -1)
-                // Search by rowid / ObjectID
-            {
-                void *pTmp = zSQL;
-                zSQL = sqlite3_mprintf(
-                        "%s select ObjectID from [.objects] where ObjectID %s :%d",
-                        pTmp, zOp, i + 1);
-                sqlite3_free(pTmp);
-            }
-            else
-            {
-                struct flexi_PropDef_t *prop = &vtab->pProps[colIdx];
-                if (IS_RANGE_PROPERTY(prop->type))
-                    // Special case: range data request
-                {
-                    assert(prop->cRangeColumn > 0);
+    pPlan = HashTable_get(&vtab->filterPlans, (DictionaryKey_t) {.pKey = zKey});
+    if (pPlan == NULL)
+    {
+        CHECK_MALLOC(pPlan, sizeof(*pPlan));
+        memset(pPlan, 0, sizeof(*pPlan));
+        result = _buildFilterProbes(vtab, idxNum, idxStr, argc, pPlan);
+        if (result != SQLITE_OK)
+        {
+            flexi_FilterPlan_free(pPlan);
+            goto ONERROR;
+        }
 
-                    if (zRangeSQL == NULL)
-                    {
-                        zRangeSQL = sqlite3_mprintf(
-                                "select id from [.range_data] where ClassID0 = %d and ClassID1 = %d ",
-                                vtab->lClassID, vtab->lClassID);
-                    }
-                    void *pTmp = zRangeSQL;
-                    zRangeSQL = sqlite3_mprintf("%s and %s %s :%d", pTmp, range_columns[prop->cRangeColumn - 1],
-                                                zOp, i + 1);
-                    sqlite3_free(pTmp);
-                }
-                else
-                    // Normal column
-                {
-                    void *zTmp = zSQL;
+        // Hash table takes ownership of key
+        HashTable_set(&vtab->filterPlans, (DictionaryKey_t) {.pKey = zKey}, pPlan);
+        zKey = NULL;
+    }
 
-                    if (op == SQLITE_INDEX_CONSTRAINT_MATCH && prop->bFullTextIndex)
-                        // full text search
-                    {
-                        // TODO Generate lookup on [.full_text_data]
-                    }
-                    else
-                    {
-                        zSQL = sqlite3_mprintf
-                                ("%sselect ObjectID from [.ref-values] where "
-                                         "[PropertyID] = %d and [PropIndex] = 0 and ", zTmp,
-                                 prop->iPropID);
-                        sqlite3_free(zTmp);
-                        if (op != SQLITE_INDEX_CONSTRAINT_MATCH)
-                        {
-                            zTmp = zSQL;
-                            zSQL = sqlite3_mprintf("%s[Value] %s :%d", zTmp, zOp, i + 1);
-                            sqlite3_free(zTmp);
-
-                            if (prop->bIndexed)
-                            {
-                                void *pTmp = zSQL;
-                                zSQL = sqlite3_mprintf("%s and (ctlv & %d) = %d", pTmp, CTLV_INDEX, CTLV_INDEX);
-                                sqlite3_free(pTmp);
-                            }
-                            else
-                                if (prop->bUnique)
-                                {
-                                    void *pTmp = zSQL;
-                                    zSQL = sqlite3_mprintf("%s and (ctlv & %d) = %d", pTmp, CTLV_UNIQUE_INDEX,
-                                                           CTLV_UNIQUE_INDEX);
-                                    sqlite3_free(pTmp);
-                                }
-                        }
-                        else
-                        {
-                            /*
-                             * TODO
-                             * mem database
-                             *
-                             */
-                            zTmp = zSQL;
-                            zSQL = sqlite3_mprintf("%smatch_text(:%d, [Value])", zTmp, i + 1);
-                            sqlite3_free(zTmp);
-                        }
-                    }
-                }
-            }
+    if (pPlan->nProbes == 1 || pPlan->bConcat)
+    {
+        /*
+         * Ordered index scan with bookmark starts from the probe which bookmark position belongs to:
+         * objects without value go first in ascending order
+         */
+        int iStart = 0;
+        if (pPlan->bConcat && cur->bookmark.eOrder != 0)
+        {
+            bool bNullKey = cur->bookmark.pos.iType == SQLITE_NULL;
+            if (cur->eOrder == FLEXI_DATA_ORDER_BY_INDEX_DESC ? bNullKey : !bNullKey)
+                iStart = 1;
         }
 
-        if (zRangeSQL != NULL)
+        CHECK_CALL(_borrowProbeStmt(vtab, &pPlan->aProbes[iStart], &cur->pObjectIterator));
+        cur->pPlan = pPlan;
+        cur->iProbe = iStart;
+
+        if (pPlan->bConcat || FLEXI_DATA_IDX_PLAN(idxNum) == FLEXI_DATA_PLAN_FULL_SCAN)
         {
-            void *pTmp = zSQL;
-            zSQL = sqlite3_mprintf("%s intersect %s", pTmp, zRangeSQL);
-            sqlite3_free(pTmp);
+            CHECK_CALL(_bindScanParams(cur, cur->pObjectIterator));
+        }
+        else
+        {
+            CHECK_CALL(_bindFilterArgs(cur->pObjectIterator, argc, argv));
+            CHECK_CALL(_bindBookmark(cur, cur->pObjectIterator));
         }
 
-        CHECK_STMT_PREPARE(vtab->pCtx->db, zSQL, &cur->pObjectIterator);
-        // Bind arguments
-        for (int ii = 0; ii < argc; ii++)
+        if (pPlan->bKeyed)
         {
-            sqlite3_bind_value(cur->pObjectIterator, ii + 1, argv[ii]);
+            u32 nLimit;
+            _getPagingArgs(idxStr, _hasBookmarkArg(vtab, idxStr, argc) ? argc - 1 : argc, argv, &nLimit);
+            CHECK_CALL(_fillHeap(cur, idxNum, nLimit));
         }
     }
+    else
+    {
+        CHECK_CALL(_runProbes(cur, pPlan, argc, argv));
+        IdSet_begin(&cur->ids, &cur->idsIter, FLEXI_DATA_IDX_ORDER(idxNum) == FLEXI_DATA_ORDER_BY_ID_DESC);
+    }
 
+    cur->iEof = -1;
     CHECK_CALL(_next(pCursor));
 
     result = SQLITE_OK;
@@ -417,8 +1769,7 @@ static int _filter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr,
     ONERROR:
 
     EXIT:
-    sqlite3_free(zSQL);
-    sqlite3_free(zRangeSQL);
+    sqlite3_free(zKey);
 
     return result;
 }
@@ -495,71 +1846,122 @@ static int _eof(sqlite3_vtab_cursor *pCursor)
 }
 
 /*
- * Returns value for the column at position iCol (starting from 0).
- * Reads column data from ref-values table, filtered by ObjectID and sorted by PropertyID
- * For the sake of better performance, fetches required columns on demand, sequentially.
- *
+ * Returns bookmark of current object: ordering of results, ID of property to order by,
+ * object's value of this property (as returned by xColumn) and object ID
  */
-static int _column(sqlite3_vtab_cursor *pCursor, sqlite3_context *pContext, int iCol)
+static int _bookmarkColumn(struct flexi_VTabCursor *cur, sqlite3_context *pContext)
 {
-    int result = SQLITE_OK;
-    struct flexi_VTabCursor *cur = (void *) pCursor;
-
-    if (iCol == -1)
-    {
-        sqlite3_result_int64(pContext, cur->lObjectID);
-        goto EXIT;
-    }
-
+    int result;
     struct flexi_ClassDef_t *vtab = (void *) cur->base.pVtab;
+    flexi_Bookmark_t bookmark;
+    char *zBookmark = NULL;
+
+    memset(&bookmark, 0, sizeof(bookmark));
+    bookmark.eOrder = _bookmarkOrder(cur->eOrder);
+    KeyHeap_setItem(&bookmark.pos, cur->lObjectID, NULL);
 
-    // First, check if column has been already loaded
-    while (cur->iReadCol < iCol)
+    if (bookmark.eOrder == FLEXI_BOOKMARK_BY_VALUE || bookmark.eOrder == FLEXI_BOOKMARK_BY_VALUE_DESC)
     {
-        int colResult = sqlite3_step(cur->pPropertyIterator);
-        if (colResult == SQLITE_DONE)
-            break;
-        if (colResult != SQLITE_ROW)
+        struct flexi_PropDef_t *prop = &vtab->pProps[cur->iOrderCol];
+        bookmark.lPropID = prop->iPropID;
+
+        if (!cur->bBatchLoaded)
         {
-            result = colResult;
-            goto ONERROR;
+            CHECK_CALL(_loadBatchProps(cur));
         }
-        sqlite3_int64 lPropID = sqlite3_column_int64(cur->pPropertyIterator, 1);
-        if (lPropID < vtab->pProps[cur->iReadCol + 1].iPropID)
-            continue;
 
-        cur->iReadCol++;
-        if (lPropID == vtab->pProps[cur->iReadCol].iPropID)
+        const flexi_ObjValue_t *pValue = &cur->pCols[cur->iOrderCol * FLEXI_DATA_BATCH_SIZE + cur->iBatchPos];
+        if (pValue->iType == 0 || pValue->iType == SQLITE_NULL)
+            KeyHeap_setItem(&bookmark.pos, cur->lObjectID, prop->defaultValue);
+        else
         {
-            sqlite3_int64 lPropIdx = sqlite3_column_int64(cur->pPropertyIterator, 2);
+            bookmark.pos.iType = pValue->iType;
+            bookmark.pos.nBytes = pValue->nBytes;
+            switch (pValue->iType)
+            {
+                case SQLITE_INTEGER:
+                    bookmark.pos.v.i = pValue->v.i;
+                    break;
 
-            /*
-             * No need in any special verification as we expect columns are sorted by property IDs, so
-             * we just assume that once column index is OK, we can process this property data
-             */
+                case SQLITE_FLOAT:
+                    bookmark.pos.v.d = pValue->v.d;
+                    break;
 
-            cur->pCols[cur->iReadCol] = sqlite3_value_dup(sqlite3_column_value(cur->pPropertyIterator, 4));
+                default:
+                    bookmark.pos.v.z = pValue->v.z;
+                    break;
+            }
         }
     }
 
-    if (cur->pCols[iCol] == NULL || sqlite3_value_type(cur->pCols[iCol]) == SQLITE_NULL)
-    {
-        sqlite3_result_value(pContext, vtab->pProps[iCol].defaultValue);
-    }
-    else
-    {
-        sqlite3_result_value(pContext, cur->pCols[iCol]);
-    }
+    zBookmark = flexi_Bookmark_encode(&bookmark);
+    CHECK_NULL(zBookmark);
+    sqlite3_result_text(pContext, zBookmark, -1, sqlite3_free);
 
     result = SQLITE_OK;
     goto EXIT;
+
     ONERROR:
 
     EXIT:
-    // Map column number to property ID
     return result;
 }
 
+/*
+ * Returns value for the column at position iCol (starting from 0).
+ * Column data are read from [.ref-values] for the whole batch of objects, when column
+ * of any object in batch is requested for the first time
+ */
+static int _column(sqlite3_vtab_cursor *pCursor, sqlite3_context *pContext, int iCol)
+{
+    struct flexi_VTabCursor *cur = (void *) pCursor;
+
+    if (iCol == -1)
+    {
+        sqlite3_result_int64(pContext, cur->lObjectID);
+        return SQLITE_OK;
+    }
+
+    struct flexi_ClassDef_t *vtab = (void *) cur->base.pVtab;
+
+    if (iCol == FLEXI_DATA_VTAB_BOOKMARK_COL(vtab))
+        return _bookmarkColumn(cur, pContext);
+
+    // Values are loaded for the whole batch, on first column request
+    if (!cur->bBatchLoaded)
+    {
+        int result = _loadBatchProps(cur);
+        if (result != SQLITE_OK)
+            return result;
+    }
+
+    const flexi_ObjValue_t *pValue = &cur->pCols[iCol * FLEXI_DATA_BATCH_SIZE + cur->iBatchPos];
+    switch (pValue->iType)
+    {
+        case SQLITE_INTEGER:
+            sqlite3_result_int64(pContext, pValue->v.i);
+            break;
+
+        case SQLITE_FLOAT:
+            sqlite3_result_double(pContext, pValue->v.d);
+            break;
+
+        case SQLITE_TEXT:
+            sqlite3_result_text(pContext, pValue->v.z, pValue->nBytes, SQLITE_TRANSIENT);
+            break;
+
+        case SQLITE_BLOB:
+            sqlite3_result_blob(pContext, pValue->v.z, pValue->nBytes, SQLITE_TRANSIENT);
+            break;
+
+        default:
+            sqlite3_result_value(pContext, vtab->pProps[iCol].defaultValue);
+            break;
+    }
+
+    return SQLITE_OK;
+}
+
 /*
  * Returns object ID into pRowID
  */
@@ -608,6 +2010,15 @@ static int flexi_validate(struct flexi_ClassDef_t *pVTab, int argc, sqlite3_valu
     return result;
 }
 
+/*
+ * Checks if changes of property values should be recorded in [.change_log]
+ */
+static bool _isTrackedProp(struct flexi_ClassDef_t *pVTab, struct flexi_PropDef_t *pProp)
+{
+    return (pVTab->xCtloMask & CTLO_NO_TRACK_CHANGES) == 0
+           && (pProp == NULL || (pProp->xCtlv & CTLV_NO_TRACK_CHANGES) == 0);
+}
+
 /*
  * Saves property values for the given object ID
  */
@@ -700,6 +2111,21 @@ static int flexi_upsert_props(struct flexi_ClassDef_t *pVTab, sqlite3_int64 lObj
                 //                ii += 2;
             }
 
+            if (_isTrackedProp(pVTab, pProp))
+            {
+                if (bDeleteNulls)
+                {
+                    // Update: old value is loaded before it gets replaced
+                    CHECK_CALL(flexi_ChangeLog_addPropValue(&pVTab->pCtx->changeLog, pVTab->lClassID, lObjectID,
+                                                            pProp->iPropID, 0, pVal));
+                }
+                else
+                {
+                    CHECK_CALL(flexi_ChangeLog_add(&pVTab->pCtx->changeLog, 'C', pVTab->lClassID, lObjectID,
+                                                   pProp->iPropID, 0, NULL, pVal));
+                }
+            }
+
             CHECK_STMT_STEP(pStmt, pVTab->pCtx->db);
         }
         else
@@ -709,6 +2135,12 @@ static int flexi_upsert_props(struct flexi_ClassDef_t *pVTab, sqlite3_int64 lObj
             // TODO Check if this is a mapped column
             if (bDeleteNulls && pProp->cRngBound == 0)
             {
+                if (_isTrackedProp(pVTab, pProp))
+                {
+                    CHECK_CALL(flexi_ChangeLog_addPropValue(&pVTab->pCtx->changeLog, pVTab->lClassID, lObjectID,
+                                                            pProp->iPropID, 0, NULL));
+                }
+
                 const char *zDelPropSQL = "delete from [.ref-values] where ObjectID = :1 and PropertyID = :2 and PropIndex = :3;";
                 CHECK_CALL(flexi_Context_stmtInit(pVTab->pCtx, STMT_DEL_PROP, zDelPropSQL, &pDelProp));
                 sqlite3_bind_int64(pDelProp, 1, lObjectID);
@@ -794,6 +2226,10 @@ static int _update(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv, sqlite_i
     }
     else
     {
+        // Hidden bookmark column is read-only, only property columns are saved
+        if (argc > vtab->propsByName.count + 2)
+            argc = vtab->propsByName.count + 2;
+
         if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
             // Insert new row
         {
@@ -803,7 +2239,7 @@ static int _update(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv, sqlite_i
 
             sqlite3_bind_value(pInsObj, 1, argv[1]); // Object ID, normally null
             sqlite3_bind_int64(pInsObj, 2, vtab->lClassID);
-            sqlite3_bind_int(pInsObj, 3, vtab->xCtloMask);
+            sqlite3_bind_int64(pInsObj, 3, vtab->xCtloMask);
 
             CHECK_STMT_STEP(pInsObj, vtab->pCtx->db);
 
@@ -866,6 +2302,67 @@ static int _rename(sqlite3_vtab *pVtab, const char *zNew)
     return flexi_class_rename(pTab->pCtx, pTab->lClassID, zNew);
 }
 
+/*
+ * Starts capturing property value changes. Without xBegin SQLite does not include virtual table
+ * in transaction, and none of the other transaction methods below would be called
+ */
+static int _begin(sqlite3_vtab *pVTab)
+{
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) pVTab;
+    flexi_ChangeLog_begin(&vtab->pCtx->changeLog);
+    return SQLITE_OK;
+}
+
+/*
+ * Writes pending changes to [.change_log]. xSync is called in the first phase of commit,
+ * when transaction can still modify database (commit hook cannot do that)
+ */
+static int _sync(sqlite3_vtab *pVTab)
+{
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) pVTab;
+    return flexi_ChangeLog_flush(&vtab->pCtx->changeLog);
+}
+
+static int _rollback(sqlite3_vtab *pVTab)
+{
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) pVTab;
+    flexi_ChangeLog_discard(&vtab->pCtx->changeLog);
+
+    // Names inserted by rolled back transaction do not exist anymore
+    flexi_NameCache_clear(&vtab->pCtx->nameCache);
+    return SQLITE_OK;
+}
+
+static int _commit(sqlite3_vtab *pVTab)
+{
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) pVTab;
+
+    // All changes are expected to be already written by xSync
+    flexi_ChangeLog_discard(&vtab->pCtx->changeLog);
+    return SQLITE_OK;
+}
+
+static int _savepoint(sqlite3_vtab *pVTab, int iSavepoint)
+{
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) pVTab;
+    return flexi_ChangeLog_savepoint(&vtab->pCtx->changeLog, iSavepoint);
+}
+
+static int _release(sqlite3_vtab *pVTab, int iSavepoint)
+{
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) pVTab;
+    flexi_ChangeLog_release(&vtab->pCtx->changeLog, iSavepoint);
+    return SQLITE_OK;
+}
+
+static int _rollbackTo(sqlite3_vtab *pVTab, int iSavepoint)
+{
+    struct flexi_ClassDef_t *vtab = (struct flexi_ClassDef_t *) pVTab;
+    flexi_ChangeLog_rollbackTo(&vtab->pCtx->changeLog, iSavepoint);
+    flexi_NameCache_clear(&vtab->pCtx->nameCache);
+    return SQLITE_OK;
+}
+
 /*
 *
 Class definition
@@ -915,7 +2412,7 @@ int (*xRollbackTo)(sqlite3_vtab *pVTab, int);
 
 */
 sqlite3_module _classDefProxyModule = {
-        .iVersion = 0,
+        .iVersion = 2,
         .xCreate = NULL,
         .xConnect = NULL,
         .xBestIndex = _best_index,
@@ -929,12 +2426,13 @@ sqlite3_module _classDefProxyModule = {
         .xColumn = _column,
         .xRowid = _row_id,
         .xUpdate = _update,
-        .xBegin = NULL,
-        .xSync = NULL,
-        .xCommit= NULL,
-        .xRollback = NULL,
+        .xBegin = _begin,
+        .xSync = _sync,
+        .xCommit= _commit,
+        .xRollback = _rollback,
         .xFindFunction = _find_method,
         .xRename = _rename,
-        .xSavepoint = NULL,
-        .xRelease = NULL
+        .xSavepoint = _savepoint,
+        .xRelease = _release,
+        .xRollbackTo = _rollbackTo
 };
@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include "flexi_db_ctx.h"
 #include "flexi_class.h"
+#include "flexi_class_cache.h"
 #include "../misc/regexp.h"
 
 /*
@@ -46,16 +47,14 @@ static void
 _RefValue_combiner(RBNode *existing, const RBNode *newdata, void *arg)
 {}
 
+/*
+ * Nodes are allocated in request arena and released all at once by flexi_Context_endRequest
+ */
 static RBNode *
 _RefValue_alloc(void *arg)
 {
-    return sqlite3_malloc(sizeof(flexi_RefValue_t));
-}
-
-static void
-_RefValue_free(RBNode *x, void *arg)
-{
-    sqlite3_free(x);
+    auto pCtx = static_cast<struct flexi_Context_t *>(arg);
+    return static_cast<RBNode *>(Arena_alloc(&pCtx->requestArena, sizeof(flexi_RefValue_t)));
 }
 
 /*
@@ -68,14 +67,33 @@ struct flexi_Context_t *flexi_Context_new(sqlite3 *db)
         return NULL;
     memset(result, 0, sizeof(struct flexi_Context_t));
     result->db = db;
-    HashTable_init(&result->classDefsByName, DICT_STRING, (void *) flexi_ClassDef_free);
-    HashTable_init(&result->classDefsById, DICT_INT, _dummy_ptr);
+    FlatHash_init(&result->classDefsByName, DICT_STRING, (void *) flexi_ClassDef_free);
+    FlatHash_init(&result->classDefsById, DICT_INT, _dummy_ptr);
 
     rb_create(&result->refValueCache, sizeof(flexi_RefValue_t),
-              _RefValue_comparer, _RefValue_combiner, _RefValue_alloc, _RefValue_free, result);
+              _RefValue_comparer, _RefValue_combiner, _RefValue_alloc, NULL, result);
+    Arena_init(&result->requestArena);
+    flexi_ChangeLog_init(&result->changeLog, db);
+    flexi_StmtCache_init(&result->stmtCache, 0);
+    flexi_NameCache_init(&result->nameCache);
     return result;
 }
 
+void flexi_Context_beginRequest(struct flexi_Context_t *pCtx)
+{
+    pCtx->nRequestDepth++;
+}
+
+void flexi_Context_endRequest(struct flexi_Context_t *pCtx)
+{
+    assert(pCtx->nRequestDepth > 0);
+    if (--pCtx->nRequestDepth == 0)
+    {
+        rb_reset(&pCtx->refValueCache);
+        Arena_reset(&pCtx->requestArena);
+    }
+}
+
 /*
  * Gets name ID by value. Name is expected to exist
  */
@@ -86,6 +104,13 @@ int flexi_Context_getNameId(struct flexi_Context_t *pCtx,
     sqlite3_stmt *p;
     if (pNameID)
     {
+        const flexi_NameEntry_t *pEntry = flexi_NameCache_findByValue(&pCtx->nameCache, zName);
+        if (pEntry != NULL)
+        {
+            *pNameID = pEntry->lNameID;
+            return SQLITE_OK;
+        }
+
         flexi_Context_stmtInit(pCtx, STMT_SEL_NAME_ID,
                                "select NameID from [.names] where [Value] = :1;",
                                &p);
@@ -96,6 +121,7 @@ int flexi_Context_getNameId(struct flexi_Context_t *pCtx,
             return stepRes;
 
         *pNameID = sqlite3_column_int64(p, 0);
+        CHECK_CALL(flexi_NameCache_add(&pCtx->nameCache, *pNameID, zName));
     }
 
     result = SQLITE_OK;
@@ -174,6 +200,14 @@ int flexi_Context_insertName(struct flexi_Context_t *pCtx, const char *zName, sq
 {
     int result;
     assert(zName);
+
+    // Most names already exist
+    if (flexi_NameCache_findByValue(&pCtx->nameCache, zName) != NULL)
+    {
+        CHECK_CALL(flexi_Context_getNameId(pCtx, zName, pNameID));
+        goto EXIT;
+    }
+
     {
         sqlite3_stmt *p;
         const char *zInsNameSQL = "insert or replace into [.names] ([Value], NameID)"
@@ -199,8 +233,13 @@ int flexi_Context_insertName(struct flexi_Context_t *pCtx, const char *zName, sq
 static void
 _freeMetadata(struct flexi_Context_t *pCtx)
 {
-    HashTable_clear(&pCtx->classDefsByName);
-    HashTable_clear(&pCtx->classDefsById);
+    FlatHash_clear(&pCtx->classDefsByName);
+    FlatHash_clear(&pCtx->classDefsById);
+    flexi_NameCache_clear(&pCtx->nameCache);
+
+    // Snapshot stays alive while class definitions from it are still in use
+    flexi_ClassSnapshot_release(pCtx->pClassSnapshot);
+    pCtx->pClassSnapshot = NULL;
 }
 
 void flexi_Context_free(struct flexi_Context_t *pCtx)
@@ -214,27 +253,13 @@ void flexi_Context_free(struct flexi_Context_t *pCtx)
             pCtx->pStmts[ii] = NULL;
         }
     }
-
-    if (pCtx->pMatchFuncSelStmt != NULL)
-    {
-        sqlite3_finalize(pCtx->pMatchFuncSelStmt);
-        pCtx->pMatchFuncSelStmt = NULL;
-    }
-
-    if (pCtx->pMatchFuncInsStmt != NULL)
-    {
-        sqlite3_finalize(pCtx->pMatchFuncInsStmt);
-        pCtx->pMatchFuncInsStmt = NULL;
-    }
-
-    if (pCtx->pMemDB != NULL)
-    {
-        sqlite3_close(pCtx->pMemDB);
-        pCtx->pMemDB = NULL;
-    }
+    flexi_StmtCache_clear(&pCtx->stmtCache);
+    flexi_NameCache_free(&pCtx->nameCache);
 
     flexi_UserInfo_free(pCtx->pCurrentUser);
 
+    flexi_ChangeLog_clear(&pCtx->changeLog);
+
     _freeMetadata(pCtx);
 
     /*
@@ -245,7 +270,8 @@ void flexi_Context_free(struct flexi_Context_t *pCtx)
 
     sqlite3_free(pCtx->zLastErrorMessage);
 
-    // TODO rb_delete(&pCtx->refValueCache);
+    rb_reset(&pCtx->refValueCache);
+    Arena_clear(&pCtx->requestArena);
 
     sqlite3_free(pCtx);
 }
@@ -341,8 +367,8 @@ int flexi_Context_addClassDef(struct flexi_Context_t *self, flexi_ClassDef_t *pC
 {
     int result;
 
-    HashTable_set(&self->classDefsByName, (DictionaryKey_t) {.pKey = pClassDef->name.name}, pClassDef);
-    HashTable_set(&self->classDefsById, (DictionaryKey_t) {.iKey = pClassDef->lClassID}, pClassDef);
+    FlatHash_set(&self->classDefsByName, (DictionaryKey_t) {.pKey = pClassDef->name.name}, pClassDef);
+    FlatHash_set(&self->classDefsById, (DictionaryKey_t) {.iKey = pClassDef->lClassID}, pClassDef);
     pClassDef->nRefCount++;
 
     result = SQLITE_OK;
@@ -357,13 +383,13 @@ int flexi_Context_addClassDef(struct flexi_Context_t *self, flexi_ClassDef_t *pC
 
 int flexi_Context_getClassByName(struct flexi_Context_t *self, const char *zClassName, flexi_ClassDef_t **ppClassDef)
 {
-    *ppClassDef = HashTable_get(&self->classDefsByName, (DictionaryKey_t) {.pKey = zClassName});
+    *ppClassDef = FlatHash_get(&self->classDefsByName, (DictionaryKey_t) {.pKey = zClassName});
     return *ppClassDef != NULL;
 }
 
 int flexi_Context_getClassById(struct flexi_Context_t *self, sqlite3_int64 lClassId, flexi_ClassDef_t **ppClassDef)
 {
-    *ppClassDef = HashTable_get(&self->classDefsByName, (DictionaryKey_t) {.iKey = lClassId});
+    *ppClassDef = FlatHash_get(&self->classDefsById, (DictionaryKey_t) {.iKey = lClassId});
     return *ppClassDef != NULL;
 }
 
@@ -441,7 +467,7 @@ int flexi_Context_userVersion(struct flexi_Context_t *pCtx, sqlite3_int64 *plUse
         if (true == bIncrement)
         {
             (*plUserVersion)++;
-            zSetUserVersion = sqlite3_mprintf("pragma user_version=%" PRId64, plUserVersion);
+            zSetUserVersion = sqlite3_mprintf("pragma user_version=%" PRId64, *plUserVersion);
             CHECK_CALL(sqlite3_exec(pCtx->db, zSetUserVersion, NULL, NULL, &pCtx->zLastErrorMessage));
         }
 
@@ -453,6 +479,8 @@ int flexi_Context_userVersion(struct flexi_Context_t *pCtx, sqlite3_int64 *plUse
     ONERROR:
 
     EXIT:
+    if (pCtx->pStmts[STMT_USER_VERSION_GET] != NULL)
+        sqlite3_reset(pCtx->pStmts[STMT_USER_VERSION_GET]);
     sqlite3_free(zSetUserVersion);
     return result;
 }
@@ -498,13 +526,24 @@ int flexi_Context_getNameValueByID(struct flexi_Context_t *pCtx, sqlite3_int64 l
 {
     int result;
     sqlite3_stmt *pStmt;
+    const flexi_NameEntry_t *pEntry = flexi_NameCache_findByID(&pCtx->nameCache, lNameID);
+    if (pEntry != NULL)
+    {
+        *pzName = sqlite3_mprintf("%s", pEntry->zValue);
+        return *pzName != NULL ? SQLITE_OK : SQLITE_NOMEM;
+    }
+
     flexi_Context_stmtInit(pCtx, STMT_GET_NAME_BY_ID, "select [Value] from [.names_props] where ID = :1 limit 1;",
                            &pStmt);
     sqlite3_bind_int64(pStmt, 1, lNameID);
     result = sqlite3_step(pStmt);
     if (result == SQLITE_ROW)
     {
-        CHECK_CALL(getColumnAsText(pzName, pStmt, 1));
+        CHECK_CALL(getColumnAsText(pzName, pStmt, 0));
+        if (*pzName != NULL)
+        {
+            CHECK_CALL(flexi_NameCache_add(&pCtx->nameCache, lNameID, *pzName));
+        }
         result = SQLITE_OK;
     }
     else
@@ -530,10 +569,12 @@ int flexi_Context_stmtInit(struct flexi_Context_t *pCtx, enum FLEXI_CTX_STMT stm
 
     if (pCtx->pStmts[stmt] == NULL)
     {
+        pCtx->stmtCache.nMisses++;
         CHECK_STMT_PREPARE(pCtx->db, zSql, &pCtx->pStmts[stmt]);
     }
     else
     {
+        pCtx->stmtCache.nHits++;
         CHECK_SQLITE(pCtx->db, sqlite3_reset(pCtx->pStmts[stmt]));
     }
 
@@ -561,3 +602,8 @@ void flexi_config_func(sqlite3_context *context,
     // TODO current_user
     // TODO row_mode
 }
+
+int flexi_Context_getStmt(struct flexi_Context_t *pCtx, const char *zSql, sqlite3_stmt **ppStmt)
+{
+    return flexi_StmtCache_get(&pCtx->stmtCache, pCtx->db, zSql, ppStmt);
+}
@@ -11,9 +11,13 @@ extern "C" {
 
 #include <sqlite3ext.h>
 #include "../util/hash.h"
+#include "../util/FlatHash.h"
 #include "flexi_UserInfo_t.h"
 #include "../util/Array.h"
 #include "../util/rbtree.h"
+#include "flexi_change_log.h"
+#include "flexi_stmt_cache.h"
+#include "flexi_name_cache.h"
 
 /*
  * Forward declaration
@@ -109,6 +113,12 @@ enum FLEXI_CTX_STMT
     // Load from .ref-values by object ID
             STMT_SEL_REF_VALUES = 27,
 
+    // Load binary class image
+            STMT_SEL_CLS_IMAGE = 28,
+
+    // Save binary class image
+            STMT_INS_CLS_IMAGE = 29,
+
     // Should be last one in the list
             STMT_DEL_FTS = 30
 };
@@ -149,22 +159,16 @@ typedef struct flexi_Context_t
     sqlite3_stmt *pStmts[STMT_DEL_FTS + 1];
 
     /*
-     * In-memory database used for certain operations, e.g. MATCH function on non-FTS indexed columns.
-     * Lazy-opened and initialized on demand, on first attempt to use it.
+     * LRU cache of ad hoc statements (see flexi_Context_getStmt).
+     * Its hit/miss counters also include predefined statements (pStmts)
      */
-    sqlite3 *pMemDB;
+    flexi_StmtCache_t stmtCache;
 
     /*
-     * Prepared SQL statement used by MATCH function on non-FTS indexed columns to insert temporary rows
-     * into full text index table
+     * Intern table of symbolic names, used by flexi_Context_getNameId, flexi_Context_insertName
+     * and flexi_Context_getNameValueByID
      */
-    sqlite3_stmt *pMatchFuncInsStmt;
-
-    /*
-     * Prepared SQL statement used by MATCH function on non-FTS indexed columns to select temporary rows
-     * from full text index table
-     */
-    sqlite3_stmt *pMatchFuncSelStmt;
+    flexi_NameCache_t nameCache;
 
     /*
      * Info on current user
@@ -174,10 +178,10 @@ typedef struct flexi_Context_t
     /*
      * Hash of loaded class definitions (by current names)
      */
-    Hash classDefsByName;
+    FlatHash classDefsByName;
 
     // TODO Init and use
-    Hash classDefsById;
+    FlatHash classDefsById;
 
     /*
      * Last error
@@ -187,6 +191,12 @@ typedef struct flexi_Context_t
 
     sqlite3_int64 lUserVersion;
 
+    /*
+     * Class definitions snapshot for lUserVersion, shared with other connections to the same database
+     * (see flexi_class_cache.h)
+     */
+    struct flexi_ClassSnapshot_t *pClassSnapshot;
+
     /*
      * Number of open vtables.
      */
@@ -197,16 +207,42 @@ typedef struct flexi_Context_t
     /*
      * RB tree of existing ref-values rows processed during current request (flexi and flexi_data calls)
      * Tree is ordered by objectID, propertyID, property index
-     * Items in tree are flexi_RefValue_t
+     * Items in tree are flexi_RefValue_t, allocated in requestArena
      * Cache gets cleared on every exit
      */
     struct RBTree refValueCache;
+
+    /*
+     * Storage for transient data of current request (flexi_data write or cursor): ref-value cache nodes,
+     * parsed JSON nodes etc. Reset at once when outermost request ends
+     */
+    Arena_t requestArena;
+
+    /*
+     * Number of nested requests in progress. See flexi_Context_beginRequest
+     */
+    int nRequestDepth;
+
+    /*
+     * Pending changes to be written to [.change_log] when transaction gets committed
+     */
+    flexi_ChangeLog_t changeLog;
 } flexi_Context_t;
 
 struct flexi_Context_t *flexi_Context_new(sqlite3 *db);
 
 void flexi_Context_free(struct flexi_Context_t *data);
 
+/*
+ * Starts request scope. Requests may be nested (e.g. update of flexi_data while its cursor is open)
+ */
+void flexi_Context_beginRequest(struct flexi_Context_t *pCtx);
+
+/*
+ * Ends request scope. When outermost request ends, ref-value cache is cleared and request arena is reset
+ */
+void flexi_Context_endRequest(struct flexi_Context_t *pCtx);
+
 /*
  * Finds class by its name. Returns found ID in pClassID. If class not found, sets pClassID to -1;
  * Returns SQLITE_OK if operation was executed successfully, or SQLITE error code
@@ -298,6 +334,12 @@ int flexi_Context_getNameValueByID(struct flexi_Context_t *pCtx, sqlite3_int64 l
 int flexi_Context_stmtInit(struct flexi_Context_t *pCtx, enum FLEXI_CTX_STMT stmt, const char *zSql,
                            sqlite3_stmt **pStmt);
 
+/*
+ * Returns prepared statement for zSql from connection's statement cache.
+ * Statement is owned by cache and must not be finalized by caller
+ */
+int flexi_Context_getStmt(struct flexi_Context_t *pCtx, const char *zSql, sqlite3_stmt **ppStmt);
+
 /*
  * flexi('config', name [, value])
  */
@@ -34,6 +34,31 @@
 //#define CTLO_NO_TRACK_CHANGES        1 << 49
 //#define CTLO_SCHEMA_NOT_ENFORCED     1 << 50
 
+/*
+ * Flags to exclude data from [.change_log]. Values match Constants.CTLO_FLAGS and Constants.CTLV_FLAGS (Lua)
+ */
+#define CTLO_NO_TRACK_CHANGES        0x4000000000LL
+#define CTLV_NO_TRACK_CHANGES        0x0400
+
+/*
+ * Layout of [.objects].ctlo and [.objects].vtypes for mapped columns A - P (see Constants.CTLO_FLAGS).
+ * ctlo has unique flag at bit (CTLO_UNIQUE_SHIFT + column index), index flag - at (CTLO_INDEX_SHIFT + column index).
+ * vtypes has 3 bits of value type per column
+ */
+#define CTLO_UNIQUE_SHIFT            0
+#define CTLO_INDEX_SHIFT             16
+#define CTLV_VTYPE_MASK              0x0007
+#define CTLV_UNIQUE                  0x0008
+#define CTLV_INDEX                   0x0010
+
+/*
+ * Reference kind in [.ref-values].ctlv (see Constants.CTLV_FLAGS). Value of reference is ID of referenced object.
+ * CTLV_REF_DELETE_B_WHEN_A and CTLV_REF_DELETE_COUNTERPART are used for owned (nested) objects
+ */
+#define CTLV_REF_MASK                0x00E0
+#define CTLV_REF_DELETE_B_WHEN_A     0x0040
+#define CTLV_REF_DELETE_COUNTERPART  0x0080
+
 /*
  ctlv is used for indexing and processing control. Possible values (the same as Values.ctlv):
  0 - Index
@@ -20,12 +20,9 @@ extern "C"
 #include "../project_defs.h"
 #include "flexi_class.h"
 #include "../util/Path.h"
-
-extern "C"
-{
-LUALIB_API int luaopen_lsqlite3(lua_State *L);
-int luaopen_cjson(lua_State *l);
-}
+#include "flexi_lua_pool.h"
+#include "flexi_ref_expand.h"
+#include "flexi_json_export.h"
 
 static int flexi_help_func(sqlite3_context *context,
                            int argc,
@@ -84,9 +81,70 @@ static int flexi_init_func(sqlite3_context *context,
 
 //thread_local auto pDukCtx = std::unique_ptr<DukContext>(new DukContext());
 
+static void _pushValue(lua_State *L, sqlite3_value *pValue)
+{
+    switch (sqlite3_value_type(pValue))
+    {
+        case SQLITE_INTEGER:
+            lua_pushinteger(L, (lua_Integer) sqlite3_value_int64(pValue));
+            break;
+
+        case SQLITE_FLOAT:
+            lua_pushnumber(L, sqlite3_value_double(pValue));
+            break;
+
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+            lua_pushlstring(L, static_cast<const char *>(sqlite3_value_blob(pValue)),
+                            (size_t) sqlite3_value_bytes(pValue));
+            break;
+
+        default:
+            lua_pushnil(L);
+            break;
+    }
+}
+
+static void _setResult(sqlite3_context *context, lua_State *L, int idx)
+{
+    switch (lua_type(L, idx))
+    {
+        case LUA_TNIL:
+        case LUA_TNONE:
+            sqlite3_result_null(context);
+            break;
+
+        case LUA_TBOOLEAN:
+            sqlite3_result_int(context, lua_toboolean(L, idx));
+            break;
+
+        case LUA_TNUMBER:
+        {
+            lua_Number v = lua_tonumber(L, idx);
+            auto i = (sqlite3_int64) v;
+            if ((lua_Number) i == v)
+                sqlite3_result_int64(context, i);
+            else sqlite3_result_double(context, v);
+            break;
+        }
+
+        case LUA_TSTRING:
+        {
+            size_t len;
+            const char *z = lua_tolstring(L, idx, &len);
+            sqlite3_result_text(context, z, (int) len, SQLITE_TRANSIENT);
+            break;
+        }
+
+        default:
+            sqlite3_result_error(context, "Unsupported result type of flexi function", -1);
+            break;
+    }
+}
 
 /*
- * Central gateway to all Flexilite API
+ * Central gateway to all Flexilite API.
+ * Forwards call to Flexi:invoke(db, action, ...) in Lua state attached to the connection
  */
 static void flexi_func(sqlite3_context *context,
                        int argc,
@@ -99,126 +157,33 @@ static void flexi_func(sqlite3_context *context,
         return;
     }
 
-    /*
-     * TODO description
-     */
-    struct
-    {
-        const char *zMethod;
-
-        void (DBContext::*func)(sqlite3_context *, int, sqlite3_value **);
-
-        bool noTrn;
-
-        const char *zDescription;
-
-        const char *zHelp;
-    } methods[] = {
-            //            {"create class",          &DBContext::CreateClassFunc},
-            //            {"alter class",           &DBContext::AlterClassFunc},
-            //            {"drop class",            &DBContext::DropClassFunc},
-            //            {"rename class",          &DBContext::RenameClassFunc},
-            //            {"create property",       &DBContext::CreatePropFunc},
-            //            {"alter property",        &DBContext::AlterPropFunc},
-            //            {"drop property",         &DBContext::DropPropFunc},
-            //            {"rename property",       &DBContext::RenamePropFunc},
-            //            {"merge property",        &DBContext::MergePropFunc},
-            //            {"split property",        &DBContext::SplitPropFunc},
-            //
-            //            {"properties to object",  &DBContext::PropsToObjectFunc},
-            //            {"object to properties",  &DBContext::ObjectToPropsFunc},
-            //            {"property to reference", &DBContext::PropToRefFunc},
-            //            {"reference to property", &DBContext::RefToPropFunc},
-            //            {"change object class",   &DBContext::ChangeObjectClassFunc},
-            //
-            //            {"schema",                &DBContext::SchemaFunc},
-            //            {"config",                &DBContext::ConfigFunc},
-            //            {"structural merge",      &DBContext::StructuralMergeFunc},
-            //            {"structural split",      &DBContext::StructuralSplitFunc},
-            //            {"remove duplicates",     &DBContext::RemoveDuplicatesFunc},
-
-            /* TODO
-             * "structural merge" -- join 2+ objects to 1 object
-             * "structural split" -- reverse operation to structural split
-             * "remove duplicates" -- finds and merges duplicates by uid, code or name
-             *
-             */
-
-            //            {"init",                  &DBContext::InitDatabaseFunc},
-            //            {"help",                  &DBContext::UsageFunc, false},
-
-            // TODO
-            {"validate data", nullptr},
-    };
-
-
-    char *zMethodName = (char *) sqlite3_value_text(argv[0]);
+    auto pConn = static_cast<flexi_LuaConn_t *>(sqlite3_user_data(context));
+    lua_State *L = nullptr;
     char *zError = nullptr;
-    int result = SQLITE_OK;
-    return;
-
-    for (int ii = 0; ii < sizeof(methods) / sizeof(methods[0]); ii++)
+    if (flexi_LuaConn_getState(pConn, &L, &zError) != SQLITE_OK)
     {
-        if (sqlite3_stricmp(methods[ii].zMethod, zMethodName) == 0)
-        {
-            sqlite3 *db = nullptr;
-
-            if (!methods[ii].noTrn)
-            {
-                db = sqlite3_context_db_handle(context);
-
-                result = sqlite3_exec(db, "savepoint flexi1;", NULL, NULL, &zError);
-                if (result != SQLITE_OK)
-                {
-                    sqlite3_result_error(context, zError, -1);
-                    return;
-                }
-            }
-
-            // Check user_version
-            std::shared_ptr<DBContext> pCtx;
-            void *pData = sqlite3_user_data(context);
-            memmove(&pCtx, pData, sizeof(pCtx));
-            //            result = flexi_Context_checkMetaDataCache(pCtx);
-            if (result == SQLITE_OK)
-            {
-                auto method = methods[ii].func;
-                (*pCtx.*method)(context, argc - 1, &argv[1]);
-            }
-
-            if (!methods[ii].noTrn)
-            {
-                // Check if call finished with error
-                // TODO
-                if (result != SQLITE_OK)
-                {
-                    // Dump database
-                    result = sqlite3_exec(db, "rollback to savepoint flexi1;", NULL, NULL, &zError);
-                }
-                else
-                {
-                    result = sqlite3_exec(db, "release flexi1;", NULL, NULL, &zError);
-                }
-
-                if (result != SQLITE_OK)
-                {
-                    sqlite3_result_error(context, zError, -1);
-                }
-            }
-
-            if (result != SQLITE_OK)
-            {
-                sqlite3 *db = sqlite3_context_db_handle(context);
-                zError = (char *) sqlite3_errmsg(db);
-                sqlite3_result_error(context, zError, -1);
-            }
-
-            return;
-        }
+        sqlite3_result_error(context, zError != nullptr ? zError : "Cannot initialize Flexilite", -1);
+        sqlite3_free(zError);
+        return;
     }
 
-    zError = sqlite3_mprintf("Invalid method name: %s", zMethodName);
-    sqlite3_result_error(context, zError, -1);
+    int top = lua_gettop(L);
+
+    lua_getglobal(L, "Flexi");
+    lua_getfield(L, -1, "invoke");
+    lua_pushvalue(L, -2);
+    lua_pushlightuserdata(L, pConn->db);
+    for (int ii = 0; ii < argc; ii++)
+        _pushValue(L, argv[ii]);
+
+    // Returns result and error message
+    if (lua_pcall(L, argc + 2, 2, 0) != 0)
+        sqlite3_result_error(context, lua_tostring(L, -1), -1);
+    else if (!lua_isnil(L, -1))
+        sqlite3_result_error(context, lua_tostring(L, -1), -1);
+    else _setResult(context, L, -2);
+
+    lua_settop(L, top);
 }
 
 int flexi_data_init(
@@ -236,24 +201,11 @@ extern "C" int flexi_init(sqlite3 *db,
     {
         int result;
         sqlite3_stmt *pDummy = nullptr;
+        flexi_LuaConn_t *pConn = nullptr;
 
-        lua_State *L = luaL_newstate();
-        luaL_openlibs(L);
-        luaopen_lsqlite3(L);
-        luaopen_cjson(L);
-
-        char zCurrentDir[PATH_MAX + 1];
-        char *zLuaSrc = nullptr;
-        getcwd(zCurrentDir, PATH_MAX);
-        //        Path_join(&zLuaSrc, zCurrentDir, "../../src_lua/index.lua");
-        if (luaL_dofile(L, "/Users/ruslanskorynin/Documents/Github/slanska/flexilite/src_lua/index.lua"))
-        {
-            printf("doFile: %s\n", lua_tostring(L, -1));
-        }
-        printf("\nLua file\n");
-        lua_pop(L, 1);
-        lua_close(L);
-
+        // Lua state is taken from pool on first flexi call and returned on connection close
+        pConn = flexi_LuaConn_new(db);
+        CHECK_NULL(pConn);
 
         /*
          * TODO temp load from external file
@@ -279,15 +231,19 @@ extern "C" int flexi_init(sqlite3 *db,
         //        dukglue_peval(pDukCtx->getCtx(), str.str().c_str());
         //        DukValue dbVal = DukValue::take_from_stack(pDukCtx->getCtx());
 
-        CHECK_CALL(sqlite3_create_function_v2(db, "flexi", -1, SQLITE_UTF8,
-                                              nullptr, // Use db context id
-                                              flexi_func, nullptr, nullptr, nullptr));
+        // pConn is owned by function from this point, even if registration fails
+        CHECK_CALL(sqlite3_create_function_v2(db, "flexi", -1, SQLITE_UTF8, pConn,
+                                              flexi_func, nullptr, nullptr,
+                                              reinterpret_cast<void (*)(void *)>(flexi_LuaConn_free)));
+
+        // Lua state (and statements prepared by Lua) get released when connection is being closed
+        CHECK_CALL(flexi_LuaConn_register(pConn));
+
+        // Native batched loading of objects with referenced objects embedded
+        CHECK_CALL(flexi_RefExpand_createFunc(db));
 
-        // Execute 'flexi_data' with dummy call to enable finalization
-        //        CHECK_STMT_PREPARE(db, "select * from flexi_data();", &pDummy);
-        //        result = sqlite3_step(pDummy);
-        //        if (result != SQLITE_ROW && result != SQLITE_DONE)
-        //            goto ONERROR;
+        // Export of class as JSON, streamed in chunks
+        CHECK_CALL(flexi_JsonExport_register(db));
 
         result = SQLITE_OK;
         goto EXIT;
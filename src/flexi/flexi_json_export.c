@@ -0,0 +1,430 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#include <string.h>
+#include <stdint.h>
+
+#include "../project_defs.h"
+#include "flexi_json_export.h"
+
+SQLITE_EXTENSION_INIT3
+
+/*
+ * Next page of objects of class, by object ID
+ */
+#define FLEXI_JSON_EXPORT_PAGE_SQL \
+    "select ObjectID from [.objects] where ClassID = :1 and ObjectID > :2 order by ObjectID limit :3;"
+
+enum _EXPORT_COLUMNS
+{
+    EXPORT_COL_CHUNK = 0,
+    EXPORT_COL_CLASS_ID = 1,
+    EXPORT_COL_FETCH_DEPTH = 2,
+    EXPORT_COL_NESTED_ONLY = 3,
+    EXPORT_COL_AS_OBJECT = 4,
+    EXPORT_COL_CHUNK_SIZE = 5,
+    EXPORT_COL_COUNT = 6
+};
+
+typedef struct _ExportVTab_t
+{
+    sqlite3_vtab base;
+    sqlite3 *db;
+} _ExportVTab_t;
+
+typedef struct _ExportCursor_t
+{
+    sqlite3_vtab_cursor base;
+
+    /*
+     * Parameters, as passed to xFilter
+     */
+    sqlite3_int64 lClassID;
+    int iFetchDepth;
+    bool bNestedOnly;
+    bool bAsObject;
+    sqlite3_int64 nChunkSize;
+
+    /*
+     * Objects of current page, with referenced objects
+     */
+    flexi_RefExpand_t refs;
+    sqlite3_stmt *pPageStmt;
+    sqlite3_int64 aPageIDs[FLEXI_JSON_EXPORT_PAGE_SIZE];
+    int nPageCount;
+    int iNextObject;
+    sqlite3_int64 lLastObjectID;
+    bool bLastPage;
+
+    /*
+     * Output buffer, reused for all rows. Holds fragment of current row at the beginning, followed by
+     * the rest of the last appended object
+     */
+    StringBuilder_t sb;
+    uint64_t nChunk;
+    sqlite3_int64 nOutputCount;
+    bool bClosed;
+
+    sqlite3_int64 lRowid;
+    bool bEof;
+} _ExportCursor_t;
+
+static int _connect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                    sqlite3_vtab **ppVTab, char **pzErr)
+{
+    (void) pAux;
+    (void) argc;
+    (void) argv;
+    (void) pzErr;
+
+    int result = sqlite3_declare_vtab(db, "create table x(Chunk text, ClassID hidden, FetchDepth hidden, "
+            "NestedOnly hidden, AsObject hidden, ChunkSize hidden)");
+    if (result != SQLITE_OK)
+        return result;
+
+    _ExportVTab_t *vtab = sqlite3_malloc(sizeof(_ExportVTab_t));
+    if (vtab == NULL)
+        return SQLITE_NOMEM;
+    memset(vtab, 0, sizeof(*vtab));
+    vtab->db = db;
+    *ppVTab = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int _disconnect(sqlite3_vtab *pVTab)
+{
+    sqlite3_free(pVTab);
+    return SQLITE_OK;
+}
+
+/*
+ * Parameters are passed as equality constraints on hidden columns. idxNum has bit (iCol - 1) set for every
+ * passed parameter, and argv has parameters in order of columns
+ */
+static int _bestIndex(sqlite3_vtab *pVTab, sqlite3_index_info *pIdxInfo)
+{
+    (void) pVTab;
+    int aConstraint[EXPORT_COL_COUNT];
+    bool bClassIDUnusable = false;
+
+    for (int iCol = 0; iCol < EXPORT_COL_COUNT; iCol++)
+        aConstraint[iCol] = -1;
+
+    for (int ii = 0; ii < pIdxInfo->nConstraint; ii++)
+    {
+        const struct sqlite3_index_constraint *pConstr = &pIdxInfo->aConstraint[ii];
+        if (pConstr->iColumn < EXPORT_COL_CLASS_ID || pConstr->op != SQLITE_INDEX_CONSTRAINT_EQ)
+            continue;
+        if (!pConstr->usable)
+        {
+            if (pConstr->iColumn == EXPORT_COL_CLASS_ID)
+                bClassIDUnusable = true;
+            continue;
+        }
+        aConstraint[pConstr->iColumn] = ii;
+    }
+
+    // Class ID will be available in another plan
+    if (aConstraint[EXPORT_COL_CLASS_ID] < 0 && bClassIDUnusable)
+        return SQLITE_CONSTRAINT;
+
+    int iArg = 0;
+    pIdxInfo->idxNum = 0;
+    for (int iCol = EXPORT_COL_CLASS_ID; iCol < EXPORT_COL_COUNT; iCol++)
+    {
+        if (aConstraint[iCol] >= 0)
+        {
+            pIdxInfo->aConstraintUsage[aConstraint[iCol]].argvIndex = ++iArg;
+            pIdxInfo->aConstraintUsage[aConstraint[iCol]].omit = 1;
+            pIdxInfo->idxNum |= 1 << (iCol - 1);
+        }
+    }
+
+    // Chunks are returned in order of rowid
+    if (pIdxInfo->nOrderBy == 1 && pIdxInfo->aOrderBy[0].iColumn < 0 && !pIdxInfo->aOrderBy[0].desc)
+        pIdxInfo->orderByConsumed = 1;
+
+    pIdxInfo->estimatedCost = aConstraint[EXPORT_COL_CLASS_ID] >= 0 ? 1000 : 1e18;
+    pIdxInfo->estimatedRows = 1000;
+    return SQLITE_OK;
+}
+
+static int _open(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor)
+{
+    _ExportCursor_t *cur = sqlite3_malloc(sizeof(_ExportCursor_t));
+    if (cur == NULL)
+        return SQLITE_NOMEM;
+    memset(cur, 0, sizeof(*cur));
+    flexi_RefExpand_init(&cur->refs, ((_ExportVTab_t *) pVTab)->db, LOAD_ROW_MODE_EMBED_REFS, 1);
+    StringBuilder_init(&cur->sb);
+    cur->bEof = true;
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static int _close(sqlite3_vtab_cursor *pCursor)
+{
+    _ExportCursor_t *cur = (_ExportCursor_t *) pCursor;
+    flexi_RefExpand_clear(&cur->refs);
+    sqlite3_finalize(cur->pPageStmt);
+    StringBuilder_clear(&cur->sb);
+    sqlite3_free(cur);
+    return SQLITE_OK;
+}
+
+/*
+ * Copies message of the last error on connection to virtual table, so that it is reported by statement
+ */
+static int _setError(_ExportCursor_t *cur, int result)
+{
+    if (result != SQLITE_OK && result != SQLITE_NOMEM)
+    {
+        sqlite3_vtab *pVTab = cur->base.pVtab;
+        sqlite3_free(pVTab->zErrMsg);
+        pVTab->zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(((_ExportVTab_t *) pVTab)->db));
+    }
+    return result;
+}
+
+/*
+ * Loads the next page of objects with their referenced objects. Objects of previous page are released,
+ * as their JSON is already in output buffer
+ */
+static int _loadPage(_ExportCursor_t *cur)
+{
+    int result;
+
+    if (cur->pPageStmt == NULL)
+    {
+        CHECK_STMT_PREPARE(((_ExportVTab_t *) cur->base.pVtab)->db, FLEXI_JSON_EXPORT_PAGE_SQL, &cur->pPageStmt);
+    }
+
+    sqlite3_bind_int64(cur->pPageStmt, 1, cur->lClassID);
+    sqlite3_bind_int64(cur->pPageStmt, 2, cur->lLastObjectID);
+    sqlite3_bind_int(cur->pPageStmt, 3, FLEXI_JSON_EXPORT_PAGE_SIZE);
+
+    cur->nPageCount = 0;
+    cur->iNextObject = 0;
+    while ((result = sqlite3_step(cur->pPageStmt)) == SQLITE_ROW)
+        cur->aPageIDs[cur->nPageCount++] = sqlite3_column_int64(cur->pPageStmt, 0);
+    if (result != SQLITE_DONE)
+        goto ONERROR;
+
+    cur->bLastPage = cur->nPageCount < FLEXI_JSON_EXPORT_PAGE_SIZE;
+    if (cur->nPageCount > 0)
+        cur->lLastObjectID = cur->aPageIDs[cur->nPageCount - 1];
+
+    flexi_RefExpand_reset(&cur->refs);
+    CHECK_CALL(flexi_RefExpand_load(&cur->refs, cur->aPageIDs, cur->nPageCount));
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    sqlite3_reset(cur->pPageStmt);
+    return result;
+}
+
+/*
+ * Appends the next object of page to array (or to object with object IDs as keys)
+ */
+static int _appendNextObject(_ExportCursor_t *cur)
+{
+    sqlite3_int64 lObjectID = cur->aPageIDs[cur->iNextObject++];
+
+    if (cur->nOutputCount++ > 0)
+        StringBuilder_appendRaw(&cur->sb, ",", 1);
+    if (cur->bAsObject)
+    {
+        char zKey[32];
+        sqlite3_snprintf(sizeof(zKey), zKey, "\"%lld\":", lObjectID);
+        StringBuilder_appendRaw(&cur->sb, zKey, -1);
+    }
+    return flexi_RefExpand_appendJson(&cur->refs, lObjectID, &cur->sb);
+}
+
+/*
+ * Drops fragment of the previous row and appends objects, loading pages as needed, until there is
+ * complete chunk at the beginning of output buffer. After the last object, JSON is closed and the rest of
+ * buffer is returned in chunks
+ */
+static int _nextChunk(_ExportCursor_t *cur)
+{
+    int result;
+
+    if (cur->nChunk > 0)
+        StringBuilder_consume(&cur->sb, cur->nChunk);
+    cur->lRowid++;
+
+    while ((cur->nChunk = StringBuilder_chunkLength(&cur->sb, false)) == 0)
+    {
+        if (cur->iNextObject < cur->nPageCount)
+        {
+            CHECK_CALL(_appendNextObject(cur));
+        }
+        else if (!cur->bLastPage)
+        {
+            CHECK_CALL(_loadPage(cur));
+        }
+        else
+        {
+            if (!cur->bClosed)
+            {
+                StringBuilder_appendRaw(&cur->sb, cur->bAsObject ? "}" : "]", 1);
+                cur->bClosed = true;
+            }
+            cur->nChunk = StringBuilder_chunkLength(&cur->sb, true);
+            cur->bEof = cur->nChunk == 0;
+            break;
+        }
+    }
+
+    result = cur->sb.bErr ? SQLITE_NOMEM : SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    cur->bEof = true;
+
+    EXIT:
+    return result;
+}
+
+static int _filter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr,
+                   int argc, sqlite3_value **argv)
+{
+    (void) idxStr;
+    (void) argc;
+    int result;
+    _ExportCursor_t *cur = (_ExportCursor_t *) pCursor;
+
+    sqlite3_value *aParams[EXPORT_COL_COUNT] = {NULL};
+    int iArg = 0;
+    for (int iCol = EXPORT_COL_CLASS_ID; iCol < EXPORT_COL_COUNT; iCol++)
+    {
+        if (idxNum & (1 << (iCol - 1)))
+            aParams[iCol] = argv[iArg++];
+    }
+
+    if (aParams[EXPORT_COL_CLASS_ID] == NULL)
+    {
+        sqlite3_free(pCursor->pVtab->zErrMsg);
+        pCursor->pVtab->zErrMsg = sqlite3_mprintf(FLEXI_JSON_EXPORT_MODULE ": ClassID is required");
+        return SQLITE_ERROR;
+    }
+
+    cur->lClassID = sqlite3_value_int64(aParams[EXPORT_COL_CLASS_ID]);
+    cur->iFetchDepth = aParams[EXPORT_COL_FETCH_DEPTH] != NULL
+                       ? sqlite3_value_int(aParams[EXPORT_COL_FETCH_DEPTH]) : 1;
+    cur->bNestedOnly = aParams[EXPORT_COL_NESTED_ONLY] != NULL
+                       && sqlite3_value_int(aParams[EXPORT_COL_NESTED_ONLY]) != 0;
+    cur->bAsObject = aParams[EXPORT_COL_AS_OBJECT] != NULL && sqlite3_value_int(aParams[EXPORT_COL_AS_OBJECT]) != 0;
+    cur->nChunkSize = aParams[EXPORT_COL_CHUNK_SIZE] != NULL
+                      ? sqlite3_value_int64(aParams[EXPORT_COL_CHUNK_SIZE]) : 0;
+    if (cur->nChunkSize <= 0)
+        cur->nChunkSize = FLEXI_JSON_EXPORT_CHUNK_SIZE;
+
+    // Cursor may be filtered more than once
+    flexi_RefExpand_clear(&cur->refs);
+    flexi_RefExpand_init(&cur->refs, ((_ExportVTab_t *) pCursor->pVtab)->db,
+                         cur->bNestedOnly ? LOAD_ROW_MODE_EMBED_NESTED : LOAD_ROW_MODE_EMBED_REFS, cur->iFetchDepth);
+    if (cur->sb.nUsed > 0)
+        StringBuilder_consume(&cur->sb, cur->sb.nUsed);
+    cur->sb.bErr = false;
+    cur->sb.nChunkSize = (uint64_t) cur->nChunkSize;
+
+    cur->nPageCount = 0;
+    cur->iNextObject = 0;
+    cur->lLastObjectID = INT64_MIN;
+    cur->bLastPage = false;
+    cur->nChunk = 0;
+    cur->nOutputCount = 0;
+    cur->bClosed = false;
+    cur->lRowid = 0;
+    cur->bEof = false;
+
+    StringBuilder_appendRaw(&cur->sb, cur->bAsObject ? "{" : "[", 1);
+    CHECK_CALL(_nextChunk(cur));
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    _setError(cur, result);
+
+    EXIT:
+    return result;
+}
+
+static int _next(sqlite3_vtab_cursor *pCursor)
+{
+    _ExportCursor_t *cur = (_ExportCursor_t *) pCursor;
+    return _setError(cur, _nextChunk(cur));
+}
+
+static int _eof(sqlite3_vtab_cursor *pCursor)
+{
+    return ((_ExportCursor_t *) pCursor)->bEof;
+}
+
+static int _column(sqlite3_vtab_cursor *pCursor, sqlite3_context *pContext, int iCol)
+{
+    _ExportCursor_t *cur = (_ExportCursor_t *) pCursor;
+    switch (iCol)
+    {
+        case EXPORT_COL_CHUNK:
+            sqlite3_result_text(pContext, cur->sb.zBuf, (int) cur->nChunk, SQLITE_TRANSIENT);
+            break;
+
+        case EXPORT_COL_CLASS_ID:
+            sqlite3_result_int64(pContext, cur->lClassID);
+            break;
+
+        case EXPORT_COL_FETCH_DEPTH:
+            sqlite3_result_int(pContext, cur->iFetchDepth);
+            break;
+
+        case EXPORT_COL_NESTED_ONLY:
+            sqlite3_result_int(pContext, cur->bNestedOnly);
+            break;
+
+        case EXPORT_COL_AS_OBJECT:
+            sqlite3_result_int(pContext, cur->bAsObject);
+            break;
+
+        default:
+            sqlite3_result_int64(pContext, cur->nChunkSize);
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int _rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid)
+{
+    *pRowid = ((_ExportCursor_t *) pCursor)->lRowid;
+    return SQLITE_OK;
+}
+
+static sqlite3_module _exportModule = {
+        .iVersion = 1,
+        // Eponymous only
+        .xCreate = NULL,
+        .xConnect = _connect,
+        .xBestIndex = _bestIndex,
+        .xDisconnect = _disconnect,
+        .xDestroy = _disconnect,
+        .xOpen = _open,
+        .xClose = _close,
+        .xFilter = _filter,
+        .xNext = _next,
+        .xEof = _eof,
+        .xColumn = _column,
+        .xRowid = _rowid
+};
+
+int flexi_JsonExport_register(sqlite3 *db)
+{
+    return sqlite3_create_module_v2(db, FLEXI_JSON_EXPORT_MODULE, &_exportModule, NULL, NULL);
+}
@@ -0,0 +1,44 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_JSON_EXPORT_H
+#define FLEXILITE_FLEXI_JSON_EXPORT_H
+
+#include "flexi_ref_expand.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLEXI_JSON_EXPORT_MODULE "flexi_export_json"
+
+/*
+ * Number of objects loaded (with their referenced objects) at once
+ */
+#define FLEXI_JSON_EXPORT_PAGE_SIZE 256
+
+/*
+ * Default size of JSON fragment returned in one row
+ */
+#define FLEXI_JSON_EXPORT_CHUNK_SIZE 65536
+
+/*
+ * Registers eponymous table-valued function which exports all objects of class as one JSON value,
+ * returned in consecutive rows of fixed size:
+ *
+ * select Chunk from flexi_export_json(ClassID [, FetchDepth [, NestedOnly [, AsObject [, ChunkSize]]]]);
+ *
+ * Result is JSON array of objects (or, if AsObject is true, object with object IDs as keys), ordered by
+ * object ID, with referenced objects embedded as by flexi_expand_refs. Concatenation of Chunk values in order of
+ * rowid gives complete JSON. Chunks are up to ChunkSize bytes and do not split UTF-8 characters.
+ * Objects are loaded by pages of FLEXI_JSON_EXPORT_PAGE_SIZE, and output buffer is reused for all chunks,
+ * so memory does not depend on number of objects in class
+ */
+int flexi_JsonExport_register(sqlite3 *db);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_JSON_EXPORT_H
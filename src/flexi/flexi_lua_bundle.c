@@ -0,0 +1,43 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Registration of precompiled Lua modules in package.preload
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "flexi_lua_bundle.h"
+
+/*
+ * package.preload loader. Upvalue 1 is pointer to flexi_LuaModule_t
+ */
+static int _loadModule(lua_State *L)
+{
+    const flexi_LuaModule_t *pModule = (const flexi_LuaModule_t *) lua_touserdata(L, lua_upvalueindex(1));
+
+    if (luaL_loadbuffer(L, (const char *) pModule->pBytecode, pModule->nBytecode, pModule->zName) != 0)
+        return lua_error(L);
+
+    // Pass module name, as require does
+    lua_pushstring(L, pModule->zName);
+    lua_call(L, 1, 1);
+    return 1;
+}
+
+void flexi_LuaBundle_preload(lua_State *L)
+{
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "preload");
+
+    for (const flexi_LuaModule_t *pModule = flexi_LuaBundle; pModule->zName != NULL; pModule++)
+    {
+        lua_pushlightuserdata(L, (void *) pModule);
+        lua_pushcclosure(L, _loadModule, 1);
+        lua_setfield(L, -2, pModule->zName);
+    }
+
+    lua_pop(L, 2);
+}
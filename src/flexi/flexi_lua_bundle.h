@@ -0,0 +1,50 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_LUA_BUNDLE_H
+#define FLEXILITE_FLEXI_LUA_BUNDLE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Precompiled Lua module, embedded into Flexilite library.
+ * Array of modules (flexi_LuaBundle) is generated by util/lua2c.lua from src_lua/filelist.lua
+ * into src/resources/lua_bundle.res.c when library is built with FLEXI_LUA_BUNDLE option
+ */
+typedef struct flexi_LuaModule_t
+{
+    /*
+     * Name to be used in require
+     */
+    const char *zName;
+
+    /*
+     * LuaJIT bytecode
+     */
+    const unsigned char *pBytecode;
+    size_t nBytecode;
+} flexi_LuaModule_t;
+
+/*
+ * Terminated by item with zName == NULL
+ */
+extern const flexi_LuaModule_t flexi_LuaBundle[];
+
+struct lua_State;
+
+/*
+ * Registers all bundled modules in package.preload. Modules are not loaded at this point -
+ * bytecode of module gets loaded and executed by the first 'require'
+ */
+void flexi_LuaBundle_preload(struct lua_State *L);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_LUA_BUNDLE_H
@@ -0,0 +1,400 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Process wide pool of Lua states. See flexi_lua_pool.h
+ */
+
+extern "C"
+{
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include "flexi_lua_pool.h"
+#include "flexi_JsonTape_lua.h"
+#include "flexi_lua_bundle.h"
+
+#include <cstdlib>
+#include <cstring>
+
+extern "C"
+{
+LUALIB_API int luaopen_lsqlite3(lua_State *L);
+int luaopen_cjson(lua_State *l);
+}
+
+/*
+ * Idle Lua states
+ */
+static lua_State *aIdle[FLEXI_LUA_POOL_SIZE];
+static int nIdle = 0;
+
+static sqlite3_mutex *_mutex()
+{
+    return sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+}
+
+/*
+ * Calls Flexi:<zMethod>(db). On error, *pzError is set to error message
+ */
+static int _callFlexi(lua_State *L, const char *zMethod, sqlite3 *db, char **pzError)
+{
+    int top = lua_gettop(L);
+    int result = SQLITE_OK;
+
+    lua_getglobal(L, "Flexi");
+    lua_getfield(L, -1, zMethod);
+    lua_pushvalue(L, -2);
+    lua_pushlightuserdata(L, db);
+    if (lua_pcall(L, 2, 0, 0) != 0)
+    {
+        if (pzError != NULL)
+            *pzError = sqlite3_mprintf("Flexi:%s: %s", zMethod, lua_tostring(L, -1));
+        result = SQLITE_ERROR;
+    }
+
+    lua_settop(L, top);
+    return result;
+}
+
+/*
+ * Creates new Lua state with all Flexilite modules loaded
+ */
+static int _newState(lua_State **pL, char **pzError)
+{
+    int result;
+
+    lua_State *L = luaL_newstate();
+    if (L == NULL)
+        return SQLITE_NOMEM;
+
+    luaL_openlibs(L);
+
+    // Native modules available via require
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "preload");
+    lua_pushcfunction(L, luaopen_lsqlite3);
+    lua_setfield(L, -2, "lsqlite3");
+    lua_pushcfunction(L, luaopen_cjson);
+    lua_setfield(L, -2, "cjson");
+    lua_pushcfunction(L, luaopen_flexi_JsonTape);
+    lua_setfield(L, -2, "flexi_JsonTape");
+    lua_pop(L, 2);
+
+#ifdef FLEXI_LUA_BUNDLE
+    // Precompiled modules are loaded lazily, on first require
+    flexi_LuaBundle_preload(L);
+    lua_getglobal(L, "require");
+    lua_pushstring(L, "index");
+    result = lua_pcall(L, 1, 0, 0);
+#else
+    // Lua sources are loaded from directory set by FLEXI_LUA_PATH or at build time
+    const char *zLuaDir = getenv("FLEXI_LUA_PATH");
+    if (zLuaDir == NULL || *zLuaDir == 0)
+        zLuaDir = FLEXI_LUA_SRC_DIR;
+
+    lua_getglobal(L, "package");
+    lua_pushfstring(L, "%s/?.lua;", zLuaDir);
+    lua_getfield(L, -2, "path");
+    lua_concat(L, 2);
+    lua_setfield(L, -2, "path");
+    lua_pop(L, 1);
+
+    char *zIndex = sqlite3_mprintf("%s/index.lua", zLuaDir);
+    if (zIndex == NULL)
+    {
+        lua_close(L);
+        return SQLITE_NOMEM;
+    }
+    result = luaL_dofile(L, zIndex);
+    sqlite3_free(zIndex);
+#endif
+
+    if (result != 0)
+    {
+        *pzError = sqlite3_mprintf("Cannot initialize Flexilite Lua state: %s", lua_tostring(L, -1));
+        lua_close(L);
+        return SQLITE_ERROR;
+    }
+
+    *pL = L;
+    return SQLITE_OK;
+}
+
+/*
+ * Takes idle Lua state from pool or creates new one, and attaches it to connection
+ */
+static int _checkout(sqlite3 *db, lua_State **pL, char **pzError)
+{
+    int result;
+    lua_State *L = NULL;
+
+    sqlite3_mutex_enter(_mutex());
+    if (nIdle > 0)
+        L = aIdle[--nIdle];
+    sqlite3_mutex_leave(_mutex());
+
+    if (L == NULL)
+    {
+        CHECK_CALL(_newState(&L, pzError));
+    }
+
+    CHECK_CALL(_callFlexi(L, "attachConnection", db, pzError));
+
+    *pL = L;
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    if (L != NULL)
+        lua_close(L);
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Detaches Lua state from connection and puts it back to pool.
+ * State which cannot be detached cleanly is closed, as it may keep data of previous connection
+ */
+static void _checkin(sqlite3 *db, lua_State *L)
+{
+    if (_callFlexi(L, "detachConnection", db, NULL) != SQLITE_OK)
+    {
+        lua_close(L);
+        return;
+    }
+
+    sqlite3_mutex_enter(_mutex());
+    if (nIdle < FLEXI_LUA_POOL_SIZE)
+    {
+        aIdle[nIdle++] = L;
+        L = NULL;
+    }
+    sqlite3_mutex_leave(_mutex());
+
+    // Pool is full
+    if (L != NULL)
+        lua_close(L);
+}
+
+void flexi_LuaPool_clear()
+{
+    sqlite3_mutex_enter(_mutex());
+    while (nIdle > 0)
+        lua_close(aIdle[--nIdle]);
+    sqlite3_mutex_leave(_mutex());
+}
+
+flexi_LuaConn_t *flexi_LuaConn_new(sqlite3 *db)
+{
+    auto self = static_cast<flexi_LuaConn_t *>(sqlite3_malloc(sizeof(flexi_LuaConn_t)));
+    if (self != NULL)
+    {
+        self->db = db;
+        self->nRefCount = 1;
+        self->L = NULL;
+    }
+    return self;
+}
+
+int flexi_LuaConn_getState(flexi_LuaConn_t *self, lua_State **pL, char **pzError)
+{
+    int result;
+
+    if (self->L == NULL)
+    {
+        CHECK_CALL(_checkout(self->db, &self->L, pzError));
+    }
+
+    *pL = self->L;
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+void flexi_LuaConn_release(flexi_LuaConn_t *self)
+{
+    if (self->L != NULL)
+    {
+        _checkin(self->db, self->L);
+        self->L = NULL;
+    }
+}
+
+void flexi_LuaConn_free(flexi_LuaConn_t *self)
+{
+    if (self == NULL)
+        return;
+
+    if (self->nRefCount > 0)
+        self->nRefCount--;
+
+    if (self->nRefCount == 0)
+    {
+        flexi_LuaConn_release(self);
+        sqlite3_free(self);
+    }
+}
+
+/*
+ * Close hook virtual table. Has no rows. Its only purpose is xDisconnect, which is called
+ * by sqlite3_close before checking for unfinalized statements
+ */
+struct _ConnVTab_t
+{
+    sqlite3_vtab base;
+    flexi_LuaConn_t *pConn;
+};
+
+static int _connConnect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                        sqlite3_vtab **ppVTab, char **pzErr)
+{
+    (void) argc;
+    (void) argv;
+    (void) pzErr;
+
+    int result = sqlite3_declare_vtab(db, "create table x(dummy)");
+    if (result != SQLITE_OK)
+        return result;
+
+    auto vtab = static_cast<_ConnVTab_t *>(sqlite3_malloc(sizeof(_ConnVTab_t)));
+    if (vtab == NULL)
+        return SQLITE_NOMEM;
+    memset(vtab, 0, sizeof(*vtab));
+    vtab->pConn = static_cast<flexi_LuaConn_t *>(pAux);
+    vtab->pConn->nRefCount++;
+    *ppVTab = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int _connDisconnect(sqlite3_vtab *pVTab)
+{
+    auto vtab = reinterpret_cast<_ConnVTab_t *>(pVTab);
+
+    // Finalizes statements kept by Lua, so that connection can be closed
+    flexi_LuaConn_release(vtab->pConn);
+    flexi_LuaConn_free(vtab->pConn);
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+}
+
+static int _connBestIndex(sqlite3_vtab *pVTab, sqlite3_index_info *pIdxInfo)
+{
+    (void) pVTab;
+    pIdxInfo->estimatedCost = 1;
+    pIdxInfo->estimatedRows = 0;
+    return SQLITE_OK;
+}
+
+static int _connOpen(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor)
+{
+    (void) pVTab;
+    auto pCur = static_cast<sqlite3_vtab_cursor *>(sqlite3_malloc(sizeof(sqlite3_vtab_cursor)));
+    if (pCur == NULL)
+        return SQLITE_NOMEM;
+    memset(pCur, 0, sizeof(*pCur));
+    *ppCursor = pCur;
+    return SQLITE_OK;
+}
+
+static int _connClose(sqlite3_vtab_cursor *pCursor)
+{
+    sqlite3_free(pCursor);
+    return SQLITE_OK;
+}
+
+static int _connFilter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr,
+                       int argc, sqlite3_value **argv)
+{
+    (void) pCursor;
+    (void) idxNum;
+    (void) idxStr;
+    (void) argc;
+    (void) argv;
+    return SQLITE_OK;
+}
+
+static int _connNext(sqlite3_vtab_cursor *pCursor)
+{
+    (void) pCursor;
+    return SQLITE_OK;
+}
+
+static int _connEof(sqlite3_vtab_cursor *pCursor)
+{
+    (void) pCursor;
+    return 1;
+}
+
+static int _connColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *pContext, int iCol)
+{
+    (void) pCursor;
+    (void) iCol;
+    sqlite3_result_null(pContext);
+    return SQLITE_OK;
+}
+
+static int _connRowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid)
+{
+    (void) pCursor;
+    *pRowid = 0;
+    return SQLITE_OK;
+}
+
+static sqlite3_module _connModule = {
+        1,                     /* iVersion */
+        NULL,                  /* xCreate - eponymous only */
+        _connConnect,          /* xConnect */
+        _connBestIndex,        /* xBestIndex */
+        _connDisconnect,       /* xDisconnect */
+        _connDisconnect,       /* xDestroy */
+        _connOpen,             /* xOpen */
+        _connClose,            /* xClose */
+        _connFilter,           /* xFilter */
+        _connNext,             /* xNext */
+        _connEof,              /* xEof */
+        _connColumn,           /* xColumn */
+        _connRowid,            /* xRowid */
+        NULL,                  /* xUpdate */
+        NULL,                  /* xBegin */
+        NULL,                  /* xSync */
+        NULL,                  /* xCommit */
+        NULL,                  /* xRollback */
+        NULL,                  /* xFindFunction */
+        NULL,                  /* xRename */
+        NULL,                  /* xSavepoint */
+        NULL,                  /* xRelease */
+        NULL                   /* xRollbackTo */
+};
+
+int flexi_LuaConn_register(flexi_LuaConn_t *self)
+{
+    int result;
+    sqlite3_stmt *pStmt = NULL;
+
+    // Reference held by module is dropped by sqlite3_create_module_v2 if it fails
+    self->nRefCount++;
+    CHECK_CALL(sqlite3_create_module_v2(self->db, FLEXI_LUA_CONN_MODULE, &_connModule, self,
+                                        reinterpret_cast<void (*)(void *)>(flexi_LuaConn_free)));
+
+    // Eponymous table gets connected when it is used for the first time, and stays connected until
+    // connection is closed
+    CHECK_STMT_PREPARE(self->db, "select * from " FLEXI_LUA_CONN_MODULE ";", &pStmt);
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    sqlite3_finalize(pStmt);
+    return result;
+}
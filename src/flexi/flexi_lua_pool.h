@@ -0,0 +1,101 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_LUA_POOL_H
+#define FLEXILITE_FLEXI_LUA_POOL_H
+
+#include "../project_defs.h"
+
+/*
+ * Process wide pool of initialized Lua states.
+ *
+ * Creating Lua state (opening libraries, loading Flexilite modules and creating DBContext) is much more
+ * expensive than typical flexi call, so Lua states are not bound to connection for its whole life.
+ * Connection checks out Lua state from pool on first use and returns it back when connection gets closed.
+ * Lua state in pool keeps all modules loaded and its DBContext created - only per-connection state gets reset
+ * (see Flexi:attachConnection and Flexi:detachConnection in src_lua/index.lua).
+ *
+ * Lua state serves one connection at a time.
+ */
+
+#ifndef FLEXI_LUA_POOL_SIZE
+
+/*
+ * Max number of idle Lua states kept in pool. States returned to full pool get closed
+ */
+#define FLEXI_LUA_POOL_SIZE 16
+#endif
+
+#ifndef FLEXI_LUA_SRC_DIR
+
+/*
+ * Directory with Lua sources (index.lua and modules it requires), used when Lua modules are not
+ * embedded (FLEXI_LUA_BUNDLE is not defined). Can be overridden at runtime by FLEXI_LUA_PATH environment variable
+ */
+#define FLEXI_LUA_SRC_DIR "src_lua"
+#endif
+
+/*
+ * Name of eponymous virtual table used as connection close hook (see flexi_LuaConn_register)
+ */
+#define FLEXI_LUA_CONN_MODULE "flexi_conn"
+
+struct lua_State;
+
+/*
+ * Binding of database connection to Lua state.
+ * Passed as user data to 'flexi' function and to FLEXI_LUA_CONN_MODULE module, and held by connected
+ * module table. Each of them holds reference, so binding is freed by whichever gets destroyed last
+ * (function and module get replaced when extension is loaded again)
+ */
+typedef struct flexi_LuaConn_t
+{
+    sqlite3 *db;
+
+    int nRefCount;
+
+    /*
+     * NULL until connection uses Lua for the first time
+     */
+    struct lua_State *L;
+} flexi_LuaConn_t;
+
+/*
+ * Creates connection binding with one reference, owned by caller
+ */
+flexi_LuaConn_t *flexi_LuaConn_new(sqlite3 *db);
+
+/*
+ * Returns Lua state attached to connection. Checks out Lua state from pool on first call.
+ * On error, *pzError is set to error message, to be freed by sqlite3_free
+ */
+int flexi_LuaConn_getState(flexi_LuaConn_t *self, struct lua_State **pL, char **pzError);
+
+/*
+ * Registers eponymous virtual table, which returns Lua state to pool when connection is being closed.
+ * Lua keeps prepared statements between flexi calls, and sqlite3_close fails with SQLITE_BUSY while there
+ * are unfinalized statements, so Lua state cannot wait for 'flexi' function to be destroyed.
+ * sqlite3_close disconnects eponymous virtual tables before checking for statements, so the table
+ * gets connected here and its xDisconnect releases Lua state. Module and connected table add their own
+ * references to self
+ */
+int flexi_LuaConn_register(flexi_LuaConn_t *self);
+
+/*
+ * Returns Lua state (if any) to pool. Lua state is checked out again on the next use
+ */
+void flexi_LuaConn_release(flexi_LuaConn_t *self);
+
+/*
+ * Drops reference to connection binding. When the last reference is dropped, returns Lua state (if any)
+ * to pool and frees binding
+ */
+void flexi_LuaConn_free(flexi_LuaConn_t *self);
+
+/*
+ * Closes all idle Lua states
+ */
+void flexi_LuaPool_clear();
+
+#endif //FLEXILITE_FLEXI_LUA_POOL_H
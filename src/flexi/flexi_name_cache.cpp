@@ -0,0 +1,201 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * In-memory intern table of symbolic names. See flexi_name_cache.h
+ */
+
+#include <string.h>
+
+#include "../common/common.h"
+#include "flexi_name_cache.h"
+
+#ifndef SQLITE_CORE
+
+SQLITE_EXTENSION_INIT3
+
+#endif
+
+/*
+ * FNV-1a. Unlike HashTable_getStringHash, spreads values well enough in low bits,
+ * which are used as slot index
+ */
+static unsigned int _valueHash(const char *zValue, unsigned int *pnLen)
+{
+    unsigned int h = 2166136261u;
+    const unsigned char *p = (const unsigned char *) zValue;
+    while (*p != 0)
+    {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    *pnLen = (unsigned int) (p - (const unsigned char *) zValue);
+    return h;
+}
+
+static unsigned int _idHash(sqlite3_int64 lNameID)
+{
+    sqlite3_uint64 h = (sqlite3_uint64) lNameID * 0x9E3779B97F4A7C15ull;
+    return (unsigned int) (h >> 32);
+}
+
+/*
+ * Inserts entry into both hash tables. Tables are expected to have free slots
+ */
+static void _insert(flexi_NameCache_t *self, flexi_NameEntry_t *pEntry)
+{
+    unsigned int mask = self->nCapacity - 1;
+
+    unsigned int ii = pEntry->iHash & mask;
+    while (self->aByValue[ii] != NULL)
+        ii = (ii + 1) & mask;
+    self->aByValue[ii] = pEntry;
+
+    ii = _idHash(pEntry->lNameID) & mask;
+    while (self->aByID[ii] != NULL)
+        ii = (ii + 1) & mask;
+    self->aByID[ii] = pEntry;
+}
+
+/*
+ * Ensures that there is room for one more entry, keeping load factor below 0.7
+ */
+static int _reserve(flexi_NameCache_t *self)
+{
+    if (self->aByValue != NULL && (self->nCount + 1) * 10 < self->nCapacity * 7)
+        return SQLITE_OK;
+
+    unsigned int nOldCapacity = self->nCapacity;
+    flexi_NameEntry_t **aOld = self->aByValue;
+    unsigned int nNewCapacity = aOld == NULL ? FLEXI_NAME_CACHE_INIT_SIZE : nOldCapacity * 2;
+
+    auto aByValue = static_cast<flexi_NameEntry_t **>(sqlite3_malloc64(sizeof(flexi_NameEntry_t *) * nNewCapacity));
+    auto aByID = static_cast<flexi_NameEntry_t **>(sqlite3_malloc64(sizeof(flexi_NameEntry_t *) * nNewCapacity));
+    if (aByValue == NULL || aByID == NULL)
+    {
+        sqlite3_free(aByValue);
+        sqlite3_free(aByID);
+        return SQLITE_NOMEM;
+    }
+    memset(aByValue, 0, sizeof(flexi_NameEntry_t *) * nNewCapacity);
+    memset(aByID, 0, sizeof(flexi_NameEntry_t *) * nNewCapacity);
+
+    sqlite3_free(self->aByID);
+    self->aByValue = aByValue;
+    self->aByID = aByID;
+    self->nCapacity = nNewCapacity;
+
+    for (unsigned int ii = 0; ii < nOldCapacity; ii++)
+    {
+        if (aOld[ii] != NULL)
+            _insert(self, aOld[ii]);
+    }
+    sqlite3_free(aOld);
+
+    return SQLITE_OK;
+}
+
+void flexi_NameCache_init(flexi_NameCache_t *self)
+{
+    memset(self, 0, sizeof(*self));
+    Arena_init(&self->arena);
+}
+
+const flexi_NameEntry_t *flexi_NameCache_findByValue(flexi_NameCache_t *self, const char *zValue)
+{
+    if (self->nCount > 0)
+    {
+        unsigned int nLen;
+        unsigned int h = _valueHash(zValue, &nLen);
+        unsigned int mask = self->nCapacity - 1;
+        for (unsigned int ii = h & mask; self->aByValue[ii] != NULL; ii = (ii + 1) & mask)
+        {
+            flexi_NameEntry_t *pEntry = self->aByValue[ii];
+            if (pEntry->iHash == h && pEntry->nLen == nLen && memcmp(pEntry->zValue, zValue, nLen) == 0)
+            {
+                self->nHits++;
+                return pEntry;
+            }
+        }
+    }
+
+    self->nMisses++;
+    return NULL;
+}
+
+const flexi_NameEntry_t *flexi_NameCache_findByID(flexi_NameCache_t *self, sqlite3_int64 lNameID)
+{
+    if (self->nCount > 0)
+    {
+        unsigned int mask = self->nCapacity - 1;
+        for (unsigned int ii = _idHash(lNameID) & mask; self->aByID[ii] != NULL; ii = (ii + 1) & mask)
+        {
+            if (self->aByID[ii]->lNameID == lNameID)
+            {
+                self->nHits++;
+                return self->aByID[ii];
+            }
+        }
+    }
+
+    self->nMisses++;
+    return NULL;
+}
+
+int flexi_NameCache_add(flexi_NameCache_t *self, sqlite3_int64 lNameID, const char *zValue)
+{
+    // Lookups below are not counted in statistics
+    sqlite3_int64 nHits = self->nHits;
+    sqlite3_int64 nMisses = self->nMisses;
+    const flexi_NameEntry_t *pByValue = flexi_NameCache_findByValue(self, zValue);
+    const flexi_NameEntry_t *pByID = flexi_NameCache_findByID(self, lNameID);
+    self->nHits = nHits;
+    self->nMisses = nMisses;
+
+    if (pByValue != NULL && pByValue == pByID)
+        return SQLITE_OK;
+
+    // Name was renamed. Entries cannot be removed from open addressing tables, so start over
+    if (pByValue != NULL || pByID != NULL)
+        flexi_NameCache_clear(self);
+
+    if (_reserve(self) != SQLITE_OK)
+        return SQLITE_NOMEM;
+
+    unsigned int nLen;
+    unsigned int h = _valueHash(zValue, &nLen);
+    auto pEntry = static_cast<flexi_NameEntry_t *>(Arena_alloc(&self->arena, sizeof(flexi_NameEntry_t) + nLen));
+    if (pEntry == NULL)
+        return SQLITE_NOMEM;
+
+    pEntry->lNameID = lNameID;
+    pEntry->iHash = h;
+    pEntry->nLen = nLen;
+    memcpy(pEntry->zValue, zValue, nLen + 1);
+
+    _insert(self, pEntry);
+    self->nCount++;
+
+    return SQLITE_OK;
+}
+
+void flexi_NameCache_clear(flexi_NameCache_t *self)
+{
+    if (self->aByValue != NULL)
+    {
+        memset(self->aByValue, 0, sizeof(flexi_NameEntry_t *) * self->nCapacity);
+        memset(self->aByID, 0, sizeof(flexi_NameEntry_t *) * self->nCapacity);
+    }
+    self->nCount = 0;
+    Arena_reset(&self->arena);
+}
+
+void flexi_NameCache_free(flexi_NameCache_t *self)
+{
+    sqlite3_free(self->aByValue);
+    sqlite3_free(self->aByID);
+    Arena_clear(&self->arena);
+    self->aByValue = self->aByID = NULL;
+    self->nCapacity = self->nCount = 0;
+}
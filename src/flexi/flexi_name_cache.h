@@ -0,0 +1,88 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_NAME_CACHE_H
+#define FLEXILITE_FLEXI_NAME_CACHE_H
+
+#include <sqlite3ext.h>
+#include "../util/Arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Initial number of slots in name cache hash tables. Must be power of 2
+ */
+#define FLEXI_NAME_CACHE_INIT_SIZE 256
+
+/*
+ * Interned symbolic name ([.sym_names] row). Allocated in cache's arena together with its text
+ */
+typedef struct flexi_NameEntry_t
+{
+    sqlite3_int64 lNameID;
+    unsigned int iHash;
+    unsigned int nLen;
+    char zValue[1];
+} flexi_NameEntry_t;
+
+/*
+ * Bidirectional in-memory intern table of symbolic names (value -> ID and ID -> value).
+ * Uses 2 open addressing hash tables (linear probing) with pointers to the same entries,
+ * which are allocated in arena.
+ * Entries are added lazily, when name is looked up in or inserted into database. Cache is
+ * invalidated when PRAGMA user_version changes and on transaction rollback, as names inserted
+ * by rolled back transaction do not exist anymore.
+ */
+typedef struct flexi_NameCache_t
+{
+    Arena_t arena;
+
+    /*
+     * Hash tables by name value and by name ID. Both have nCapacity slots. Empty slots are NULL
+     */
+    flexi_NameEntry_t **aByValue;
+    flexi_NameEntry_t **aByID;
+    unsigned int nCapacity;
+
+    unsigned int nCount;
+
+    /*
+     * Statistics
+     */
+    sqlite3_int64 nHits;
+    sqlite3_int64 nMisses;
+} flexi_NameCache_t;
+
+void flexi_NameCache_init(flexi_NameCache_t *self);
+
+/*
+ * Returns cached entry or NULL
+ */
+const flexi_NameEntry_t *flexi_NameCache_findByValue(flexi_NameCache_t *self, const char *zValue);
+
+const flexi_NameEntry_t *flexi_NameCache_findByID(flexi_NameCache_t *self, sqlite3_int64 lNameID);
+
+/*
+ * Adds name to cache. If value or ID is already cached for another pair (name was renamed),
+ * whole cache gets reset first
+ */
+int flexi_NameCache_add(flexi_NameCache_t *self, sqlite3_int64 lNameID, const char *zValue);
+
+/*
+ * Removes all entries, but keeps allocated memory for reuse
+ */
+void flexi_NameCache_clear(flexi_NameCache_t *self);
+
+/*
+ * Releases all memory
+ */
+void flexi_NameCache_free(flexi_NameCache_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_NAME_CACHE_H
@@ -105,6 +105,18 @@ struct flexi_PropDef_t
      */
     unsigned char cRngBound;
 
+    /*
+     * Number of non null values ([.class_props].NonNullCount).
+     * Collected by database statistics and used by query planner. 0 if statistics is not available
+     */
+    sqlite3_int64 lNonNullCount;
+
+    /*
+     * Estimated number of distinct values ([.prop_stats].DistinctCount), collected by flexi('analyze').
+     * 0 if statistics is not available
+     */
+    sqlite3_int64 lDistinctCount;
+
     CHANGE_STATUS eChangeStatus;
 };
 
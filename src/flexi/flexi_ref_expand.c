@@ -0,0 +1,530 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "../project_defs.h"
+#include "flexi_eav.h"
+#include "flexi_ref_expand.h"
+#include "../util/JsonTape.h"
+
+SQLITE_EXTENSION_INIT3
+
+/*
+ * Objects of one level with all their values. IDs are passed as JSON array, so that level is loaded
+ * by one statement regardless of its size. IN list is iterated in order of IDs and every object is found by
+ * primary key, so rows come ordered by ObjectID, PropertyID, PropIndex without sorting.
+ * Objects without values have one row with NULL PropertyID. IDs of objects which do not exist are skipped
+ */
+#define FLEXI_REF_EXPAND_LOAD_SQL \
+    "select o.ObjectID, v.PropertyID, v.PropIndex, v.ctlv, v.[Value], n.[Value] " \
+    "from [.objects] o left join [.ref-values] v on v.ObjectID = o.ObjectID " \
+    "left join [.class_props] p on p.ID = v.PropertyID " \
+    "left join [.sym_names] n on n.ID = p.NameID " \
+    "where o.ObjectID in (select value from json_each(:1)) " \
+    "order by o.ObjectID, v.PropertyID, v.PropIndex;"
+
+static const char _hexDigits[] = "0123456789ABCDEF";
+
+static void _dummy_ptr(void *ptr)
+{
+    UNUSED_PARAM(ptr);
+}
+
+void flexi_RefExpand_init(flexi_RefExpand_t *self, sqlite3 *db, enum FLEXI_DATA_LOAD_ROW_MODES eLoadRowMode,
+                          int iFetchDepth)
+{
+    memset(self, 0, sizeof(*self));
+    self->db = db;
+    self->bNestedOnly = eLoadRowMode == LOAD_ROW_MODE_EMBED_NESTED;
+    self->iFetchDepth = eLoadRowMode == LOAD_ROW_MODE_EMBED_NESTED || eLoadRowMode == LOAD_ROW_MODE_EMBED_REFS
+                        ? iFetchDepth : 1;
+    FlatHash_init(&self->objectsById, DICT_INT, _dummy_ptr);
+    FlatHash_init(&self->propNamesById, DICT_INT, _dummy_ptr);
+    Arena_init(&self->arena);
+}
+
+void flexi_RefExpand_reset(flexi_RefExpand_t *self)
+{
+    self->nObjects = 0;
+    self->nValues = 0;
+    FlatHash_clear(&self->objectsById);
+    FlatHash_clear(&self->propNamesById);
+    Arena_reset(&self->arena);
+}
+
+void flexi_RefExpand_clear(flexi_RefExpand_t *self)
+{
+    sqlite3_finalize(self->pLoadStmt);
+    sqlite3_free(self->aObjects);
+    sqlite3_free(self->aValues);
+    FlatHash_clear(&self->objectsById);
+    FlatHash_clear(&self->propNamesById);
+    Arena_clear(&self->arena);
+    memset(self, 0, sizeof(*self));
+}
+
+/*
+ * Returns index of loaded object in aObjects, or -1 if object was not loaded
+ */
+static int _findObject(flexi_RefExpand_t *self, sqlite3_int64 lObjectID)
+{
+    DictionaryKey_t key = {.iKey = lObjectID};
+    intptr_t iObj = (intptr_t) FlatHash_get(&self->objectsById, key);
+    return (int) iObj - 1;
+}
+
+/*
+ * Returns true if value is reference which should be expanded
+ */
+static bool _isExpandedRef(const flexi_RefExpand_t *self, const flexi_ObjValue_t *pValue)
+{
+    int iRefKind = pValue->ctlv & CTLV_REF_MASK;
+    if (iRefKind == 0 || pValue->iType != SQLITE_INTEGER)
+        return false;
+    if (self->bNestedOnly)
+        return iRefKind == CTLV_REF_DELETE_B_WHEN_A || iRefKind == CTLV_REF_DELETE_COUNTERPART;
+    return true;
+}
+
+static int _addObject(flexi_RefExpand_t *self, sqlite3_int64 lObjectID, int iLevel)
+{
+    if (self->nObjects == self->nObjectsAlloc)
+    {
+        u32 nNewAlloc = self->nObjectsAlloc > 0 ? self->nObjectsAlloc * 2 : 64;
+        flexi_RefExpandObj_t *aNew = sqlite3_realloc64(self->aObjects, nNewAlloc * sizeof(*aNew));
+        if (aNew == NULL)
+            return SQLITE_NOMEM;
+        self->aObjects = aNew;
+        self->nObjectsAlloc = nNewAlloc;
+    }
+
+    flexi_RefExpandObj_t *pObj = &self->aObjects[self->nObjects++];
+    memset(pObj, 0, sizeof(*pObj));
+    pObj->lObjectID = lObjectID;
+    pObj->iLevel = iLevel;
+    pObj->iFirstValue = self->nValues;
+
+    DictionaryKey_t key = {.iKey = lObjectID};
+    FlatHash_set(&self->objectsById, key, (void *) (intptr_t) self->nObjects);
+    return SQLITE_OK;
+}
+
+/*
+ * Returns name of property, shared by all its values. Name is taken from iCol of load statement
+ * when property is met for the first time
+ */
+static int _getPropName(flexi_RefExpand_t *self, sqlite3_int64 lPropID, int iCol, const char **pzName)
+{
+    DictionaryKey_t key = {.iKey = lPropID};
+    *pzName = FlatHash_get(&self->propNamesById, key);
+    if (*pzName != NULL || sqlite3_column_type(self->pLoadStmt, iCol) == SQLITE_NULL)
+        return SQLITE_OK;
+
+    const char *zName = (const char *) sqlite3_column_text(self->pLoadStmt, iCol);
+    *pzName = Arena_dup(&self->arena, zName, (u32) sqlite3_column_bytes(self->pLoadStmt, iCol), true);
+    if (*pzName == NULL)
+        return SQLITE_NOMEM;
+    FlatHash_set(&self->propNamesById, key, (void *) *pzName);
+    return SQLITE_OK;
+}
+
+/*
+ * Appends value from current row of load statement to the last loaded object
+ */
+static int _addValue(flexi_RefExpand_t *self)
+{
+    int result;
+    sqlite3_stmt *pStmt = self->pLoadStmt;
+
+    if (self->nValues == self->nValuesAlloc)
+    {
+        u32 nNewAlloc = self->nValuesAlloc > 0 ? self->nValuesAlloc * 2 : 256;
+        flexi_RefExpandValue_t *aNew = sqlite3_realloc64(self->aValues, nNewAlloc * sizeof(*aNew));
+        CHECK_NULL(aNew);
+        self->aValues = aNew;
+        self->nValuesAlloc = nNewAlloc;
+    }
+
+    flexi_RefExpandValue_t *pItem = &self->aValues[self->nValues];
+    flexi_ObjValue_t *pValue = &pItem->value;
+    memset(pItem, 0, sizeof(*pItem));
+    pValue->lPropID = sqlite3_column_int64(pStmt, 1);
+    pValue->lPropIndex = sqlite3_column_int64(pStmt, 2);
+    pValue->ctlv = sqlite3_column_int(pStmt, 3);
+    pValue->iType = sqlite3_column_type(pStmt, 4);
+    switch (pValue->iType)
+    {
+        case SQLITE_INTEGER:
+            pValue->v.i = sqlite3_column_int64(pStmt, 4);
+            break;
+
+        case SQLITE_FLOAT:
+            pValue->v.d = sqlite3_column_double(pStmt, 4);
+            break;
+
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+        {
+            const void *pData = pValue->iType == SQLITE_TEXT ? (const void *) sqlite3_column_text(pStmt, 4)
+                                                             : sqlite3_column_blob(pStmt, 4);
+            pValue->nBytes = sqlite3_column_bytes(pStmt, 4);
+            pValue->v.z = pValue->nBytes > 0 ? Arena_dup(&self->arena, pData, (u32) pValue->nBytes, false) : "";
+            CHECK_NULL(pValue->v.z);
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    CHECK_CALL(_getPropName(self, pValue->lPropID, 5, &pItem->zPropName));
+
+    self->nValues++;
+    self->aObjects[self->nObjects - 1].nValues++;
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Loads objects with IDs from pIds (sealed set) as level iLevel
+ */
+static int _loadLevel(flexi_RefExpand_t *self, const IdSet_t *pIds, int iLevel)
+{
+    int result;
+
+    StringBuilder_t sbIds;
+    StringBuilder_init(&sbIds);
+
+    IdSetIterator_t it;
+    sqlite3_int64 lID;
+    IdSet_begin(pIds, &it, false);
+    StringBuilder_appendRaw(&sbIds, "[", 1);
+    for (bool bFirst = true; IdSet_next(&it, &lID); bFirst = false)
+    {
+        char zID[24];
+        sqlite3_snprintf(sizeof(zID), zID, bFirst ? "%lld" : ",%lld", lID);
+        StringBuilder_appendRaw(&sbIds, zID, -1);
+    }
+    StringBuilder_appendRaw(&sbIds, "]", 1);
+    if (sbIds.bErr)
+    {
+        result = SQLITE_NOMEM;
+        goto ONERROR;
+    }
+
+    CHECK_CALL(sqlite3_reset(self->pLoadStmt));
+    CHECK_CALL(sqlite3_bind_text(self->pLoadStmt, 1, sbIds.zBuf, (int) sbIds.nUsed, SQLITE_STATIC));
+
+    sqlite3_int64 lLastID = 0;
+    bool bHasLast = false;
+    while ((result = sqlite3_step(self->pLoadStmt)) == SQLITE_ROW)
+    {
+        sqlite3_int64 lObjectID = sqlite3_column_int64(self->pLoadStmt, 0);
+        if (!bHasLast || lObjectID != lLastID)
+        {
+            CHECK_CALL(_addObject(self, lObjectID, iLevel));
+            lLastID = lObjectID;
+            bHasLast = true;
+        }
+
+        if (sqlite3_column_type(self->pLoadStmt, 1) != SQLITE_NULL)
+        {
+            CHECK_CALL(_addValue(self));
+        }
+    }
+    if (result != SQLITE_DONE)
+        goto ONERROR;
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    // Statement must not keep pointer to buffer of IDs
+    sqlite3_reset(self->pLoadStmt);
+    sqlite3_clear_bindings(self->pLoadStmt);
+    StringBuilder_clear(&sbIds);
+    return result;
+}
+
+int flexi_RefExpand_load(flexi_RefExpand_t *self, const sqlite3_int64 *aObjectIDs, int nCount)
+{
+    int result;
+
+    IdSet_t ids;
+    IdSet_init(&ids);
+
+    if (self->pLoadStmt == NULL)
+    {
+        CHECK_CALL(sqlite3_prepare_v2(self->db, FLEXI_REF_EXPAND_LOAD_SQL, -1, &self->pLoadStmt, NULL));
+    }
+
+    for (int ii = 0; ii < nCount; ii++)
+    {
+        if (_findObject(self, aObjectIDs[ii]) < 0)
+        {
+            CHECK_CALL(IdSet_add(&ids, aObjectIDs[ii]));
+        }
+    }
+
+    for (int iLevel = 0; ids.nCount > 0; iLevel++)
+    {
+        CHECK_CALL(IdSet_seal(&ids));
+        u32 iFirstObj = self->nObjects;
+        CHECK_CALL(_loadLevel(self, &ids, iLevel));
+        IdSet_clear(&ids);
+
+        // Objects of the last level are output without expanding their references
+        if (iLevel + 1 >= self->iFetchDepth)
+            break;
+
+        // Collect objects referenced from this level which were not loaded yet. Duplicates are removed by seal
+        for (u32 iObj = iFirstObj; iObj < self->nObjects; iObj++)
+        {
+            const flexi_RefExpandObj_t *pObj = &self->aObjects[iObj];
+            for (u32 iValue = pObj->iFirstValue; iValue < pObj->iFirstValue + pObj->nValues; iValue++)
+            {
+                const flexi_ObjValue_t *pValue = &self->aValues[iValue].value;
+                if (_isExpandedRef(self, pValue) && _findObject(self, pValue->v.i) < 0)
+                {
+                    CHECK_CALL(IdSet_add(&ids, pValue->v.i));
+                }
+            }
+        }
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    IdSet_clear(&ids);
+    return result;
+}
+
+static void _appendValue(StringBuilder_t *pSB, const flexi_ObjValue_t *pValue)
+{
+    char zNum[32];
+    switch (pValue->iType)
+    {
+        case SQLITE_INTEGER:
+            sqlite3_snprintf(sizeof(zNum), zNum, "%lld", pValue->v.i);
+            StringBuilder_appendRaw(pSB, zNum, -1);
+            break;
+
+        case SQLITE_FLOAT:
+            // JSON has no representation for infinity and NaN
+            if (isfinite(pValue->v.d))
+            {
+                sqlite3_snprintf(sizeof(zNum), zNum, "%!.15g", pValue->v.d);
+                StringBuilder_appendRaw(pSB, zNum, -1);
+            }
+            else StringBuilder_appendRaw(pSB, "null", 4);
+            break;
+
+        case SQLITE_TEXT:
+            StringBuilder_appendJsonElem(pSB, pValue->v.z, pValue->nBytes);
+            break;
+
+        case SQLITE_BLOB:
+            // Blobs are output as hex strings
+            StringBuilder_appendRaw(pSB, "\"", 1);
+            for (int ii = 0; ii < pValue->nBytes; ii++)
+            {
+                unsigned char c = (unsigned char) pValue->v.z[ii];
+                char zHex[2] = {_hexDigits[c >> 4], _hexDigits[c & 0x0F]};
+                StringBuilder_appendRaw(pSB, zHex, 2);
+            }
+            StringBuilder_appendRaw(pSB, "\"", 1);
+            break;
+
+        default:
+            StringBuilder_appendRaw(pSB, "null", 4);
+            break;
+    }
+}
+
+/*
+ * Appends JSON of object which is at iLevel in JSON (0 for page objects). Multiple values of property
+ * are output as array. References are replaced with referenced objects while iLevel + 1 is within fetch depth.
+ * Such objects are always loaded, as they are loaded at the same level or earlier
+ */
+static void _appendObject(flexi_RefExpand_t *self, int iObj, int iLevel, StringBuilder_t *pSB)
+{
+    char zID[32];
+    flexi_RefExpandObj_t *pObj = &self->aObjects[iObj];
+    pObj->bVisiting = true;
+
+    sqlite3_snprintf(sizeof(zID), zID, "{\"$id\":%lld", pObj->lObjectID);
+    StringBuilder_appendRaw(pSB, zID, -1);
+
+    u32 iEnd = pObj->iFirstValue + pObj->nValues;
+    for (u32 iValue = pObj->iFirstValue; iValue < iEnd;)
+    {
+        u32 iPropEnd = iValue + 1;
+        while (iPropEnd < iEnd && self->aValues[iPropEnd].value.lPropID == self->aValues[iValue].value.lPropID)
+            iPropEnd++;
+
+        // Values of properties which are not defined in class are skipped
+        const char *zPropName = self->aValues[iValue].zPropName;
+        if (zPropName != NULL)
+        {
+            StringBuilder_appendRaw(pSB, ",", 1);
+            StringBuilder_appendJsonElem(pSB, zPropName, -1);
+            StringBuilder_appendRaw(pSB, iPropEnd - iValue > 1 ? ":[" : ":", -1);
+
+            for (u32 ii = iValue; ii < iPropEnd; ii++)
+            {
+                const flexi_ObjValue_t *pValue = &self->aValues[ii].value;
+                if (ii > iValue)
+                    StringBuilder_appendRaw(pSB, ",", 1);
+
+                int iRefObj = iLevel + 1 < self->iFetchDepth && _isExpandedRef(self, pValue)
+                              ? _findObject(self, pValue->v.i) : -1;
+                if (iRefObj >= 0 && !self->aObjects[iRefObj].bVisiting)
+                    _appendObject(self, iRefObj, iLevel + 1, pSB);
+                else _appendValue(pSB, pValue);
+            }
+
+            if (iPropEnd - iValue > 1)
+                StringBuilder_appendRaw(pSB, "]", 1);
+        }
+
+        iValue = iPropEnd;
+    }
+
+    StringBuilder_appendRaw(pSB, "}", 1);
+    pObj->bVisiting = false;
+}
+
+int flexi_RefExpand_appendJson(flexi_RefExpand_t *self, sqlite3_int64 lObjectID, StringBuilder_t *pSB)
+{
+    int iObj = _findObject(self, lObjectID);
+    if (iObj >= 0)
+        _appendObject(self, iObj, 0, pSB);
+    else StringBuilder_appendRaw(pSB, "null", 4);
+
+    return pSB->bErr ? SQLITE_NOMEM : SQLITE_OK;
+}
+
+/*
+ * flexi_expand_refs(ObjectIDs, FetchDepth [, NestedOnly])
+ */
+static void _expandRefsFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    int result;
+    const char *zError = NULL;
+    sqlite3_int64 *aObjectIDs = NULL;
+    int nCount = 0;
+    bool bArray = sqlite3_value_type(argv[0]) == SQLITE_TEXT;
+    bool bNestedOnly = argc > 2 && sqlite3_value_int(argv[2]) != 0;
+
+    flexi_RefExpand_t expand;
+    flexi_RefExpand_init(&expand, sqlite3_context_db_handle(context),
+                         bNestedOnly ? LOAD_ROW_MODE_EMBED_NESTED : LOAD_ROW_MODE_EMBED_REFS,
+                         sqlite3_value_int(argv[1]));
+
+    JsonTape_t tape;
+    JsonTape_init(&tape);
+
+    StringBuilder_t sb;
+    StringBuilder_init(&sb);
+
+    if (bArray)
+    {
+        result = JsonTape_parse(&tape, (const char *) sqlite3_value_text(argv[0]), sqlite3_value_bytes(argv[0]));
+        if (result == SQLITE_OK && tape.aNodes[0].type != JSON_ARRAY)
+            result = SQLITE_ERROR;
+        if (result == SQLITE_ERROR)
+            zError = "Object IDs are expected to be JSON array";
+        CHECK_CALL(result);
+
+        CHECK_MALLOC(aObjectIDs, (tape.aNodes[0].nChildren + 1) * sizeof(*aObjectIDs));
+        for (u32 ii = JsonTape_firstChild(&tape, 0); ii != JSON_TAPE_NONE; ii = JsonTape_nextSibling(&tape, ii))
+        {
+            if (tape.aNodes[ii].type != JSON_INT)
+            {
+                result = SQLITE_ERROR;
+                zError = "Object IDs are expected to be integers";
+                goto ONERROR;
+            }
+            aObjectIDs[nCount++] = tape.aNodes[ii].v.i;
+        }
+    }
+    else if (sqlite3_value_type(argv[0]) != SQLITE_NULL)
+    {
+        CHECK_MALLOC(aObjectIDs, sizeof(*aObjectIDs));
+        aObjectIDs[nCount++] = sqlite3_value_int64(argv[0]);
+    }
+    else
+    {
+        sqlite3_result_null(context);
+        result = SQLITE_OK;
+        goto EXIT;
+    }
+
+    CHECK_CALL(flexi_RefExpand_load(&expand, aObjectIDs, nCount));
+
+    // Array of IDs gives array of objects, in the same order
+    if (bArray)
+        StringBuilder_appendRaw(&sb, "[", 1);
+    for (int ii = 0; ii < nCount; ii++)
+    {
+        if (ii > 0)
+            StringBuilder_appendRaw(&sb, ",", 1);
+        CHECK_CALL(flexi_RefExpand_appendJson(&expand, aObjectIDs[ii], &sb));
+    }
+    if (bArray)
+        StringBuilder_appendRaw(&sb, "]", 1);
+    if (sb.bErr)
+    {
+        result = SQLITE_NOMEM;
+        goto ONERROR;
+    }
+
+    sqlite3_result_text(context, sb.zBuf, (int) sb.nUsed, SQLITE_TRANSIENT);
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    if (zError != NULL)
+        sqlite3_result_error(context, zError, -1);
+    else if (result == SQLITE_NOMEM)
+        sqlite3_result_error_nomem(context);
+    else sqlite3_result_error(context, sqlite3_errmsg(sqlite3_context_db_handle(context)), -1);
+
+    EXIT:
+    sqlite3_free(aObjectIDs);
+    StringBuilder_clear(&sb);
+    JsonTape_free(&tape);
+    flexi_RefExpand_clear(&expand);
+}
+
+int flexi_RefExpand_createFunc(sqlite3 *db)
+{
+    int result;
+    CHECK_CALL(sqlite3_create_function_v2(db, "flexi_expand_refs", 2, SQLITE_UTF8, NULL, _expandRefsFunc,
+                                          NULL, NULL, NULL));
+    CHECK_CALL(sqlite3_create_function_v2(db, "flexi_expand_refs", 3, SQLITE_UTF8, NULL, _expandRefsFunc,
+                                          NULL, NULL, NULL));
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    return result;
+}
@@ -0,0 +1,142 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_REF_EXPAND_H
+#define FLEXILITE_FLEXI_REF_EXPAND_H
+
+#include "flexi_db_ctx.h"
+#include "flexi_Object.h"
+#include "../util/FlatHash.h"
+#include "../util/IdSet.h"
+#include "../util/StringBuilder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Value of loaded object with name of its property
+ */
+typedef struct flexi_RefExpandValue_t
+{
+    flexi_ObjValue_t value;
+
+    /*
+     * Property name, shared by all values of the same property. NULL if property is not defined
+     */
+    const char *zPropName;
+} flexi_RefExpandValue_t;
+
+typedef struct flexi_RefExpandObj_t
+{
+    sqlite3_int64 lObjectID;
+
+    /*
+     * Level at which object was loaded: 0 for page objects, N for objects referenced from level N - 1
+     */
+    int iLevel;
+
+    /*
+     * Range of object's values in aValues. Values are ordered by property ID and property index
+     */
+    u32 iFirstValue;
+    u32 nValues;
+
+    /*
+     * Set while object's JSON is being built, so that reference cycle is output as object ID
+     */
+    bool bVisiting;
+} flexi_RefExpandObj_t;
+
+/*
+ * Loads page of objects together with objects they reference, up to given fetch depth, and builds JSON
+ * with referenced objects embedded.
+ * Objects are loaded level by level rather than one by one: all objects of the level are loaded by one query,
+ * then IDs referenced by them ([.ref-values] rows with reference bits in ctlv) are collected and deduplicated
+ * against all loaded objects, and become the next level. So fetch depth N costs N queries, regardless of
+ * number of objects in page, and object referenced from many places (e.g. the same customer in many orders)
+ * is loaded once. JSON is stitched from loaded objects after all levels are done
+ */
+typedef struct flexi_RefExpand_t
+{
+    sqlite3 *db;
+
+    /*
+     * Number of object levels in JSON, counting page objects as level 1. E.g. 3 for order -> customer -> region.
+     * 1 or less means that references are output as object IDs
+     */
+    int iFetchDepth;
+
+    /*
+     * If true, only references to owned (nested) objects are expanded (LOAD_ROW_MODE_EMBED_NESTED).
+     * Otherwise, all references are expanded (LOAD_ROW_MODE_EMBED_REFS)
+     */
+    bool bNestedOnly;
+
+    /*
+     * Loads objects and their values for list of IDs passed as JSON array
+     */
+    sqlite3_stmt *pLoadStmt;
+
+    flexi_RefExpandObj_t *aObjects;
+    u32 nObjects;
+    u32 nObjectsAlloc;
+
+    flexi_RefExpandValue_t *aValues;
+    u32 nValues;
+    u32 nValuesAlloc;
+
+    /*
+     * Index in aObjects (+ 1) by object ID
+     */
+    FlatHash objectsById;
+
+    /*
+     * Property names by property ID, allocated in arena
+     */
+    FlatHash propNamesById;
+
+    /*
+     * Storage for text and blob values and property names
+     */
+    Arena_t arena;
+} flexi_RefExpand_t;
+
+/*
+ * Initializes expander. Fetch depth applies to LOAD_ROW_MODE_EMBED_NESTED and LOAD_ROW_MODE_EMBED_REFS only,
+ * in other modes references are not expanded
+ */
+void flexi_RefExpand_init(flexi_RefExpand_t *self, sqlite3 *db, enum FLEXI_DATA_LOAD_ROW_MODES eLoadRowMode,
+                          int iFetchDepth);
+
+/*
+ * Releases loaded objects. Prepared statement is kept, so that expander can be reused for the next page
+ */
+void flexi_RefExpand_reset(flexi_RefExpand_t *self);
+
+void flexi_RefExpand_clear(flexi_RefExpand_t *self);
+
+/*
+ * Loads page objects (aObjectIDs may have duplicates) and referenced objects, level by level
+ */
+int flexi_RefExpand_load(flexi_RefExpand_t *self, const sqlite3_int64 *aObjectIDs, int nCount);
+
+/*
+ * Appends JSON of loaded page object, with referenced objects embedded. If object does not exist, appends null
+ */
+int flexi_RefExpand_appendJson(flexi_RefExpand_t *self, sqlite3_int64 lObjectID, StringBuilder_t *pSB);
+
+/*
+ * Registers SQL function flexi_expand_refs(ObjectIDs, FetchDepth [, NestedOnly]).
+ * ObjectIDs is object ID or JSON array of object IDs. Returns JSON of object, or JSON array of objects in order
+ * of IDs, with referenced objects embedded up to FetchDepth object levels. If NestedOnly is true, only owned
+ * (nested) objects are embedded. Objects which do not exist are returned as null
+ */
+int flexi_RefExpand_createFunc(sqlite3 *db);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_REF_EXPAND_H
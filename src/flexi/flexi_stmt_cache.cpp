@@ -0,0 +1,145 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * LRU cache of prepared statements. See flexi_stmt_cache.h
+ */
+
+#include "../project_defs.h"
+
+static void _freeEntry(flexi_StmtCacheEntry_t *pEntry)
+{
+    if (pEntry != NULL)
+    {
+        sqlite3_finalize(pEntry->pStmt);
+        sqlite3_free(pEntry);
+    }
+}
+
+static void _unlink(flexi_StmtCache_t *self, flexi_StmtCacheEntry_t *pEntry)
+{
+    if (pEntry->pPrev != NULL)
+        pEntry->pPrev->pNext = pEntry->pNext;
+    else
+        self->pMru = pEntry->pNext;
+
+    if (pEntry->pNext != NULL)
+        pEntry->pNext->pPrev = pEntry->pPrev;
+    else
+        self->pLru = pEntry->pPrev;
+
+    pEntry->pPrev = pEntry->pNext = NULL;
+}
+
+static void _linkAsMru(flexi_StmtCache_t *self, flexi_StmtCacheEntry_t *pEntry)
+{
+    pEntry->pPrev = NULL;
+    pEntry->pNext = self->pMru;
+    if (self->pMru != NULL)
+        self->pMru->pPrev = pEntry;
+    self->pMru = pEntry;
+    if (self->pLru == NULL)
+        self->pLru = pEntry;
+}
+
+/*
+ * Finalizes least recently used statements until cache fits its capacity.
+ * Busy statements and the most recently used one (which is about to be returned to caller) are skipped
+ */
+static void _evict(flexi_StmtCache_t *self)
+{
+    flexi_StmtCacheEntry_t *pEntry = self->pLru;
+    while (pEntry != NULL && pEntry != self->pMru && (int) self->entries.count > self->nCapacity)
+    {
+        flexi_StmtCacheEntry_t *pPrev = pEntry->pPrev;
+        if (!sqlite3_stmt_busy(pEntry->pStmt))
+        {
+            _unlink(self, pEntry);
+            DictionaryKey_t key = {.pKey = pEntry->zSql};
+            // Removes key and finalizes statement
+            HashTable_set(&self->entries, key, NULL);
+            self->nEvictions++;
+        }
+        pEntry = pPrev;
+    }
+}
+
+void flexi_StmtCache_init(flexi_StmtCache_t *self, int nCapacity)
+{
+    memset(self, 0, sizeof(*self));
+    HashTable_init(&self->entries, DICT_STRING, (freeElem) _freeEntry);
+    self->nCapacity = nCapacity > 0 ? nCapacity : FLEXI_STMT_CACHE_SIZE;
+}
+
+int flexi_StmtCache_get(flexi_StmtCache_t *self, sqlite3 *db, const char *zSql, sqlite3_stmt **ppStmt)
+{
+    int result;
+    flexi_StmtCacheEntry_t *pEntry = NULL;
+    sqlite3_stmt *pStmt = NULL;
+    char *zKey = NULL;
+    DictionaryKey_t key = {.pKey = zSql};
+
+    *ppStmt = NULL;
+
+    pEntry = static_cast<flexi_StmtCacheEntry_t *>(HashTable_get(&self->entries, key));
+    if (pEntry != NULL)
+    {
+        self->nHits++;
+
+        // Error of previous execution (if any) has been already reported to its caller
+        sqlite3_reset(pEntry->pStmt);
+
+        if (self->pMru != pEntry)
+        {
+            _unlink(self, pEntry);
+            _linkAsMru(self, pEntry);
+        }
+
+        *ppStmt = pEntry->pStmt;
+        result = SQLITE_OK;
+        goto EXIT;
+    }
+
+    self->nMisses++;
+
+    CHECK_STMT_PREPARE(db, zSql, &pStmt);
+
+    zKey = sqlite3_mprintf("%s", zSql);
+    CHECK_NULL(zKey);
+    pEntry = static_cast<flexi_StmtCacheEntry_t *>(sqlite3_malloc(sizeof(flexi_StmtCacheEntry_t)));
+    CHECK_NULL(pEntry);
+    memset(pEntry, 0, sizeof(*pEntry));
+    pEntry->zSql = zKey;
+    pEntry->pStmt = pStmt;
+
+    key.pKey = zKey;
+    HashTable_set(&self->entries, key, pEntry);
+    if (HashTable_get(&self->entries, key) != pEntry)
+    {
+        // Hash table could not allocate new element
+        result = SQLITE_NOMEM;
+        goto ONERROR;
+    }
+
+    _linkAsMru(self, pEntry);
+    _evict(self);
+
+    *ppStmt = pStmt;
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    sqlite3_finalize(pStmt);
+    sqlite3_free(zKey);
+    sqlite3_free(pEntry);
+
+    EXIT:
+    return result;
+}
+
+void flexi_StmtCache_clear(flexi_StmtCache_t *self)
+{
+    HashTable_clear(&self->entries);
+    self->pMru = self->pLru = NULL;
+}
@@ -0,0 +1,93 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLEXI_STMT_CACHE_H
+#define FLEXILITE_FLEXI_STMT_CACHE_H
+
+#include <sqlite3ext.h>
+#include "../util/hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FLEXI_STMT_CACHE_SIZE
+
+/*
+ * Default max number of prepared statements kept in connection's statement cache
+ */
+#define FLEXI_STMT_CACHE_SIZE 64
+#endif
+
+/*
+ * Cached prepared statement
+ */
+typedef struct flexi_StmtCacheEntry_t
+{
+    /*
+     * SQL text. Owned by cache's hash table (as key)
+     */
+    const char *zSql;
+
+    sqlite3_stmt *pStmt;
+
+    /*
+     * Neighbours in LRU list. pPrev is more recently used
+     */
+    struct flexi_StmtCacheEntry_t *pPrev;
+    struct flexi_StmtCacheEntry_t *pNext;
+} flexi_StmtCacheEntry_t;
+
+/*
+ * Size bounded cache of prepared statements, keyed by SQL text.
+ * When cache is full, least recently used statement gets finalized. Statements which are
+ * still being stepped (sqlite3_stmt_busy) are never evicted, so cache may temporarily
+ * grow beyond its capacity.
+ * Lua layer has its own cache with the same policy (src_lua/StatementCache.lua)
+ */
+typedef struct flexi_StmtCache_t
+{
+    /*
+     * flexi_StmtCacheEntry_t by SQL text
+     */
+    Hash entries;
+
+    /*
+     * Most and least recently used entries
+     */
+    flexi_StmtCacheEntry_t *pMru;
+    flexi_StmtCacheEntry_t *pLru;
+
+    int nCapacity;
+
+    /*
+     * Statistics
+     */
+    sqlite3_int64 nHits;
+    sqlite3_int64 nMisses;
+    sqlite3_int64 nEvictions;
+} flexi_StmtCache_t;
+
+/*
+ * Initializes empty cache. If nCapacity <= 0, FLEXI_STMT_CACHE_SIZE is used
+ */
+void flexi_StmtCache_init(flexi_StmtCache_t *self, int nCapacity);
+
+/*
+ * Returns prepared statement for zSql, ready to bind and step. Statement found in cache gets reset
+ * (bindings are kept). New statement gets prepared and added to cache.
+ * Returned statement is owned by cache and must not be finalized by caller
+ */
+int flexi_StmtCache_get(flexi_StmtCache_t *self, sqlite3 *db, const char *zSql, sqlite3_stmt **ppStmt);
+
+/*
+ * Finalizes all cached statements. Statistics are kept
+ */
+void flexi_StmtCache_clear(flexi_StmtCache_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLEXI_STMT_CACHE_H
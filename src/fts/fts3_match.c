@@ -0,0 +1,363 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Direct evaluation of FTS3 MATCH expressions against plain text values.
+ * Query is parsed by vendored FTS3 expression parser (fts3_expr.c) into Fts3Expr tree,
+ * with the same tokenizer as used for value. Value is tokenized into list of normalized tokens
+ * and expression tree is evaluated over this list: phrases are matched by consecutive tokens,
+ * NEAR - by distance between phrases, AND/OR/NOT - as boolean operators.
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include "fts3Int.h"
+#include "../common/common.h"
+#include "fts3_match.h"
+
+/*
+ * Tokenizer used for match_text. Matches tokenizer of [.full_text_data]
+ */
+#define MATCH_TEXT_TOKENIZER "unicode61"
+
+/*
+ * Single normalized token of tokenized value
+ */
+typedef struct MatchToken_t
+{
+    /*
+     * Offset of normalized token text in MatchDoc_t.zBuf
+     */
+    int iOffset;
+    int n;
+} MatchToken_t;
+
+/*
+ * Tokenized value. Buffers are kept between calls to avoid reallocations
+ */
+typedef struct MatchDoc_t
+{
+    char *zBuf;
+    int nBuf;
+    int nBufAlloc;
+
+    MatchToken_t *aTokens;
+    int nTokens;
+    int nTokensAlloc;
+} MatchDoc_t;
+
+/*
+ * Compiled MATCH query. Stored as auxiliary data of the query argument
+ */
+typedef struct MatchExpr_t
+{
+    sqlite3_tokenizer *pTokenizer;
+
+    /*
+     * Parsed query. NULL if query has no tokens
+     */
+    Fts3Expr *pExpr;
+
+    MatchDoc_t doc;
+} MatchExpr_t;
+
+static void _freeMatchExpr(void *pArg)
+{
+    MatchExpr_t *self = pArg;
+    if (self != NULL)
+    {
+        sqlite3Fts3ExprFree(self->pExpr);
+        if (self->pTokenizer != NULL)
+            self->pTokenizer->pModule->xDestroy(self->pTokenizer);
+        sqlite3_free(self->doc.zBuf);
+        sqlite3_free(self->doc.aTokens);
+        sqlite3_free(self);
+    }
+}
+
+/*
+ * Gets tokenizer module registered in database via fts3_tokenizer function
+ */
+static int _findTokenizerModule(sqlite3 *db, const char *zName, const sqlite3_tokenizer_module **ppModule)
+{
+    int result;
+    sqlite3_stmt *pStmt = NULL;
+
+    *ppModule = NULL;
+    CHECK_STMT_PREPARE(db, "select fts3_tokenizer(:1);", &pStmt);
+    sqlite3_bind_text(pStmt, 1, zName, -1, SQLITE_STATIC);
+    result = sqlite3_step(pStmt);
+    if (result != SQLITE_ROW)
+        goto ONERROR;
+
+    if (sqlite3_column_type(pStmt, 0) != SQLITE_BLOB || sqlite3_column_bytes(pStmt, 0) != sizeof(*ppModule))
+    {
+        result = SQLITE_ERROR;
+        goto ONERROR;
+    }
+    memcpy((void *) ppModule, sqlite3_column_blob(pStmt, 0), sizeof(*ppModule));
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    sqlite3_finalize(pStmt);
+    return result;
+}
+
+/*
+ * Creates tokenizer and parses query
+ */
+static int _compileMatchExpr(sqlite3 *db, const char *zQuery, int nQuery, MatchExpr_t **ppMatch, char **pzErr)
+{
+    int result;
+    const sqlite3_tokenizer_module *pModule;
+    MatchExpr_t *pMatch = NULL;
+    char *azCol[] = {"txt"};
+
+    CHECK_CALL(_findTokenizerModule(db, MATCH_TEXT_TOKENIZER, &pModule));
+
+    CHECK_MALLOC(pMatch, sizeof(*pMatch));
+    memset(pMatch, 0, sizeof(*pMatch));
+
+    CHECK_CALL(pModule->xCreate(0, NULL, &pMatch->pTokenizer));
+    pMatch->pTokenizer->pModule = pModule;
+
+    result = sqlite3Fts3ExprParse(pMatch->pTokenizer, 0, azCol, 1, ARRAY_LEN(azCol), 0, zQuery, nQuery,
+                                  &pMatch->pExpr, pzErr);
+    if (result != SQLITE_OK)
+    {
+        if (*pzErr == NULL)
+            *pzErr = sqlite3_mprintf("malformed MATCH expression: [%s]", zQuery);
+        goto ONERROR;
+    }
+
+    *ppMatch = pMatch;
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    _freeMatchExpr(pMatch);
+
+    EXIT:
+    return result;
+}
+
+/*
+ * Splits value into normalized tokens
+ */
+static int _tokenizeDoc(MatchExpr_t *pMatch, const char *zText, int nText)
+{
+    int result;
+    MatchDoc_t *pDoc = &pMatch->doc;
+    sqlite3_tokenizer_cursor *pCsr = NULL;
+    const char *zToken;
+    int nToken, iStart, iEnd, iPos;
+
+    pDoc->nBuf = 0;
+    pDoc->nTokens = 0;
+
+    CHECK_CALL(sqlite3Fts3OpenTokenizer(pMatch->pTokenizer, 0, zText, nText, &pCsr));
+    while ((result = pMatch->pTokenizer->pModule->xNext(pCsr, &zToken, &nToken, &iStart, &iEnd, &iPos)) ==
+           SQLITE_OK)
+    {
+        if (pDoc->nBuf + nToken > pDoc->nBufAlloc)
+        {
+            int nNewAlloc = (pDoc->nBufAlloc + nToken) * 2 + 64;
+            char *zNew = sqlite3_realloc(pDoc->zBuf, nNewAlloc);
+            CHECK_NULL(zNew);
+            pDoc->zBuf = zNew;
+            pDoc->nBufAlloc = nNewAlloc;
+        }
+
+        if (pDoc->nTokens >= pDoc->nTokensAlloc)
+        {
+            int nNewAlloc = pDoc->nTokensAlloc * 2 + 16;
+            MatchToken_t *aNew = sqlite3_realloc(pDoc->aTokens, nNewAlloc * (int) sizeof(MatchToken_t));
+            CHECK_NULL(aNew);
+            pDoc->aTokens = aNew;
+            pDoc->nTokensAlloc = nNewAlloc;
+        }
+
+        memcpy(pDoc->zBuf + pDoc->nBuf, zToken, (size_t) nToken);
+        pDoc->aTokens[pDoc->nTokens].iOffset = pDoc->nBuf;
+        pDoc->aTokens[pDoc->nTokens].n = nToken;
+        pDoc->nTokens++;
+        pDoc->nBuf += nToken;
+    }
+    if (result != SQLITE_DONE)
+        goto ONERROR;
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+
+    EXIT:
+    if (pCsr != NULL)
+        pMatch->pTokenizer->pModule->xClose(pCsr);
+    return result;
+}
+
+static bool _tokenMatches(const MatchDoc_t *pDoc, int iToken, const Fts3PhraseToken *pToken)
+{
+    const MatchToken_t *pDocToken = &pDoc->aTokens[iToken];
+    if (pToken->bFirst && iToken != 0)
+        return false;
+    if (pToken->isPrefix ? pDocToken->n < pToken->n : pDocToken->n != pToken->n)
+        return false;
+    return memcmp(pDoc->zBuf + pDocToken->iOffset, pToken->z, (size_t) pToken->n) == 0;
+}
+
+/*
+ * Returns true if phrase starts at token iStart
+ */
+static bool _phraseMatchesAt(const MatchDoc_t *pDoc, const Fts3Phrase *pPhrase, int iStart)
+{
+    if (pPhrase->nToken == 0 || iStart < 0 || iStart + pPhrase->nToken > pDoc->nTokens)
+        return false;
+
+    for (int ii = 0; ii < pPhrase->nToken; ii++)
+    {
+        if (!_tokenMatches(pDoc, iStart + ii, &pPhrase->aToken[ii]))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Returns position of the next occurrence of phrase, starting from token iFrom. -1 if not found
+ */
+static int _phraseNext(const MatchDoc_t *pDoc, const Fts3Phrase *pPhrase, int iFrom)
+{
+    for (int ii = iFrom; ii < pDoc->nTokens; ii++)
+    {
+        if (_phraseMatchesAt(pDoc, pPhrase, ii))
+            return ii;
+    }
+    return -1;
+}
+
+/*
+ * NEAR expressions are left-deep: right operand is always phrase
+ */
+static const Fts3Phrase *_rightmostPhrase(const Fts3Expr *pExpr)
+{
+    while (pExpr->eType == FTSQUERY_NEAR)
+        pExpr = pExpr->pRight;
+    return pExpr->pPhrase;
+}
+
+/*
+ * Returns true if NEAR chain pExpr matches so that its rightmost phrase starts at token iStart.
+ * Every pair of adjacent phrases in chain must be separated by not more than nNear tokens
+ */
+static bool _nearMatchesAt(const MatchDoc_t *pDoc, const Fts3Expr *pExpr, int iStart)
+{
+    if (pExpr->eType == FTSQUERY_PHRASE)
+        return _phraseMatchesAt(pDoc, pExpr->pPhrase, iStart);
+
+    assert(pExpr->eType == FTSQUERY_NEAR);
+    const Fts3Phrase *pRight = pExpr->pRight->pPhrase;
+    if (!_phraseMatchesAt(pDoc, pRight, iStart))
+        return false;
+
+    const Fts3Phrase *pLeft = _rightmostPhrase(pExpr->pLeft);
+    int iFrom = iStart - pExpr->nNear - pLeft->nToken;
+    int iTo = iStart + pRight->nToken + pExpr->nNear;
+    if (iFrom < 0)
+        iFrom = 0;
+    for (int ii = iFrom; ii <= iTo && ii < pDoc->nTokens; ii++)
+    {
+        if (_nearMatchesAt(pDoc, pExpr->pLeft, ii))
+            return true;
+    }
+    return false;
+}
+
+static bool _evalExpr(const MatchDoc_t *pDoc, const Fts3Expr *pExpr)
+{
+    switch (pExpr->eType)
+    {
+        case FTSQUERY_PHRASE:
+            return _phraseNext(pDoc, pExpr->pPhrase, 0) >= 0;
+
+        case FTSQUERY_NEAR:
+        {
+            const Fts3Phrase *pRight = _rightmostPhrase(pExpr);
+            for (int ii = _phraseNext(pDoc, pRight, 0); ii >= 0; ii = _phraseNext(pDoc, pRight, ii + 1))
+            {
+                if (_nearMatchesAt(pDoc, pExpr, ii))
+                    return true;
+            }
+            return false;
+        }
+
+        case FTSQUERY_AND:
+            return _evalExpr(pDoc, pExpr->pLeft) && _evalExpr(pDoc, pExpr->pRight);
+
+        case FTSQUERY_OR:
+            return _evalExpr(pDoc, pExpr->pLeft) || _evalExpr(pDoc, pExpr->pRight);
+
+        default:
+            assert(pExpr->eType == FTSQUERY_NOT);
+            return _evalExpr(pDoc, pExpr->pLeft) && !_evalExpr(pDoc, pExpr->pRight);
+    }
+}
+
+void flexi_match_text_func(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    int result;
+    char *zErr = NULL;
+    bool bNewMatch = false;
+    MatchExpr_t *pMatch;
+
+    (void) argc;
+
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL)
+    {
+        sqlite3_result_int(context, 0);
+        return;
+    }
+
+    pMatch = sqlite3_get_auxdata(context, 0);
+    if (pMatch == NULL)
+    {
+        const char *zQuery = (const char *) sqlite3_value_text(argv[0]);
+        CHECK_NULL(zQuery);
+        CHECK_CALL(_compileMatchExpr(sqlite3_context_db_handle(context), zQuery, sqlite3_value_bytes(argv[0]),
+                                     &pMatch, &zErr));
+        bNewMatch = true;
+    }
+
+    if (pMatch->pExpr == NULL)
+    {
+        sqlite3_result_int(context, 0);
+    }
+    else
+    {
+        const char *zText = (const char *) sqlite3_value_text(argv[1]);
+        CHECK_NULL(zText);
+        CHECK_CALL(_tokenizeDoc(pMatch, zText, sqlite3_value_bytes(argv[1])));
+        sqlite3_result_int(context, _evalExpr(&pMatch->doc, pMatch->pExpr) ? 1 : 0);
+    }
+
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    if (zErr != NULL)
+        sqlite3_result_error(context, zErr, -1);
+    else sqlite3_result_error_code(context, result);
+
+    EXIT:
+    sqlite3_free(zErr);
+
+    // Compiled query is cached for subsequent calls with the same query. SQLite takes ownership
+    if (bNewMatch)
+        sqlite3_set_auxdata(context, 0, pMatch, _freeMatchExpr);
+}
@@ -0,0 +1,27 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FTS3_MATCH_H
+#define FLEXILITE_FTS3_MATCH_H
+
+#include "../../lib/sqlite/sqlite3ext.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Implementation of match_text(query, value) SQL function.
+ * Returns 1 if value matches FTS3 query, 0 otherwise. Used for MATCH on properties which are not
+ * indexed for full text search.
+ * Query is parsed once per statement (compiled expression is kept as auxiliary data of
+ * the first argument), value is tokenized and evaluated in-process, with 'unicode61' tokenizer
+ */
+void flexi_match_text_func(sqlite3_context *context, int argc, sqlite3_value **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FTS3_MATCH_H
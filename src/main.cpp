@@ -23,6 +23,7 @@ extern "C" int sqlite3_extension_init(
             var_func_init,
             hash_func_init,
             memstat_func_init,
+            value_stats_func_init,
             flexi_init
     };
 
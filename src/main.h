@@ -61,6 +61,12 @@ int memstat_func_init(
         const sqlite3_api_routines *pApi
 );
 
+int value_stats_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+);
+
 int flexi_data_init(
         sqlite3 *db,
         char **pzErrMsg,
@@ -0,0 +1,695 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Statistics of value sets. Used by flexi('analyze') to collect property statistics for query planning.
+ *
+ * value_stats(value [, buckets]) - aggregate function. Returns JSON object:
+ * {"rows": number of rows, "count": number of non null values, "distinct": estimated number of distinct values,
+ * "min": min value, "max": max value, "histogram": [b0, b1, ... bN], "sketch": "HyperLogLog registers as hex"}
+ *
+ * Number of distinct values is estimated by HyperLogLog with 1024 registers (~3% standard error).
+ * Histogram is equi-depth: every of N buckets (b[i - 1], b[i]] holds approximately count / N values
+ * (16 buckets by default). b0 and bN are min and max. Inner bounds are computed from reservoir sample of values.
+ * Values are ordered as in SQLite: numbers before text. Blobs are counted, but do not participate in
+ * min, max and histogram.
+ *
+ * value_stats_merge(stats1, stats2) - combines statistics of two disjoint sets of values (e.g. collected by
+ * subsequent runs of incremental analyze). Sketches are merged exactly. Histograms are merged approximately:
+ * upper bounds of buckets of both histograms are treated as points weighted by bucket depth, and new bounds are
+ * taken at weighted quantiles of these points.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../common/common.h"
+#include "../util/JsonTape.h"
+#include "../util/StringBuilder.h"
+
+#ifdef  SQLITE_CORE
+
+#include <sqlite3.h>
+
+#else
+
+#include <sqlite3ext.h>
+
+SQLITE_EXTENSION_INIT3
+
+#endif
+
+#define VALUE_STATS_HLL_BITS 10
+#define VALUE_STATS_HLL_REGISTERS (1 << VALUE_STATS_HLL_BITS)
+#define VALUE_STATS_SAMPLE_SIZE 1024
+#define VALUE_STATS_DEFAULT_BUCKETS 16
+#define VALUE_STATS_MAX_BUCKETS 256
+
+/*
+ * Numeric or text value. Text is either owned (aggregate) or points to JSON tape (merge)
+ */
+typedef struct _StatValue_t
+{
+    /*
+     * SQLITE_INTEGER, SQLITE_FLOAT or SQLITE_TEXT. 0 - no value
+     */
+    int type;
+    sqlite3_int64 i;
+    double d;
+    char *z;
+    int n;
+} _StatValue_t;
+
+/*
+ * Aggregate context of value_stats
+ */
+typedef struct _StatsAgg_t
+{
+    sqlite3_int64 nRows;
+    sqlite3_int64 nCount;
+    u8 aSketch[VALUE_STATS_HLL_REGISTERS];
+    _StatValue_t min;
+    _StatValue_t max;
+
+    /*
+     * Reservoir sample of numeric and text values
+     */
+    _StatValue_t *aSample;
+    int nSample;
+
+    /*
+     * Number of values offered to reservoir
+     */
+    sqlite3_int64 nOffered;
+
+    u64 iRandom;
+    int nBuckets;
+} _StatsAgg_t;
+
+/*
+ * Point of merged histogram
+ */
+typedef struct _WeightedPoint_t
+{
+    _StatValue_t v;
+    double dWeight;
+} _WeightedPoint_t;
+
+static u64 _mix64(u64 x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static u64 _hashBytes(const unsigned char *p, int n, u64 seed)
+{
+    u64 h = 0xCBF29CE484222325ULL ^ seed;
+    for (int ii = 0; ii < n; ii++)
+    {
+        h ^= p[ii];
+        h *= 0x100000001B3ULL;
+    }
+    return _mix64(h);
+}
+
+/*
+ * Hash of value. Integers and reals with integer value (which are equal in SQLite) get the same hash
+ */
+static u64 _hashValue(sqlite3_value *pVal)
+{
+    switch (sqlite3_value_type(pVal))
+    {
+        case SQLITE_INTEGER:
+            return _mix64((u64) sqlite3_value_int64(pVal));
+
+        case SQLITE_FLOAT:
+        {
+            double d = sqlite3_value_double(pVal);
+            if (d >= -9.2e18 && d <= 9.2e18 && d == (double) (sqlite3_int64) d)
+                return _mix64((u64) (sqlite3_int64) d);
+            u64 bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return _mix64(bits ^ 0x5555555555555555ULL);
+        }
+
+        case SQLITE_TEXT:
+            return _hashBytes(sqlite3_value_text(pVal), sqlite3_value_bytes(pVal), 0);
+
+        default:
+            return _hashBytes(sqlite3_value_blob(pVal), sqlite3_value_bytes(pVal), 0xAAAAAAAAAAAAAAAAULL);
+    }
+}
+
+static void _sketchAdd(u8 *aSketch, u64 hash)
+{
+    u32 iReg = (u32) (hash >> (64 - VALUE_STATS_HLL_BITS));
+    u64 w = hash << VALUE_STATS_HLL_BITS;
+    u8 rank = 1;
+    while (rank <= 64 - VALUE_STATS_HLL_BITS && (w & 0x8000000000000000ULL) == 0)
+    {
+        rank++;
+        w <<= 1;
+    }
+    if (rank > aSketch[iReg])
+        aSketch[iReg] = rank;
+}
+
+/*
+ * HyperLogLog estimation, with linear counting for small cardinalities
+ */
+static double _sketchEstimate(const u8 *aSketch)
+{
+    const double m = VALUE_STATS_HLL_REGISTERS;
+    double dSum = 0;
+    int nZeros = 0;
+    for (int ii = 0; ii < VALUE_STATS_HLL_REGISTERS; ii++)
+    {
+        dSum += ldexp(1.0, -aSketch[ii]);
+        if (aSketch[ii] == 0)
+            nZeros++;
+    }
+
+    double e = 0.7213 / (1 + 1.079 / m) * m * m / dSum;
+    if (e <= 2.5 * m && nZeros > 0)
+        e = m * log(m / nZeros);
+    return e;
+}
+
+static sqlite3_int64 _distinctCount(const u8 *aSketch, sqlite3_int64 nCount)
+{
+    sqlite3_int64 result = (sqlite3_int64) (_sketchEstimate(aSketch) + 0.5);
+    if (result > nCount)
+        result = nCount;
+    if (result == 0 && nCount > 0)
+        result = 1;
+    return result;
+}
+
+static double _asDouble(const _StatValue_t *v)
+{
+    return v->type == SQLITE_INTEGER ? (double) v->i : v->d;
+}
+
+/*
+ * Compares values in SQLite order (numbers before text, text is compared as BINARY)
+ */
+static int _compareValues(const _StatValue_t *a, const _StatValue_t *b)
+{
+    bool bTextA = a->type == SQLITE_TEXT;
+    bool bTextB = b->type == SQLITE_TEXT;
+    if (bTextA != bTextB)
+        return bTextA ? 1 : -1;
+
+    if (bTextA)
+    {
+        int c = memcmp(a->z, b->z, (size_t) (a->n < b->n ? a->n : b->n));
+        return c != 0 ? c : a->n - b->n;
+    }
+
+    if (a->type == SQLITE_INTEGER && b->type == SQLITE_INTEGER)
+        return a->i < b->i ? -1 : a->i > b->i;
+
+    double da = _asDouble(a), db = _asDouble(b);
+    return da < db ? -1 : da > db;
+}
+
+static int _qsortValues(const void *a, const void *b)
+{
+    return _compareValues(a, b);
+}
+
+static int _qsortPoints(const void *a, const void *b)
+{
+    return _compareValues(&((const _WeightedPoint_t *) a)->v, &((const _WeightedPoint_t *) b)->v);
+}
+
+/*
+ * Copies numeric or text value to pDest. Text is copied. Returns SQLITE_NOMEM
+ */
+static int _copyValue(_StatValue_t *pDest, sqlite3_value *pVal)
+{
+    sqlite3_free(pDest->z);
+    memset(pDest, 0, sizeof(*pDest));
+    pDest->type = sqlite3_value_type(pVal);
+    switch (pDest->type)
+    {
+        case SQLITE_INTEGER:
+            pDest->i = sqlite3_value_int64(pVal);
+            break;
+
+        case SQLITE_FLOAT:
+            pDest->d = sqlite3_value_double(pVal);
+            break;
+
+        default:
+        {
+            const unsigned char *zText = sqlite3_value_text(pVal);
+            pDest->n = sqlite3_value_bytes(pVal);
+            pDest->z = sqlite3_malloc(pDest->n + 1);
+            if (pDest->z == NULL)
+            {
+                pDest->type = 0;
+                return SQLITE_NOMEM;
+            }
+            memcpy(pDest->z, zText, (size_t) pDest->n + 1);
+            break;
+        }
+    }
+    return SQLITE_OK;
+}
+
+/*
+ * Initializes pDest from scalar JSON node. Text is not copied. Returns false for other node types
+ */
+static bool _valueFromNode(_StatValue_t *pDest, const JsonTapeNode_t *pNode)
+{
+    memset(pDest, 0, sizeof(*pDest));
+    switch (pNode->type)
+    {
+        case JSON_INT:
+            pDest->type = SQLITE_INTEGER;
+            pDest->i = pNode->v.i;
+            return true;
+
+        case JSON_REAL:
+            pDest->type = SQLITE_FLOAT;
+            pDest->d = pNode->v.d;
+            return true;
+
+        case JSON_STRING:
+            pDest->type = SQLITE_TEXT;
+            pDest->z = (char *) pNode->v.s.z;
+            pDest->n = (int) pNode->v.s.n;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static void _appendValue(StringBuilder_t *sb, const _StatValue_t *v)
+{
+    char zNum[40];
+    switch (v == NULL ? 0 : v->type)
+    {
+        case SQLITE_INTEGER:
+            sqlite3_snprintf(sizeof(zNum), zNum, "%lld", v->i);
+            StringBuilder_appendRaw(sb, zNum, -1);
+            break;
+
+        case SQLITE_FLOAT:
+            if (isinf(v->d))
+                StringBuilder_appendRaw(sb, v->d > 0 ? "9e999" : "-9e999", -1);
+            else
+            {
+                sqlite3_snprintf(sizeof(zNum), zNum, "%!.15g", v->d);
+                StringBuilder_appendRaw(sb, zNum, -1);
+            }
+            break;
+
+        case SQLITE_TEXT:
+            StringBuilder_appendJsonElem(sb, v->z, v->n);
+            break;
+
+        default:
+            StringBuilder_appendRaw(sb, "null", 4);
+            break;
+    }
+}
+
+/*
+ * Writes statistics JSON. apBounds has nBuckets + 1 items (or 0, if there are no values in histogram)
+ */
+static void _appendStats(StringBuilder_t *sb, sqlite3_int64 nRows, sqlite3_int64 nCount, const u8 *aSketch,
+                         const _StatValue_t *pMin, const _StatValue_t *pMax, const _StatValue_t **apBounds,
+                         int nBounds)
+{
+    static const char aHex[] = "0123456789abcdef";
+    char zNum[80];
+
+    sqlite3_snprintf(sizeof(zNum), zNum, "{\"rows\":%lld,\"count\":%lld,\"distinct\":%lld,\"min\":",
+                     nRows, nCount, _distinctCount(aSketch, nCount));
+    StringBuilder_appendRaw(sb, zNum, -1);
+    _appendValue(sb, pMin);
+    StringBuilder_appendRaw(sb, ",\"max\":", -1);
+    _appendValue(sb, pMax);
+
+    StringBuilder_appendRaw(sb, ",\"histogram\":[", -1);
+    for (int ii = 0; ii < nBounds; ii++)
+    {
+        if (ii > 0)
+            StringBuilder_appendRaw(sb, ",", 1);
+        _appendValue(sb, apBounds[ii]);
+    }
+
+    StringBuilder_appendRaw(sb, "],\"sketch\":\"", -1);
+    if (nCount > 0)
+    {
+        char zHex[2 * VALUE_STATS_HLL_REGISTERS];
+        for (int ii = 0; ii < VALUE_STATS_HLL_REGISTERS; ii++)
+        {
+            zHex[ii * 2] = aHex[aSketch[ii] >> 4];
+            zHex[ii * 2 + 1] = aHex[aSketch[ii] & 0x0F];
+        }
+        StringBuilder_appendRaw(sb, zHex, sizeof(zHex));
+    }
+    StringBuilder_appendRaw(sb, "\"}", 2);
+}
+
+static void _setResult(sqlite3_context *context, StringBuilder_t *sb)
+{
+    if (sb->bErr)
+        sqlite3_result_error_nomem(context);
+    else
+        sqlite3_result_text(context, sb->zBuf, (int) sb->nUsed, SQLITE_TRANSIENT);
+    StringBuilder_clear(sb);
+}
+
+static u64 _nextRandom(_StatsAgg_t *pAgg)
+{
+    pAgg->iRandom ^= pAgg->iRandom >> 12;
+    pAgg->iRandom ^= pAgg->iRandom << 25;
+    pAgg->iRandom ^= pAgg->iRandom >> 27;
+    return pAgg->iRandom * 0x2545F4914F6CDD1DULL;
+}
+
+static void _statsStep(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    _StatsAgg_t *pAgg = sqlite3_aggregate_context(context, sizeof(*pAgg));
+    if (pAgg == NULL)
+    {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+
+    if (pAgg->nRows == 0)
+    {
+        // Fixed seed, so that statistics is repeatable
+        pAgg->iRandom = 0x9E3779B97F4A7C15ULL;
+        pAgg->nBuckets = VALUE_STATS_DEFAULT_BUCKETS;
+        if (argc > 1 && sqlite3_value_type(argv[1]) == SQLITE_INTEGER)
+        {
+            pAgg->nBuckets = sqlite3_value_int(argv[1]);
+            if (pAgg->nBuckets < 1)
+                pAgg->nBuckets = 1;
+            if (pAgg->nBuckets > VALUE_STATS_MAX_BUCKETS)
+                pAgg->nBuckets = VALUE_STATS_MAX_BUCKETS;
+        }
+    }
+
+    pAgg->nRows++;
+
+    sqlite3_value *pVal = argv[0];
+    int type = sqlite3_value_type(pVal);
+    if (type == SQLITE_NULL)
+        return;
+
+    pAgg->nCount++;
+    _sketchAdd(pAgg->aSketch, _hashValue(pVal));
+
+    if (type == SQLITE_BLOB)
+        return;
+
+    int rc = SQLITE_OK;
+    _StatValue_t v = {type, 0, 0, NULL, 0};
+    if (type == SQLITE_INTEGER)
+        v.i = sqlite3_value_int64(pVal);
+    else if (type == SQLITE_FLOAT)
+        v.d = sqlite3_value_double(pVal);
+    else
+    {
+        v.z = (char *) sqlite3_value_text(pVal);
+        v.n = sqlite3_value_bytes(pVal);
+    }
+
+    if (pAgg->min.type == 0 || _compareValues(&v, &pAgg->min) < 0)
+        rc = _copyValue(&pAgg->min, pVal);
+    if (rc == SQLITE_OK && (pAgg->max.type == 0 || _compareValues(&v, &pAgg->max) > 0))
+        rc = _copyValue(&pAgg->max, pVal);
+
+    if (rc == SQLITE_OK)
+    {
+        // Reservoir sampling
+        pAgg->nOffered++;
+        if (pAgg->aSample == NULL)
+        {
+            pAgg->aSample = sqlite3_malloc(VALUE_STATS_SAMPLE_SIZE * sizeof(_StatValue_t));
+            if (pAgg->aSample == NULL)
+                rc = SQLITE_NOMEM;
+            else
+                memset(pAgg->aSample, 0, VALUE_STATS_SAMPLE_SIZE * sizeof(_StatValue_t));
+        }
+
+        if (rc == SQLITE_OK)
+        {
+            if (pAgg->nSample < VALUE_STATS_SAMPLE_SIZE)
+                rc = _copyValue(&pAgg->aSample[pAgg->nSample++], pVal);
+            else
+            {
+                u64 iSlot = _nextRandom(pAgg) % (u64) pAgg->nOffered;
+                if (iSlot < VALUE_STATS_SAMPLE_SIZE)
+                    rc = _copyValue(&pAgg->aSample[iSlot], pVal);
+            }
+        }
+    }
+
+    if (rc != SQLITE_OK)
+        sqlite3_result_error_nomem(context);
+}
+
+static void _statsFinal(sqlite3_context *context)
+{
+    static const u8 aEmptySketch[VALUE_STATS_HLL_REGISTERS];
+
+    _StatsAgg_t *pAgg = sqlite3_aggregate_context(context, 0);
+    StringBuilder_t sb;
+    const _StatValue_t *apBounds[VALUE_STATS_MAX_BUCKETS + 1];
+    int nBounds = 0;
+
+    StringBuilder_init(&sb);
+
+    if (pAgg == NULL)
+    {
+        _appendStats(&sb, 0, 0, aEmptySketch, NULL, NULL, NULL, 0);
+        _setResult(context, &sb);
+        return;
+    }
+
+    if (pAgg->nSample > 0)
+    {
+        qsort(pAgg->aSample, (size_t) pAgg->nSample, sizeof(_StatValue_t), _qsortValues);
+
+        int nBuckets = pAgg->nBuckets < pAgg->nSample ? pAgg->nBuckets : pAgg->nSample;
+        apBounds[nBounds++] = &pAgg->min;
+        for (int ii = 1; ii < nBuckets; ii++)
+            apBounds[nBounds++] = &pAgg->aSample[(sqlite3_int64) ii * pAgg->nSample / nBuckets - 1];
+        apBounds[nBounds++] = &pAgg->max;
+    }
+
+    _appendStats(&sb, pAgg->nRows, pAgg->nCount, pAgg->aSketch, &pAgg->min, &pAgg->max, apBounds, nBounds);
+    _setResult(context, &sb);
+
+    for (int ii = 0; ii < pAgg->nSample; ii++)
+        sqlite3_free(pAgg->aSample[ii].z);
+    sqlite3_free(pAgg->aSample);
+    sqlite3_free(pAgg->min.z);
+    sqlite3_free(pAgg->max.z);
+}
+
+static sqlite3_int64 _nodeInt(const JsonTape_t *pTape, u32 iNode)
+{
+    if (iNode == JSON_TAPE_NONE)
+        return 0;
+    const JsonTapeNode_t *pNode = &pTape->aNodes[iNode];
+    if (pNode->type == JSON_INT)
+        return pNode->v.i;
+    if (pNode->type == JSON_REAL)
+        return (sqlite3_int64) pNode->v.d;
+    return 0;
+}
+
+static int _hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return 0;
+}
+
+/*
+ * Merges sketch of parsed statistics into aSketch
+ */
+static void _mergeSketch(const JsonTape_t *pTape, u8 *aSketch)
+{
+    u32 iNode = JsonTape_findKey(pTape, 0, "sketch");
+    if (iNode == JSON_TAPE_NONE || pTape->aNodes[iNode].type != JSON_STRING
+        || pTape->aNodes[iNode].v.s.n != 2 * VALUE_STATS_HLL_REGISTERS)
+        return;
+
+    const char *z = pTape->aNodes[iNode].v.s.z;
+    for (int ii = 0; ii < VALUE_STATS_HLL_REGISTERS; ii++)
+    {
+        u8 reg = (u8) (_hexDigit(z[ii * 2]) << 4 | _hexDigit(z[ii * 2 + 1]));
+        if (reg > aSketch[ii])
+            aSketch[ii] = reg;
+    }
+}
+
+/*
+ * Updates pResult with min or max value from parsed statistics
+ */
+static void _mergeBound(const JsonTape_t *pTape, const char *zKey, int iSign, _StatValue_t *pResult)
+{
+    _StatValue_t v;
+    u32 iNode = JsonTape_findKey(pTape, 0, zKey);
+    if (iNode != JSON_TAPE_NONE && _valueFromNode(&v, &pTape->aNodes[iNode])
+        && (pResult->type == 0 || _compareValues(&v, pResult) * iSign > 0))
+        *pResult = v;
+}
+
+/*
+ * Adds upper bounds of histogram buckets as points weighted by bucket depth.
+ * Returns number of buckets
+ */
+static int _addHistogramPoints(const JsonTape_t *pTape, _WeightedPoint_t *aPoints, int *pnPoints)
+{
+    u32 iHist = JsonTape_findKey(pTape, 0, "histogram");
+    if (iHist == JSON_TAPE_NONE || pTape->aNodes[iHist].type != JSON_ARRAY || pTape->aNodes[iHist].nChildren < 2)
+        return 0;
+
+    int nBuckets = (int) pTape->aNodes[iHist].nChildren - 1;
+    double dWeight = (double) _nodeInt(pTape, JsonTape_findKey(pTape, 0, "count")) / nBuckets;
+    u32 iNode = JsonTape_firstChild(pTape, iHist);
+    for (iNode = JsonTape_nextSibling(pTape, iNode); iNode != JSON_TAPE_NONE;
+         iNode = JsonTape_nextSibling(pTape, iNode))
+    {
+        _WeightedPoint_t *pPoint = &aPoints[*pnPoints];
+        if (_valueFromNode(&pPoint->v, &pTape->aNodes[iNode]))
+        {
+            pPoint->dWeight = dWeight;
+            (*pnPoints)++;
+        }
+    }
+    return nBuckets;
+}
+
+static void _statsMergeFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    int result;
+    JsonTape_t aTapes[2];
+    u8 aSketch[VALUE_STATS_HLL_REGISTERS];
+    _StatValue_t min = {0}, max = {0};
+    _WeightedPoint_t *aPoints = NULL;
+    int nPoints = 0;
+    int nBuckets = 0;
+    sqlite3_int64 nRows = 0, nCount = 0;
+    const _StatValue_t *apBounds[VALUE_STATS_MAX_BUCKETS + 1];
+    int nBounds = 0;
+    StringBuilder_t sb;
+
+    UNUSED_PARAM(argc);
+
+    // Statistics merged with nothing is the same statistics
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL)
+    {
+        sqlite3_result_value(context, argv[sqlite3_value_type(argv[0]) == SQLITE_NULL ? 1 : 0]);
+        return;
+    }
+
+    StringBuilder_init(&sb);
+    JsonTape_init(&aTapes[0]);
+    JsonTape_init(&aTapes[1]);
+    memset(aSketch, 0, sizeof(aSketch));
+
+    for (int ii = 0; ii < 2; ii++)
+    {
+        JsonTape_t *pTape = &aTapes[ii];
+        CHECK_CALL(JsonTape_parse(pTape, (const char *) sqlite3_value_text(argv[ii]), sqlite3_value_bytes(argv[ii])));
+        if (pTape->aNodes[0].type != JSON_OBJECT)
+        {
+            result = SQLITE_MISMATCH;
+            goto ONERROR;
+        }
+
+        nRows += _nodeInt(pTape, JsonTape_findKey(pTape, 0, "rows"));
+        nCount += _nodeInt(pTape, JsonTape_findKey(pTape, 0, "count"));
+        _mergeSketch(pTape, aSketch);
+        _mergeBound(pTape, "min", -1, &min);
+        _mergeBound(pTape, "max", 1, &max);
+    }
+
+    CHECK_MALLOC(aPoints, (int) ((aTapes[0].nNodes + aTapes[1].nNodes) * sizeof(_WeightedPoint_t)));
+    for (int ii = 0; ii < 2; ii++)
+    {
+        int n = _addHistogramPoints(&aTapes[ii], aPoints, &nPoints);
+        if (n > nBuckets)
+            nBuckets = n;
+    }
+
+    if (nPoints > 0 && min.type != 0)
+    {
+        double dTotal = 0;
+        qsort(aPoints, (size_t) nPoints, sizeof(_WeightedPoint_t), _qsortPoints);
+        for (int ii = 0; ii < nPoints; ii++)
+            dTotal += aPoints[ii].dWeight;
+
+        apBounds[nBounds++] = &min;
+        double dCumulative = 0;
+        int iPoint = 0;
+        for (int jj = 1; jj < nBuckets; jj++)
+        {
+            double dThreshold = dTotal * jj / nBuckets;
+            while (iPoint < nPoints - 1 && dCumulative + aPoints[iPoint].dWeight < dThreshold)
+                dCumulative += aPoints[iPoint++].dWeight;
+            apBounds[nBounds++] = &aPoints[iPoint].v;
+        }
+        apBounds[nBounds++] = &max;
+    }
+
+    _appendStats(&sb, nRows, nCount, aSketch, &min, &max, apBounds, nBounds);
+    _setResult(context, &sb);
+    result = SQLITE_OK;
+    goto EXIT;
+
+    ONERROR:
+    StringBuilder_clear(&sb);
+    if (result == SQLITE_NOMEM)
+        sqlite3_result_error_nomem(context);
+    else
+        sqlite3_result_error(context, "value_stats_merge: invalid statistics", -1);
+
+    EXIT:
+    sqlite3_free(aPoints);
+    JsonTape_free(&aTapes[0]);
+    JsonTape_free(&aTapes[1]);
+}
+
+int value_stats_func_init(
+        sqlite3 *db,
+        char **pzErrMsg,
+        const sqlite3_api_routines *pApi
+)
+{
+    int rc;
+
+    UNUSED_PARAM(pzErrMsg);
+    UNUSED_PARAM(pApi);
+
+    rc = sqlite3_create_function(db, "value_stats", 1, SQLITE_UTF8, NULL, NULL, _statsStep, _statsFinal);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function(db, "value_stats", 2, SQLITE_UTF8, NULL, NULL, _statsStep, _statsFinal);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function(db, "value_stats_merge", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+                                     _statsMergeFunc, NULL, NULL);
+
+    return rc;
+}
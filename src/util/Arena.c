@@ -0,0 +1,127 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#include <string.h>
+
+#include "Arena.h"
+
+#ifdef  SQLITE_CORE
+
+#include <sqlite3.h>
+
+#else
+
+#include <sqlite3ext.h>
+
+SQLITE_EXTENSION_INIT3
+
+#endif
+
+struct ArenaBlock_t
+{
+    ArenaBlock_t *pNext;
+
+    /*
+     * Size of aData
+     */
+    u32 nSize;
+
+    /*
+     * Number of used bytes in aData
+     */
+    u32 nUsed;
+
+    /*
+     * Block data. Declared as 64 bit integers to keep alignment
+     */
+    sqlite3_int64 aData[1];
+};
+
+#define ARENA_ALIGN(n) (((n) + 7) & ~((u32) 7))
+
+void Arena_init(Arena_t *self)
+{
+    memset(self, 0, sizeof(*self));
+}
+
+static void _freeBlocks(ArenaBlock_t *pBlock)
+{
+    while (pBlock != NULL)
+    {
+        ArenaBlock_t *pNext = pBlock->pNext;
+        sqlite3_free(pBlock);
+        pBlock = pNext;
+    }
+}
+
+void *Arena_alloc(Arena_t *self, u32 n)
+{
+    ArenaBlock_t *pBlock = self->pCurrent;
+    void *result;
+
+    n = ARENA_ALIGN(n == 0 ? 1 : n);
+
+    if (pBlock == NULL || pBlock->nSize - pBlock->nUsed < n)
+    {
+        /*
+         * Reuse free block if it is big enough. Otherwise, allocate new one
+         */
+        if (self->pFree != NULL && self->pFree->nSize >= n)
+        {
+            pBlock = self->pFree;
+            self->pFree = pBlock->pNext;
+        }
+        else
+        {
+            u32 nSize = n > ARENA_BLOCK_SIZE ? n : ARENA_BLOCK_SIZE;
+            pBlock = sqlite3_malloc((int) (sizeof(ArenaBlock_t) - sizeof(pBlock->aData) + nSize));
+            if (pBlock == NULL)
+                return NULL;
+            pBlock->nSize = nSize;
+        }
+
+        pBlock->nUsed = 0;
+        pBlock->pNext = self->pBlocks;
+        self->pBlocks = pBlock;
+        self->pCurrent = pBlock;
+    }
+
+    result = (char *) pBlock->aData + pBlock->nUsed;
+    pBlock->nUsed += n;
+    return result;
+}
+
+void *Arena_dup(Arena_t *self, const void *pData, u32 n, bool bZeroTerm)
+{
+    char *result = Arena_alloc(self, bZeroTerm ? n + 1 : n);
+    if (result == NULL)
+        return NULL;
+
+    if (n > 0)
+        memcpy(result, pData, n);
+    if (bZeroTerm)
+        result[n] = 0;
+    return result;
+}
+
+void Arena_reset(Arena_t *self)
+{
+    ArenaBlock_t *pBlock = self->pBlocks;
+    while (pBlock != NULL)
+    {
+        ArenaBlock_t *pNext = pBlock->pNext;
+        pBlock->pNext = self->pFree;
+        self->pFree = pBlock;
+        pBlock = pNext;
+    }
+    self->pBlocks = NULL;
+    self->pCurrent = NULL;
+}
+
+void Arena_clear(Arena_t *self)
+{
+    _freeBlocks(self->pBlocks);
+    _freeBlocks(self->pFree);
+    memset(self, 0, sizeof(*self));
+}
@@ -0,0 +1,70 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_ARENA_H
+#define FLEXILITE_ARENA_H
+
+#include "../common/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Default size of arena block. Allocations larger than block size get their own block
+ */
+#define ARENA_BLOCK_SIZE 8192
+
+typedef struct ArenaBlock_t ArenaBlock_t;
+
+/*
+ * Bump allocator for short lived data with common lifetime (e.g. values of loaded object).
+ * Individual allocations are never freed. Whole arena is released at once by Arena_reset (blocks are kept
+ * for reuse) or Arena_clear (memory is returned to SQLite allocator)
+ */
+typedef struct Arena_t
+{
+    /*
+     * Current block, where allocations are made from
+     */
+    ArenaBlock_t *pCurrent;
+
+    /*
+     * All allocated blocks, current is the first one
+     */
+    ArenaBlock_t *pBlocks;
+
+    /*
+     * Blocks released by Arena_reset, to be reused
+     */
+    ArenaBlock_t *pFree;
+} Arena_t;
+
+void Arena_init(Arena_t *self);
+
+/*
+ * Allocates n bytes, aligned to 8 bytes. Returns NULL if out of memory
+ */
+void *Arena_alloc(Arena_t *self, u32 n);
+
+/*
+ * Allocates copy of memory buffer. If bZeroTerm is true, zero byte is appended after the copy.
+ */
+void *Arena_dup(Arena_t *self, const void *pData, u32 n, bool bZeroTerm);
+
+/*
+ * Releases all allocations, but keeps memory blocks for reuse
+ */
+void Arena_reset(Arena_t *self);
+
+/*
+ * Releases all memory
+ */
+void Arena_clear(Arena_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_ARENA_H
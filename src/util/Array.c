@@ -13,7 +13,7 @@
 #else
 
 #include <sqlite3ext.h>
-#include <ntsid.h>
+#include <stdint.h>
 
 SQLITE_EXTENSION_INIT3
 
@@ -56,6 +56,12 @@ void Array_init(Array_t *self, size_t elemSize, void (*disposeElem)(void *))
     }
 }
 
+void Array_initInArena(Array_t *self, size_t elemSize, void (*disposeElem)(void *), Arena_t *pArena)
+{
+    Array_init(self, elemSize, disposeElem);
+    self->pArena = pArena;
+}
+
 void Array_clear(Array_t *self)
 {
     assert(self);
@@ -72,7 +78,8 @@ void Array_clear(Array_t *self)
 
     if (!self->bStatic)
     {
-        sqlite3_free(self->items);
+        if (self->pArena == NULL)
+            sqlite3_free(self->items);
 
         if (self->iElemSize < sizeof(self->staticData))
         {
@@ -95,12 +102,13 @@ _array_ensure_capacity(Array_t *self, intptr_t newCnt)
         if (newCap < newCnt)
             newCap = newCnt;
 
-        void *newItems = sqlite3_malloc64(newCap * self->iElemSize);
+        void *newItems = self->pArena != NULL ? Arena_alloc(self->pArena, (u32) (newCap * self->iElemSize))
+                                              : sqlite3_malloc64(newCap * self->iElemSize);
         if (!newItems)
             return SQLITE_NOMEM;
         memcpy(newItems, self->items, self->iElemSize * self->iCnt);
 
-        if (!self->bStatic)
+        if (!self->bStatic && self->pArena == NULL)
         {
             sqlite3_free(self->items);
         }
@@ -144,7 +152,9 @@ void *Array_append(Array_t *self)
     int result = _array_ensure_capacity(self, self->iCnt + 1);
     if (result != SQLITE_OK)
         return NULL;
-    void *pItem = Array_getNth(self, self->iCnt + 1);
+    self->iCnt++;
+    void *pItem = Array_getNth(self, self->iCnt - 1);
+    memset(pItem, 0, self->iElemSize);
     return pItem;
 }
 
@@ -6,8 +6,9 @@
 #define FLEXILITE_ARRAY_H
 
 #include <stddef.h>
-#include <ntsid.h>
+#include <stdint.h>
 #include "../common/common.h"
+#include "Arena.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,6 +54,11 @@ typedef struct Array_t
      */
     bool bStatic;
 
+    /*
+     * If not NULL, items are allocated in this arena and are never freed individually
+     */
+    Arena_t *pArena;
+
     char staticData[64];
 } Array_t;
 
@@ -62,6 +68,11 @@ extern void Array_free(Array_t *self);
 
 extern void Array_init(Array_t *self, size_t elemSize, void (*disposeElem)(void *pElem));
 
+/*
+ * Initializes array which allocates items in pArena. Memory is released when arena gets reset
+ */
+extern void Array_initInArena(Array_t *self, size_t elemSize, void (*disposeElem)(void *pElem), Arena_t *pArena);
+
 /*
  * Removes and cleans all items
  */
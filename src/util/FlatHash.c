@@ -0,0 +1,388 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#include <string.h>
+
+#include "FlatHash.h"
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+
+#endif
+
+#define CTRL_EMPTY ((unsigned char) 0x80)
+#define CTRL_DELETED ((unsigned char) 0xFE)
+
+/*
+ * Control byte of occupied slot: 7 top bits of hash
+ */
+#define CTRL_H2(h) ((unsigned char) ((h) >> 25))
+
+/*
+ * Max load (including tombstones) is 7/8 of capacity
+ */
+#define MAX_LOAD(nCapacity) ((nCapacity) - (nCapacity) / 8)
+
+/*
+ * ASCII case folding, as in sqlite3_stricmp
+ */
+static const unsigned char _aFold[256] = {
+#define F16(n) n, n+1, n+2, n+3, n+4, n+5, n+6, n+7, n+8, n+9, n+10, n+11, n+12, n+13, n+14, n+15
+        F16(0), F16(16), F16(32), F16(48),
+        64, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+        'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', 91, 92, 93, 94, 95,
+        F16(96), F16(112), F16(128), F16(144), F16(160), F16(176), F16(192), F16(208), F16(224), F16(240)
+#undef F16
+};
+
+static inline bool _isIgnoreCase(DICTIONARY_TYPE eDictType)
+{
+    return eDictType == DICT_STRING_IGNORE_CASE || eDictType == DICT_STRING_IGNORE_CASE_NO_FREE;
+}
+
+static inline bool _ownsKey(DICTIONARY_TYPE eDictType)
+{
+    return eDictType == DICT_STRING || eDictType == DICT_STRING_IGNORE_CASE;
+}
+
+/*
+ * Final mixing step of MurmurHash3, so that both low bits (group index) and high bits (control byte)
+ * depend on all bits of key
+ */
+static inline u32 _fmix32(u32 h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static u32 _hashKey(const FlatHash *self, DictionaryKey_t key)
+{
+    if (self->eDictType == DICT_INT)
+    {
+        u64 k = (u64) key.iKey;
+        return _fmix32((u32) k ^ (u32) (k >> 32) * 0x9E3779B9u);
+    }
+
+    // FNV-1a. Case insensitive keys are hashed in folded form
+    u32 h = 2166136261u;
+    const unsigned char *p = (const unsigned char *) key.pKey;
+    if (_isIgnoreCase(self->eDictType))
+    {
+        while (*p != 0)
+        {
+            h ^= _aFold[*p++];
+            h *= 16777619u;
+        }
+    }
+    else
+    {
+        while (*p != 0)
+        {
+            h ^= *p++;
+            h *= 16777619u;
+        }
+    }
+    return _fmix32(h);
+}
+
+static inline bool _keyEquals(const FlatHash *self, const FlatHashSlot_t *pSlot, DictionaryKey_t key)
+{
+    if (self->eDictType == DICT_INT)
+        return pSlot->key.iKey == key.iKey;
+    if (pSlot->key.pKey == key.pKey)
+        return true;
+    if (_isIgnoreCase(self->eDictType))
+    {
+        const unsigned char *p1 = (const unsigned char *) pSlot->key.pKey;
+        const unsigned char *p2 = (const unsigned char *) key.pKey;
+        while (*p1 != 0 && _aFold[*p1] == _aFold[*p2])
+        {
+            p1++;
+            p2++;
+        }
+        return _aFold[*p1] == _aFold[*p2];
+    }
+    return strcmp(pSlot->key.pKey, key.pKey) == 0;
+}
+
+/*
+ * Returns bitmask of slots in group (bit N - slot N), which control byte is equal to c
+ */
+static inline u32 _matchByte(const unsigned char *aGroup, unsigned char c)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) aGroup);
+    return (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) c)));
+#else
+    u32 result = 0;
+    for (int ii = 0; ii < FLATHASH_GROUP_SIZE; ii++)
+    {
+        if (aGroup[ii] == c)
+            result |= 1u << ii;
+    }
+    return result;
+#endif
+}
+
+/*
+ * Returns bitmask of slots in group, which are either EMPTY or DELETED (both have high bit set)
+ */
+static inline u32 _matchFree(const unsigned char *aGroup)
+{
+#ifdef __SSE2__
+    return (u32) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) aGroup));
+#else
+    u32 result = 0;
+    for (int ii = 0; ii < FLATHASH_GROUP_SIZE; ii++)
+    {
+        if (aGroup[ii] & 0x80)
+            result |= 1u << ii;
+    }
+    return result;
+#endif
+}
+
+static inline int _lowestBit(u32 mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int result = 0;
+    while ((mask & 1) == 0)
+    {
+        mask >>= 1;
+        result++;
+    }
+    return result;
+#endif
+}
+
+/*
+ * Returns index of slot with given key, or -1 if key is not found
+ */
+static int _find(const FlatHash *self, DictionaryKey_t key, u32 h)
+{
+    if (self->nCapacity == 0)
+        return -1;
+
+    u32 groupMask = self->nCapacity / FLATHASH_GROUP_SIZE - 1;
+    u32 iGroup = h & groupMask;
+    unsigned char h2 = CTRL_H2(h);
+
+    // Triangular probing visits every group when number of groups is power of 2
+    for (u32 iStep = 1;; iStep++)
+    {
+        const unsigned char *aGroup = self->aCtrl + iGroup * FLATHASH_GROUP_SIZE;
+        u32 match = _matchByte(aGroup, h2);
+        while (match != 0)
+        {
+            int iSlot = (int) (iGroup * FLATHASH_GROUP_SIZE) + _lowestBit(match);
+            const FlatHashSlot_t *pSlot = &self->aSlots[iSlot];
+            if (pSlot->iHash == h && _keyEquals(self, pSlot, key))
+                return iSlot;
+            match &= match - 1;
+        }
+
+        if (_matchByte(aGroup, CTRL_EMPTY) != 0)
+            return -1;
+
+        iGroup = (iGroup + iStep) & groupMask;
+    }
+}
+
+/*
+ * Returns index of the first EMPTY or DELETED slot in probing sequence for hash h
+ */
+static int _findFree(const FlatHash *self, u32 h)
+{
+    u32 groupMask = self->nCapacity / FLATHASH_GROUP_SIZE - 1;
+    u32 iGroup = h & groupMask;
+
+    for (u32 iStep = 1;; iStep++)
+    {
+        u32 match = _matchFree(self->aCtrl + iGroup * FLATHASH_GROUP_SIZE);
+        if (match != 0)
+            return (int) (iGroup * FLATHASH_GROUP_SIZE) + _lowestBit(match);
+
+        iGroup = (iGroup + iStep) & groupMask;
+    }
+}
+
+/*
+ * Reallocates table with nNewCapacity slots and moves all entries there. Tombstones are dropped
+ */
+static int _resize(FlatHash *self, u32 nNewCapacity)
+{
+    // Slots follow control bytes, aligned to 8 bytes
+    size_t nCtrlSize = (nNewCapacity + 7) & ~((size_t) 7);
+    unsigned char *pBlock = sqlite3_malloc64(nCtrlSize + sizeof(FlatHashSlot_t) * nNewCapacity);
+    if (pBlock == NULL)
+        return SQLITE_NOMEM;
+
+    unsigned char *aOldCtrl = self->aCtrl;
+    FlatHashSlot_t *aOldSlots = self->aSlots;
+    u32 nOldCapacity = self->nCapacity;
+
+    self->aCtrl = pBlock;
+    self->aSlots = (FlatHashSlot_t *) (pBlock + nCtrlSize);
+    self->nCapacity = nNewCapacity;
+    self->nDeleted = 0;
+    memset(self->aCtrl, CTRL_EMPTY, nNewCapacity);
+
+    for (u32 ii = 0; ii < nOldCapacity; ii++)
+    {
+        if ((aOldCtrl[ii] & 0x80) == 0)
+        {
+            int iSlot = _findFree(self, aOldSlots[ii].iHash);
+            self->aCtrl[iSlot] = aOldCtrl[ii];
+            self->aSlots[iSlot] = aOldSlots[ii];
+        }
+    }
+
+    sqlite3_free(aOldCtrl);
+    return SQLITE_OK;
+}
+
+void FlatHash_init(FlatHash *self, DICTIONARY_TYPE dictType, freeElem freeElemFunc)
+{
+    assert(self != NULL);
+    memset(self, 0, sizeof(*self));
+    self->eDictType = dictType;
+    if (freeElemFunc)
+        self->freeElemFunc = freeElemFunc;
+    else self->freeElemFunc = (void *) sqlite3_value_free;
+}
+
+void FlatHash_set(FlatHash *self, DictionaryKey_t key, void *pData)
+{
+    assert(self != NULL);
+
+    u32 h = _hashKey(self, key);
+    int iSlot = _find(self, key, h);
+
+    if (iSlot >= 0)
+    {
+        FlatHashSlot_t *pSlot = &self->aSlots[iSlot];
+        if (pData == NULL)
+        {
+            self->freeElemFunc(pSlot->data);
+            if (_ownsKey(self->eDictType))
+                sqlite3_free((void *) pSlot->key.pKey);
+
+            // If group has empty slot, lookups stop at this group anyway, so slot can become empty again
+            unsigned char *aGroup = self->aCtrl + (iSlot & ~(FLATHASH_GROUP_SIZE - 1));
+            if (_matchByte(aGroup, CTRL_EMPTY) != 0)
+                self->aCtrl[iSlot] = CTRL_EMPTY;
+            else
+            {
+                self->aCtrl[iSlot] = CTRL_DELETED;
+                self->nDeleted++;
+            }
+            self->count--;
+            return;
+        }
+
+        if (pSlot->data != pData)
+        {
+            self->freeElemFunc(pSlot->data);
+            pSlot->data = pData;
+        }
+
+        if (pSlot->key.pKey != key.pKey)
+        {
+            if (_ownsKey(self->eDictType))
+                sqlite3_free((void *) pSlot->key.pKey);
+            pSlot->key = key;
+        }
+        return;
+    }
+
+    if (pData == NULL)
+        return;
+
+    if (self->nCapacity == 0)
+    {
+        if (_resize(self, FLATHASH_GROUP_SIZE) != SQLITE_OK)
+            return;
+    }
+    else
+        if (self->count + self->nDeleted + 1 > MAX_LOAD(self->nCapacity))
+        {
+            // Grow if table is at least half full with live entries. Otherwise, just drop tombstones
+            u32 nNewCapacity = (self->count + 1) * 2 > MAX_LOAD(self->nCapacity)
+                               ? self->nCapacity * 2 : self->nCapacity;
+            if (_resize(self, nNewCapacity) != SQLITE_OK)
+                return;
+        }
+
+    iSlot = _findFree(self, h);
+    if (self->aCtrl[iSlot] == CTRL_DELETED)
+        self->nDeleted--;
+    self->aCtrl[iSlot] = CTRL_H2(h);
+    self->aSlots[iSlot].key = key;
+    self->aSlots[iSlot].data = pData;
+    self->aSlots[iSlot].iHash = h;
+    self->count++;
+}
+
+void *FlatHash_get(const FlatHash *self, DictionaryKey_t key)
+{
+    assert(self != NULL);
+    if (self->count == 0)
+        return NULL;
+
+    int iSlot = _find(self, key, _hashKey(self, key));
+    return iSlot >= 0 ? self->aSlots[iSlot].data : NULL;
+}
+
+void *FlatHash_each(const FlatHash *self, iterateeFunc iteratee, var param)
+{
+    assert(self != NULL);
+    assert(iteratee);
+
+    u32 index = 0;
+    bool bStop = false;
+    for (u32 ii = 0; ii < self->nCapacity; ii++)
+    {
+        if (self->aCtrl[ii] & 0x80)
+            continue;
+
+        FlatHashSlot_t *pSlot = &self->aSlots[ii];
+        if (self->eDictType == DICT_INT)
+            iteratee(NULL, pSlot->key.iKey, pSlot->data, (var) self, param, &bStop);
+        else iteratee(pSlot->key.pKey, index, pSlot->data, (var) self, param, &bStop);
+        if (bStop)
+            return pSlot->data;
+        index++;
+    }
+
+    return NULL;
+}
+
+void FlatHash_clear(FlatHash *self)
+{
+    assert(self != NULL);
+
+    for (u32 ii = 0; ii < self->nCapacity; ii++)
+    {
+        if (self->aCtrl[ii] & 0x80)
+            continue;
+
+        self->freeElemFunc(self->aSlots[ii].data);
+        if (_ownsKey(self->eDictType))
+            sqlite3_free((void *) self->aSlots[ii].key.pKey);
+    }
+
+    sqlite3_free(self->aCtrl);
+    self->aCtrl = NULL;
+    self->aSlots = NULL;
+    self->nCapacity = 0;
+    self->nDeleted = 0;
+    self->count = 0;
+}
@@ -0,0 +1,93 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_FLATHASH_H
+#define FLEXILITE_FLATHASH_H
+
+#include "hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Number of slots in probing group. Control bytes of group are matched at once (SSE2 when available)
+ */
+#define FLATHASH_GROUP_SIZE 16
+
+/*
+ * Slot of FlatHash. Full hash value is kept to avoid string comparisons for non matching keys
+ * and to avoid re-hashing on growth. For case insensitive tables hash is calculated on folded key
+ */
+typedef struct FlatHashSlot_t
+{
+    DictionaryKey_t key;
+    void *data;
+    u32 iHash;
+} FlatHashSlot_t;
+
+/*
+ * Open addressing hash table (Swiss table layout), with the same semantics as Hash (see hash.h):
+ * the same dictionary types, key ownership rules, element disposal and iteration callback.
+ * Used for metadata lookups on hot paths (class and property definitions by name and ID).
+ *
+ * Slots are organized in groups of FLATHASH_GROUP_SIZE. Every slot has control byte: EMPTY, DELETED
+ * or 7 bits of hash of key in the slot. Lookup compares control bytes of whole group with 7 bits of hash
+ * of searched key, and compares keys only for matching slots. Groups are probed quadratically until group
+ * with empty slot is found.
+ */
+typedef struct FlatHash
+{
+    /*
+     * Number of entries. Same as Hash.count
+     */
+    unsigned int count;
+
+    /*
+     * Number of slots (multiple of FLATHASH_GROUP_SIZE, power of 2). 0 if table is not allocated
+     */
+    unsigned int nCapacity;
+
+    /*
+     * Number of DELETED control bytes (tombstones)
+     */
+    unsigned int nDeleted;
+
+    /*
+     * Control bytes (nCapacity) and slots. Allocated as one block
+     */
+    unsigned char *aCtrl;
+    FlatHashSlot_t *aSlots;
+
+    freeElem freeElemFunc;
+
+    DICTIONARY_TYPE eDictType;
+} FlatHash;
+
+/*
+ * Initializes hash table. If freeElemFunc is NULL, hash table is assumed to hold sqlite3_value
+ * and sqlite3_value_free will be used for disposing elements' data
+ */
+void FlatHash_init(FlatHash *self, DICTIONARY_TYPE dictType, freeElem freeElemFunc);
+
+/*
+ * Sets new value for key. If pData is NULL, existing entry gets deleted
+ */
+void FlatHash_set(FlatHash *self, DictionaryKey_t key, void *pData);
+
+void *FlatHash_get(const FlatHash *self, DictionaryKey_t key);
+
+/*
+ * Iterates over all entries, in order of slots. Returns data of entry, on which iteratee set bStop
+ * to true, or NULL
+ */
+void *FlatHash_each(const FlatHash *self, iterateeFunc iteratee, var param);
+
+void FlatHash_clear(FlatHash *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_FLATHASH_H
@@ -0,0 +1,412 @@
+//
+// Created by slanska on 2026-10-16.
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "IdSet.h"
+
+#ifdef  SQLITE_CORE
+
+#include <sqlite3.h>
+
+#else
+
+#include <sqlite3ext.h>
+
+SQLITE_EXTENSION_INIT3
+
+#endif
+
+/*
+ * Set is converted to bitmap only if it has at least this number of items
+ */
+#define IDSET_MIN_BITMAP_COUNT 256
+
+/*
+ * Bitmap takes 1 bit per ID in range, sorted array - 64 bits per ID.
+ * So, bitmap is used when range of IDs is not more than 64 times bigger than number of IDs
+ */
+#define IDSET_BITMAP_DENSITY 64
+
+static inline u32 _popCount64(u64 x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (u32) __builtin_popcountll(x);
+#else
+    u32 result = 0;
+    while (x)
+    {
+        x &= x - 1;
+        result++;
+    }
+    return result;
+#endif
+}
+
+static inline sqlite3_int64 _floor64(sqlite3_int64 x)
+{
+    return x >= 0 ? x & ~(sqlite3_int64) 63 : -((-x + 63) & ~(sqlite3_int64) 63);
+}
+
+static int _compareIds(const void *a, const void *b)
+{
+    sqlite3_int64 aa = *(const sqlite3_int64 *) a;
+    sqlite3_int64 bb = *(const sqlite3_int64 *) b;
+    return aa < bb ? -1 : (aa > bb ? 1 : 0);
+}
+
+static int _ensureCapacity(IdSet_t *self, u32 nCapacity)
+{
+    if (nCapacity <= self->nAlloc)
+        return SQLITE_OK;
+
+    u32 nNewAlloc = self->nAlloc > 0 ? self->nAlloc : 64;
+    while (nNewAlloc < nCapacity)
+        nNewAlloc *= 2;
+
+    sqlite3_int64 *aNew = sqlite3_realloc64(self->aIds, nNewAlloc * sizeof(sqlite3_int64));
+    if (aNew == NULL)
+        return SQLITE_NOMEM;
+
+    self->aIds = aNew;
+    self->nAlloc = nNewAlloc;
+    return SQLITE_OK;
+}
+
+void IdSet_init(IdSet_t *self)
+{
+    memset(self, 0, sizeof(*self));
+    self->bSorted = true;
+}
+
+void IdSet_clear(IdSet_t *self)
+{
+    if (self != NULL)
+    {
+        sqlite3_free(self->aIds);
+        sqlite3_free(self->aBits);
+        IdSet_init(self);
+    }
+}
+
+void IdSet_move(IdSet_t *pDest, IdSet_t *pSrc)
+{
+    IdSet_clear(pDest);
+    *pDest = *pSrc;
+    IdSet_init(pSrc);
+}
+
+int IdSet_add(IdSet_t *self, sqlite3_int64 lID)
+{
+    assert(!self->bBitmap);
+
+    int result = _ensureCapacity(self, self->nCount + 1);
+    if (result != SQLITE_OK)
+        return result;
+
+    if (self->nCount > 0 && self->aIds[self->nCount - 1] >= lID)
+        self->bSorted = false;
+
+    self->aIds[self->nCount++] = lID;
+    return SQLITE_OK;
+}
+
+/*
+ * Converts sorted array to bitmap
+ */
+static int _toBitmap(IdSet_t *self)
+{
+    assert(!self->bBitmap && self->bSorted && self->nCount > 0);
+
+    sqlite3_int64 lBase = _floor64(self->aIds[0]);
+    sqlite3_int64 nWords = (self->aIds[self->nCount - 1] - lBase) / 64 + 1;
+
+    u64 *aBits = sqlite3_malloc64(nWords * sizeof(u64));
+    if (aBits == NULL)
+        return SQLITE_NOMEM;
+    memset(aBits, 0, nWords * sizeof(u64));
+
+    for (u32 ii = 0; ii < self->nCount; ii++)
+    {
+        sqlite3_int64 bit = self->aIds[ii] - lBase;
+        aBits[bit / 64] |= (u64) 1 << (bit % 64);
+    }
+
+    sqlite3_free(self->aIds);
+    self->aIds = NULL;
+    self->nAlloc = 0;
+    self->aBits = aBits;
+    self->nWords = (u32) nWords;
+    self->lBase = lBase;
+    self->bBitmap = true;
+    return SQLITE_OK;
+}
+
+/*
+ * Converts bitmap to sorted array
+ */
+static int _toArray(IdSet_t *self)
+{
+    assert(self->bBitmap);
+
+    sqlite3_int64 *aIds = NULL;
+    if (self->nCount > 0)
+    {
+        aIds = sqlite3_malloc64(self->nCount * sizeof(sqlite3_int64));
+        if (aIds == NULL)
+            return SQLITE_NOMEM;
+    }
+
+    u32 n = 0;
+    for (u32 ww = 0; ww < self->nWords; ww++)
+    {
+        u64 word = self->aBits[ww];
+        while (word)
+        {
+            u32 bit = _popCount64((word & -word) - 1);
+            aIds[n++] = self->lBase + ww * 64 + bit;
+            word &= word - 1;
+        }
+    }
+    assert(n == self->nCount);
+
+    sqlite3_free(self->aBits);
+    self->aBits = NULL;
+    self->nWords = 0;
+    self->lBase = 0;
+    self->aIds = aIds;
+    self->nAlloc = n;
+    self->bBitmap = false;
+    self->bSorted = true;
+    return SQLITE_OK;
+}
+
+int IdSet_seal(IdSet_t *self)
+{
+    if (self->bBitmap)
+        return SQLITE_OK;
+
+    if (!self->bSorted)
+    {
+        qsort(self->aIds, self->nCount, sizeof(sqlite3_int64), _compareIds);
+
+        // Remove duplicates
+        u32 n = 0;
+        for (u32 ii = 0; ii < self->nCount; ii++)
+        {
+            if (n == 0 || self->aIds[n - 1] != self->aIds[ii])
+                self->aIds[n++] = self->aIds[ii];
+        }
+        self->nCount = n;
+        self->bSorted = true;
+    }
+
+    if (self->nCount >= IDSET_MIN_BITMAP_COUNT)
+    {
+        sqlite3_uint64 range = (sqlite3_uint64) (self->aIds[self->nCount - 1] - self->aIds[0]);
+        if (range / IDSET_BITMAP_DENSITY < self->nCount)
+            return _toBitmap(self);
+    }
+
+    return SQLITE_OK;
+}
+
+/*
+ * Finds position of the first item in aIds[iStart..nCount) which is >= lID.
+ * Probes positions iStart + 1, iStart + 2, iStart + 4... and then does binary search in the last interval.
+ * Effective when searched values are close to iStart, which is typical for merging sorted sequences
+ */
+static u32 _gallop(const sqlite3_int64 *aIds, u32 nCount, u32 iStart, sqlite3_int64 lID)
+{
+    if (iStart >= nCount || aIds[iStart] >= lID)
+        return iStart;
+
+    u32 lo = iStart;
+    u32 step = 1;
+    u32 hi = iStart + step;
+    while (hi < nCount && aIds[hi] < lID)
+    {
+        lo = hi;
+        step *= 2;
+        hi = iStart + step;
+    }
+    if (hi > nCount)
+        hi = nCount;
+
+    // aIds[lo] < lID, and aIds[hi] >= lID (or hi == nCount)
+    while (lo + 1 < hi)
+    {
+        u32 mid = lo + (hi - lo) / 2;
+        if (aIds[mid] < lID)
+            lo = mid;
+        else hi = mid;
+    }
+    return hi;
+}
+
+static int _intersectArrays(IdSet_t *pDest, const IdSet_t *pA, const IdSet_t *pB)
+{
+    int result;
+
+    // Iterate over smaller set, gallop over bigger one
+    if (pA->nCount > pB->nCount)
+    {
+        const IdSet_t *pTmp = pA;
+        pA = pB;
+        pB = pTmp;
+    }
+
+    result = _ensureCapacity(pDest, pA->nCount);
+    if (result != SQLITE_OK)
+        return result;
+
+    u32 jj = 0;
+    for (u32 ii = 0; ii < pA->nCount && jj < pB->nCount; ii++)
+    {
+        jj = _gallop(pB->aIds, pB->nCount, jj, pA->aIds[ii]);
+        if (jj < pB->nCount && pB->aIds[jj] == pA->aIds[ii])
+        {
+            pDest->aIds[pDest->nCount++] = pA->aIds[ii];
+            jj++;
+        }
+    }
+
+    return SQLITE_OK;
+}
+
+static int _intersectArrayWithBitmap(IdSet_t *pDest, const IdSet_t *pArray, const IdSet_t *pBitmap)
+{
+    int result = _ensureCapacity(pDest, pArray->nCount);
+    if (result != SQLITE_OK)
+        return result;
+
+    for (u32 ii = 0; ii < pArray->nCount; ii++)
+    {
+        if (IdSet_contains(pBitmap, pArray->aIds[ii]))
+            pDest->aIds[pDest->nCount++] = pArray->aIds[ii];
+    }
+
+    return SQLITE_OK;
+}
+
+static int _intersectBitmaps(IdSet_t *pDest, const IdSet_t *pA, const IdSet_t *pB)
+{
+    sqlite3_int64 lBase = pA->lBase > pB->lBase ? pA->lBase : pB->lBase;
+    sqlite3_int64 lEndA = pA->lBase + (sqlite3_int64) pA->nWords * 64;
+    sqlite3_int64 lEndB = pB->lBase + (sqlite3_int64) pB->nWords * 64;
+    sqlite3_int64 lEnd = lEndA < lEndB ? lEndA : lEndB;
+
+    if (lEnd <= lBase)
+        // No overlap. Result is empty
+        return SQLITE_OK;
+
+    u32 nWords = (u32) ((lEnd - lBase) / 64);
+    u64 *aBits = sqlite3_malloc64(nWords * sizeof(u64));
+    if (aBits == NULL)
+        return SQLITE_NOMEM;
+
+    const u64 *aBitsA = pA->aBits + (lBase - pA->lBase) / 64;
+    const u64 *aBitsB = pB->aBits + (lBase - pB->lBase) / 64;
+    u32 nCount = 0;
+    for (u32 ww = 0; ww < nWords; ww++)
+    {
+        aBits[ww] = aBitsA[ww] & aBitsB[ww];
+        nCount += _popCount64(aBits[ww]);
+    }
+
+    pDest->aBits = aBits;
+    pDest->nWords = nWords;
+    pDest->lBase = lBase;
+    pDest->nCount = nCount;
+    pDest->bBitmap = true;
+
+    // Result became sparse. Switch to array
+    if (nCount < IDSET_MIN_BITMAP_COUNT || nWords > nCount)
+        return _toArray(pDest);
+
+    return SQLITE_OK;
+}
+
+int IdSet_intersect(IdSet_t *pDest, const IdSet_t *pA, const IdSet_t *pB)
+{
+    assert(pDest != pA && pDest != pB);
+    assert(pDest->nCount == 0 && !pDest->bBitmap);
+    assert(pA->bBitmap || pA->bSorted);
+    assert(pB->bBitmap || pB->bSorted);
+
+    if (pA->nCount == 0 || pB->nCount == 0)
+        return SQLITE_OK;
+
+    if (!pA->bBitmap && !pB->bBitmap)
+        return _intersectArrays(pDest, pA, pB);
+
+    if (pA->bBitmap && pB->bBitmap)
+        return _intersectBitmaps(pDest, pA, pB);
+
+    return pA->bBitmap ? _intersectArrayWithBitmap(pDest, pB, pA) : _intersectArrayWithBitmap(pDest, pA, pB);
+}
+
+bool IdSet_contains(const IdSet_t *self, sqlite3_int64 lID)
+{
+    if (self->bBitmap)
+    {
+        if (lID < self->lBase || lID >= self->lBase + (sqlite3_int64) self->nWords * 64)
+            return false;
+        sqlite3_int64 bit = lID - self->lBase;
+        return (self->aBits[bit / 64] & ((u64) 1 << (bit % 64))) != 0;
+    }
+
+    assert(self->bSorted);
+    u32 pos = _gallop(self->aIds, self->nCount, 0, lID);
+    return pos < self->nCount && self->aIds[pos] == lID;
+}
+
+void IdSet_begin(const IdSet_t *self, IdSetIterator_t *pIterator, bool bReverse)
+{
+    pIterator->pSet = self;
+    pIterator->bReverse = bReverse;
+    if (self->bBitmap)
+        pIterator->iPos = bReverse ? (sqlite3_int64) self->nWords * 64 - 1 : 0;
+    else pIterator->iPos = bReverse ? (sqlite3_int64) self->nCount - 1 : 0;
+}
+
+bool IdSet_next(IdSetIterator_t *pIterator, sqlite3_int64 *pID)
+{
+    const IdSet_t *pSet = pIterator->pSet;
+
+    if (!pSet->bBitmap)
+    {
+        if (pIterator->iPos < 0 || pIterator->iPos >= pSet->nCount)
+            return false;
+
+        *pID = pSet->aIds[pIterator->iPos];
+        pIterator->iPos += pIterator->bReverse ? -1 : 1;
+        return true;
+    }
+
+    sqlite3_int64 nBits = (sqlite3_int64) pSet->nWords * 64;
+    while (pIterator->iPos >= 0 && pIterator->iPos < nBits)
+    {
+        sqlite3_int64 pos = pIterator->iPos;
+        u64 word = pSet->aBits[pos / 64];
+
+        // Skip empty words
+        if (word == 0)
+        {
+            pIterator->iPos = pIterator->bReverse ? (pos / 64) * 64 - 1 : (pos / 64 + 1) * 64;
+            continue;
+        }
+
+        pIterator->iPos += pIterator->bReverse ? -1 : 1;
+        if (word & ((u64) 1 << (pos % 64)))
+        {
+            *pID = pSet->lBase + pos;
+            return true;
+        }
+    }
+
+    return false;
+}
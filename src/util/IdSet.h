@@ -0,0 +1,116 @@
+//
+// Created by slanska on 2026-10-16.
+//
+
+#ifndef FLEXILITE_IDSET_H
+#define FLEXILITE_IDSET_H
+
+#include "../common/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Set of object IDs, used for intersection of results of multiple index lookups.
+ * Set is built by appending IDs (in any order) and then sealed. Sealed set is sorted
+ * and has no duplicates. Depending on density, sealed set is stored either as
+ * sorted array of IDs, or as bitmap over range of IDs.
+ * Intersection of 2 arrays is done via galloping merge, intersection of 2 bitmaps -
+ * via bitwise AND
+ */
+typedef struct IdSet_t
+{
+    /*
+     * Sorted array of IDs (when bBitmap is false)
+     */
+    sqlite3_int64 *aIds;
+
+    /*
+     * Number of IDs in set (both for array and bitmap)
+     */
+    u32 nCount;
+
+    /*
+     * Allocated number of items in aIds
+     */
+    u32 nAlloc;
+
+    /*
+     * Bitmap (when bBitmap is true). Bit N corresponds to ID lBase + N.
+     * lBase is always multiple of 64
+     */
+    u64 *aBits;
+    u32 nWords;
+    sqlite3_int64 lBase;
+
+    bool bBitmap;
+
+    /*
+     * true if items in aIds are sorted and unique
+     */
+    bool bSorted;
+} IdSet_t;
+
+typedef struct IdSetIterator_t
+{
+    const IdSet_t *pSet;
+
+    /*
+     * Position of the next item: index in aIds or bit number in aBits
+     */
+    sqlite3_int64 iPos;
+
+    bool bReverse;
+} IdSetIterator_t;
+
+void IdSet_init(IdSet_t *self);
+
+/*
+ * Releases memory and resets set to empty state
+ */
+void IdSet_clear(IdSet_t *self);
+
+/*
+ * Appends ID to unsealed set. Returns SQLITE_OK or SQLITE_NOMEM
+ */
+int IdSet_add(IdSet_t *self, sqlite3_int64 lID);
+
+/*
+ * Sorts and removes duplicates. Converts set to bitmap if IDs are dense enough.
+ * Returns SQLITE_OK or SQLITE_NOMEM
+ */
+int IdSet_seal(IdSet_t *self);
+
+/*
+ * Intersects 2 sealed sets and puts result into pDest, which must be initialized and empty.
+ * pDest must not be the same as pA or pB.
+ * Returns SQLITE_OK or SQLITE_NOMEM
+ */
+int IdSet_intersect(IdSet_t *pDest, const IdSet_t *pA, const IdSet_t *pB);
+
+/*
+ * Moves content of pSrc to pDest. pDest gets cleared first. pSrc is left empty
+ */
+void IdSet_move(IdSet_t *pDest, IdSet_t *pSrc);
+
+/*
+ * Returns true if sealed set has lID
+ */
+bool IdSet_contains(const IdSet_t *self, sqlite3_int64 lID);
+
+/*
+ * Starts iteration over sealed set in ascending (or descending, if bReverse is true) order
+ */
+void IdSet_begin(const IdSet_t *self, IdSetIterator_t *pIterator, bool bReverse);
+
+/*
+ * Returns next ID in pID. Returns false when there are no more items
+ */
+bool IdSet_next(IdSetIterator_t *pIterator, sqlite3_int64 *pID);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_IDSET_H
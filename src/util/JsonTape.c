@@ -0,0 +1,534 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+/*
+ * Single pass JSON parser producing flat tape of nodes. See JsonTape.h
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "JsonTape.h"
+
+#ifdef  SQLITE_CORE
+
+#include <sqlite3.h>
+
+#else
+
+#include <sqlite3ext.h>
+
+SQLITE_EXTENSION_INIT3
+
+#endif
+
+#define JSON_TAPE_INIT_NODES 64
+
+/*
+ * State of single parse
+ */
+typedef struct _Parser_t
+{
+    JsonTape_t *pTape;
+    char *p;
+
+    /*
+     * Current array or object, JSON_TAPE_NONE when parsing root value
+     */
+    u32 iContainer;
+    int nDepth;
+} _Parser_t;
+
+static const unsigned char _aSpace[256] = {[' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\r'] = 1};
+
+#define SKIP_SPACE(p) while (_aSpace[(unsigned char) *(p)]) (p)++
+
+void JsonTape_init(JsonTape_t *self)
+{
+    memset(self, 0, sizeof(*self));
+}
+
+void JsonTape_free(JsonTape_t *self)
+{
+    sqlite3_free(self->aNodes);
+    sqlite3_free(self->zBuf);
+    memset(self, 0, sizeof(*self));
+}
+
+/*
+ * Appends new node. Returns its index or JSON_TAPE_NONE if out of memory.
+ * Note that aNodes may get reallocated, so pointers to nodes must not be kept across calls
+ */
+static u32 _appendNode(_Parser_t *pParser, u8 type, const char *zKey, u32 nKey)
+{
+    JsonTape_t *self = pParser->pTape;
+    if (self->nNodes == self->nNodesAlloc)
+    {
+        u32 nNew = self->nNodesAlloc == 0 ? JSON_TAPE_INIT_NODES : self->nNodesAlloc * 2;
+        JsonTapeNode_t *aNew = sqlite3_realloc64(self->aNodes, (sqlite3_uint64) nNew * sizeof(JsonTapeNode_t));
+        if (aNew == NULL)
+            return JSON_TAPE_NONE;
+        self->aNodes = aNew;
+        self->nNodesAlloc = nNew;
+    }
+
+    u32 result = self->nNodes++;
+    JsonTapeNode_t *pNode = &self->aNodes[result];
+    pNode->zKey = zKey;
+    pNode->nKey = nKey;
+    pNode->type = type;
+    pNode->iParent = pParser->iContainer;
+    pNode->iEnd = result + 1;
+    pNode->nChildren = 0;
+    pNode->v.i = 0;
+    if (pParser->iContainer != JSON_TAPE_NONE)
+        self->aNodes[pParser->iContainer].nChildren++;
+    return result;
+}
+
+static int _hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int _readHex4(const char *z, u32 *pResult)
+{
+    u32 v = 0;
+    for (int ii = 0; ii < 4; ii++)
+    {
+        int d = _hexDigit(z[ii]);
+        if (d < 0)
+            return SQLITE_ERROR;
+        v = (v << 4) | d;
+    }
+    *pResult = v;
+    return SQLITE_OK;
+}
+
+/*
+ * Decodes string starting at opening quote in place. On success, string is zero terminated
+ * at *pzOut, its length is in *pnOut, and pParser->p points after closing quote
+ */
+static int _parseString(_Parser_t *pParser, const char **pzOut, u32 *pnOut)
+{
+    char *zIn = pParser->p + 1;
+    char *zOut;
+
+    /*
+     * Fast path: no escapes. Like SQLite JSON1, unescaped control characters are tolerated.
+     * Zero byte is end of input
+     */
+    while (*zIn != '"' && *zIn != '\\')
+    {
+        if (*zIn == 0)
+            goto ONERROR;
+        zIn++;
+    }
+
+    zOut = zIn;
+    while (*zIn != '"')
+    {
+        unsigned char c = (unsigned char) *zIn;
+        if (c == 0)
+            goto ONERROR;
+
+        if (c != '\\')
+        {
+            *zOut++ = *zIn++;
+            continue;
+        }
+
+        zIn++;
+        switch (*zIn)
+        {
+            case '"':
+            case '\\':
+            case '/':
+                *zOut++ = *zIn;
+                break;
+            case 'b':
+                *zOut++ = '\b';
+                break;
+            case 'f':
+                *zOut++ = '\f';
+                break;
+            case 'n':
+                *zOut++ = '\n';
+                break;
+            case 'r':
+                *zOut++ = '\r';
+                break;
+            case 't':
+                *zOut++ = '\t';
+                break;
+            case 'u':
+            {
+                u32 cp;
+                if (_readHex4(zIn + 1, &cp) != SQLITE_OK)
+                    goto ONERROR;
+                zIn += 4;
+
+                // Surrogate pair
+                if (cp >= 0xD800 && cp <= 0xDBFF && zIn[1] == '\\' && zIn[2] == 'u')
+                {
+                    u32 lo;
+                    if (_readHex4(zIn + 3, &lo) == SQLITE_OK && lo >= 0xDC00 && lo <= 0xDFFF)
+                    {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        zIn += 6;
+                    }
+                }
+
+                // UTF-8 encoding is never longer than escape sequence, so decoding in place is safe
+                if (cp < 0x80)
+                    *zOut++ = (char) cp;
+                else if (cp < 0x800)
+                {
+                    *zOut++ = (char) (0xC0 | (cp >> 6));
+                    *zOut++ = (char) (0x80 | (cp & 0x3F));
+                }
+                else if (cp < 0x10000)
+                {
+                    *zOut++ = (char) (0xE0 | (cp >> 12));
+                    *zOut++ = (char) (0x80 | ((cp >> 6) & 0x3F));
+                    *zOut++ = (char) (0x80 | (cp & 0x3F));
+                }
+                else
+                {
+                    *zOut++ = (char) (0xF0 | (cp >> 18));
+                    *zOut++ = (char) (0x80 | ((cp >> 12) & 0x3F));
+                    *zOut++ = (char) (0x80 | ((cp >> 6) & 0x3F));
+                    *zOut++ = (char) (0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                goto ONERROR;
+        }
+        zIn++;
+    }
+
+    *zOut = 0;
+    *pzOut = pParser->p + 1;
+    *pnOut = (u32) (zOut - (pParser->p + 1));
+    pParser->p = zIn + 1;
+    return SQLITE_OK;
+
+    ONERROR:
+    pParser->p = zIn;
+    return SQLITE_ERROR;
+}
+
+/*
+ * Parses number according to JSON grammar. Integers which do not fit into 64 bits are stored as real
+ */
+static int _parseNumber(_Parser_t *pParser, u32 iNode)
+{
+    char *zStart = pParser->p;
+    char *z = zStart;
+    bool bNegative = false;
+    bool bReal = false;
+    sqlite3_uint64 u = 0;
+    int nDigits = 0;
+
+    if (*z == '-')
+    {
+        bNegative = true;
+        z++;
+    }
+
+    if (*z == '0')
+    {
+        z++;
+        nDigits = 1;
+    }
+    else
+    {
+        while (*z >= '0' && *z <= '9')
+        {
+            u = u * 10 + (*z - '0');
+            z++;
+            nDigits++;
+        }
+    }
+    if (nDigits == 0)
+        goto ONERROR;
+
+    if (*z == '.')
+    {
+        bReal = true;
+        z++;
+        if (!(*z >= '0' && *z <= '9'))
+            goto ONERROR;
+        while (*z >= '0' && *z <= '9')
+            z++;
+    }
+
+    if (*z == 'e' || *z == 'E')
+    {
+        bReal = true;
+        z++;
+        if (*z == '+' || *z == '-')
+            z++;
+        if (!(*z >= '0' && *z <= '9'))
+            goto ONERROR;
+        while (*z >= '0' && *z <= '9')
+            z++;
+    }
+
+    JsonTapeNode_t *pNode = &pParser->pTape->aNodes[iNode];
+
+    // 19 digits always fit into unsigned 64 bit value, so overflow check is only needed for them
+    if (!bReal && (nDigits < 19 ||
+                   (nDigits == 19 && (bNegative ? u <= (sqlite3_uint64) 1 << 63 : u < (sqlite3_uint64) 1 << 63))))
+    {
+        pNode->type = JSON_INT;
+        pNode->v.i = bNegative ? (sqlite3_int64) (0 - u) : (sqlite3_int64) u;
+    }
+    else
+    {
+        pNode->type = JSON_REAL;
+        pNode->v.d = strtod(zStart, NULL);
+    }
+
+    pParser->p = z;
+    return SQLITE_OK;
+
+    ONERROR:
+    pParser->p = z;
+    return SQLITE_ERROR;
+}
+
+/*
+ * Parses scalar value or opening of array/object at current position
+ */
+static int _parseValue(_Parser_t *pParser, const char *zKey, u32 nKey)
+{
+    int result;
+    char *p = pParser->p;
+    u32 iNode = _appendNode(pParser, JSON_NULL, zKey, nKey);
+    if (iNode == JSON_TAPE_NONE)
+        return SQLITE_NOMEM;
+
+    JsonTapeNode_t *pNode = &pParser->pTape->aNodes[iNode];
+    switch (*p)
+    {
+        case '{':
+        case '[':
+            pNode->type = *p == '{' ? JSON_OBJECT : JSON_ARRAY;
+            if (++pParser->nDepth > JSON_TAPE_MAX_DEPTH)
+                return SQLITE_ERROR;
+            pParser->iContainer = iNode;
+            pParser->p = p + 1;
+            return SQLITE_OK;
+
+        case '"':
+        {
+            pNode->type = JSON_STRING;
+            const char *z;
+            u32 n;
+            CHECK_CALL(_parseString(pParser, &z, &n));
+            // aNodes was not reallocated by _parseString
+            pNode->v.s.z = z;
+            pNode->v.s.n = n;
+            return SQLITE_OK;
+        }
+
+        case 't':
+            if (strncmp(p, "true", 4) != 0)
+                return SQLITE_ERROR;
+            pNode->type = JSON_TRUE;
+            pParser->p = p + 4;
+            return SQLITE_OK;
+
+        case 'f':
+            if (strncmp(p, "false", 5) != 0)
+                return SQLITE_ERROR;
+            pNode->type = JSON_FALSE;
+            pParser->p = p + 5;
+            return SQLITE_OK;
+
+        case 'n':
+            if (strncmp(p, "null", 4) != 0)
+                return SQLITE_ERROR;
+            pNode->type = JSON_NULL;
+            pParser->p = p + 4;
+            return SQLITE_OK;
+
+        default:
+            return _parseNumber(pParser, iNode);
+    }
+
+    ONERROR:
+    return result;
+}
+
+int JsonTape_parse(JsonTape_t *self, const char *zJson, int nJson)
+{
+    int result;
+    _Parser_t parser;
+
+    if (nJson < 0)
+        nJson = (int) strlen(zJson);
+
+    if (self->zBuf == NULL || self->nBufAlloc < (u32) nJson + 1)
+    {
+        char *zNew = sqlite3_realloc64(self->zBuf, (sqlite3_uint64) nJson + 1);
+        if (zNew == NULL)
+            return SQLITE_NOMEM;
+        self->zBuf = zNew;
+        self->nBufAlloc = (u32) nJson + 1;
+    }
+    memcpy(self->zBuf, zJson, (size_t) nJson);
+    self->zBuf[nJson] = 0;
+
+    self->nNodes = 0;
+    self->iErrorPos = 0;
+    parser.pTape = self;
+    parser.p = self->zBuf;
+    parser.iContainer = JSON_TAPE_NONE;
+    parser.nDepth = 0;
+
+    for (;;)
+    {
+        const char *zKey = NULL;
+        u32 nKey = 0;
+        bool bEmpty = false;
+
+        SKIP_SPACE(parser.p);
+
+        if (parser.iContainer != JSON_TAPE_NONE)
+        {
+            JsonTapeNode_t *pContainer = &self->aNodes[parser.iContainer];
+
+            // Empty array or object
+            if (pContainer->nChildren == 0 && *parser.p == (pContainer->type == JSON_OBJECT ? '}' : ']'))
+                bEmpty = true;
+            else if (pContainer->type == JSON_OBJECT)
+            {
+                if (*parser.p != '"')
+                {
+                    result = SQLITE_ERROR;
+                    goto ONERROR;
+                }
+                CHECK_CALL(_parseString(&parser, &zKey, &nKey));
+                SKIP_SPACE(parser.p);
+                if (*parser.p != ':')
+                {
+                    result = SQLITE_ERROR;
+                    goto ONERROR;
+                }
+                parser.p++;
+                SKIP_SPACE(parser.p);
+            }
+        }
+
+        if (!bEmpty)
+        {
+            u32 iContainer = parser.iContainer;
+            CHECK_CALL(_parseValue(&parser, zKey, nKey));
+
+            // New array or object was opened, proceed with its first item
+            if (parser.iContainer != iContainer)
+                continue;
+        }
+
+        /*
+         * Value is complete. Close finished containers until separator of next item is found
+         */
+        for (;;)
+        {
+            SKIP_SPACE(parser.p);
+
+            if (parser.iContainer == JSON_TAPE_NONE)
+            {
+                if (*parser.p != 0)
+                {
+                    result = SQLITE_ERROR;
+                    goto ONERROR;
+                }
+                result = SQLITE_OK;
+                goto EXIT;
+            }
+
+            JsonTapeNode_t *pContainer = &self->aNodes[parser.iContainer];
+            if (*parser.p == ',' && !bEmpty)
+            {
+                parser.p++;
+                break;
+            }
+
+            if (*parser.p != (pContainer->type == JSON_OBJECT ? '}' : ']'))
+            {
+                result = SQLITE_ERROR;
+                goto ONERROR;
+            }
+
+            parser.p++;
+            pContainer->iEnd = self->nNodes;
+            parser.iContainer = pContainer->iParent;
+            parser.nDepth--;
+            bEmpty = false;
+        }
+    }
+
+    ONERROR:
+    if (result == SQLITE_ERROR)
+        self->iErrorPos = (u32) (parser.p - self->zBuf);
+    self->nNodes = 0;
+
+    EXIT:
+    return result;
+}
+
+u32 JsonTape_firstChild(const JsonTape_t *self, u32 iNode)
+{
+    return self->aNodes[iNode].nChildren > 0 ? iNode + 1 : JSON_TAPE_NONE;
+}
+
+u32 JsonTape_nextSibling(const JsonTape_t *self, u32 iNode)
+{
+    const JsonTapeNode_t *pNode = &self->aNodes[iNode];
+    if (pNode->iParent == JSON_TAPE_NONE || pNode->iEnd >= self->aNodes[pNode->iParent].iEnd)
+        return JSON_TAPE_NONE;
+    return pNode->iEnd;
+}
+
+u32 JsonTape_findKey(const JsonTape_t *self, u32 iObject, const char *zKey)
+{
+    size_t nKey = strlen(zKey);
+    for (u32 ii = JsonTape_firstChild(self, iObject); ii != JSON_TAPE_NONE; ii = JsonTape_nextSibling(self, ii))
+    {
+        const JsonTapeNode_t *pNode = &self->aNodes[ii];
+        if (pNode->nKey == nKey && memcmp(pNode->zKey, zKey, nKey) == 0)
+            return ii;
+    }
+    return JSON_TAPE_NONE;
+}
+
+int JsonTape_bindValue(const JsonTape_t *self, u32 iNode, sqlite3_stmt *pStmt, int iParam)
+{
+    const JsonTapeNode_t *pNode = &self->aNodes[iNode];
+    switch (pNode->type)
+    {
+        case JSON_TRUE:
+            return sqlite3_bind_int(pStmt, iParam, 1);
+        case JSON_FALSE:
+            return sqlite3_bind_int(pStmt, iParam, 0);
+        case JSON_INT:
+            return sqlite3_bind_int64(pStmt, iParam, pNode->v.i);
+        case JSON_REAL:
+            return sqlite3_bind_double(pStmt, iParam, pNode->v.d);
+        case JSON_STRING:
+            return sqlite3_bind_text(pStmt, iParam, pNode->v.s.z, (int) pNode->v.s.n, SQLITE_STATIC);
+        default:
+            return sqlite3_bind_null(pStmt, iParam);
+    }
+}
@@ -0,0 +1,137 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_JSONTAPE_H
+#define FLEXILITE_JSONTAPE_H
+
+#include "../common/common.h"
+#include "../misc/json1.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Value of node index meaning 'no node' (e.g. no more siblings)
+ */
+#define JSON_TAPE_NONE ((u32) -1)
+
+/*
+ * Maximum nesting level of arrays and objects
+ */
+#define JSON_TAPE_MAX_DEPTH 2000
+
+/*
+ * Single JSON element on tape
+ */
+typedef struct JsonTapeNode_t
+{
+    /*
+     * Key of object member (zero terminated), or NULL for array items and root
+     */
+    const char *zKey;
+    u32 nKey;
+
+    /*
+     * JSON_NULL, JSON_TRUE, JSON_FALSE, JSON_INT, JSON_REAL, JSON_STRING, JSON_ARRAY or JSON_OBJECT
+     */
+    u8 type;
+
+    /*
+     * Index of parent array or object. JSON_TAPE_NONE for root
+     */
+    u32 iParent;
+
+    /*
+     * Index of the node following this node and all its descendants. For scalar values, index + 1
+     */
+    u32 iEnd;
+
+    /*
+     * Number of direct children of array or object
+     */
+    u32 nChildren;
+
+    union
+    {
+        sqlite3_int64 i;
+        double d;
+
+        /*
+         * Zero terminated text of JSON_STRING (with escapes decoded)
+         */
+        struct
+        {
+            const char *z;
+            u32 n;
+        } s;
+    } v;
+} JsonTapeNode_t;
+
+/*
+ * JSON document parsed in one pass into flat array of nodes ("tape") in document order.
+ * Children of array or object immediately follow their parent, so iteration over children is O(1) per step:
+ * first child is at parent's index + 1, next sibling is at node's iEnd.
+ *
+ * Input is copied once into tape's buffer and strings are decoded in place, so keys and string values
+ * are zero terminated slices of this buffer, without per node allocations.
+ * Tape is reusable: subsequent parses reuse allocated memory
+ */
+typedef struct JsonTape_t
+{
+    JsonTapeNode_t *aNodes;
+    u32 nNodes;
+    u32 nNodesAlloc;
+
+    /*
+     * Copy of input JSON
+     */
+    char *zBuf;
+    u32 nBufAlloc;
+
+    /*
+     * Byte offset of syntax error in input, if parse failed
+     */
+    u32 iErrorPos;
+} JsonTape_t;
+
+void JsonTape_init(JsonTape_t *self);
+
+/*
+ * Parses zJson (nJson bytes, or zero terminated if nJson < 0).
+ * Returns SQLITE_OK, SQLITE_ERROR on invalid JSON (iErrorPos is set) or SQLITE_NOMEM
+ */
+int JsonTape_parse(JsonTape_t *self, const char *zJson, int nJson);
+
+/*
+ * Returns index of first child of array or object, or JSON_TAPE_NONE
+ */
+u32 JsonTape_firstChild(const JsonTape_t *self, u32 iNode);
+
+/*
+ * Returns index of next sibling, or JSON_TAPE_NONE
+ */
+u32 JsonTape_nextSibling(const JsonTape_t *self, u32 iNode);
+
+/*
+ * Finds direct child of object by key. Returns JSON_TAPE_NONE if not found
+ */
+u32 JsonTape_findKey(const JsonTape_t *self, u32 iObject, const char *zKey);
+
+/*
+ * Binds scalar value of node to statement parameter. Text is bound without copying (SQLITE_STATIC),
+ * so tape must not be modified until statement is reset. Arrays and objects are bound as NULL
+ */
+int JsonTape_bindValue(const JsonTape_t *self, u32 iNode, sqlite3_stmt *pStmt, int iParam);
+
+/*
+ * Releases memory
+ */
+void JsonTape_free(JsonTape_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_JSONTAPE_H
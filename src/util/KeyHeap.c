@@ -0,0 +1,291 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#include <string.h>
+#include <assert.h>
+
+#include "KeyHeap.h"
+
+#ifdef  SQLITE_CORE
+
+#include <sqlite3.h>
+
+#else
+
+#include <sqlite3ext.h>
+
+SQLITE_EXTENSION_INIT3
+
+#endif
+
+static int _ensureCapacity(KeyHeap_t *self, u32 nCapacity)
+{
+    if (nCapacity <= self->nAlloc)
+        return SQLITE_OK;
+
+    u32 nNewAlloc = self->nAlloc > 0 ? self->nAlloc : 64;
+    while (nNewAlloc < nCapacity)
+        nNewAlloc *= 2;
+
+    KeyHeapItem_t *aNew = sqlite3_realloc64(self->aItems, nNewAlloc * sizeof(KeyHeapItem_t));
+    if (aNew == NULL)
+        return SQLITE_NOMEM;
+
+    self->aItems = aNew;
+    self->nAlloc = nNewAlloc;
+    return SQLITE_OK;
+}
+
+/*
+ * Storage class rank, as used by SQLite for comparison of values of different types
+ */
+static inline int _typeRank(int iType)
+{
+    switch (iType)
+    {
+        case SQLITE_INTEGER:
+        case SQLITE_FLOAT:
+            return 1;
+        case SQLITE_TEXT:
+            return 2;
+        case SQLITE_BLOB:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+int KeyHeap_compareKeys(const KeyHeapItem_t *pA, const KeyHeapItem_t *pB)
+{
+    int iRankA = _typeRank(pA->iType);
+    int iRankB = _typeRank(pB->iType);
+    if (iRankA != iRankB)
+        return iRankA < iRankB ? -1 : 1;
+
+    switch (iRankA)
+    {
+        case 1:
+            if (pA->iType == SQLITE_INTEGER && pB->iType == SQLITE_INTEGER)
+                return pA->v.i < pB->v.i ? -1 : (pA->v.i > pB->v.i ? 1 : 0);
+            else
+            {
+                double dA = pA->iType == SQLITE_INTEGER ? (double) pA->v.i : pA->v.d;
+                double dB = pB->iType == SQLITE_INTEGER ? (double) pB->v.i : pB->v.d;
+                return dA < dB ? -1 : (dA > dB ? 1 : 0);
+            }
+
+        case 2:
+        case 3:
+        {
+            int n = pA->nBytes < pB->nBytes ? pA->nBytes : pB->nBytes;
+            int cmp = n > 0 ? memcmp(pA->v.z, pB->v.z, (size_t) n) : 0;
+            if (cmp != 0)
+                return cmp;
+            return pA->nBytes - pB->nBytes;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Returns true if item A must be popped before item B
+ */
+static inline bool _before(const KeyHeap_t *self, const KeyHeapItem_t *pA, const KeyHeapItem_t *pB)
+{
+    int cmp = KeyHeap_compareKeys(pA, pB);
+    if (cmp == 0)
+        cmp = pA->lID < pB->lID ? -1 : (pA->lID > pB->lID ? 1 : 0);
+    return self->bDesc ? cmp > 0 : cmp < 0;
+}
+
+/*
+ * Returns true if item A must be above item B in heap. Limited heap which is not built yet is arranged
+ * in reversed order
+ */
+static inline bool _above(const KeyHeap_t *self, const KeyHeapItem_t *pA, const KeyHeapItem_t *pB)
+{
+    return self->nLimit > 0 && !self->bBuilt ? _before(self, pB, pA) : _before(self, pA, pB);
+}
+
+static void _siftDown(KeyHeap_t *self, u32 iPos)
+{
+    KeyHeapItem_t item = self->aItems[iPos];
+    for (;;)
+    {
+        u32 iChild = iPos * 2 + 1;
+        if (iChild >= self->nCount)
+            break;
+        if (iChild + 1 < self->nCount && _above(self, &self->aItems[iChild + 1], &self->aItems[iChild]))
+            iChild++;
+        if (!_above(self, &self->aItems[iChild], &item))
+            break;
+        self->aItems[iPos] = self->aItems[iChild];
+        iPos = iChild;
+    }
+    self->aItems[iPos] = item;
+}
+
+static void _siftUp(KeyHeap_t *self, u32 iPos)
+{
+    KeyHeapItem_t item = self->aItems[iPos];
+    while (iPos > 0)
+    {
+        u32 iParent = (iPos - 1) / 2;
+        if (!_above(self, &item, &self->aItems[iParent]))
+            break;
+        self->aItems[iPos] = self->aItems[iParent];
+        iPos = iParent;
+    }
+    self->aItems[iPos] = item;
+}
+
+static inline bool _hasOwnKey(const KeyHeap_t *self, const KeyHeapItem_t *pItem)
+{
+    return self->nLimit > 0 && (pItem->iType == SQLITE_TEXT || pItem->iType == SQLITE_BLOB) && pItem->nBytes > 0;
+}
+
+/*
+ * Replaces item's key with its copy, allocated in arena or, for limited heap, on its own
+ */
+static int _copyKey(KeyHeap_t *self, KeyHeapItem_t *pItem)
+{
+    if ((pItem->iType == SQLITE_TEXT || pItem->iType == SQLITE_BLOB) && pItem->nBytes > 0)
+    {
+        if (self->nLimit > 0)
+        {
+            char *z = sqlite3_malloc(pItem->nBytes);
+            if (z != NULL)
+                memcpy(z, pItem->v.z, (size_t) pItem->nBytes);
+            pItem->v.z = z;
+        }
+        else pItem->v.z = Arena_dup(&self->arena, pItem->v.z, (u32) pItem->nBytes, false);
+
+        if (pItem->v.z == NULL)
+            return SQLITE_NOMEM;
+    }
+    return SQLITE_OK;
+}
+
+void KeyHeap_init(KeyHeap_t *self, bool bDesc)
+{
+    memset(self, 0, sizeof(*self));
+    self->bDesc = bDesc;
+    Arena_init(&self->arena);
+}
+
+void KeyHeap_clear(KeyHeap_t *self)
+{
+    bool bDesc = self->bDesc;
+    const KeyHeapItem_t *pAfter = self->pAfter;
+    u32 nLimit = self->nLimit;
+    for (u32 ii = 0; ii < self->nCount; ii++)
+    {
+        if (_hasOwnKey(self, &self->aItems[ii]))
+            sqlite3_free((void *) self->aItems[ii].v.z);
+    }
+    sqlite3_free(self->aItems);
+    Arena_clear(&self->arena);
+    KeyHeap_init(self, bDesc);
+    self->pAfter = pAfter;
+    self->nLimit = nLimit;
+}
+
+void KeyHeap_setItem(KeyHeapItem_t *pItem, sqlite3_int64 lID, sqlite3_value *pKey)
+{
+    pItem->lID = lID;
+    pItem->iType = pKey != NULL ? sqlite3_value_type(pKey) : SQLITE_NULL;
+    pItem->nBytes = 0;
+    switch (pItem->iType)
+    {
+        case SQLITE_INTEGER:
+            pItem->v.i = sqlite3_value_int64(pKey);
+            break;
+
+        case SQLITE_FLOAT:
+            pItem->v.d = sqlite3_value_double(pKey);
+            break;
+
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+            pItem->v.z = pItem->iType == SQLITE_TEXT ? (const char *) sqlite3_value_text(pKey)
+                                                     : (const char *) sqlite3_value_blob(pKey);
+            pItem->nBytes = sqlite3_value_bytes(pKey);
+            if (pItem->v.z == NULL)
+                pItem->v.z = "";
+            break;
+
+        default:
+            pItem->iType = SQLITE_NULL;
+            break;
+    }
+}
+
+int KeyHeap_add(KeyHeap_t *self, sqlite3_int64 lID, sqlite3_value *pKey)
+{
+    assert(!self->bBuilt);
+
+    KeyHeapItem_t item;
+    KeyHeap_setItem(&item, lID, pKey);
+
+    if (self->pAfter != NULL && !_before(self, self->pAfter, &item))
+        return SQLITE_OK;
+
+    if (self->nLimit > 0 && self->nCount == self->nLimit)
+    {
+        // Heap is full. New item replaces the top one (the last to be popped), if it goes before it
+        if (!_before(self, &item, &self->aItems[0]))
+            return SQLITE_OK;
+
+        if (_copyKey(self, &item) != SQLITE_OK)
+            return SQLITE_NOMEM;
+        if (_hasOwnKey(self, &self->aItems[0]))
+            sqlite3_free((void *) self->aItems[0].v.z);
+        self->aItems[0] = item;
+        _siftDown(self, 0);
+        return SQLITE_OK;
+    }
+
+    int result = _ensureCapacity(self, self->nCount + 1);
+    if (result != SQLITE_OK)
+        return result;
+
+    if (_copyKey(self, &item) != SQLITE_OK)
+        return SQLITE_NOMEM;
+
+    self->aItems[self->nCount++] = item;
+
+    // Unlimited heap is arranged at once, by KeyHeap_build
+    if (self->nLimit > 0)
+        _siftUp(self, self->nCount - 1);
+
+    return SQLITE_OK;
+}
+
+void KeyHeap_build(KeyHeap_t *self)
+{
+    self->bBuilt = true;
+    for (u32 ii = self->nCount / 2; ii > 0; ii--)
+        _siftDown(self, ii - 1);
+}
+
+bool KeyHeap_pop(KeyHeap_t *self, sqlite3_int64 *plID)
+{
+    assert(self->bBuilt);
+
+    if (self->nCount == 0)
+        return false;
+
+    *plID = self->aItems[0].lID;
+    if (_hasOwnKey(self, &self->aItems[0]))
+        sqlite3_free((void *) self->aItems[0].v.z);
+    self->nCount--;
+    if (self->nCount > 0)
+    {
+        self->aItems[0] = self->aItems[self->nCount];
+        _siftDown(self, 0);
+    }
+    return true;
+}
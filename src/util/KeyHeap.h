@@ -0,0 +1,131 @@
+//
+// Created by slanska on 2026-10-17.
+//
+
+#ifndef FLEXILITE_KEYHEAP_H
+#define FLEXILITE_KEYHEAP_H
+
+#include "../common/common.h"
+#include "Arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Object ID with its sort key
+ */
+typedef struct KeyHeapItem_t
+{
+    sqlite3_int64 lID;
+
+    /*
+     * SQLITE_NULL, SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT or SQLITE_BLOB
+     */
+    int iType;
+
+    /*
+     * Length of text or blob
+     */
+    int nBytes;
+
+    union
+    {
+        sqlite3_int64 i;
+        double d;
+        const char *z;
+    } v;
+} KeyHeapItem_t;
+
+/*
+ * Binary heap of object IDs ordered by sort key, used for ORDER BY on values which have no suitable index.
+ * Items are appended in any order, then heap is built in O(N) and items are popped in key order on demand.
+ * Consumer which stops after K items (e.g. because of LIMIT) pays O(N + K * log(N)) instead of full sort.
+ * If K is known in advance (nLimit), heap keeps only K items which go first, so memory is O(K) and
+ * adding costs O(log(K)) per item.
+ * Keys are compared in the same way as SQLite does with BINARY collation: NULL < numbers < text < blob.
+ * Items with equal keys are returned in order of ID, in the same direction as keys
+ */
+typedef struct KeyHeap_t
+{
+    KeyHeapItem_t *aItems;
+
+    /*
+     * Number of items in heap
+     */
+    u32 nCount;
+
+    /*
+     * Allocated number of items in aItems
+     */
+    u32 nAlloc;
+
+    /*
+     * If true, items are popped in descending order of keys
+     */
+    bool bDesc;
+
+    /*
+     * true after KeyHeap_build. Items cannot be added to built heap
+     */
+    bool bBuilt;
+
+    /*
+     * If set, only items which go after this one are added (used to resume ordered scan from bookmark)
+     */
+    const KeyHeapItem_t *pAfter;
+
+    /*
+     * If not 0, only nLimit items which go first are kept. Until heap is built, items are arranged in reversed
+     * order, so that the item to be dropped next is at the top
+     */
+    u32 nLimit;
+
+    /*
+     * Storage for text and blob keys. Not used when nLimit is set: keys are allocated one by one then,
+     * and freed when item is dropped or popped
+     */
+    Arena_t arena;
+} KeyHeap_t;
+
+void KeyHeap_init(KeyHeap_t *self, bool bDesc);
+
+/*
+ * Releases memory and resets heap to empty state. Order direction, pAfter and nLimit are kept
+ */
+void KeyHeap_clear(KeyHeap_t *self);
+
+/*
+ * Appends ID with copy of its sort key (pKey may be NULL, which is treated as SQL NULL).
+ * Item is skipped if it does not go after pAfter, or if heap is limited and already has nLimit items
+ * which go before this one.
+ * Returns SQLITE_OK or SQLITE_NOMEM
+ */
+int KeyHeap_add(KeyHeap_t *self, sqlite3_int64 lID, sqlite3_value *pKey);
+
+/*
+ * Initializes item with ID and sort key. Text and blob keys are not copied
+ */
+void KeyHeap_setItem(KeyHeapItem_t *pItem, sqlite3_int64 lID, sqlite3_value *pKey);
+
+/*
+ * Compares keys of 2 items, as SQLite does. Returns negative value, 0 or positive value
+ */
+int KeyHeap_compareKeys(const KeyHeapItem_t *pA, const KeyHeapItem_t *pB);
+
+/*
+ * Arranges added items into heap
+ */
+void KeyHeap_build(KeyHeap_t *self);
+
+/*
+ * Removes item with the smallest (or the largest, if bDesc) key from built heap and returns its ID in plID.
+ * Returns false when heap is empty
+ */
+bool KeyHeap_pop(KeyHeap_t *self, sqlite3_int64 *plID);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FLEXILITE_KEYHEAP_H
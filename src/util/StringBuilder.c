@@ -38,6 +38,12 @@ void StringBuilder_init(StringBuilder_t *self)
     _zero(self);
 }
 
+void StringBuilder_initInArena(StringBuilder_t *self, Arena_t *pArena)
+{
+    StringBuilder_init(self);
+    self->pArena = pArena;
+}
+
 /* Enlarge self->zBuf so that it can hold at least N more bytes.
 ** Return zero on success.  Return non-zero on an OOM error
 */
@@ -46,7 +52,20 @@ _grow(StringBuilder_t *self, uint32_t N)
 {
     sqlite3_uint64 nTotal = N < self->nAlloc ? self->nAlloc * 2 : self->nAlloc + N + 10;
     char *zNew;
-    if (self->bStatic)
+    if (self->pArena != NULL)
+    {
+        /* Arena memory cannot be reallocated, so buffer is copied. Old one is released with arena */
+        if (self->bErr) return 1;
+        zNew = Arena_alloc(self->pArena, (u32) nTotal);
+        if (zNew == 0)
+        {
+            return SQLITE_NOMEM;
+        }
+        memcpy(zNew, self->zBuf, (size_t) self->nUsed);
+        self->zBuf = zNew;
+        self->bStatic = 0;
+    }
+    else if (self->bStatic)
     {
         if (self->bErr) return 1;
         zNew = sqlite3_malloc64(nTotal);
@@ -71,18 +90,124 @@ _grow(StringBuilder_t *self, uint32_t N)
     return SQLITE_OK;
 }
 
+/* Returns length of chunk at the beginning of z (nAvail bytes), up to nChunkSize bytes.
+** Chunk is shortened so that it does not split multi-byte UTF-8 character (continuation bytes are 10xxxxxx).
+** If chunk size is less than the first character, the whole character is taken
+*/
+static uint64_t
+_chunkLength(const char *z, uint64_t nAvail, uint64_t nChunkSize)
+{
+    if (nAvail <= nChunkSize)
+        return nAvail;
+
+    uint64_t n = nChunkSize;
+    while (n > 0 && ((unsigned char) z[n] & 0xC0) == 0x80)
+        n--;
+    if (n > 0)
+        return n;
+
+    n = nChunkSize;
+    while (n < nAvail && ((unsigned char) z[n] & 0xC0) == 0x80)
+        n++;
+    return n;
+}
+
+/* Passes complete chunks to sink and removes them from buffer
+*/
+static void
+_emitChunks(StringBuilder_t *self)
+{
+    if (self->xSink == NULL || self->bErr)
+        return;
+
+    uint64_t iStart = 0;
+    while (self->nUsed - iStart >= self->nChunkSize)
+    {
+        uint64_t n = _chunkLength(self->zBuf + iStart, self->nUsed - iStart, self->nChunkSize);
+        int rc = self->xSink(self->pSinkArg, self->zBuf + iStart, n);
+        iStart += n;
+        if (rc != SQLITE_OK)
+        {
+            self->iSinkResult = rc;
+            self->bErr = true;
+            break;
+        }
+    }
+
+    if (iStart > 0)
+        StringBuilder_consume(self, iStart);
+}
+
 /* Append N bytes from zIn onto the end of the StringBuilder_t string.
 */
 void StringBuilder_appendRaw(StringBuilder_t *self, const char *zInStr, int32_t nInStrLen)
 {
+    if (self->iSinkResult != SQLITE_OK)
+        return;
+
     if (nInStrLen < 0)
         nInStrLen = (int32_t) strlen(zInStr);
 
     if ((nInStrLen + self->nUsed >= self->nAlloc) && _grow(self, nInStrLen) != 0)
+    {
+        self->bErr = true;
         return;
+    }
     memcpy(self->zBuf + self->nUsed, zInStr, nInStrLen);
     self->nUsed += nInStrLen;
     self->zBuf[self->nUsed] = 0;
+
+    _emitChunks(self);
+}
+
+void StringBuilder_setSink(StringBuilder_t *self, uint64_t nChunkSize, StringBuilder_sink_t xSink, void *pArg)
+{
+    assert(nChunkSize > 0);
+    self->nChunkSize = nChunkSize;
+    self->xSink = xSink;
+    self->pSinkArg = pArg;
+    self->iSinkResult = SQLITE_OK;
+}
+
+int StringBuilder_flush(StringBuilder_t *self)
+{
+    assert(self->xSink != NULL);
+
+    if (self->iSinkResult != SQLITE_OK)
+        return self->iSinkResult;
+    if (self->bErr)
+        return SQLITE_NOMEM;
+
+    if (self->nUsed > 0)
+    {
+        int rc = self->xSink(self->pSinkArg, self->zBuf, self->nUsed);
+        if (rc != SQLITE_OK)
+        {
+            self->iSinkResult = rc;
+            self->bErr = true;
+            return rc;
+        }
+        StringBuilder_consume(self, self->nUsed);
+    }
+
+    return SQLITE_OK;
+}
+
+uint64_t StringBuilder_chunkLength(const StringBuilder_t *self, bool bFinal)
+{
+    if (bFinal)
+        return _chunkLength(self->zBuf, self->nUsed, self->nChunkSize > 0 ? self->nChunkSize : self->nUsed);
+    if (self->nChunkSize == 0 || self->nUsed < self->nChunkSize)
+        return 0;
+    return _chunkLength(self->zBuf, self->nUsed, self->nChunkSize);
+}
+
+void StringBuilder_consume(StringBuilder_t *self, uint64_t N)
+{
+    assert(N <= self->nUsed);
+    memmove(self->zBuf, self->zBuf + N, (size_t) (self->nUsed - N));
+    self->nUsed -= N;
+    self->zBuf[self->nUsed] = 0;
 }
 
 /* Free all allocated memory and reset the StringBuilder_t object back to its
@@ -90,7 +215,7 @@ void StringBuilder_appendRaw(StringBuilder_t *self, const char *zInStr, int32_t
 */
 void StringBuilder_clear(StringBuilder_t *self)
 {
-    if (!self->bStatic)
+    if (!self->bStatic && self->pArena == NULL)
         sqlite3_free(self->zBuf);
     _zero(self);
 }
@@ -103,12 +228,15 @@ void StringBuilder_clear(StringBuilder_t *self)
 */
 void StringBuilder_appendJsonElem(StringBuilder_t *self, const char *zIn, int32_t N)
 {
-    uint32_t i;
+    int32_t i;
+
+    if (self->iSinkResult != SQLITE_OK)
+        return;
 
     if (N < 0)
         N = (int32_t) strlen(zIn);
 
-    if ((N + self->nUsed + 2 >= self->nAlloc) && _grow(self, N + 2) != 0) return;
+    if ((N + self->nUsed + 2 >= self->nAlloc) && _grow(self, N + 2) != 0) goto json_oom;
     self->zBuf[self->nUsed++] = '"';
     for (i = 0; i < N; i++)
     {
@@ -116,7 +244,7 @@ void StringBuilder_appendJsonElem(StringBuilder_t *self, const char *zIn, int32_
         if (c == '"' || c == '\\')
         {
             json_simple_escape:
-            if ((self->nUsed + N + 3 - i > self->nAlloc) && _grow(self, N + 3 - i) != 0) return;
+            if ((self->nUsed + N + 3 - i > self->nAlloc) && _grow(self, N + 3 - i) != 0) goto json_oom;
             self->zBuf[self->nUsed++] = '\\';
         }
         else
@@ -137,7 +265,7 @@ void StringBuilder_appendJsonElem(StringBuilder_t *self, const char *zIn, int32_
                     c = (unsigned char) aSpecial[c];
                     goto json_simple_escape;
                 }
-                if ((self->nUsed + N + 7 + i > self->nAlloc) && _grow(self, N + 7 - i) != 0) return;
+                if ((self->nUsed + N + 7 + i > self->nAlloc) && _grow(self, N + 7 - i) != 0) goto json_oom;
                 self->zBuf[self->nUsed++] = '\\';
                 self->zBuf[self->nUsed++] = 'u';
                 self->zBuf[self->nUsed++] = '0';
@@ -150,6 +278,12 @@ void StringBuilder_appendJsonElem(StringBuilder_t *self, const char *zIn, int32_
     self->zBuf[self->nUsed++] = '"';
     self->zBuf[self->nUsed] = 0;
     assert(self->nUsed < self->nAlloc);
+
+    _emitChunks(self);
+    return;
+
+    json_oom:
+    self->bErr = true;
 }
 
 /*
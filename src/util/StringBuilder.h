@@ -8,11 +8,17 @@
 /* Objects */
 #include <stdbool.h>
 #include <stdint.h>
+#include "Arena.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Receives chunk of accumulated string (see StringBuilder_setSink).
+** Returns SQLITE_OK or error code, which stops further output
+*/
+typedef int (*StringBuilder_sink_t)(void *pArg, const char *zChunk, uint64_t nBytes);
+
 /* An instance of this object represents a JSON string
 ** under construction.  Really, this is a generic string accumulator
 ** that can be and is used to create strings other than JSON.
@@ -35,6 +41,20 @@ struct StringBuilder_t
     /* True if an error has been encountered */
     bool bErr;
 
+    /* If not NULL, buffer is allocated in this arena and never freed individually */
+    Arena_t *pArena;
+
+    /* Chunk size for streamed output. If xSink is set, every complete chunk is passed to it as soon as
+    ** it is accumulated, so that buffer stays about nChunkSize (plus the longest single append), regardless
+    ** of total length of output. Chunks end on UTF-8 character boundary, so they may be a few bytes shorter
+    */
+    uint64_t nChunkSize;
+    StringBuilder_sink_t xSink;
+    void *pSinkArg;
+
+    /* Error returned by sink */
+    int iSinkResult;
+
     /* Initial static space */
     char zSpace[100];
 };
@@ -45,6 +65,11 @@ typedef struct StringBuilder_t StringBuilder_t;
 */
 void StringBuilder_init(StringBuilder_t *self /*, sqlite3_context *pCtx*/);
 
+/* Initialize the StringBuilder_t object which grows its buffer in pArena.
+** Buffer is released when arena gets reset
+*/
+void StringBuilder_initInArena(StringBuilder_t *self, Arena_t *pArena);
+
 /* Append the N-byte string in zIn to the end of the StringBuilder_t string
 ** under construction.  Enclose the string in "..." and escape
 ** any double-quotes or backslash characters contained within the
@@ -63,6 +88,27 @@ void StringBuilder_appendRaw(StringBuilder_t *self, const char *zInStr, int32_t
 */
 void StringBuilder_clear(StringBuilder_t *self);
 
+/* Switches StringBuilder_t to streamed output: complete chunks of nChunkSize bytes are passed to xSink
+** and removed from buffer. Buffer is kept and reused for the next chunks
+*/
+void StringBuilder_setSink(StringBuilder_t *self, uint64_t nChunkSize, StringBuilder_sink_t xSink, void *pArg);
+
+/* Passes the rest of accumulated string to sink (as last, possibly shorter chunk).
+** Returns SQLITE_OK, SQLITE_NOMEM if any append failed, or error returned by sink
+*/
+int StringBuilder_flush(StringBuilder_t *self);
+
+/* For pulling output in chunks without sink (e.g. as consecutive result rows): returns length of
+** complete chunk at the beginning of buffer (up to nChunkSize bytes, on UTF-8 character boundary),
+** or 0 if less than nChunkSize bytes are accumulated. If bFinal is true, returns length of the rest of buffer.
+** Chunk is removed by StringBuilder_consume after it is processed
+*/
+uint64_t StringBuilder_chunkLength(const StringBuilder_t *self, bool bFinal);
+
+/* Removes first N bytes from buffer, keeping allocated memory
+*/
+void StringBuilder_consume(StringBuilder_t *self, uint64_t N);
+
 /*
  * Calculates number of UTF-8 characters in the string.
  * Source: http://stackoverflow.com/questions/5117393/utf-8-strings-length-in-linux-c
@@ -37,48 +37,65 @@ _JsonNode_comparer(const RBNode *a, const RBNode *b, void *arg)
     return (int) diff;
 }
 
+/*
+ * Duplicate key in JSON object. Last value wins
+ */
 static void
 _JsonNode_combiner(RBNode *existing, const RBNode *newdata, void *arg)
 {
-    _JsonNode *from = (void *) existing;
-    _JsonNode *to = (void *) newdata;
+    UNUSED_PARAM(arg);
+    _JsonNode *to = (void *) existing;
+    const _JsonNode *from = (const void *) newdata;
+    sqlite3_value_free(to->d.pValue);
     to->d = from->d;
-    to->d.pValue = sqlite3_value_dup(from->d.pValue);
-    String_copy(from->d.zKey, (char **) &to->d.zKey);
-    String_copy(from->d.zFullKey, (char **) &to->d.zFullKey);
-    String_copy(from->d.zPath, (char **) &to->d.zPath);
 }
 
+/*
+ * Nodes and their strings are allocated in processor's arena
+ */
 static RBNode *
 _JsonNode_alloc(void *arg)
 {
-    _JsonNode *result;
-    result = sqlite3_malloc(sizeof(_JsonNode));
+    JsonProcessor_t *self = arg;
+    _JsonNode *result = Arena_alloc(self->pArena, sizeof(_JsonNode));
+    if (result == NULL)
+        return NULL;
     memset(result, 0, sizeof(*result));
     return &result->hdr;
 }
 
+/*
+ * Only value needs to be freed. Node itself is released with arena
+ */
 static void
 _JsonNode_free(RBNode *x, void *arg)
 {
-    if (x == NULL)
-        return;
-
+    UNUSED_PARAM(arg);
     _JsonNode *node = (void *) x;
-    sqlite3_free((void *) node->d.zFullKey);
-    sqlite3_free((void *) node->d.zKey);
-    sqlite3_free((void *) node->d.zPath);
     sqlite3_value_free(node->d.pValue);
 }
 
+/*
+ * Copies text of column to arena. NULL values are kept as NULL
+ */
+static const char *
+_dupColumnText(JsonProcessor_t *self, sqlite3_stmt *pStmt, int iCol)
+{
+    const char *zText = (const char *) sqlite3_column_text(pStmt, iCol);
+    if (zText == NULL)
+        return NULL;
+    return Arena_dup(self->pArena, zText, (u32) sqlite3_column_bytes(pStmt, iCol), true);
+}
+
 void JsonProcessor_init(JsonProcessor_t *self, flexi_Context_t *pCtx)
 {
     memset(self, 0, sizeof(*self));
     self->pCtx = pCtx;
+    self->pArena = &pCtx->requestArena;
     rb_create(&self->nodes, sizeof(_JsonNode), _JsonNode_comparer, _JsonNode_combiner, _JsonNode_alloc,
               _JsonNode_free, self);
-    StringBuilder_init(&self->sb);
-    Array_init(&self->parentIds, sizeof(intptr_t), NULL);
+    StringBuilder_initInArena(&self->sb, self->pArena);
+    Array_initInArena(&self->parentIds, sizeof(intptr_t), NULL, self->pArena);
 }
 
 void JsonProcessor_clear(JsonProcessor_t *self)
@@ -96,7 +113,7 @@ int JsonProcessor_parse(JsonProcessor_t *self, const char *zInJzon)
     int result;
 
     sqlite3_stmt *pDataSource = NULL;
-    _JsonNode *node = NULL;
+    _JsonNode node;
 
     /*
      * Parse data JSON
@@ -116,10 +133,10 @@ int JsonProcessor_parse(JsonProcessor_t *self, const char *zInJzon)
 
     while ((result = sqlite3_step(pDataSource)) == SQLITE_ROW)
     {
-        _JsonNode_free(&node->hdr, self);
-        node = (void *) _JsonNode_alloc(self);
-        String_copy((const char *) sqlite3_column_text(pDataSource, 0), (void *) &node->d.zKey);
-        node->d.pValue = sqlite3_value_dup(sqlite3_column_value(pDataSource, 1));
+        memset(&node, 0, sizeof(node));
+        node.d.zKey = _dupColumnText(self, pDataSource, 0);
+        node.d.pValue = sqlite3_value_dup(sqlite3_column_value(pDataSource, 1));
+        CHECK_NULL(node.d.pValue);
 
         static struct
         {
@@ -140,18 +157,23 @@ int JsonProcessor_parse(JsonProcessor_t *self, const char *zInJzon)
         {
             if (strcmp(zJsonTypes[ii].zType, zType) == 0)
             {
-                node->d.type = zJsonTypes[ii].type;
+                node.d.type = zJsonTypes[ii].type;
                 break;
             }
         }
-        node->d.atom = sqlite3_column_int(pDataSource, 3) != 0;
-        node->d.id = sqlite3_column_int64(pDataSource, 4);
-        node->d.parent = sqlite3_column_int64(pDataSource, 5);
-        String_copy((const char *) sqlite3_column_text(pDataSource, 6), (void *) &node->d.zFullKey);
-        String_copy((const char *) sqlite3_column_text(pDataSource, 7), (void *) &node->d.zPath);
+        node.d.atom = sqlite3_column_int(pDataSource, 3) != 0;
+        node.d.id = sqlite3_column_int64(pDataSource, 4);
+        node.d.parent = sqlite3_column_int64(pDataSource, 5);
+        node.d.zFullKey = _dupColumnText(self, pDataSource, 6);
+        node.d.zPath = _dupColumnText(self, pDataSource, 7);
         bool isNew;
-        rb_insert(&self->nodes, &node->hdr, &isNew);
-        Array_setNth(&self->parentIds, (u32)node->d.id, &node->d.parent);
+        if (rb_insert(&self->nodes, &node.hdr, &isNew) == NULL)
+        {
+            sqlite3_value_free(node.d.pValue);
+            result = SQLITE_NOMEM;
+            goto ONERROR;
+        }
+        Array_setNth(&self->parentIds, (u32)node.d.id, &node.d.parent);
     }
 
     if (result != SQLITE_ROW && result != SQLITE_DONE)
@@ -163,7 +185,6 @@ int JsonProcessor_parse(JsonProcessor_t *self, const char *zInJzon)
     ONERROR:
 
     EXIT:
-    _JsonNode_free(&node->hdr, self);
     sqlite3_finalize(pDataSource);
     return result;
 }
@@ -22,6 +22,12 @@ extern "C" {
 typedef struct JsonProcessor_t
 {
     flexi_Context_t *pCtx;
+
+    /*
+     * Nodes, their strings, parent IDs and output buffer are allocated in context's request arena
+     */
+    Arena_t *pArena;
+
     /*
      * Nodes sorted by fullkey
      */
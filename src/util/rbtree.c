@@ -946,4 +946,9 @@ void rb_clear(RBTree *self)
 {
     _freeNode(self, self->root);
     self->root = RBNIL;
-}
\ No newline at end of file
+}
+
+void rb_reset(RBTree *self)
+{
+    self->root = RBNIL;
+}
@@ -130,6 +130,11 @@ extern RBNode *rb_inverted_walk(RBTreeInvertedWalk *dw);
 
 extern void rb_clear(RBTree *self);
 
+/*
+ * Makes tree empty without calling freefunc. Used for trees whose nodes are allocated in arena
+ */
+extern void rb_reset(RBTree *self);
+
 #ifdef __cplusplus
 }
 #endif
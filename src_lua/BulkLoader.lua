@@ -0,0 +1,352 @@
+---
+--- Created by slanska.
+--- DateTime: 2026-10-17
+---
+
+--[[
+Bulk loader for array payloads of flexi_data and flexi('import data').
+Unlike DBObject:saveToDB, which writes every object with its own set of statements,
+BulkLoader groups objects by class and for every class:
+- initializes and validates new objects the same way as DBObject:saveToDB does
+- pre-allocates ObjectIDs as continuous range after current last ObjectID
+- writes [.objects] and [.ref-values] rows, sorted by primary key, by multi-row INSERT batches
+- does not maintain secondary indexes (full text, .range_data_N, .multi_keyN) per object.
+Instead, they are populated for the whole range of chunk objects, by INSERT ... SELECT
+- fires after triggers of chunk objects when their rows and index entries are written
+
+Whole load runs inside transaction of calling flexi statement.
+]]
+
+local class = require 'pl.class'
+local JSON = require 'cjson'
+
+-- Number of objects which are prepared and kept in memory before their rows get written
+local CHUNK_SIZE = 1000
+
+-- Max number of parameters in single statement. Matches default SQLITE_MAX_VARIABLE_NUMBER for
+-- SQLite versions prior to 3.32
+local MAX_STMT_PARAMS = 999
+
+local COL_MAP_COLUMNS = { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P' }
+local FTS_COLUMNS = { 'X1', 'X2', 'X3', 'X4', 'X5' }
+local RANGE_COLUMNS = { 'A0', 'A1', 'B0', 'B1', 'C0', 'C1', 'D0', 'D1', 'E0', 'E1' }
+
+--[[
+Accumulates rows for multi-row INSERT and writes them when batch is full.
+SQL for every batch size is built once, so prepared statements get reused via DBContext:getStatement
+]]
+---@class RowBatch
+---@field DBContext DBContext
+---@field nCols number
+---@field maxRows number
+---@field nRows number
+---@field values any[] @comment flat list of column values, may have nils
+local RowBatch = class()
+
+---@param DBContext DBContext
+---@param nCols number
+---@param buildSQL function @comment (rowsSQL: string) -> string, gets 'values' list for given number of rows
+function RowBatch:_init(DBContext, nCols, buildSQL)
+    self.DBContext = DBContext
+    self.nCols = nCols
+    self.maxRows = math.floor(MAX_STMT_PARAMS / nCols)
+    self.buildSQL = buildSQL
+    self.sqlByRowCount = {}
+    self.values = {}
+    self.nRows = 0
+
+    local placeholders = {}
+    for i = 1, nCols do
+        placeholders[i] = '?'
+    end
+    self.rowSQL = '(' .. table.concat(placeholders, ', ') .. ')'
+end
+
+---@param nRows number
+---@return string
+function RowBatch:getSQL(nRows)
+    local result = self.sqlByRowCount[nRows]
+    if not result then
+        local rows = {}
+        for i = 1, nRows do
+            rows[i] = self.rowSQL
+        end
+        result = self.buildSQL(table.concat(rows, ', '))
+        self.sqlByRowCount[nRows] = result
+    end
+    return result
+end
+
+-- Adds row. Number of arguments must match nCols
+function RowBatch:add(...)
+    local base = self.nRows * self.nCols
+    for i = 1, self.nCols do
+        self.values[base + i] = (select(i, ...))
+    end
+    self.nRows = self.nRows + 1
+
+    if self.nRows == self.maxRows then
+        self:flush()
+    end
+end
+
+function RowBatch:flush()
+    if self.nRows == 0 then
+        return
+    end
+
+    local stmt = self.DBContext:getStatement(self:getSQL(self.nRows))
+    for i = 1, self.nRows * self.nCols do
+        self.DBContext:checkSqlite(stmt:bind(i, self.values[i]))
+    end
+    local result = stmt:step()
+    if result ~= sqlite3.DONE then
+        self.DBContext:checkSqlite(result)
+    end
+
+    -- Values are overwritten by next rows, so there is no need to clear them
+    self.nRows = 0
+end
+
+--[[
+BulkLoader
+]]
+---@class BulkLoader
+---@field DBContext DBContext
+---@field classPayloads table<string, table[]> @comment lists of object payloads by class names
+---@field classOrder string[] @comment class names in order they were added
+local BulkLoader = class()
+
+---@param DBContext DBContext
+function BulkLoader:_init(DBContext)
+    self.DBContext = DBContext
+    self.classPayloads = {}
+    self.classOrder = {}
+
+    -- ObjectID, ClassID, ctlo, vtypes, A - P, MetaData
+    self.objectRows = RowBatch(DBContext, 4 + #COL_MAP_COLUMNS + 1, function(rowsSQL)
+        return string.format([[insert into [.objects] (ObjectID, ClassID, ctlo, vtypes, %s, MetaData)
+        values %s;]], table.concat(COL_MAP_COLUMNS, ', '), rowsSQL)
+    end)
+
+    -- ObjectID, PropertyID, PropIndex, Value, ctlv, MetaData, native type to cast Value to
+    self.refValueRows = RowBatch(DBContext, 7, function(rowsSQL)
+        return string.format([[insert into [.ref-values] (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData)
+        select column1, column2, column3,
+        case column7 when 'float' then cast(column4 as float) when 'integer' then cast(column4 as integer)
+        else column4 end, column5, column6 from (values %s);]], rowsSQL)
+    end)
+end
+
+-- Queues array of object payloads for the given class
+---@param className string
+---@param rows table[]
+function BulkLoader:add(className, rows)
+    local payloads = self.classPayloads[className]
+    if not payloads then
+        payloads = {}
+        self.classPayloads[className] = payloads
+        table.insert(self.classOrder, className)
+    end
+
+    for _, row in ipairs(rows) do
+        table.insert(payloads, row)
+    end
+end
+
+-- Returns last used ObjectID, taking into account AUTOINCREMENT sequence of [.objects]
+---@return number
+function BulkLoader:getLastObjectID()
+    local row = self.DBContext:loadOneRow([[select max(
+        coalesce((select seq from sqlite_sequence where name = '.objects'), 0),
+        coalesce((select max(ObjectID) from [.objects]), 0)) as LastID;]], {})
+    return row and row.LastID or 0
+end
+
+-- Saves all queued objects
+function BulkLoader:run()
+    local lastID = self:getLastObjectID()
+
+    for _, className in ipairs(self.classOrder) do
+        local classDef = self.DBContext:getClassDef(className)
+        local payloads = self.classPayloads[className]
+
+        for chunkStart = 1, #payloads, CHUNK_SIZE do
+            local chunkEnd = math.min(chunkStart + CHUNK_SIZE - 1, #payloads)
+            local firstID = lastID + 1
+            local objects = {}
+            for i = chunkStart, chunkEnd do
+                lastID = lastID + 1
+                table.insert(objects, self:saveObject(classDef, payloads[i], lastID))
+            end
+            self.objectRows:flush()
+            self.refValueRows:flush()
+            self:rebuildIndexes(classDef, firstID, lastID)
+
+            for _, obj in ipairs(objects) do
+                obj:fireAfterTrigger()
+            end
+
+            -- Triggers may have saved other objects, so next chunk starts after them
+            lastID = math.max(lastID, self:getLastObjectID())
+        end
+    end
+
+    self.classPayloads = {}
+    self.classOrder = {}
+end
+
+-- Prepares new object and adds its [.objects] and [.ref-values] rows to batches.
+-- After trigger is not fired here, as object rows may be not written yet
+---@param classDef ClassDef
+---@param data table
+---@param objectID number
+---@return DBObject
+function BulkLoader:saveObject(classDef, data, objectID)
+    local obj = self.DBContext:NewObject(classDef, data)
+    local dbov = obj.curVer
+
+    -- Loaded objects are not kept in DBContext cache
+    self.DBContext.Objects:remove(dbov.ID)
+    dbov.ID = objectID
+
+    obj:fireBeforeTrigger()
+    obj:setMissingDefaultData()
+    obj:ValidateData()
+
+    dbov:setObjectMetaData()
+    local params = {}
+    dbov:applyMappedColumnValues(params)
+
+    self.objectRows:add(objectID, classDef.ClassID, dbov.ctlo, classDef.vtypes,
+            params.A, params.B, params.C, params.D, params.E, params.F, params.G, params.H,
+            params.I, params.J, params.K, params.L, params.M, params.N, params.O, params.P,
+            dbov.MetaData and JSON.encode(dbov.MetaData) or nil)
+
+    -- Collect values sorted by PropertyID and PropIndex, to match [.ref-values] primary key
+    local values = {}
+    for _, prop in pairs(dbov.props) do
+        if prop.values then
+            local propDef = prop.PropDef
+            local ctlv = propDef:GetCTLV()
+            local nativeType = propDef:getNativeType()
+
+            -- Appended values (negative indexes: -1, -2...) go after values with explicit indexes
+            local maxIdx = 0
+            local appended = {}
+            for idx, dbv in pairs(prop.values) do
+                if idx > 0 then
+                    maxIdx = math.max(maxIdx, idx)
+                    if dbv.Value ~= nil then
+                        table.insert(values, { propDef.ID, idx, dbv, ctlv, nativeType })
+                    end
+                elseif dbv.Value ~= nil then
+                    table.insert(appended, idx)
+                end
+            end
+
+            table.sort(appended, function(a, b)
+                return a > b
+            end)
+            for i, idx in ipairs(appended) do
+                table.insert(values, { propDef.ID, maxIdx + i, prop.values[idx], ctlv, nativeType })
+            end
+        end
+    end
+
+    table.sort(values, function(a, b)
+        if a[1] ~= b[1] then
+            return a[1] < b[1]
+        end
+        return a[2] < b[2]
+    end)
+
+    for _, v in ipairs(values) do
+        local dbv = v[3]
+        self.refValueRows:add(objectID, v[1], v[2], dbv.Value, v[4],
+                dbv.MetaData and JSON.encode(dbv.MetaData) or nil, v[5])
+    end
+
+    return obj
+end
+
+-- Returns SQL expression for the first value of property of object aliased as 'o'
+---@param propDef PropertyDef
+---@return string
+local function firstValueExpr(propDef)
+    local result = string.format([[(select [Value] from [.ref-values] v
+        where v.ObjectID = o.ObjectID and v.PropertyID = %d order by v.PropIndex limit 1)]], propDef.ID)
+    if propDef.ColMap then
+        result = string.format('coalesce(o.[%s], %s)', propDef.ColMap, result)
+    end
+    return result
+end
+
+--[[ Builds INSERT ... SELECT statement to populate index table for range of new objects.
+Only objects which have values for all required columns are inserted
+]]
+---@param classDef ClassDef
+---@param tableName string
+---@param fixedCols table<string, string>[] @comment pairs of index table column and [.objects] column
+---@param indexCols string[] @comment names of index table columns for propIDs
+---@param propIDs number[]
+---@param requireAll boolean @comment if true, all index columns must be not null. Otherwise, at least one
+---@return string
+function BulkLoader:buildIndexSQL(classDef, tableName, fixedCols, indexCols, propIDs, requireAll)
+    local cols, exprs, conds = {}, {}, {}
+    for _, pair in ipairs(fixedCols) do
+        table.insert(cols, string.format('[%s]', pair[1]))
+        table.insert(exprs, string.format('o.[%s] as [%s]', pair[2], pair[1]))
+    end
+    for i, propID in ipairs(propIDs) do
+        local propDef = self.DBContext.ClassProps[propID]
+        local col = indexCols[i]
+        table.insert(cols, string.format('[%s]', col))
+        table.insert(exprs, string.format('%s as [%s]', firstValueExpr(propDef), col))
+        table.insert(conds, string.format('[%s] is not null', col))
+    end
+
+    return string.format([[insert into [%s] (%s) select %s from (select %s from [.objects] o
+        where o.ClassID = :ClassID and o.ObjectID between :FirstID and :LastID) where %s;]],
+            tableName, table.concat(cols, ', '), table.concat(cols, ', '), table.concat(exprs, ', '),
+            table.concat(conds, requireAll and ' and ' or ' or '))
+end
+
+-- Populates secondary indexes for range of new objects
+---@param classDef ClassDef
+---@param firstID number
+---@param lastID number
+function BulkLoader:rebuildIndexes(classDef, firstID, lastID)
+    local indexes = classDef.indexes
+    if not indexes then
+        return
+    end
+
+    local params = { ClassID = classDef.ClassID, FirstID = firstID, LastID = lastID }
+
+    -- Full text index
+    if indexes.fullTextIndexing and #indexes.fullTextIndexing > 0 then
+        local sql = self:buildIndexSQL(classDef, '.full_text_data', { { 'docid', 'ObjectID' }, { 'ClassID', 'ClassID' } },
+                FTS_COLUMNS, indexes.fullTextIndexing, false)
+        self.DBContext:execStatement(sql, params)
+    end
+
+    -- Range index
+    if indexes.rangeIndexing and #indexes.rangeIndexing > 0 then
+        local sql = self:buildIndexSQL(classDef, string.format('.range_data_%d', classDef.ClassID),
+                { { 'ObjectID', 'ObjectID' } }, RANGE_COLUMNS, indexes.rangeIndexing, true)
+        self.DBContext:execStatement(sql, params)
+    end
+
+    -- Multi key unique index
+    if indexes.multiKeyIndexing and #indexes.multiKeyIndexing > 0 then
+        local sql = self:buildIndexSQL(classDef, string.format('.multi_key%d', #indexes.multiKeyIndexing),
+                { { 'ClassID', 'ClassID' }, { 'ObjectID', 'ObjectID' } }, { 'Z1', 'Z2', 'Z3', 'Z4' }, indexes.multiKeyIndexing, true)
+        local ok, errMsg = pcall(self.DBContext.execStatement, self.DBContext, sql, params)
+        if not ok then
+            error(string.format('Error updating multi-key unique index: %s', tostring(errMsg)))
+        end
+    end
+end
+
+return BulkLoader
@@ -28,11 +28,14 @@ local util = require 'pl.utils'
 local ClassDef = require('ClassDef')
 local PropertyDef = require('PropertyDef')
 local UserInfo = require('UserInfo')
+local StatementCache = require('StatementCache')
+local ObjectCache = require('ObjectCache')
 local AccessControl = require 'AccessControl'
 local DBObject = require 'DBObject'
 local EnumManager = require 'EnumManager'
 local Constants = require 'Constants'
 local DictCI = require('Util').DictCI
+local NativeObjectView = require 'NativeObjectView'
 
 -------------------------------------------------------------------------------
 -- ActionList
@@ -93,22 +96,27 @@ end
 
 ---@class DBContextConfig
 ---@field createVirtualTable boolean
+---@field objectCacheBudget number @comment memory budget of DBContext.Objects, in bytes. 0 - unlimited
 
 ---@class DBContext
 ---@field db sqlite3
----@field Statements table <string, sqlite3_stmt>
+---@field Statements StatementCache
 ---@field MemDB table
 ---@field UserInfo UserInfo
 ---@field Classes table <string, ClassDef>
 ---@field Functions table @comment TODO use Function class
 ---@field ClassProps table<number, PropertyDef>
----@field Objects tables <number, DBObject>
+---@field NameIDs table<string, number> @comment intern table of symbolic names, value -> ID
+---@field NameValues table<number, string> @comment intern table of symbolic names, ID -> value
+---@field Objects ObjectCache
 ---@field DirtyObjects table <number, DBObject>
 ---@field ClassDef ClassDef @comment constructor
 ---@field PropertyDef PropertyDef @comment constructor
 ---@field AccessControl AccessControl
 ---@field EnumManager EnumManager
 ---@field SchemaChanged boolean
+---@field SchemaVersion number @comment PRAGMA user_version, for which class definitions are loaded
+---@field DBFileName string @comment main database file name, for which class definitions are loaded
 ---@field DeferredActions ActionList
 ---@field config DBContextConfig
 local DBContext = class()
@@ -123,8 +131,8 @@ local flexiMeta
 function DBContext:_init(db)
     self.db = assert(db, 'Expected sqlite3 database but nil was passed')
 
-    -- Cache of prepared statements, key is statement SQL
-    self.Statements = {}
+    -- LRU cache of prepared statements, key is statement SQL
+    self.Statements = StatementCache()
     self.MemDB = nil
     self.UserInfo = UserInfo()
 
@@ -138,8 +146,10 @@ function DBContext:_init(db)
     -- Global list of class property definitions (by property ID)
     self.ClassProps = {}
 
-    -- Cache of loaded objects (map by object ID). Exists only during time of request. Gets reset after request is complete
-    self.Objects = {}
+    self:flushNameCache()
+
+    -- Cache of loaded objects (by object ID). Exists only during time of request. Gets reset after request is complete
+    self.Objects = ObjectCache()
 
     -- helper constructors and singletons
     self.ClassDef = ClassDef
@@ -166,7 +176,8 @@ function DBContext:_init(db)
 
     -- Can be overridden by flexi('config', ...)
     self.config = {
-        createVirtualTable = false
+        createVirtualTable = false,
+        objectCacheBudget = self.Objects.budget
     }
 
     self:initMemoizeFunctions()
@@ -212,13 +223,13 @@ properties will be loaded on demand. Also, when object gets edited, its entire c
 ---@param objRow table | nil @comment row of [.objects]
 ---@return DBObject
 function DBContext:LoadObject(id, propIds, forUpdate, objRow)
-    local result = self.Objects[id]
+    local result = self.Objects:get(id)
 
     if not result then
         local op = forUpdate and Constants.OPERATION.UPDATE or Constants.OPERATION.READ
         -- TODO Check access rules for class and specific object
         result = DBObject({ ID = id, PropIDs = propIds, DBContext = self, ObjRow = objRow }, op)
-        self.Objects[id] = result
+        self.Objects:put(id, result)
     end
     return result
 end
@@ -259,7 +270,7 @@ end
 function DBContext:NewObject(classDef, data)
     local pp = { ClassDef = classDef, ID = self:GetNewObjectID(), Data = data }
     local result = DBObject(pp, Constants.OPERATION.CREATE)
-    self.Objects[pp.ID] = result
+    self.Objects:put(pp.ID, result)
     return result
 end
 
@@ -302,8 +313,9 @@ function DBContext:flexiAction(ctx, action, ...)
         local uv = self:loadOneRow(
         ---@language SQL
                 [[pragma user_version;]])
-        if self.SchemaVersion ~= uv then
+        if self.SchemaVersion ~= uv.user_version then
             self:flushSchemaCache()
+            self.SchemaVersion = uv.user_version
         end
 
         self.DeferredActions:Clear()
@@ -312,7 +324,9 @@ function DBContext:flexiAction(ctx, action, ...)
         result = ff(self, unpack(args))
 
         if meta.schemaChange or self.SchemaChanged then
-            self:execStatement(string.format([[pragma user_version=%d;]], uv.user_version))
+            -- Signals other connections (and native class cache) to reload class definitions
+            self.SchemaVersion = uv.user_version + 1
+            self:execStatement(string.format([[pragma user_version=%d;]], self.SchemaVersion))
         end
 
         self.DeferredActions:Run(true)
@@ -327,6 +341,8 @@ function DBContext:flexiAction(ctx, action, ...)
 
     if not ok then
         self.db:exec 'rollback'
+        -- Names inserted by rolled back transaction do not exist anymore
+        self:flushNameCache()
         ctx:result_error(errorMsg)
     end
 
@@ -339,39 +355,68 @@ function DBContext:flexiAction(ctx, action, ...)
 end
 
 -- Utility method to obtain prepared sqlite statement
--- All prepared statements are kept in DBContext.Statements pool and accessed by sql as key
+-- Prepared statements are kept in DBContext.Statements LRU cache and accessed by sql as key
 --- @param sql string
 --- @return stmt
 -- (alias to sqlite3_stmt)
 function DBContext:getStatement(sql)
-    local result = self.Statements[sql]
+    local result = self.Statements:get(self.db, sql)
     if not result then
-        result = self.db:prepare(sql)
-        if not result then
-            self:checkSqlite(1)
-        end
-
-        self.Statements[sql] = result
-    else
-        result:reset()
+        self:checkSqlite(1)
     end
 
     return result
 end
 
+-- Resets all cached statements, so that none of them keeps read transaction open
+function DBContext:resetStatements()
+    self.Statements:reset()
+end
+
 function DBContext:finalizeStatements()
-    for _, stmt in pairs(self.Statements) do
-        if stmt then
-            stmt:finalize()
-        end
-    end
-    self.Statements = {}
+    self.Statements:clear()
+    NativeObjectView.releaseLoader(self)
 end
 
 function DBContext:close()
     self:finalizeStatements()
 end
 
+--[[ Attaches context to another database connection. Used when Lua state is taken from pool
+(see src/flexi/flexi_lua_pool.h), so that context is reused instead of being created again.
+Per-connection state is reset. Class definitions are kept if connection is to the same database file,
+as they get validated against PRAGMA user_version on every flexi call anyway ]]
+---@param db sqlite3
+function DBContext:attach(db)
+    self.db = assert(db, 'Expected sqlite3 database but nil was passed')
+
+    local fileName = db:db_filename('main')
+    if fileName == nil or fileName == '' or fileName ~= self.DBFileName then
+        self:flushSchemaCache()
+        self.SchemaVersion = nil
+    end
+    self.DBFileName = fileName
+
+    self.UserInfo = UserInfo()
+    self.SchemaChanged = false
+    self.DeferredActions:Clear()
+    self.DeferredRefs = {}
+    self.Objects:setBudget(nil)
+    self.config = {
+        createVirtualTable = false,
+        objectCacheBudget = self.Objects.budget
+    }
+    self:flushDataCache()
+    self.AccessControl:flushCache()
+    self:flushCurrentUserCheckPermissions()
+end
+
+--[[ Detaches context from database connection, before Lua state is returned to pool ]]
+function DBContext:detach()
+    self:finalizeStatements()
+    self.db = nil
+end
+
 --- Finds class ID by its name
 --- @param className string
 --- @param errorIfNotFound boolean @comment optional. If true and class does not exist,
@@ -387,12 +432,32 @@ function DBContext:getClassIdByName(className, errorIfNotFound)
     return row and row.ClassID or 0
 end
 
+--[[ Resets intern table of symbolic names. Names are cached on first lookup or insert, and
+flushed together with schema cache (on PRAGMA user_version change) and on rollback ]]
+function DBContext:flushNameCache()
+    self.NameIDs = {}
+    self.NameValues = {}
+end
+
+---@param nameID number
+---@param name string
+function DBContext:internName(nameID, name)
+    self.NameIDs[name] = nameID
+    self.NameValues[nameID] = name
+end
+
 --- @param nameID number
 --- @return string
 function DBContext:getNameValueByID(nameID)
+    local result = self.NameValues[nameID]
+    if result then
+        return result
+    end
+
     local row = self:loadOneRow([[select [Value] from [.sym_names] where ID = :v limit 1;]],
                                 { v = nameID })
     if row then
+        self:internName(nameID, row.Value)
         return row.Value
     end
 
@@ -425,6 +490,11 @@ end
 --- @param name string
 --- @return number @comment nameID
 function DBContext:insertName(name)
+    local result = self.NameIDs[name]
+    if result then
+        return result
+    end
+
     local sql = [[insert  into [.sym_names] ([Value]) select :v
         where not exists (select ID from [.sym_names] where [Value] = :v limit 1);
         ]]
@@ -451,6 +521,11 @@ end
 --- @return number
 function DBContext:getNameID(name)
     assert(name)
+    local result = self.NameIDs[name]
+    if result then
+        return result
+    end
+
     local row = self:loadOneRow('select NameID from [.names] where [Value] = :n;', { n = name })
     if not row then
 
@@ -459,6 +534,7 @@ function DBContext:getNameID(name)
         error('Name [' .. name .. '] not found')
     end
 
+    self:internName(row.NameID, name)
     return row.NameID
 end
 
@@ -516,7 +592,7 @@ function DBContext:loadRows(sql, params)
         self:checkSqlite(ok)
     end
 
-    return stmt:nrows()
+    return self.Statements:nrows(stmt)
 end
 
 -- Utility method. Adds instance of ClassDef to DBContext.Classes collection
@@ -666,6 +742,43 @@ function DBContext:flexi_ping()
     return 'pong'
 end
 
+--- Gets or sets connection level setting (see DBContextConfig)
+--- flexi('config', name) returns current value, flexi('config', name, value) sets new value
+--- @param name string
+--- @param value any
+--- @return any
+function DBContext:flexi_Config(name, value)
+    local current = self.config[name]
+    if current == nil then
+        error(string.format('Unknown config setting [%s]', tostring(name)))
+    end
+
+    if value ~= nil then
+        if type(current) == 'number' then
+            value = tonumber(value) or error(string.format('Config setting [%s] expects number', name))
+        elseif type(current) == 'boolean' then
+            value = value ~= 0 and value ~= false and value ~= 'false'
+        end
+        self.config[name] = value
+
+        if name == 'objectCacheBudget' then
+            self.Objects:setBudget(value)
+        end
+    end
+
+    local result = self.config[name]
+    if type(result) == 'boolean' then
+        result = result and 1 or 0
+    end
+    return result
+end
+
+--- Returns statistics of object and prepared statement caches, as JSON
+--- @return string
+function DBContext:flexi_CacheStats()
+    return json.encode({ objects = self.Objects:stats(), statements = self.Statements:stats() })
+end
+
 --- Purges previously softly deleted data
 --- @param className string @comment if set, will purge deleted data for that class only
 --- @param propName string @comment if set, will purge deleted data for that property only
@@ -710,14 +823,15 @@ function DBContext:flushSchemaCache()
     self.Classes = {}
     self.ClassProps = {}
     self.Functions = {}
-    self.Objects = {}
+    self.Objects:clear()
+    self:flushNameCache()
     self:initMemoizeFunctions()
     self:flushCurrentUserCheckPermissions()
     self:finalizeStatements()
 end
 
 function DBContext:flushDataCache()
-    self.Objects = {}
+    self.Objects:clear()
 end
 
 ---@param objectID number
@@ -726,13 +840,13 @@ function DBContext:getObject(objectID)
 
     -- TODO Check access permissions for class and specific object
 
-    local result = self.Objects[objectID]
+    local result = self.Objects:get(objectID)
     if result then
         return result
     end
 
     result = DBObject(self, nil, objectID)
-    self.Objects[objectID] = result
+    self.Objects:put(objectID, result)
     return result
 end
 
@@ -758,10 +872,7 @@ end
 ---@param params table
 ---@return lsqlite.stmt
 function DBContext:getAdhocStmt(sql, params)
-    local result = self.db:prepare(sql)
-    if not result then
-        self:checkSqlite(1)
-    end
+    local result = self:getStatement(sql)
 
     if params then
         self:checkSqlite(result:bind_names(params))
@@ -786,7 +897,7 @@ end
 --- @return iterator
 function DBContext:LoadAdhocRows(sql, params)
     local stmt = self:getAdhocStmt(sql, params)
-    return stmt:nrows()
+    return self.Statements:nrows(stmt)
 end
 
 -- Internal method to initialize metadata reference (NameRef, PropRef...)
@@ -825,6 +936,7 @@ local flexi_SplitProperty = require 'flexi_SplitProperty'
 local flexi_MergeProperty = require 'flexi_MergeProperty'
 local TriggerAPI = require 'Triggers'
 local flexi_DataUpdate = require 'flexi_DataUpdate'
+local flexi_Analyze = require 'flexi_Analyze'
 
 -- Initialization should be after all FLEXI functions are defined
 -- Variables are declared above
@@ -841,6 +953,10 @@ flexiMeta = {
     [flexi_DropProperty] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_Configure] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [DBContext.flexi_ping] = { shortInfo = '', fullInfo = [[]] },
+    [DBContext.flexi_Config] = { shortInfo = '', fullInfo = [[]] },
+    [DBContext.flexi_CacheStats] = { shortInfo = '', fullInfo = [[]] },
+    -- Statistics is loaded with class definitions, so they need to be reloaded
+    [flexi_Analyze] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [DBContext.flexi_CurrentUser] = { shortInfo = '', fullInfo = [[]] },
     [flexi_PropToObject] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
     [flexi_ObjectToProp] = { shortInfo = '', fullInfo = [[]], schemaChange = true },
@@ -876,6 +992,9 @@ flexiFuncs = {
     ['property drop'] = flexi_DropProperty,
     ['configure'] = flexi_Configure,
     ['ping'] = DBContext.flexi_ping,
+    ['config'] = DBContext.flexi_Config,
+    ['cache stats'] = DBContext.flexi_CacheStats,
+    ['analyze'] = flexi_Analyze,
     ['current user'] = DBContext.flexi_CurrentUser,
     ['property to object'] = flexi_PropToObject,
     ['object to property'] = flexi_ObjectToProp,
@@ -442,9 +442,9 @@ function WritableDBOV:saveCreate(ctx)
         :ClassID, :ctlo, :vtypes, :A, :B, :C, :D, :E, :F, :G, :H, :I, :J, :J, :K, :L, :M, :N, :O, :P);]],
             params)
     -- TODO process deferred links
-    self.ClassDef.DBContext.Objects[self.ID] = nil
+    self.ClassDef.DBContext.Objects:remove(self.ID)
     self.ID = self.ClassDef.DBContext.db:last_insert_rowid()
-    self.ClassDef.DBContext.Objects[self.ID] = self.DBObject
+    self.ClassDef.DBContext.Objects:put(self.ID, self.DBObject)
 
     for propName, prop in pairs(self.props) do
         prop:SaveToDB(ctx)
@@ -186,6 +186,7 @@ Used by WritableDBOV (DBObject.curVer)
 ---@field PropDef PropertyDef
 ---@field values table<number, DBValue>
 ---@field appendIndex number @comment auto-decrement value used for appended values
+---@field nextIndex number @comment PropIndex for the next appended value, while saving to DB
 local ChangedDBProperty = class(DBProperty)
 
 function ChangedDBProperty:_init(DBOV, propDef)
@@ -274,10 +275,13 @@ function ChangedDBProperty:updateCTLV(dbv)
 
 end
 
--- Sorts property values by index
--- TODO
+-- Returns indexes of property values sorted in save order: explicit indexes (1, 2...) in ascending order,
+-- then appended ones (-1, -2...) in order they were added
+---@param values table<number, DBValue>
+---@return number[]
 local function sort_values(values)
-    tablex.sort(tablex.keys(values), function(a, b)
+    local result = tablex.keys(values)
+    table.sort(result, function(a, b)
         if a > 0 and b > 0 then
             return a < b
         elseif a < 0 and b < 0 then
@@ -288,6 +292,63 @@ local function sort_values(values)
             return false
         end
     end)
+    return result
+end
+
+--[[
+SQL for saving [.ref-values] rows, by operation ('insert' or 'replace') and property native type.
+Built once, so that DBContext:getStatement always gets the same text and reuses prepared statement
+]]
+local saveValueSQL = { insert = {}, replace = {} }
+
+---@param op string @comment 'insert' or 'replace'
+---@param nativeType string
+---@return string
+local function getSaveValueSQL(op, nativeType)
+    nativeType = nativeType or ''
+    local result = saveValueSQL[op][nativeType]
+    if not result then
+        local valWrapper = ':Value'
+        if nativeType ~= '' then
+            valWrapper = string.format('cast(:Value as %s)', nativeType)
+        end
+        result = string.format([[%s into [.ref-values]
+            (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
+            (:ObjectID, :PropertyID, :PropIndex, %s, :ctlv, :MetaData);]],
+                op == 'replace' and 'insert or replace' or 'insert', valWrapper)
+        saveValueSQL[op][nativeType] = result
+    end
+    return result
+end
+
+-- Returns PropIndex to be assigned to the next appended value and advances it.
+-- Initial value is determined once per property: from explicitly indexed values and, for existing
+-- objects, from max PropIndex stored in the database
+---@return number
+function ChangedDBProperty:nextPropIndex()
+    if not self.nextIndex then
+        local maxIdx = 0
+        for idx, _ in pairs(self.values) do
+            if idx > maxIdx then
+                maxIdx = idx
+            end
+        end
+
+        if self.DBOV.DBObject.state ~= Constants.OPERATION.CREATE then
+            local row = self.DBOV.ClassDef.DBContext:loadOneRow([[select max(PropIndex) as MaxIdx
+                from [.ref-values] where ObjectID = :ObjectID and PropertyID = :PropertyID;]],
+                    { ObjectID = self.DBOV.ID, PropertyID = self.PropDef.ID })
+            if row and row.MaxIdx and row.MaxIdx > maxIdx then
+                maxIdx = row.MaxIdx
+            end
+        end
+
+        self.nextIndex = maxIdx + 1
+    end
+
+    local result = self.nextIndex
+    self.nextIndex = result + 1
+    return result
 end
 
 -- Saves values to the database
@@ -311,47 +372,27 @@ function ChangedDBProperty:SaveToDB(ctx)
     end
 
     local propCtlv = self.PropDef:GetCTLV()
-
-    local valWrapper = ':Value'
     local nativeType = self.PropDef:getNativeType()
-    if nativeType ~= nil and nativeType ~= '' then
-        valWrapper = string.format('cast(:Value as %s)', nativeType)
-    end
+    local insertSQL = getSaveValueSQL(op == Constants.OPERATION.CREATE and 'insert' or 'replace', nativeType)
 
-    for idx, dbv in pairs(self.values) do
+    for _, idx in ipairs(sort_values(self.values)) do
+        local dbv = self.values[idx]
         ctx.PropIdx = idx
         if idx == 1 then
             -- Check if there is column mapping
             -- TODO
         end
 
-        if self.DBOV.DBObject.state == Constants.OPERATION.CREATE then
+        if op == Constants.OPERATION.CREATE then
             if dbv.Value ~= nil then
-                --  insert
-                local params = {
+                --  insert. Appended values get next available index
+                DBContext:execStatement(insertSQL, {
                     ObjectID = self.DBOV.ID,
                     PropertyID = self.PropDef.ID,
-                    PropIndex = idx,
+                    PropIndex = idx < 0 and self:nextPropIndex() or idx,
                     Value = dbv.Value,
                     ctlv = propCtlv,
-                    MetaData = dbv.MetaData and JSON.encode(dbv.MetaData) or nil }
-
-                if idx < 0 then
-                    -- Append new value
-                    DBContext:execStatement(string.format([[insert into [.ref-values]
-                    (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
-                    (:ObjectID, :PropertyID,
-                    coalesce((select max(PropIndex) from [.ref-values] where ObjectID = :ObjectID and PropertyID = :PropertyID limit 1), 0) + 1,
-                    %d, :ctlv, :MetaData);]], valWrapper)
-                    , params)
-                else
-                    -- Add or update value with known index
-                    DBContext:execStatement(string.format([[insert into [.ref-values]
-                    (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
-                    (:ObjectID, :PropertyID, :PropIndex, %s, :ctlv, :MetaData);]], valWrapper)
-                    , params)
-                end
-
+                    MetaData = dbv.MetaData and JSON.encode(dbv.MetaData) or nil })
             end
         else
             if dbv.Value == nil then
@@ -368,34 +409,20 @@ function ChangedDBProperty:SaveToDB(ctx)
                     -- Extended update - object ID and/or property ID have changed
                     -- TODO
                 else
-                    -- Regular insert/update
-                    local params = {
+                    -- Regular insert/update. Appended values get next available index
+                    DBContext:execStatement(insertSQL, {
                         ObjectID = self.DBOV.ID,
                         PropertyID = self.PropDef.ID,
-                        PropIndex = idx,
+                        PropIndex = idx < 0 and self:nextPropIndex() or idx,
                         Value = dbv.Value,
                         ctlv = propCtlv,
-                        MetaData = dbv.MetaData and JSON.encode(dbv.MetaData) or nil }
-
-                    if idx < 0 then
-                        -- Append new value
-                        DBContext:execStatement(string.format([[insert or replace into [.ref-values]
-                    (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
-                    (:ObjectID, :PropertyID,
-                    coalesce((select max(PropIndex) from [.ref-values] where ObjectID = :ObjectID and PropertyID = :PropertyID limit 1), 0) + 1,
-                    %s, :ctlv, :MetaData);]], valWrapper)
-                        , params)
-                    else
-                        -- Add or update value with known index
-                        DBContext:execStatement(string.format([[insert or replace into [.ref-values]
-                    (ObjectID, PropertyID, PropIndex, [Value], ctlv, MetaData) values
-                    (:ObjectID, :PropertyID, :PropIndex, %s, :ctlv, :MetaData);]], valWrapper)
-                        , params)
-                    end
+                        MetaData = dbv.MetaData and JSON.encode(dbv.MetaData) or nil })
                 end
             end
         end
     end
+
+    self.nextIndex = nil
 end
 
 return {
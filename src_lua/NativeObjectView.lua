@@ -0,0 +1,128 @@
+---
+--- Created by slanska.
+--- DateTime: 2026-10-17
+---
+
+--[[
+Read-only sandbox view on object loaded by native flexi_ObjectLoader (flexi_Object_load).
+Used by DBQuery for filtering, as lightweight alternative to DBObject/ReadOnlyDBOV:
+object row and all [.ref-values] are loaded by a single call in C, and property values are
+read directly from loaded data on access. No DBObject, DBProperty or DBValue tables are created per object,
+and the same view instance is reused for all objects in query.
+
+Property values are returned the same way as DBObjectWrap:getBoxedAttr does for filter expressions:
+scalar value if property has maxOccurrences == 1, otherwise array of values.
+
+If native module is not available (it is not linked into extension until flexi_Context_t functions it depends on
+are built, or Lua code runs outside of Flexilite extension),
+NativeObjectView.isAvailable() returns false and callers should use DBObject.
+]]
+
+local class = require 'pl.class'
+local Constants = require 'Constants'
+
+local ok, ObjectLoader = pcall(require, 'flexi_ObjectLoader')
+if not ok then
+    ObjectLoader = nil
+end
+
+-- One native loader per DBContext
+local loaders = setmetatable({}, { __mode = 'k' })
+
+---@class NativeObjectView
+---@field DBContext DBContext
+---@field ClassDef ClassDef
+---@field loader userdata
+---@field env table @comment sandbox environment
+local NativeObjectView = class()
+
+---@return boolean
+function NativeObjectView.isAvailable()
+    return ObjectLoader ~= nil
+end
+
+--[[ Releases native loader of DBContext, together with its prepared statements.
+Called when DBContext finalizes statements or gets detached from connection ]]
+---@param DBContext DBContext
+function NativeObjectView.releaseLoader(DBContext)
+    local loader = loaders[DBContext]
+    if loader then
+        loader:close()
+        loaders[DBContext] = nil
+    end
+end
+
+---@param DBContext DBContext
+---@param ClassDef ClassDef
+function NativeObjectView:_init(DBContext, ClassDef)
+    self.DBContext = assert(DBContext)
+    self.ClassDef = assert(ClassDef)
+
+    local loader = loaders[DBContext]
+    if not loader then
+        loader = ObjectLoader.new(DBContext.db:get_ptr())
+        loaders[DBContext] = loader
+    end
+    self.loader = loader
+
+    -- Property definitions by name, with access already checked
+    self.checkedProps = {}
+
+    self.env = setmetatable({}, {
+        __index = function(_, name)
+            return self:getBoxedAttr(name)
+        end,
+        __newindex = function(_, name)
+            error(string.format('Cannot modify property [%s] of read-only object', tostring(name)))
+        end,
+    })
+end
+
+--[[ Loads object data. Returns false if object was not found ]]
+---@param objectID number
+---@return boolean
+function NativeObjectView:load(objectID)
+    if not self.loader:load(objectID) then
+        return false
+    end
+
+    -- Theoretically, object's class may not match class def of query
+    local classID = self.loader:classID()
+    if classID ~= self.ClassDef.ClassID then
+        self.ClassDef = self.DBContext:getClassDef(classID)
+        self.checkedProps = {}
+    end
+
+    return true
+end
+
+---@param name string
+---@return PropertyDef | nil
+function NativeObjectView:getPropDef(name)
+    local propDef = self.checkedProps[name]
+    if propDef == nil then
+        propDef = self.ClassDef:hasProperty(name)
+        if propDef then
+            self.DBContext.ensureCurrentUserAccessForProperty(propDef.ID, Constants.OPERATION.READ)
+        end
+        self.checkedProps[name] = propDef or false
+    end
+
+    return propDef or nil
+end
+
+---@param name string
+function NativeObjectView:getBoxedAttr(name)
+    local propDef = self:getPropDef(name)
+    if not propDef then
+        return nil
+    end
+
+    if (propDef.D.rules.maxOccurrences or 1) == 1 then
+        return (self.loader:value(propDef.ID, 1, propDef:ColMapIndex()))
+    end
+
+    return self.loader:values(propDef.ID, propDef:ColMapIndex())
+end
+
+return NativeObjectView
@@ -0,0 +1,238 @@
+---
+--- Created by slanska.
+--- DateTime: 2026-10-17
+---
+
+--[[
+Identity cache of DBObject-s loaded during request (DBContext.Objects).
+Guarantees that the same object ID resolves to the same DBObject instance, while keeping
+memory used by loaded objects within configurable budget (flexi('config', 'objectCacheBudget', bytes)).
+
+Objects are kept in doubly linked list, ordered from most to least recently used.
+When estimated size of cached objects exceeds budget, least recently used clean objects
+(in READ state) get evicted. Dirty objects (created, edited or deleted, but not yet saved)
+are pinned and never evicted, so budget may be exceeded temporarily.
+
+Object size is estimated from number and size of loaded property values, and is re-estimated
+every time object is accessed, as property values are loaded on demand.
+]]
+
+local class = require 'pl.class'
+local Constants = require 'Constants'
+
+-- Default memory budget, in bytes
+local DEFAULT_BUDGET = 64 * 1024 * 1024
+
+-- Rough estimation of memory used by DBObject and its versions without property values
+local OBJECT_OVERHEAD = 1024
+
+-- Rough estimation of memory used by DBProperty and DBValue, not counting string/blob content
+local PROPERTY_OVERHEAD = 128
+local VALUE_OVERHEAD = 96
+
+---@param props table <string, DBProperty>
+---@return number
+local function estimatePropsSize(props)
+    local result = 0
+    if type(props) ~= 'table' then
+        return result
+    end
+
+    for _, prop in pairs(props) do
+        result = result + PROPERTY_OVERHEAD
+        if type(prop) == 'table' and prop.values then
+            for _, dbv in pairs(prop.values) do
+                result = result + VALUE_OVERHEAD
+                if type(dbv) == 'table' and type(dbv.Value) == 'string' then
+                    result = result + #dbv.Value
+                end
+            end
+        end
+    end
+    return result
+end
+
+---@param obj DBObject
+---@return number
+local function estimateObjectSize(obj)
+    local result = OBJECT_OVERHEAD
+    if type(obj.origVer) == 'table' then
+        result = result + estimatePropsSize(obj.origVer.props)
+    end
+    if type(obj.curVer) == 'table' then
+        result = result + estimatePropsSize(obj.curVer.props)
+    end
+    return result
+end
+
+---@class ObjectCacheEntry
+---@field id number
+---@field obj DBObject
+---@field size number
+---@field prev ObjectCacheEntry @comment more recently used
+---@field next ObjectCacheEntry @comment less recently used
+
+---@class ObjectCache
+---@field budget number @comment max estimated size of cached objects, in bytes. 0 - unlimited
+---@field size number @comment estimated size of cached objects, in bytes
+---@field count number
+---@field entries table<number, ObjectCacheEntry>
+---@field mru ObjectCacheEntry
+---@field lru ObjectCacheEntry
+---@field hits number
+---@field misses number
+---@field evictions number
+local ObjectCache = class()
+
+---@param budget number | nil
+function ObjectCache:_init(budget)
+    self:setBudget(budget)
+    self.hits = 0
+    self.misses = 0
+    self.evictions = 0
+    self:clear()
+end
+
+---@param budget number | nil @comment in bytes. nil - default budget, 0 - unlimited
+function ObjectCache:setBudget(budget)
+    self.budget = tonumber(budget) or DEFAULT_BUDGET
+end
+
+---@param entry ObjectCacheEntry
+function ObjectCache:unlink(entry)
+    if entry.prev then
+        entry.prev.next = entry.next
+    else
+        self.mru = entry.next
+    end
+
+    if entry.next then
+        entry.next.prev = entry.prev
+    else
+        self.lru = entry.prev
+    end
+
+    entry.prev, entry.next = nil, nil
+end
+
+---@param entry ObjectCacheEntry
+function ObjectCache:linkAsMru(entry)
+    entry.prev = nil
+    entry.next = self.mru
+    if self.mru then
+        self.mru.prev = entry
+    end
+    self.mru = entry
+    if not self.lru then
+        self.lru = entry
+    end
+end
+
+---@param entry ObjectCacheEntry
+function ObjectCache:updateSize(entry)
+    local newSize = estimateObjectSize(entry.obj)
+    self.size = self.size + newSize - entry.size
+    entry.size = newSize
+end
+
+---@param entry ObjectCacheEntry
+function ObjectCache:removeEntry(entry)
+    self:unlink(entry)
+    self.entries[entry.id] = nil
+    self.count = self.count - 1
+    self.size = self.size - entry.size
+end
+
+-- Evicts least recently used clean objects until cache fits its budget.
+-- Most recently used object is never evicted
+function ObjectCache:evict()
+    if self.budget <= 0 then
+        return
+    end
+
+    local entry = self.lru
+    while entry and entry ~= self.mru and self.size > self.budget do
+        local prev = entry.prev
+        if entry.obj.state == Constants.OPERATION.READ then
+            self:removeEntry(entry)
+            self.evictions = self.evictions + 1
+        end
+        entry = prev
+    end
+end
+
+--- Returns cached object or nil
+---@param id number
+---@return DBObject | nil
+function ObjectCache:get(id)
+    local entry = self.entries[id]
+    if not entry then
+        self.misses = self.misses + 1
+        return nil
+    end
+
+    self.hits = self.hits + 1
+    if entry ~= self.mru then
+        self:unlink(entry)
+        self:linkAsMru(entry)
+    end
+
+    -- Object may have loaded more values since last access
+    self:updateSize(entry)
+    self:evict()
+
+    return entry.obj
+end
+
+--- Adds or replaces object with given ID
+---@param id number
+---@param obj DBObject
+function ObjectCache:put(id, obj)
+    local entry = self.entries[id]
+    if entry then
+        entry.obj = obj
+        if entry ~= self.mru then
+            self:unlink(entry)
+            self:linkAsMru(entry)
+        end
+    else
+        entry = { id = id, obj = obj, size = 0 }
+        self.entries[id] = entry
+        self.count = self.count + 1
+        self:linkAsMru(entry)
+    end
+
+    self:updateSize(entry)
+    self:evict()
+end
+
+---@param id number
+function ObjectCache:remove(id)
+    local entry = self.entries[id]
+    if entry then
+        self:removeEntry(entry)
+    end
+end
+
+-- Removes all objects. Counters are kept
+function ObjectCache:clear()
+    self.entries = {}
+    self.count = 0
+    self.size = 0
+    self.mru = nil
+    self.lru = nil
+end
+
+---@return table @comment {count, size, budget, hits, misses, evictions}
+function ObjectCache:stats()
+    return {
+        count = self.count,
+        size = self.size,
+        budget = self.budget,
+        hits = self.hits,
+        misses = self.misses,
+        evictions = self.evictions
+    }
+end
+
+return ObjectCache
@@ -67,6 +67,7 @@ local dbprops = require 'DBProperty'
 local parseDatTimeToJulian = require('Util').parseDatTimeToJulian
 local stringifyDateTimeInfo = require('Util').stringifyDateTimeInfo
 local base64 = require 'base64'
+local json = require 'cjson'
 
 --[[
 ===============================================================================
@@ -112,8 +113,17 @@ PropertyDef
 ---@field ColMap string
 ---@field NonNullCount number
 ---@field SearchHitCount number
+---@field Stats PropertyStats | boolean @comment false if statistics is not available
 local PropertyDef = class()
 
+---@class PropertyStats
+---@field ObjectCount number @comment estimated number of class objects
+---@field NonNullCount number
+---@field DistinctCount number
+---@field MinValue number | string
+---@field MaxValue number | string
+---@field Histogram table @comment bounds of equi-depth histogram buckets
+
 -- Factory method to create a property object based on rules.type in params.jsonData
 ---@param params PropertyDefCtorParams @comment 2 variants:
 ---for new property (not stored in DB) {ClassDef: ClassDef, newPropertyName:string, jsonData: table}
@@ -418,6 +428,28 @@ function PropertyDef:ColMapIndex()
     return self.ColMap ~= nil and string.lower(self.ColMap):byte() - string.byte('a') or nil
 end
 
+-- Returns statistics of property values, collected by flexi('analyze'), or nil if statistics is not available.
+-- Statistics is loaded once, as class definitions are reloaded after analyze
+---@return PropertyStats | nil
+function PropertyDef:getStats()
+    if self.Stats == nil then
+        self.Stats = false
+        if self.ID then
+            -- Database may have been created before statistics tables were added
+            local ok, row = pcall(self.ClassDef.DBContext.loadOneRow, self.ClassDef.DBContext, [[
+            select cs.ObjectCount, ps.NonNullCount, ps.DistinctCount, ps.MinValue, ps.MaxValue, ps.Histogram
+            from [.prop_stats] ps join [.class_stats] cs on cs.ClassID = ps.ClassID
+            where ps.PropertyID = :PropertyID;]], { PropertyID = self.ID })
+            if ok and row and row.ObjectCount > 0 then
+                row.Histogram = row.Histogram and json.decode(row.Histogram) or {}
+                self.Stats = row
+            end
+        end
+    end
+
+    return self.Stats or nil
+end
+
 --[[
 ===============================================================================
 AnyPropertyDef
@@ -103,11 +103,13 @@ local Constants = require 'Constants'
 local pretty = require 'pl.pretty'
 local bit52 = require('Util').bit52
 local Sandbox = require 'sandbox'
+local NativeObjectView = require 'NativeObjectView'
 
 ---@class QueryBuilderIndexItem
 ---@field propID number
 ---@field cond string @comment >=, <, =, >, <=
 ---@field val nil | boolean | number | string | table @comment params.Name
+---@field rawVal nil | number | string @comment value before escaping, used for selectivity estimation
 ---@field processed number @comment Counter of how many times property was included into index search
 
 ---@class FilterDef
@@ -116,6 +118,8 @@ local Sandbox = require 'sandbox'
 ---@field ast table
 ---@field indexedItems QueryBuilderIndexItem[] @comment property IDs may be duplicated
 ---@field params table
+---@field sqlParams table @comment values bound to generated SQL, by parameter name
+---@field sqlParamCount number
 ---@field matchCallCount number @comment Number of MATCH function calls
 ---@field callCount number @comment Total umber of function calls
 local FilterDef = class()
@@ -132,12 +136,6 @@ local function skip_parens(astToken)
     return astToken
 end
 
-local function escape_single_quotes(val)
-    if type(val) == 'string' then
-        return string.format([['%s']], string.gsub(val, [[']], [['']]))
-    end
-    return tostring(val)
-end
 
 ---@class ExprItem
 ---@field isProp boolean
@@ -234,10 +232,27 @@ function FilterDef:is_property_name(astToken)
     return nil
 end
 
+-- Adds value to parameters of generated SQL (sqlParams) and returns reference to it.
+-- Values are bound rather than inlined into SQL text, so that numbers keep full precision
+-- and SQL (and so cached prepared statement) is the same for any values
+---@param v any
+---@return string
+function FilterDef:bind_value(v)
+    if not self.sqlParams then
+        self.sqlParams = {}
+        self.sqlParamCount = 0
+    end
+    self.sqlParamCount = self.sqlParamCount + 1
+    local name = 'v' .. self.sqlParamCount
+    self.sqlParams[name] = v
+    return ':' .. name
+end
+
 -- Evaluates if astToken is literal value or param
+-- Returns reference to bound value, ready to be included into SQL, and raw value
 ---@param propDef PropertyDef
 ---@param astToken ASTToken | string[]
----@return number | string | nil
+---@return number | string | nil, number | string | nil
 function FilterDef:is_valid_value(propDef, astToken)
     astToken = skip_parens(astToken)
     local vv
@@ -255,11 +270,10 @@ function FilterDef:is_valid_value(propDef, astToken)
     if vv then
         local dbv = DBValue { }
         propDef:ImportDBValue(dbv, vv)
-        local result = dbv.Value
-        if type(result) == 'string' then
-            result = escape_single_quotes(result)
+        if dbv.Value == nil then
+            return nil
         end
-        return result
+        return self:bind_value(dbv.Value), dbv.Value
     else
         return nil
     end
@@ -283,18 +297,18 @@ function FilterDef:is_prop_expression(astToken)
 
     if astToken.tag == 'Op' and (astToken[1] == 'lt' or astToken[1] == 'le' or astToken[1] == 'eq') then
         local prop = self:is_property_name(astToken[2])
-        local propVal = self:is_valid_value(prop, astToken[3])
+        local propVal, rawVal = self:is_valid_value(prop, astToken[3])
 
         if prop and propVal then
             table.insert(self.indexedItems, { propID = prop.ID,
-                                              cond = directConditions[astToken[1]], val = propVal })
+                                              cond = directConditions[astToken[1]], val = propVal, rawVal = rawVal })
             return true
         end
         prop = self:is_property_name(astToken[3])
-        propVal = self:is_valid_value(prop, astToken[2])
+        propVal, rawVal = self:is_valid_value(prop, astToken[2])
         if prop and propVal then
             table.insert(self.indexedItems, { propID = prop.ID,
-                                              cond = reversedConditions[astToken[1]], val = propVal })
+                                              cond = reversedConditions[astToken[1]], val = propVal, rawVal = rawVal })
             return true
         end
     end
@@ -422,8 +436,74 @@ function FilterDef:process_full_text_index(sql)
 
 end
 
+-- Conditions on property with estimated selectivity above this threshold are not used for index search.
+-- Such condition would not narrow down search, but would add subquery. Exact filter is applied anyway
+local MAX_INDEX_SELECTIVITY = 0.3
+
+-- Compares values in the same order as value_stats does: numbers go before strings
+local function value_less(a, b)
+    local ta, tb = type(a) == 'number', type(b) == 'number'
+    if ta ~= tb then
+        return ta
+    end
+    return a < b
+end
+
+-- Returns estimated fraction of values less than v, by bounds of equi-depth histogram
+---@param bounds table @comment N + 1 bucket bounds, from min to max value
+---@param v number | string
+---@return number
+local function histogram_fraction_below(bounds, v)
+    local nBuckets = #bounds - 1
+    if nBuckets < 1 or not value_less(bounds[1], v) then
+        return 0
+    end
+    if not value_less(v, bounds[#bounds]) then
+        return 1
+    end
+    for i = 1, nBuckets do
+        local lo, hi = bounds[i], bounds[i + 1]
+        if value_less(v, hi) or v == hi then
+            -- Numeric bucket: assume uniform distribution within bucket
+            local inBucket = 0.5
+            if type(lo) == 'number' and type(hi) == 'number' and type(v) == 'number' and hi > lo then
+                inBucket = (v - lo) / (hi - lo)
+            end
+            return (i - 1 + inBucket) / nBuckets
+        end
+    end
+    return 1
+end
+
+-- Estimates fraction of class objects which match index item, based on statistics
+-- collected by flexi('analyze'). Returns nil if there is no statistics
+---@param item QueryBuilderIndexItem
+---@return number | nil
+function FilterDef:estimate_selectivity(item)
+    local propDef = self.ClassDef.DBContext.ClassProps[item.propID]
+    local stats = propDef and propDef:getStats()
+    if not stats or item.rawVal == nil or type(item.rawVal) == 'boolean' then
+        return nil
+    end
+
+    local nonNull = math.min(1, stats.NonNullCount / stats.ObjectCount)
+    if item.cond == '=' then
+        return stats.DistinctCount > 0 and nonNull / stats.DistinctCount or 0
+    end
+
+    local below = histogram_fraction_below(stats.Histogram, item.rawVal)
+    if item.cond == '<' or item.cond == '<=' then
+        return nonNull * below
+    elseif item.cond == '>' or item.cond == '>=' then
+        return nonNull * (1 - below)
+    end
+    return nil
+end
+
 -- Generates SQL for searching on individual properties
 -- Takes into account: indexed, unique indexed, non indexed, mapped and non mapped properties
+-- If statistics is available, properties are searched in order of selectivity, most selective first.
+-- Properties with low selectivity are skipped
 ---@param sql List
 function FilterDef:process_single_properties(sql)
     local indexes = self.ClassDef.indexes
@@ -431,9 +511,18 @@ function FilterDef:process_single_properties(sql)
     -- List of already processed props
     local processedProps = {}
 
+    -- Estimated selectivity per property: product of selectivity of its conditions
+    local selectivity = {}
+    for _, v in ipairs(self.indexedItems) do
+        if selectivity[v.propID] ~= false then
+            local sel = self:estimate_selectivity(v)
+            selectivity[v.propID] = sel and (selectivity[v.propID] or 1) * sel or false
+        end
+    end
+
     for i, v in ipairs(self.indexedItems) do
         local propDef = self.ClassDef.DBContext.ClassProps[v.propID]
-        if propDef then
+        if propDef and (selectivity[v.propID] or 0) <= MAX_INDEX_SELECTIVITY then
             local appendAnd = false
             local propSql = processedProps[v.propID]
             local propIndexed = self.ClassDef.indexes.propIndexing[propDef.ID]
@@ -444,8 +533,8 @@ function FilterDef:process_single_properties(sql)
                     propSql:append(string.format(' and ObjectID in (select ObjectID from [.ref-values] where PropertyID = %d ',
                                                  propDef.ID))
                     if propIndexed ~= nil then
-                        propSql:append(' and ctlv & %d <> 0',
-                                       propIndexed == true and Constants.CTLV_FLAGS.UNIQUE or Constants.CTLV_FLAGS.INDEX)
+                        propSql:append(string.format(' and ctlv & %d <> 0',
+                                       propIndexed == true and Constants.CTLV_FLAGS.UNIQUE or Constants.CTLV_FLAGS.INDEX))
                     end
                     appendAnd = true
                 else
@@ -502,8 +591,21 @@ function FilterDef:process_single_properties(sql)
         end
     end
 
-    for propId, pp in pairs(processedProps) do
-        local ss = pp:join(' ') .. ')'
+    -- Most selective first. Properties without statistics go last
+    local propIDs = List()
+    for propId, _ in pairs(processedProps) do
+        propIDs:append(propId)
+    end
+    propIDs:sort(function(a, b)
+        local sa, sb = selectivity[a] or 2, selectivity[b] or 2
+        if sa ~= sb then
+            return sa < sb
+        end
+        return a < b
+    end)
+
+    for _, propId in ipairs(propIDs) do
+        local ss = processedProps[propId]:join(' ') .. ')'
         sql:append(ss)
     end
 end
@@ -518,9 +620,299 @@ function FilterDef:process_multi_key_index(sql)
     end
 end
 
+--[[
+Compilation of filter expression to SQL
+
+Every AST node is translated to SQL expression, evaluated in the context of [.objects] row.
+If node (or any of its children) cannot be translated, nil is returned and expression has to be evaluated
+in Lua sandbox.
+Translated expressions are either 'bool' (comparisons, logical operators, MATCH) or 'value'
+(properties, literals, arithmetic, string functions). Logical operators accept only 'bool' operands,
+as Lua truthiness (only nil and false are false) is different from SQL one. For the same reason
+boolean literals are not allowed in comparisons and arithmetic.
+Equality is translated to IS, so that comparison with nil and negation work like in Lua.
+]]
+
+local sqlArithmeticOps = {
+    add = '+',
+    sub = '-',
+    mul = '*',
+    concat = '||',
+}
+
+local sqlComparisonOps = {
+    eq = 'is',
+    lt = '<',
+    le = '<=',
+}
+
+-- Splits expression to list of top level 'and' operands
+---@param astToken ASTToken
+---@param result ASTToken[]
+---@return ASTToken[]
+local function split_conjuncts(astToken, result)
+    astToken = skip_parens(astToken)
+    if astToken.tag == 'Op' and astToken[1] == 'and' then
+        split_conjuncts(astToken[2], result)
+        split_conjuncts(astToken[3], result)
+    else
+        table.insert(result, astToken)
+    end
+    return result
+end
+
+---@param v any
+---@return string | nil
+function FilterDef:literal_to_sql(v)
+    if type(v) == 'string' or (type(v) == 'number' and v == v and v ~= math.huge and v ~= -math.huge) then
+        return self:bind_value(v)
+    end
+    return nil
+end
+
+-- Returns SQL for value of single value property: mapped column or [.ref-values] with PropIndex = 1
+---@param propDef PropertyDef
+---@return string | nil
+function FilterDef:prop_to_sql(propDef)
+    if propDef:isReference() or (propDef.D.rules.maxOccurrences or 1) ~= 1 then
+        return nil
+    end
+
+    if propDef.ColMap then
+        return string.format('[.objects].[%s]', propDef.ColMap)
+    end
+
+    return string.format([[(select [Value] from [.ref-values] where ObjectID = [.objects].ObjectID
+    and PropertyID = %d and PropIndex = 1)]], propDef.ID)
+end
+
+-- Translates literal or params.Name, compared with property, using property's value conversion
+---@param propDef PropertyDef
+---@param astToken ASTToken
+---@return string | nil
+function FilterDef:prop_value_to_sql(propDef, astToken)
+    astToken = skip_parens(astToken)
+    if astToken.tag ~= 'Number' and astToken.tag ~= 'String' and astToken.tag ~= 'Index' then
+        return nil
+    end
+
+    return self:is_valid_value(propDef, astToken)
+end
+
+---@param astToken ASTToken
+---@return string | nil, string | nil
+function FilterDef:comparison_to_sql(astToken)
+    local op = sqlComparisonOps[astToken[1]]
+    local left, right
+
+    -- Property compared with literal or parameter: convert value according to property type
+    local propDef = self:is_property_name(astToken[2])
+    if propDef then
+        right = self:prop_value_to_sql(propDef, astToken[3])
+        left = right and self:prop_to_sql(propDef)
+    else
+        propDef = self:is_property_name(astToken[3])
+        if propDef then
+            left = self:prop_value_to_sql(propDef, astToken[2])
+            right = left and self:prop_to_sql(propDef)
+        end
+    end
+
+    if not left or not right then
+        local leftKind, rightKind
+        left, leftKind = self:expr_to_sql(astToken[2])
+        right, rightKind = self:expr_to_sql(astToken[3])
+        if not left or not right or leftKind ~= 'value' or rightKind ~= 'value' then
+            return nil
+        end
+    end
+
+    return string.format('(%s %s %s)', left, op, right), 'bool'
+end
+
+---@param astToken ASTToken
+---@return string | nil, string | nil
+function FilterDef:op_to_sql(astToken)
+    local op = astToken[1]
+
+    if op == 'and' or op == 'or' then
+        local left, leftKind = self:expr_to_sql(astToken[2])
+        local right, rightKind = self:expr_to_sql(astToken[3])
+        if left and right and leftKind == 'bool' and rightKind == 'bool' then
+            return string.format('(%s %s %s)', left, op, right), 'bool'
+        end
+    elseif op == 'not' then
+        local operand, kind = self:expr_to_sql(astToken[2])
+        if operand and kind == 'bool' then
+            return string.format('(not %s)', operand), 'bool'
+        end
+    elseif sqlComparisonOps[op] then
+        return self:comparison_to_sql(astToken)
+    else
+        local left, leftKind = self:expr_to_sql(astToken[2])
+        if not left or leftKind ~= 'value' then
+            return nil
+        end
+
+        if op == 'unm' then
+            return string.format('(- %s)', left), 'value'
+        elseif op == 'len' then
+            -- Lua strings are byte arrays
+            return string.format('length(cast(%s as blob))', left), 'value'
+        end
+
+        local right, rightKind = self:expr_to_sql(astToken[3])
+        if not right or rightKind ~= 'value' then
+            return nil
+        end
+
+        if sqlArithmeticOps[op] then
+            return string.format('(%s %s %s)', left, sqlArithmeticOps[op], right), 'value'
+        elseif op == 'div' then
+            -- Division in Lua is always floating point
+            return string.format('(%s * 1.0 / %s)', left, right), 'value'
+        end
+
+        -- mod (floored in Lua, truncated in SQL) and pow are left to Lua
+    end
+
+    return nil
+end
+
+-- Translates string function called either as string.func(s, ...) or s:func(...)
+---@param funcName string
+---@param args ASTToken[] @comment first item is string argument
+---@return string | nil, string | nil
+function FilterDef:string_func_to_sql(funcName, args)
+    local s, kind = self:expr_to_sql(args[1] or {})
+    if not s or kind ~= 'value' then
+        return nil
+    end
+
+    if (funcName == 'lower' or funcName == 'upper') and #args == 1 then
+        return string.format('%s(%s)', funcName, s), 'value'
+    elseif funcName == 'len' and #args == 1 then
+        return string.format('length(cast(%s as blob))', s), 'value'
+    elseif funcName == 'sub' and (#args == 2 or #args == 3) then
+        -- Only positive literal positions have the same meaning in Lua and SQL
+        local i = skip_parens(args[2])
+        local j = args[3] and skip_parens(args[3])
+        if i.tag ~= 'Number' or i[1] < 1 or i[1] % 1 ~= 0
+                or (j and (j.tag ~= 'Number' or j[1] < i[1] or j[1] % 1 ~= 0)) then
+            return nil
+        end
+
+        if j then
+            return string.format('cast(substr(cast(%s as blob), %d, %d) as text)', s, i[1], j[1] - i[1] + 1), 'value'
+        end
+        return string.format('cast(substr(cast(%s as blob), %d) as text)', s, i[1]), 'value'
+    end
+
+    return nil
+end
+
+---@param astToken ASTToken
+---@return string | nil, string | nil
+function FilterDef:call_to_sql(astToken)
+    local func = skip_parens(astToken[1])
+
+    -- MATCH(prop, value) on property with full text index
+    if func.tag == 'Id' and func[1] == 'MATCH' and #astToken == 3 then
+        local propDef = self:is_property_name(astToken[2])
+        local indexes = self.ClassDef.indexes
+        if not propDef or not indexes then
+            return nil
+        end
+
+        local ftsCol = indexes:IndexArrayToMap(indexes.fullTextIndexing)[propDef.ID]
+        local v = ftsCol and self:prop_value_to_sql(propDef, astToken[3])
+        if v then
+            return string.format([[([.objects].ObjectID in (select docid from [.full_text_data]
+            where ClassID = %d and X%d match %s))]], self.ClassDef.ClassID, ftsCol, v), 'bool'
+        end
+        return nil
+    end
+
+    -- string.func(s, ...)
+    if func.tag == 'Index' and func[1].tag == 'Id' and func[1][1] == 'string' and func[2].tag == 'String' then
+        return self:string_func_to_sql(func[2][1], { select(2, unpack(astToken)) })
+    end
+
+    return nil
+end
+
+---@param astToken ASTToken
+---@return string | nil, string | nil
+function FilterDef:expr_to_sql(astToken)
+    astToken = skip_parens(astToken)
+    local tag = astToken.tag
+
+    if tag == 'Number' or tag == 'String' then
+        return self:literal_to_sql(astToken[1]), 'value'
+    elseif tag == 'Nil' then
+        return 'null', 'value'
+    elseif tag == 'True' then
+        return '1', 'bool'
+    elseif tag == 'False' then
+        return '0', 'bool'
+    elseif tag == 'Id' then
+        local propDef = self:is_property_name(astToken)
+        if propDef then
+            return self:prop_to_sql(propDef), 'value'
+        end
+    elseif tag == 'Index' then
+        -- params.Name
+        if astToken[1].tag == 'Id' and astToken[1][1] == 'params' and astToken[2].tag == 'String' then
+            local v = self.params and self.params[astToken[2][1]]
+            if v == nil then
+                return 'null', 'value'
+            end
+            return self:literal_to_sql(v), 'value'
+        end
+    elseif tag == 'Op' then
+        return self:op_to_sql(astToken)
+    elseif tag == 'Call' then
+        return self:call_to_sql(astToken)
+    elseif tag == 'Invoke' then
+        -- s:func(...)
+        if astToken[2].tag == 'String' then
+            local args = { astToken[1], select(3, unpack(astToken)) }
+            return self:string_func_to_sql(astToken[2][1], args)
+        end
+    end
+
+    return nil
+end
+
+--[[ Translates filter expression to SQL condition on [.objects].
+Top level 'and' operands are translated individually, so that translatable ones are still applied in SQL.
+Sets self.compiledFully to true if entire expression was translated and Lua sandbox is not needed
+]]
+---@return string | nil
+function FilterDef:compile_to_sql()
+    local conditions = List()
+    self.compiledFully = true
+
+    for _, astToken in ipairs(split_conjuncts(self.ast[1][1], {})) do
+        local sql, kind = self:expr_to_sql(astToken)
+        if sql and kind == 'bool' then
+            conditions:append(sql)
+        else
+            self.compiledFully = false
+        end
+    end
+
+    if #conditions == 0 then
+        return nil
+    end
+    return conditions:join(' and ')
+end
+
 function FilterDef:build_index_query()
     self.matchCallCount = 0
     self.callCount = 0
+    self.sqlParams = {}
+    self.sqlParamCount = 0
 
     -- Skip external wrapper and 'Return' tag - they will be always there
     self:process_token(self.ast[1][1])
@@ -542,12 +934,12 @@ function FilterDef:build_index_query()
     -- 4) single property search - indexed or not
     self:process_single_properties(result)
 
-    -- 5. For all 'indexable' tokens (i.e. those which meet criteria to search by index)
-    -- and are column-mapped generate SQL 'where' clause to apply to .objects fields directly
-    -- TODO
-
-    print('-> SQL:' .. result:join(' ') .. '\n')
-    --print('-> SQL:' .. result:join('\n'))
+    -- 5) Filter expression translated to SQL. Index conditions above narrow down search,
+    -- this one is exact
+    local compiled = self:compile_to_sql()
+    if compiled then
+        result:append(string.format(' and (%s)', compiled))
+    end
 
     return result:join('\n')
 end
@@ -604,7 +996,16 @@ function DBQuery:Run()
     self.ObjectIDs = {}
 
     local sql = self._filterDef:build_index_query()
-    --local rows =
+    local DBContext = self._filterDef.ClassDef.DBContext
+
+    -- Entire filter is evaluated by SQLite: no need to load objects
+    if self._filterDef.compiledFully then
+        for objRow in DBContext:LoadAdhocRows(sql, self._filterDef.sqlParams) do
+            table.insert(self.ObjectIDs, objRow.ObjectID)
+        end
+
+        return #self.ObjectIDs > 0
+    end
 
     -- TODO set env.quote?
 
@@ -613,9 +1014,22 @@ function DBQuery:Run()
         -- TODO error (err)
     end
 
+    -- Use native object loader if available: single view is reused for all found objects
+    if NativeObjectView.isAvailable() then
+        local view = NativeObjectView(DBContext, self._filterDef.ClassDef)
+        local sandbox_options = { env = view.env }
+        for objRow in DBContext:LoadAdhocRows(sql, self._filterDef.sqlParams) do
+            if view:load(objRow.ObjectID) and Sandbox.run(filterCallback, sandbox_options) then
+                table.insert(self.ObjectIDs, objRow.ObjectID)
+            end
+        end
+
+        return #self.ObjectIDs > 0
+    end
+
     -- objRow is [.objects]
-    for objRow in self._filterDef.ClassDef.DBContext:LoadAdhocRows(sql, self._filterDef.params) do
-        local dbobj = self._filterDef.ClassDef.DBContext:LoadObject(objRow.ObjectID, nil, false, objRow)
+    for objRow in DBContext:LoadAdhocRows(sql, self._filterDef.sqlParams) do
+        local dbobj = DBContext:LoadObject(objRow.ObjectID, nil, false, objRow)
         assert(dbobj)
         local boxed = dbobj:GetSandBoxed(Constants.DBOBJECT_SANDBOX_MODE.FILTER)
 
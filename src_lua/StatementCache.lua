@@ -0,0 +1,216 @@
+---
+--- Created by slanska.
+--- DateTime: 2026-10-17
+---
+
+--[[
+Size bounded cache of prepared statements, keyed by SQL text.
+Statements are kept in doubly linked list, ordered from most to least recently used.
+When cache is full, least recently used statement gets finalized.
+
+Native code has its own cache with the same policy and counters (see src/flexi/flexi_stmt_cache.h):
+lsqlite3 cannot wrap statements prepared by C code, so the two caches cannot share entries.
+
+lsqlite3 does not expose sqlite3_stmt_busy, so statements which are being iterated are tracked by
+cache itself (see StatementCache:nrows). Busy statement is not evicted, and is not returned by get,
+as resetting it would break iteration in progress (e.g. nested DBContext:LoadAdhocRows with the same SQL).
+Instead, separate statement is prepared, which is finalized by StatementCache:reset
+]]
+
+local class = require 'pl.class'
+
+-- Default max number of prepared statements. Matches FLEXI_STMT_CACHE_SIZE
+local DEFAULT_CAPACITY = 64
+
+---@class StatementCacheEntry
+---@field sql string
+---@field stmt sqlite3_stmt
+---@field busy boolean @comment true while statement rows are being iterated
+---@field prev StatementCacheEntry @comment more recently used
+---@field next StatementCacheEntry @comment less recently used
+
+---@class StatementCache
+---@field capacity number
+---@field count number
+---@field entries table<string, StatementCacheEntry>
+---@field byStmt table<sqlite3_stmt, StatementCacheEntry>
+---@field uncached sqlite3_stmt[] @comment statements prepared while cached one was busy
+---@field mru StatementCacheEntry
+---@field lru StatementCacheEntry
+---@field hits number
+---@field misses number
+---@field evictions number
+local StatementCache = class()
+
+---@param capacity number | nil
+function StatementCache:_init(capacity)
+    self.capacity = capacity or DEFAULT_CAPACITY
+    self.entries = {}
+    self.byStmt = {}
+    self.uncached = {}
+    self.count = 0
+    self.mru = nil
+    self.lru = nil
+    self.hits = 0
+    self.misses = 0
+    self.evictions = 0
+end
+
+---@param entry StatementCacheEntry
+function StatementCache:unlink(entry)
+    if entry.prev then
+        entry.prev.next = entry.next
+    else
+        self.mru = entry.next
+    end
+
+    if entry.next then
+        entry.next.prev = entry.prev
+    else
+        self.lru = entry.prev
+    end
+
+    entry.prev, entry.next = nil, nil
+end
+
+---@param entry StatementCacheEntry
+function StatementCache:linkAsMru(entry)
+    entry.prev = nil
+    entry.next = self.mru
+    if self.mru then
+        self.mru.prev = entry
+    end
+    self.mru = entry
+    if not self.lru then
+        self.lru = entry
+    end
+end
+
+-- Finalizes least recently used statements until cache fits its capacity.
+-- Most recently used statement (which is about to be returned) and busy statements are never evicted,
+-- so cache may temporarily exceed its capacity
+function StatementCache:evict()
+    local entry = self.lru
+    while self.count > self.capacity and entry and entry ~= self.mru do
+        local prev = entry.prev
+        if not entry.busy then
+            self:unlink(entry)
+            self.entries[entry.sql] = nil
+            self.byStmt[entry.stmt] = nil
+            self.count = self.count - 1
+            self.evictions = self.evictions + 1
+            entry.stmt:finalize()
+        end
+        entry = prev
+    end
+end
+
+--- Returns prepared statement for sql. Cached statement gets reset.
+--- Returns nil if statement cannot be prepared (error is available via db:errmsg())
+---@param db sqlite3
+---@param sql string
+---@return sqlite3_stmt
+function StatementCache:get(db, sql)
+    local entry = self.entries[sql]
+    if entry and entry.busy then
+        self.misses = self.misses + 1
+        local stmt = db:prepare(sql)
+        if stmt then
+            table.insert(self.uncached, stmt)
+        end
+        return stmt
+    end
+
+    if entry then
+        self.hits = self.hits + 1
+        entry.stmt:reset()
+        if entry ~= self.mru then
+            self:unlink(entry)
+            self:linkAsMru(entry)
+        end
+        return entry.stmt
+    end
+
+    self.misses = self.misses + 1
+    local stmt = db:prepare(sql)
+    if not stmt then
+        return nil
+    end
+
+    entry = { sql = sql, stmt = stmt, busy = false }
+    self.entries[sql] = entry
+    self.byStmt[stmt] = entry
+    self.count = self.count + 1
+    self:linkAsMru(entry)
+    self:evict()
+
+    return stmt
+end
+
+--- Returns iterator over rows of statement, as stmt:nrows() does.
+--- Statement returned by get is marked as busy until all rows are read
+---@param stmt sqlite3_stmt
+---@return function
+function StatementCache:nrows(stmt)
+    local iter, vm = stmt:nrows()
+    local entry = self.byStmt[stmt]
+    if not entry then
+        return iter, vm
+    end
+
+    entry.busy = true
+    return function()
+        local row = iter(vm)
+        if row == nil then
+            entry.busy = false
+        end
+        return row
+    end
+end
+
+function StatementCache:finalizeUncached()
+    for _, stmt in ipairs(self.uncached) do
+        stmt:finalize()
+    end
+    self.uncached = {}
+end
+
+-- Resets all cached statements, including those with iteration not finished. Statements stay in cache.
+-- Statements prepared while cached one was busy get finalized
+function StatementCache:reset()
+    local entry = self.mru
+    while entry do
+        entry.stmt:reset()
+        entry.busy = false
+        entry = entry.next
+    end
+    self:finalizeUncached()
+end
+
+-- Finalizes all cached statements. Counters are kept
+function StatementCache:clear()
+    local entry = self.mru
+    while entry do
+        entry.stmt:finalize()
+        entry = entry.next
+    end
+    self:finalizeUncached()
+    self.entries = {}
+    self.byStmt = {}
+    self.count = 0
+    self.mru = nil
+    self.lru = nil
+end
+
+---@return table @comment {size, capacity, hits, misses, evictions}
+function StatementCache:stats()
+    return {
+        size = self.count,
+        capacity = self.capacity,
+        hits = self.hits,
+        misses = self.misses,
+        evictions = self.evictions
+    }
+end
+
+return StatementCache
@@ -38,8 +38,11 @@ return {
     'src_lua/Triggers.lua',
     'src_lua/flexi_ConvertCustomEAV.lua',
     'src_lua/flexi_DataUpdate.lua',
+    'src_lua/flexi_Analyze.lua',
+    'src_lua/BulkLoader.lua',
     'src_lua/flexi_PropToObject.lua',
     'src_lua/DBObject.lua',
+    'src_lua/NativeObjectView.lua',
     'src_lua/Constants.lua',
     'src_lua/AccessControl.lua',
     'src_lua/Util.lua',
@@ -48,6 +51,8 @@ return {
     'src_lua/ApiGlobalScope.lua',
     'src_lua/DBProperty.lua',
     'src_lua/ColMapping.lua',
+    'src_lua/StatementCache.lua',
+    'src_lua/ObjectCache.lua',
 
     -- lib
     'lib/lua-prettycjson/lib/resty/prettycjson.lua',
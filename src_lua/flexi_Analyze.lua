@@ -0,0 +1,214 @@
+---
+--- Created by slanska.
+--- DateTime: 2026-10-17
+---
+
+--[[
+flexi('analyze' [, className [, options]])
+
+Collects statistics of class objects and property values ([.class_stats], [.prop_stats] and
+[.class_props].NonNullCount), used for query planning by flexi_data virtual table and FilterDef.
+If className is not set, all classes are analyzed.
+
+Every class is processed in one pass: properties mapped to [.objects] columns (A - P) by single aggregate
+query on [.objects], other properties by single aggregate query on [.ref-values], grouped by property.
+For every property value_stats collects number of values, HyperLogLog sketch to estimate number of distinct values,
+min, max and equi-depth histogram.
+
+options (JSON object, all settings are optional):
+sample - fraction of objects to analyze (0 < sample <= 1, default 1). Objects are sampled by blocks of
+SAMPLE_BLOCK consecutive object IDs, so that [.objects] rows and [.ref-values] are read only for sampled objects.
+Counts are extrapolated to entire class.
+maxRows - max number of objects to process by one call (default 0 - no limit). With maxRows set, analyze runs
+incrementally: every call continues from the object where previous call stopped and merges collected statistics
+with statistics of previous calls (value_stats_merge), until all class objects are processed. Next call starts
+new pass. Until pass is completed, statistics is extrapolated from processed objects.
+buckets - number of histogram buckets (default 16).
+restart - if true, uncompleted pass is discarded and new pass is started.
+
+Sample rate and number of buckets of uncompleted pass do not change until pass is completed.
+
+Returns JSON with summary per class:
+{"<class>": {"objects": <estimated number of objects>, "processed": <objects in processed range of the current pass>,
+"sampled": <analyzed objects of the current pass>, "completed": <true if pass is completed>}}
+]]
+
+local json = require 'cjson'
+local List = require 'pl.list'
+local Constants = require 'Constants'
+
+local SAMPLE_BLOCK = 64
+local DEFAULT_BUCKETS = 16
+
+-- Returns SQL condition to select sampled objects
+---@param sampleRate number
+---@return string
+local function sample_condition(sampleRate)
+    if sampleRate >= 1 then
+        return ''
+    end
+    return string.format(' and (ObjectID / %d) %% %d = 0', SAMPLE_BLOCK, math.floor(1 / sampleRate + 0.5))
+end
+
+---@param options string | nil
+---@return table
+local function parse_options(options)
+    local opts = options and json.decode(options) or {}
+    local result = {
+        sample = tonumber(opts.sample) or 1,
+        maxRows = math.floor(tonumber(opts.maxRows) or 0),
+        buckets = math.floor(tonumber(opts.buckets) or DEFAULT_BUCKETS),
+        restart = opts.restart == true,
+    }
+    if result.sample <= 0 or result.sample > 1 then
+        error(string.format('analyze: sample must be in (0, 1] range, got %s', tostring(opts.sample)))
+    end
+    if result.buckets < 1 then
+        error(string.format('analyze: invalid number of buckets %s', tostring(opts.buckets)))
+    end
+    return result
+end
+
+---@param self DBContext
+---@param classDef ClassDef
+---@param options table
+---@return table
+local function analyze_class(self, classDef, options)
+    local classID = classDef.ClassID
+    local state = self:loadOneRow([[select * from [.class_stats] where ClassID = :ClassID;]], { ClassID = classID })
+
+    -- Continue uncompleted pass with its settings, or start new one
+    if not state or state.ScanPos == 0 or options.restart then
+        state = { ObjectCount = state and state.ObjectCount or 0, ScanPos = 0, PassObjects = 0, PassSampled = 0,
+                  SampleRate = options.sample, Buckets = options.buckets }
+        self:execStatement([[delete from [.prop_stats] where ClassID = :ClassID;]], { ClassID = classID })
+    end
+
+    local first = self:loadOneRow([[select ObjectID from [.objects] where ClassID = :ClassID
+        order by ObjectID limit 1;]], { ClassID = classID })
+    local last = self:loadOneRow([[select ObjectID from [.objects] where ClassID = :ClassID
+        order by ObjectID desc limit 1;]], { ClassID = classID })
+    local minID = first and first.ObjectID or 0
+    local maxID = last and last.ObjectID or 0
+
+    -- Range of object IDs to process by this call
+    local params = { ClassID = classID, FromID = state.ScanPos, ToID = maxID, Buckets = state.Buckets,
+                     Deleted = Constants.CTLV_FLAGS.DELETED }
+    if options.maxRows > 0 then
+        local row = self:loadOneRow([[select ObjectID from [.objects] where ClassID = :ClassID and ObjectID > :FromID
+            order by ObjectID limit 1 offset :Offset;]],
+                { ClassID = classID, FromID = params.FromID, Offset = options.maxRows - 1 })
+        if row then
+            params.ToID = row.ObjectID
+        end
+    end
+    local completed = params.ToID >= maxID
+
+    local range = 'ClassID = :ClassID and ObjectID > :FromID and ObjectID <= :ToID'
+    local sampled = range .. sample_condition(state.SampleRate)
+
+    local propsByID = {}
+    local cols = List()
+    for _, propDef in pairs(classDef.Properties) do
+        propsByID[propDef.ID] = propDef
+        if propDef.ColMap then
+            cols:append(string.format('value_stats([%s], :Buckets) as [%s]', propDef.ColMap, propDef.ColMap))
+        end
+    end
+
+    local rangeCount = self:loadOneRow(string.format('select count(*) as Cnt from [.objects] where %s;', range),
+            params).Cnt
+
+    -- Mapped properties
+    local statsByPropID = {}
+    local objRow = self:loadOneRow(string.format('select count(*) as Cnt%s from [.objects] where %s;',
+            #cols > 0 and ', ' .. cols:join(', ') or '', sampled), params)
+    for propID, propDef in pairs(propsByID) do
+        if propDef.ColMap then
+            statsByPropID[propID] = objRow[propDef.ColMap]
+        end
+    end
+
+    -- Properties stored in [.ref-values]
+    for row in self:loadRows(string.format([[select PropertyID, value_stats(Value, :Buckets) as Stats
+        from [.ref-values] where ObjectID in (select ObjectID from [.objects] where %s) and (ctlv & :Deleted) = 0
+        group by PropertyID;]], sampled), params) do
+        local propDef = propsByID[row.PropertyID]
+        if propDef and not propDef.ColMap then
+            statsByPropID[row.PropertyID] = row.Stats
+        end
+    end
+
+    for propID, stats in pairs(statsByPropID) do
+        self:execStatement([[insert or replace into [.prop_stats] (PropertyID, ClassID, Stats)
+            values (:PropertyID, :ClassID,
+            value_stats_merge((select Stats from [.prop_stats] where PropertyID = :PropertyID), :Stats));]],
+                { PropertyID = propID, ClassID = classID, Stats = stats })
+    end
+
+    state.PassObjects = state.PassObjects + rangeCount
+    state.PassSampled = state.PassSampled + objRow.Cnt
+    state.ScanPos = completed and 0 or params.ToID
+
+    -- Uncompleted pass: number of objects is extrapolated by covered range of object IDs
+    if completed then
+        state.ObjectCount = state.PassObjects
+    elseif params.ToID >= minID then
+        state.ObjectCount = math.floor(state.PassObjects * (maxID - minID + 1) / (params.ToID - minID + 1) + 0.5)
+    end
+
+    --[[ Publish estimations for entire class. Sampled values which look unique (number of distinct values
+    is close to number of values) are assumed to be unique in entire class. Otherwise, sample is assumed to have
+    all distinct values ]]
+    local scale = state.PassSampled > 0 and state.ObjectCount / state.PassSampled or 0
+    self:execStatement([[update [.prop_stats] set
+        NonNullCount = cast(json_extract(Stats, '$.count') * :Scale + 0.5 as integer),
+        DistinctCount = case when :Scale > 1 and json_extract(Stats, '$.distinct') >= 0.9 * json_extract(Stats, '$.count')
+            then cast(json_extract(Stats, '$.distinct') * :Scale + 0.5 as integer)
+            else json_extract(Stats, '$.distinct') end,
+        MinValue = json_extract(Stats, '$.min'),
+        MaxValue = json_extract(Stats, '$.max'),
+        Histogram = json_extract(Stats, '$.histogram')
+        where ClassID = :ClassID;]], { ClassID = classID, Scale = scale })
+
+    self:execStatement([[update [.class_props] set NonNullCount =
+        coalesce((select ps.NonNullCount from [.prop_stats] ps where ps.PropertyID = [.class_props].ID), 0)
+        where ClassID = :ClassID;]], { ClassID = classID })
+
+    self:execStatement([[insert or replace into [.class_stats]
+        (ClassID, ObjectCount, ScanPos, PassObjects, PassSampled, SampleRate, Buckets, AnalyzedAt)
+        values (:ClassID, :ObjectCount, :ScanPos, :PassObjects, :PassSampled, :SampleRate, :Buckets, julianday('now'));]],
+            { ClassID = classID, ObjectCount = state.ObjectCount, ScanPos = state.ScanPos,
+              PassObjects = state.PassObjects, PassSampled = state.PassSampled, SampleRate = state.SampleRate,
+              Buckets = state.Buckets })
+
+    return { objects = state.ObjectCount, processed = state.PassObjects, sampled = state.PassSampled,
+             completed = completed }
+end
+
+---@param self DBContext
+---@param className string | nil
+---@param options string | nil @comment JSON
+---@return string
+local function flexi_Analyze(self, className, options)
+    local opts = parse_options(options)
+
+    local classIDs = {}
+    if className then
+        table.insert(classIDs, self:getClassDef(className, true).ClassID)
+    else
+        for row in self:loadRows([[select ClassID from [.classes] where Deleted = 0;]], {}) do
+            table.insert(classIDs, row.ClassID)
+        end
+    end
+
+    local result = {}
+    for _, classID in ipairs(classIDs) do
+        local classDef = self:getClassDef(classID, true)
+        result[classDef.Name.text] = analyze_class(self, classDef, opts)
+    end
+
+    return json.encode(result)
+end
+
+return flexi_Analyze
@@ -13,10 +13,11 @@ Fires custom triggers BEFORE and AFTER save.
 Uses DBObject and DBCell Api for data manipulation.
 ]]
 
-local json = require('cjson')
+local JsonTape = require('flexi_JsonTape')
 local class = require 'pl.class'
 local QueryBuilder = require('QueryBuilder').QueryBuilder
 local Constants = require 'Constants'
+local BulkLoader = require 'BulkLoader'
 
 --[[
 Internal helper class to save objects to DB
@@ -110,7 +111,7 @@ Implementation of flexi_data virtual table xUpdate API: insert, update, delete
 ---@param queryJSON string
 --- filter to apply - optional, for update and delete
 local function flexi_DataUpdate(self, className, oldRowID, newRowID, dataJSON, queryJSON)
-    local data = json.decode(dataJSON)
+    local data = JsonTape.decode(dataJSON)
 
     if type(data) ~= 'table' then
         error('Invalid data type')
@@ -130,9 +131,9 @@ local function flexi_DataUpdate(self, className, oldRowID, newRowID, dataJSON, q
                 error('Incompatible arguments: oldRowID and newRowID must be null for array mode')
             end
 
-            for i, row in ipairs(data) do
-                saveHelper:saveObject(className, row, nil, nil)
-            end
+            local loader = BulkLoader(self)
+            loader:add(className, data)
+            loader:run()
         else
             -- xUpdate mode: single object with row IDs
             saveHelper:saveObject(className, data, oldRowID, newRowID)
@@ -156,18 +157,18 @@ local function flexi_DataUpdate(self, className, oldRowID, newRowID, dataJSON, q
             oldObj:loadFromDB()
             saveHelper:saveObject(oldObj.ClassDef.Name.text, data, oldRowID, nil)
         else
+            local loader = BulkLoader(self)
             for clsName, dd in pairs(data) do
                 if #dd > 0 then
-                    for i, row in ipairs(dd) do
-                        saveHelper:saveObject(clsName, nil, nil, row)
-                    end
+                    loader:add(clsName, dd)
                 else
                     -- TODO Load objects based on query
-                    local query = json.decode(queryJSON)
+                    local query = JsonTape.decode(queryJSON)
 
                     saveHelper:saveObject(self, clsName, dd, nil, nil)
                 end
             end
+            loader:run()
         end
     end
 
@@ -78,4 +78,62 @@ function Flexi:closeDBContext(contextID)
     ctx:close()
 end
 
+--[[
+Binds Lua state to sqlite connection. Called by native code (src/flexi/flexi_lua_pool.cpp) when
+connection checks out Lua state from process wide pool.
+Lua state serves one connection at a time, so it needs single DBContext, which is created on
+the first attach and then re-attached to every next connection.
+dbPtr is native sqlite3 handle (light userdata)
+]]
+function Flexi:attachConnection(dbPtr)
+    -- lsqlite3 is linked into Flexilite library
+    local db = require('lsqlite3').open_ptr(dbPtr)
+    local ctx = self.PooledContext
+    if ctx then
+        ctx:attach(db)
+    else
+        ctx = DBContext(db)
+        self.PooledContext = ctx
+    end
+    ctx.Vars = {}
+    self.Contexts[dbPtr] = ctx
+end
+
+--[[ Called by native code when connection gets closed and Lua state is returned to pool ]]
+function Flexi:detachConnection(dbPtr)
+    local ctx = self.Contexts[dbPtr]
+    if ctx then
+        ctx:detach()
+        ctx.Vars = {}
+        self.Contexts[dbPtr] = nil
+    end
+end
+
+--[[
+Entry point for native 'flexi' function. Returns result and error message (nil if there was no error).
+Prepared statements are kept for next calls. They are reset after every call, so that statement
+which was not stepped to the end does not hold read transaction, and get finalized in Flexi:detachConnection
+(called by native code when connection is being closed)
+]]
+function Flexi:invoke(dbPtr, action, ...)
+    local ctx = self.Contexts[dbPtr]
+    if not ctx then
+        error('Database connection is not attached to Flexilite')
+    end
+
+    local errorMsg
+    local sqlCtx = {
+        result_error = function(_, msg)
+            errorMsg = msg
+        end
+    }
+    local ok, result = pcall(DBContext.flexiAction, ctx, sqlCtx, action, ...)
+    ctx:resetStatements()
+    if not ok then
+        return nil, tostring(result)
+    end
+
+    return result, errorMsg
+end
+
 
@@ -0,0 +1,169 @@
+/*
+ * Correctness test of FlatHash and microbenchmark of FlatHash vs Hash (hash.c)
+ * on typical metadata workloads: lookups of property definitions by name (case sensitive and
+ * case insensitive) and by ID, for tables of different size.
+ * Note that Hash hashes keys of case insensitive tables as is, so lookups with different case
+ * work only for small tables, which do not have buckets yet. Benchmark uses keys in original case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <sqlite3.h>
+#include <FlatHash.h>
+
+#define MAX_KEYS 100000
+#define LOOKUPS 4000000
+
+static char *aKeys[MAX_KEYS];
+static char *aUpperKeys[MAX_KEYS];
+
+static void
+dummy_free(void *p)
+{
+	(void) p;
+}
+
+static double
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+init_keys()
+{
+	for (int i = 0; i < MAX_KEYS; i++)
+	{
+		aKeys[i] = sqlite3_mprintf("property_%d_name", i);
+		aUpperKeys[i] = sqlite3_mprintf("PROPERTY_%d_NAME", i);
+	}
+}
+
+static DictionaryKey_t
+key_of(DICTIONARY_TYPE eType, int i, bool bUpper)
+{
+	DictionaryKey_t key;
+	if (eType == DICT_INT)
+		key.iKey = (sqlite3_int64) i * 7919 + 1;
+	else
+		key.pKey = bUpper ? aUpperKeys[i] : aKeys[i];
+	return key;
+}
+
+/*
+ * Random sets and deletes, checked against plain array
+ */
+static void
+check_correctness(DICTIONARY_TYPE eType)
+{
+	static void *aExpected[MAX_KEYS];
+	const int nKeys = 5000;
+	FlatHash h;
+
+	memset(aExpected, 0, sizeof(aExpected));
+	FlatHash_init(&h, eType, dummy_free);
+	srand(42);
+	u32 nCount = 0;
+	for (int n = 0; n < 200000; n++)
+	{
+		int i = rand() % nKeys;
+		void *pData = (rand() % 3 == 0) ? NULL : (void *) (intptr_t) (n + 1);
+		FlatHash_set(&h, key_of(eType, i, false), pData);
+		if (aExpected[i] == NULL && pData != NULL)
+			nCount++;
+		else if (aExpected[i] != NULL && pData == NULL)
+			nCount--;
+		aExpected[i] = pData;
+		assert(h.count == nCount);
+	}
+
+	bool bIgnoreCase = eType == DICT_STRING_IGNORE_CASE_NO_FREE;
+	for (int i = 0; i < nKeys; i++)
+	{
+		assert(FlatHash_get(&h, key_of(eType, i, false)) == aExpected[i]);
+		if (bIgnoreCase)
+			assert(FlatHash_get(&h, key_of(eType, i, true)) == aExpected[i]);
+	}
+	if (eType == DICT_STRING_NO_FREE)
+		assert(FlatHash_get(&h, key_of(eType, 0, true)) == NULL);
+
+	FlatHash_clear(&h);
+	assert(h.count == 0);
+}
+
+static void
+bench(const char *zTitle, DICTIONARY_TYPE eType, int nKeys)
+{
+	Hash h1;
+	FlatHash h2;
+	int *aOrder = malloc(sizeof(int) * LOOKUPS);
+	uintptr_t nSum1 = 0, nSum2 = 0;
+
+	srand(7);
+	for (int i = 0; i < LOOKUPS; i++)
+		aOrder[i] = rand() % nKeys;
+
+	HashTable_init(&h1, eType, dummy_free);
+	FlatHash_init(&h2, eType, dummy_free);
+
+	double t0 = now_ns();
+	for (int i = 0; i < nKeys; i++)
+		HashTable_set(&h1, key_of(eType, i, false), (void *) (intptr_t) (i + 1));
+	double t1 = now_ns();
+	for (int i = 0; i < nKeys; i++)
+		FlatHash_set(&h2, key_of(eType, i, false), (void *) (intptr_t) (i + 1));
+	double t2 = now_ns();
+
+	for (int i = 0; i < LOOKUPS; i++)
+		nSum1 += (uintptr_t) HashTable_get(&h1, key_of(eType, aOrder[i], false));
+	double t3 = now_ns();
+	for (int i = 0; i < LOOKUPS; i++)
+		nSum2 += (uintptr_t) FlatHash_get(&h2, key_of(eType, aOrder[i], false));
+	double t4 = now_ns();
+
+	assert(nSum1 == nSum2);
+
+	printf("%-28s %7d keys | insert ns/op: Hash %7.1f, FlatHash %7.1f | lookup ns/op: Hash %7.1f, FlatHash %7.1f\n",
+	       zTitle, nKeys, (t1 - t0) / nKeys, (t2 - t1) / nKeys, (t3 - t2) / LOOKUPS, (t4 - t3) / LOOKUPS);
+
+	HashTable_clear(&h1);
+	FlatHash_clear(&h2);
+	free(aOrder);
+}
+
+/*
+ * Runs correctness tests only. Benchmark is run when '--bench' argument is passed
+ */
+int main(int argc, char **argv)
+{
+	init_keys();
+
+	check_correctness(DICT_INT);
+	check_correctness(DICT_STRING_NO_FREE);
+	check_correctness(DICT_STRING_IGNORE_CASE_NO_FREE);
+	printf("FlatHash tests passed\n");
+
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+	{
+		int aSizes[] = {8, 64, 1000, MAX_KEYS};
+		for (int i = 0; i < (int) (sizeof(aSizes) / sizeof(aSizes[0])); i++)
+		{
+			bench("by name", DICT_STRING_NO_FREE, aSizes[i]);
+			bench("by name, case insensitive", DICT_STRING_IGNORE_CASE_NO_FREE, aSizes[i]);
+			bench("by ID", DICT_INT, aSizes[i]);
+		}
+	}
+
+	for (int i = 0; i < MAX_KEYS; i++)
+	{
+		sqlite3_free(aKeys[i]);
+		sqlite3_free(aUpperKeys[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * Tests flexi_ChangeLog driven by SQLite transactions: changes are written to [.change_log] on COMMIT,
+ * dropped on ROLLBACK and partially dropped on ROLLBACK TO, also when several tables share the log and join
+ * transaction at different moments, and when ring overflows in the middle of transaction.
+ * Test virtual table forwards transaction methods to the log the same way as flexi_data does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sqlite3.h>
+#include "../../src/flexi/flexi_change_log.h"
+
+static sqlite3 *db;
+
+static flexi_ChangeLog_t changeLog;
+
+static sqlite3_int64 lLastObjectID = 0;
+
+typedef struct TestVTab_t
+{
+	sqlite3_vtab base;
+	sqlite3_int64 lClassID;
+} TestVTab_t;
+
+static int
+_connect(sqlite3 *pDb, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVTab, char **pzErr)
+{
+	TestVTab_t *pVTab = sqlite3_malloc(sizeof(TestVTab_t));
+	if (pVTab == NULL)
+		return SQLITE_NOMEM;
+	memset(pVTab, 0, sizeof(*pVTab));
+	pVTab->lClassID = strcmp(argv[2], "a") == 0 ? 1 : 2;
+	*ppVTab = &pVTab->base;
+	return sqlite3_declare_vtab(pDb, "create table x(v)");
+}
+
+static int
+_disconnect(sqlite3_vtab *pVTab)
+{
+	sqlite3_free(pVTab);
+	return SQLITE_OK;
+}
+
+static int
+_bestIndex(sqlite3_vtab *pVTab, sqlite3_index_info *pInfo)
+{
+	pInfo->estimatedCost = 1;
+	return SQLITE_OK;
+}
+
+/*
+ * Table has no rows, only writes are of interest
+ */
+static int
+_open(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor)
+{
+	*ppCursor = sqlite3_malloc(sizeof(sqlite3_vtab_cursor));
+	return *ppCursor == NULL ? SQLITE_NOMEM : SQLITE_OK;
+}
+
+static int
+_close(sqlite3_vtab_cursor *pCursor)
+{
+	sqlite3_free(pCursor);
+	return SQLITE_OK;
+}
+
+static int
+_filter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv)
+{
+	return SQLITE_OK;
+}
+
+static int
+_next(sqlite3_vtab_cursor *pCursor)
+{
+	return SQLITE_OK;
+}
+
+static int
+_eof(sqlite3_vtab_cursor *pCursor)
+{
+	return 1;
+}
+
+static int
+_column(sqlite3_vtab_cursor *pCursor, sqlite3_context *pCtx, int iCol)
+{
+	return SQLITE_OK;
+}
+
+static int
+_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid)
+{
+	return SQLITE_OK;
+}
+
+static int
+_update(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv, sqlite3_int64 *pRowid)
+{
+	assert(argc == 3 && sqlite3_value_type(argv[0]) == SQLITE_NULL);
+	*pRowid = ++lLastObjectID;
+	return flexi_ChangeLog_add(&changeLog, 'C', ((TestVTab_t *) pVTab)->lClassID, *pRowid, 1, 0, NULL, argv[2]);
+}
+
+static int
+_begin(sqlite3_vtab *pVTab)
+{
+	flexi_ChangeLog_begin(&changeLog);
+	return SQLITE_OK;
+}
+
+static int
+_sync(sqlite3_vtab *pVTab)
+{
+	return flexi_ChangeLog_flush(&changeLog);
+}
+
+static int
+_commit(sqlite3_vtab *pVTab)
+{
+	flexi_ChangeLog_discard(&changeLog);
+	return SQLITE_OK;
+}
+
+static int
+_rollback(sqlite3_vtab *pVTab)
+{
+	flexi_ChangeLog_discard(&changeLog);
+	return SQLITE_OK;
+}
+
+static int
+_savepoint(sqlite3_vtab *pVTab, int iSavepoint)
+{
+	return flexi_ChangeLog_savepoint(&changeLog, iSavepoint);
+}
+
+static int
+_release(sqlite3_vtab *pVTab, int iSavepoint)
+{
+	flexi_ChangeLog_release(&changeLog, iSavepoint);
+	return SQLITE_OK;
+}
+
+static int
+_rollbackTo(sqlite3_vtab *pVTab, int iSavepoint)
+{
+	flexi_ChangeLog_rollbackTo(&changeLog, iSavepoint);
+	return SQLITE_OK;
+}
+
+static sqlite3_module testModule = {
+		.iVersion = 2,
+		.xCreate = _connect,
+		.xConnect = _connect,
+		.xBestIndex = _bestIndex,
+		.xDisconnect = _disconnect,
+		.xDestroy = _disconnect,
+		.xOpen = _open,
+		.xClose = _close,
+		.xFilter = _filter,
+		.xNext = _next,
+		.xEof = _eof,
+		.xColumn = _column,
+		.xRowid = _rowid,
+		.xUpdate = _update,
+		.xBegin = _begin,
+		.xSync = _sync,
+		.xCommit = _commit,
+		.xRollback = _rollback,
+		.xSavepoint = _savepoint,
+		.xRelease = _release,
+		.xRollbackTo = _rollbackTo
+};
+
+static void
+varFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	sqlite3_result_text(context, "tester", -1, SQLITE_STATIC);
+}
+
+static void
+exec(const char *zSql)
+{
+	char *zErr = NULL;
+	if (sqlite3_exec(db, zSql, NULL, NULL, &zErr) != SQLITE_OK)
+	{
+		printf("%s: %s\n", zSql, zErr);
+		assert(0);
+	}
+}
+
+/*
+ * Returns logged new values, comma separated, in order of logging, and clears [.change_log]
+ */
+static char *
+take_logged()
+{
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, "select coalesce(group_concat([Value], ','), '') from "
+			"(select [Value] from [.change_log] order by ID);", -1, &pStmt, NULL) == SQLITE_OK);
+	assert(sqlite3_step(pStmt) == SQLITE_ROW);
+	char *result = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0));
+	sqlite3_finalize(pStmt);
+	exec("delete from [.change_log];");
+	return result;
+}
+
+static void
+check_logged(const char *zExpected)
+{
+	char *zLogged = take_logged();
+	if (strcmp(zLogged, zExpected) != 0)
+	{
+		printf("Expected [%s], logged [%s]\n", zExpected, zLogged);
+		assert(0);
+	}
+	assert(changeLog.nCount == 0 && !changeLog.bInTransaction);
+	sqlite3_free(zLogged);
+}
+
+static void
+check_autocommit()
+{
+	exec("insert into a (v) values ('x');");
+	check_logged("x");
+}
+
+static void
+check_commit()
+{
+	// Table b joins transaction after a has logged change. It must not reset the log
+	exec("begin; insert into a (v) values ('x'); insert into b (v) values ('y'); "
+				 "insert into a (v) values ('z'); commit;");
+	check_logged("x,y,z");
+
+	// Change key format
+	exec("insert into b (v) values ('k');");
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, "select [KEY], [OldKey], [ChangedBy] from [.change_log];", -1, &pStmt, NULL)
+		   == SQLITE_OK);
+	assert(sqlite3_step(pStmt) == SQLITE_ROW);
+	char zKey[64];
+	snprintf(zKey, sizeof(zKey), "@2.%lld#1[0]", lLastObjectID);
+	assert(strcmp((const char *) sqlite3_column_text(pStmt, 0), zKey) == 0);
+	assert(sqlite3_column_type(pStmt, 1) == SQLITE_NULL);
+	assert(strcmp((const char *) sqlite3_column_text(pStmt, 2), "tester") == 0);
+	sqlite3_finalize(pStmt);
+	check_logged("k");
+}
+
+static void
+check_rollback()
+{
+	exec("begin; insert into a (v) values ('x'); insert into b (v) values ('y'); rollback;");
+	check_logged("");
+
+	// Nothing is left for the next transaction
+	exec("begin; insert into b (v) values ('z'); commit;");
+	check_logged("z");
+}
+
+static void
+check_rollback_to()
+{
+	exec("begin; insert into a (v) values ('x'); savepoint s1; insert into a (v) values ('y'); "
+				 "insert into b (v) values ('z'); rollback to s1; insert into b (v) values ('w'); "
+				 "release s1; commit;");
+	check_logged("x,w");
+
+	// Nested savepoints, table b joins transaction inside of inner savepoint
+	exec("begin; savepoint s1; insert into a (v) values ('x'); savepoint s2; insert into a (v) values ('y'); "
+				 "savepoint s3; insert into b (v) values ('z'); rollback to s2; insert into b (v) values ('w'); "
+				 "rollback to s1; insert into a (v) values ('v'); commit;");
+	check_logged("v");
+
+	// Table b joins after change has been logged within savepoint. Savepoint must keep its position
+	exec("begin; insert into a (v) values ('x'); savepoint s1; insert into a (v) values ('y'); "
+				 "insert into b (v) values ('z'); rollback to s1; commit;");
+	check_logged("x");
+
+	exec("begin; savepoint s1; savepoint s2; insert into b (v) values ('x'); rollback to s1; "
+				 "insert into a (v) values ('y'); release s1; commit;");
+	check_logged("y");
+
+	// Savepoint as transaction
+	exec("savepoint s1; insert into a (v) values ('x'); savepoint s2; insert into b (v) values ('y'); "
+				 "rollback to s2; release s1;");
+	check_logged("x");
+}
+
+/*
+ * Changes which did not fit into ring get written in the middle of transaction. They are still rolled back
+ */
+static void
+check_ring_overflow()
+{
+	int nRows = FLEXI_CHANGE_LOG_RING_SIZE * 2 + 7;
+	char zSql[256];
+
+	snprintf(zSql, sizeof(zSql), "begin; with recursive n(i) as (select 1 union all select i + 1 from n where i < %d) "
+			"insert into a (v) select 'r' from n; rollback;", nRows);
+	exec(zSql);
+	check_logged("");
+
+	snprintf(zSql, sizeof(zSql), "begin; with recursive n(i) as (select 1 union all select i + 1 from n where i < %d) "
+			"insert into a (v) select 'r' from n; savepoint s1; insert into b (v) values ('x'); rollback to s1; "
+			"commit;", nRows);
+	exec(zSql);
+	char *zLogged = take_logged();
+	assert(strlen(zLogged) == (size_t) nRows * 2 - 1);
+	assert(strchr(zLogged, 'x') == NULL);
+	sqlite3_free(zLogged);
+}
+
+int main()
+{
+	assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+	flexi_ChangeLog_init(&changeLog, db);
+	assert(sqlite3_create_function(db, "var", 1, SQLITE_UTF8, NULL, varFunc, NULL, NULL) == SQLITE_OK);
+	assert(sqlite3_create_module(db, "test_data", &testModule, NULL) == SQLITE_OK);
+	exec("create table [.change_log] ([ID] integer not null primary key autoincrement, [OldKey] text null, "
+				 "[OldValue], [KEY] text null, [Value], [ChangedBy] null);");
+	exec("create virtual table a using test_data; create virtual table b using test_data;");
+
+	check_autocommit();
+	check_commit();
+	check_rollback();
+	check_rollback_to();
+	check_ring_overflow();
+
+	printf("Change log tests passed\n");
+
+	flexi_ChangeLog_clear(&changeLog);
+	sqlite3_close(db);
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sqlite3.h>
+#include <IdSet.h>
+
+#define ID_RANGE 100000
+
+static void
+fill_set(IdSet_t *pSet, bool *aFlags, int nStep, int nOffset, bool bShuffle)
+{
+	IdSet_init(pSet);
+	for (int i = nOffset; i < ID_RANGE; i += nStep)
+	{
+		int id = bShuffle ? ID_RANGE - 1 - i : i;
+		aFlags[id] = true;
+		assert(IdSet_add(pSet, id) == SQLITE_OK);
+		/* duplicates must be ignored */
+		if (bShuffle)
+			assert(IdSet_add(pSet, id) == SQLITE_OK);
+	}
+	assert(IdSet_seal(pSet) == SQLITE_OK);
+}
+
+static void
+check_intersection(int nStepA, int nOffsetA, bool bShuffleA, int nStepB, int nOffsetB, bool bShuffleB)
+{
+	static bool aFlagsA[ID_RANGE];
+	static bool aFlagsB[ID_RANGE];
+	IdSet_t a, b, c;
+	IdSetIterator_t it;
+	sqlite3_int64 id;
+	sqlite3_int64 prev = -1;
+	u32 nExpected = 0;
+	u32 nFound = 0;
+
+	memset(aFlagsA, 0, sizeof(aFlagsA));
+	memset(aFlagsB, 0, sizeof(aFlagsB));
+	fill_set(&a, aFlagsA, nStepA, nOffsetA, bShuffleA);
+	fill_set(&b, aFlagsB, nStepB, nOffsetB, bShuffleB);
+
+	IdSet_init(&c);
+	assert(IdSet_intersect(&c, &a, &b) == SQLITE_OK);
+
+	for (int i = 0; i < ID_RANGE; i++)
+	{
+		if (aFlagsA[i] && aFlagsB[i])
+		{
+			nExpected++;
+			assert(IdSet_contains(&c, i));
+		}
+	}
+	assert(c.nCount == nExpected);
+
+	/* ascending walk */
+	IdSet_begin(&c, &it, false);
+	while (IdSet_next(&it, &id))
+	{
+		assert(id > prev);
+		assert(aFlagsA[id] && aFlagsB[id]);
+		prev = id;
+		nFound++;
+	}
+	assert(nFound == nExpected);
+
+	/* descending walk */
+	nFound = 0;
+	prev = ID_RANGE;
+	IdSet_begin(&c, &it, true);
+	while (IdSet_next(&it, &id))
+	{
+		assert(id < prev);
+		prev = id;
+		nFound++;
+	}
+	assert(nFound == nExpected);
+
+	IdSet_clear(&a);
+	IdSet_clear(&b);
+	IdSet_clear(&c);
+}
+
+int main()
+{
+	/* sparse & sparse (arrays) */
+	check_intersection(97, 0, false, 89, 3, true);
+
+	/* dense & dense (bitmaps) */
+	check_intersection(2, 0, true, 3, 0, false);
+
+	/* dense & sparse */
+	check_intersection(1, 0, false, 1000, 7, true);
+	check_intersection(1001, 1, false, 2, 1, false);
+
+	/* no overlap */
+	check_intersection(2, 0, false, 2, 1, false);
+
+	printf("IdSet tests passed\n");
+	return 0;
+}
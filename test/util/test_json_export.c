@@ -0,0 +1,262 @@
+/*
+ * Tests flexi_export_json table-valued function: class is exported as one JSON value in consecutive rows.
+ * Concatenated chunks must give the same JSON as flexi_expand_refs for all objects of class, chunks must not
+ * exceed chunk size nor split UTF-8 characters, and memory used by export must not grow with size of result.
+ * Test database has only tables and columns which are used by export.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sqlite3.h>
+#include "../../src/flexi/flexi_json_export.h"
+#include "../../src/util/StringBuilder.h"
+
+#define ORDER_COUNT 3000
+#define LARGE_COUNT 20000
+
+static sqlite3 *db;
+
+static void
+exec(const char *zSql)
+{
+	char *zErr = NULL;
+	if (sqlite3_exec(db, zSql, NULL, NULL, &zErr) != SQLITE_OK)
+	{
+		printf("%s: %s\n", zSql, zErr);
+		assert(0);
+	}
+}
+
+/*
+ * Returns text returned by SQL, allocated by sqlite3_mprintf
+ */
+static char *
+select_text(const char *zSql)
+{
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) == SQLITE_OK);
+	assert(sqlite3_step(pStmt) == SQLITE_ROW);
+	char *zResult = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0));
+	sqlite3_finalize(pStmt);
+	return zResult;
+}
+
+/*
+ * Runs export and appends concatenated chunks to pAll. Checks chunk sizes and order of rowids
+ */
+static void
+export(StringBuilder_t *pAll, const char *zSql, int nChunkSize, int *pnChunks)
+{
+	sqlite3_stmt *pStmt;
+	int nChunks = 0;
+
+	assert(sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) == SQLITE_OK);
+	while (sqlite3_step(pStmt) == SQLITE_ROW)
+	{
+		const char *zChunk = (const char *) sqlite3_column_text(pStmt, 0);
+		int nBytes = sqlite3_column_bytes(pStmt, 0);
+		assert(nBytes > 0 && nBytes <= nChunkSize);
+
+		// Chunk must not start with UTF-8 continuation byte
+		assert(((unsigned char) zChunk[0] & 0xC0) != 0x80);
+		assert(sqlite3_column_int64(pStmt, 1) == ++nChunks);
+		StringBuilder_appendRaw(pAll, zChunk, nBytes);
+	}
+	assert(sqlite3_finalize(pStmt) == SQLITE_OK);
+
+	assert(!pAll->bErr);
+	if (pnChunks != NULL)
+		*pnChunks = nChunks;
+}
+
+static void
+check_equal(const char *zExported, const char *zExpected)
+{
+	if (strcmp(zExported, zExpected) != 0)
+	{
+		printf("Expected %.200s\nExported %.200s\n", zExpected, zExported);
+		assert(0);
+	}
+}
+
+/*
+ * Class 1: orders, referencing customers of class 2. Several pages of objects, multi-byte names,
+ * multi-value property. Class 4 has no objects
+ */
+static void
+init_orders()
+{
+	exec("insert into [.sym_names] (ID, [Value]) values (1, 'Customer'), (2, 'Total'), (3, 'Name'), (4, 'Note');");
+	exec("insert into [.class_props] (ID, NameID) values (101, 1), (102, 2), (103, 3), (104, 4);");
+
+	exec("with recursive n(i) as (select 1 union all select i + 1 from n where i < 50) "
+				 "insert into [.objects] (ObjectID, ClassID) select i, 2 from n;");
+	exec("insert into [.ref-values] (ObjectID, PropertyID, PropIndex, ctlv, [Value]) "
+				 "select ObjectID, 103, 0, 0, '\xD0\x9A\xD0\xBB\xD0\xB8\xD0\xB5\xD0\xBD\xD1\x82 ' || ObjectID "
+				 "from [.objects] where ClassID = 2;");
+
+	char zSql[256];
+	snprintf(zSql, sizeof(zSql), "with recursive n(i) as (select 1001 union all select i + 1 from n where i < %d) "
+			"insert into [.objects] (ObjectID, ClassID) select i, 1 from n;", 1000 + ORDER_COUNT);
+	exec(zSql);
+	exec("insert into [.ref-values] (ObjectID, PropertyID, PropIndex, ctlv, [Value]) "
+				 "select ObjectID, 101, 0, 32, 1 + ObjectID % 50 from [.objects] where ClassID = 1;");
+	exec("insert into [.ref-values] (ObjectID, PropertyID, PropIndex, ctlv, [Value]) "
+				 "select ObjectID, 102, 0, 0, ObjectID * 1.5 from [.objects] where ClassID = 1;");
+	exec("insert into [.ref-values] (ObjectID, PropertyID, PropIndex, ctlv, [Value]) "
+				 "select ObjectID, 104, 0, 0, 'urgent \xF0\x9F\x98\x80' from [.objects] where ClassID = 1 "
+				 "and ObjectID % 3 = 0;");
+	exec("insert into [.ref-values] (ObjectID, PropertyID, PropIndex, ctlv, [Value]) "
+				 "select ObjectID, 104, 1, 0, 'fragile \"glass\"' from [.objects] where ClassID = 1 "
+				 "and ObjectID % 3 = 0;");
+}
+
+static void
+check_array()
+{
+	char *zExpected = select_text("select flexi_expand_refs((select json_group_array(ObjectID) from "
+										  "(select ObjectID from [.objects] where ClassID = 1 order by ObjectID)), 2);");
+
+	int aChunkSizes[] = {7, 1000, FLEXI_JSON_EXPORT_CHUNK_SIZE};
+	for (int ii = 0; ii < (int) (sizeof(aChunkSizes) / sizeof(aChunkSizes[0])); ii++)
+	{
+		char zSql[128];
+		int nChunks;
+		StringBuilder_t exported;
+		StringBuilder_init(&exported);
+		snprintf(zSql, sizeof(zSql), "select Chunk, rowid from flexi_export_json(1, 2, 0, 0, %d);",
+				 aChunkSizes[ii]);
+		export(&exported, zSql, aChunkSizes[ii], &nChunks);
+		check_equal(exported.zBuf, zExpected);
+		assert(nChunks >= (int) (strlen(zExpected) / aChunkSizes[ii]));
+		StringBuilder_clear(&exported);
+	}
+
+	// Default chunk size
+	StringBuilder_t exported;
+	StringBuilder_init(&exported);
+	export(&exported, "select Chunk, rowid from flexi_export_json(1, 2);", FLEXI_JSON_EXPORT_CHUNK_SIZE, NULL);
+	check_equal(exported.zBuf, zExpected);
+	StringBuilder_clear(&exported);
+	sqlite3_free(zExpected);
+
+	// Depth 1: references are IDs
+	zExpected = select_text("select flexi_expand_refs((select json_group_array(ObjectID) from "
+									"(select ObjectID from [.objects] where ClassID = 1 order by ObjectID)), 1);");
+	StringBuilder_init(&exported);
+	export(&exported, "select Chunk, rowid from flexi_export_json where ClassID = 1 and ChunkSize = 500;", 500, NULL);
+	check_equal(exported.zBuf, zExpected);
+	StringBuilder_clear(&exported);
+	sqlite3_free(zExpected);
+}
+
+static void
+check_object()
+{
+	char *zExpected = select_text("select '{' || group_concat('\"' || ObjectID || '\":' || "
+										  "flexi_expand_refs(ObjectID, 2), ',') || '}' from "
+										  "(select ObjectID from [.objects] where ClassID = 1 order by ObjectID);");
+	StringBuilder_t exported;
+	StringBuilder_init(&exported);
+	export(&exported, "select Chunk, rowid from flexi_export_json(1, 2, 0, 1, 300);", 300, NULL);
+	check_equal(exported.zBuf, zExpected);
+	StringBuilder_clear(&exported);
+	sqlite3_free(zExpected);
+}
+
+/*
+ * The same cursor is filtered for every class
+ */
+static void
+check_refilter()
+{
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, "select c.column1, e.Chunk from (values (4), (2), (4)) c, "
+			"flexi_export_json(c.column1, 1, 0, 0, 100000000) e;", -1, &pStmt, NULL) == SQLITE_OK);
+	char *zCustomers = select_text("select flexi_expand_refs((select json_group_array(ObjectID) from "
+										   "(select ObjectID from [.objects] where ClassID = 2 order by ObjectID)), 1);");
+	const char *aExpected[] = {"[]", zCustomers, "[]"};
+	for (int ii = 0; ii < 3; ii++)
+	{
+		assert(sqlite3_step(pStmt) == SQLITE_ROW);
+		check_equal((const char *) sqlite3_column_text(pStmt, 1), aExpected[ii]);
+	}
+	assert(sqlite3_step(pStmt) == SQLITE_DONE);
+	sqlite3_finalize(pStmt);
+	sqlite3_free(zCustomers);
+}
+
+static void
+check_errors()
+{
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, "select Chunk from flexi_export_json;", -1, &pStmt, NULL) == SQLITE_OK);
+	assert(sqlite3_step(pStmt) == SQLITE_ERROR);
+	assert(strstr(sqlite3_errmsg(db), "ClassID is required") != NULL);
+	sqlite3_finalize(pStmt);
+}
+
+/*
+ * Memory used while class is exported stays about page and chunk size, well below size of result
+ */
+static void
+check_memory()
+{
+	char zSql[256];
+	snprintf(zSql, sizeof(zSql), "with recursive n(i) as (select 100001 union all select i + 1 from n where i < %d) "
+			"insert into [.objects] (ObjectID, ClassID) select i, 3 from n;", 100000 + LARGE_COUNT);
+	exec(zSql);
+	exec("insert into [.ref-values] (ObjectID, PropertyID, PropIndex, ctlv, [Value]) "
+				 "select ObjectID, 103, 0, 0, printf('%.*c', 200, 'x') from [.objects] where ClassID = 3;");
+
+	sqlite3_int64 nUsed, nHighwater;
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, "select Chunk from flexi_export_json(3);", -1, &pStmt, NULL) == SQLITE_OK);
+	sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &nUsed, &nHighwater, 1);
+
+	sqlite3_int64 nTotal = 0;
+	while (sqlite3_step(pStmt) == SQLITE_ROW)
+		nTotal += sqlite3_column_bytes(pStmt, 0);
+	assert(sqlite3_finalize(pStmt) == SQLITE_OK);
+
+	sqlite3_int64 nUsedAfter;
+	sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &nUsedAfter, &nHighwater, 0);
+	assert(nTotal > (sqlite3_int64) LARGE_COUNT * 200);
+
+	// Memory status may be disabled in SQLite build
+	if (nUsed > 0 && nHighwater - nUsed > nTotal / 8)
+	{
+		printf("Export of %lld bytes used %lld bytes\n", nTotal, nHighwater - nUsed);
+		assert(0);
+	}
+}
+
+int main()
+{
+	assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+	assert(flexi_RefExpand_createFunc(db) == SQLITE_OK);
+	assert(flexi_JsonExport_register(db) == SQLITE_OK);
+
+	exec("create table [.sym_names] (ID integer primary key, [Value] text not null);");
+	exec("create table [.class_props] (ID integer primary key, NameID integer not null);");
+	exec("create table [.objects] (ObjectID integer primary key, ClassID integer not null);");
+	exec("create index [idxObjectsByClassID] on [.objects] (ClassID);");
+	exec("create table [.ref-values] (ObjectID integer not null, PropertyID integer not null, "
+				 "PropIndex integer not null default 0, [Value] not null, ctlv integer not null default 0, "
+				 "primary key (ObjectID, PropertyID, PropIndex)) without rowid;");
+
+	init_orders();
+
+	check_array();
+	check_object();
+	check_refilter();
+	check_errors();
+	check_memory();
+
+	printf("JSON export tests passed\n");
+
+	sqlite3_close(db);
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Tests JsonTape against SQLite JSON1 (json_valid and json_tree) and compares parse time
+ * of large array payload with json_tree scan.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <sqlite3.h>
+#include <JsonTape.h>
+#include <StringBuilder.h>
+
+static sqlite3 *db;
+
+static double
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const char *
+type_name(u8 type)
+{
+	static const char *aNames[] = {"null", "true", "false", "integer", "real", "text", "array", "object"};
+	return aNames[type];
+}
+
+static void
+check_valid(const char *zJson)
+{
+	sqlite3_stmt *pStmt;
+	JsonTape_t tape;
+
+	assert(sqlite3_prepare_v2(db, "select json_valid(:1);", -1, &pStmt, NULL) == SQLITE_OK);
+	sqlite3_bind_text(pStmt, 1, zJson, -1, NULL);
+	assert(sqlite3_step(pStmt) == SQLITE_ROW);
+	int bExpected = sqlite3_column_int(pStmt, 0);
+	sqlite3_finalize(pStmt);
+
+	JsonTape_init(&tape);
+	int rc = JsonTape_parse(&tape, zJson, -1);
+	if ((rc == SQLITE_OK) != (bExpected != 0))
+	{
+		printf("Mismatch on '%s': json_valid = %d, JsonTape_parse = %d\n", zJson, bExpected, rc);
+		assert(0);
+	}
+	JsonTape_free(&tape);
+}
+
+/*
+ * Walks tape in document order and compares nodes with rows of json_tree
+ */
+static void
+check_tree(const char *zJson)
+{
+	sqlite3_stmt *pStmt;
+	JsonTape_t tape;
+	static u32 aIdToNode[10000];
+	u32 iNode = 0;
+
+	JsonTape_init(&tape);
+	assert(JsonTape_parse(&tape, zJson, -1) == SQLITE_OK);
+
+	assert(sqlite3_prepare_v2(db, "select key, value, type, id, parent from json_tree(:1);", -1, &pStmt, NULL)
+	       == SQLITE_OK);
+	sqlite3_bind_text(pStmt, 1, zJson, -1, NULL);
+	while (sqlite3_step(pStmt) == SQLITE_ROW)
+	{
+		assert(iNode < tape.nNodes);
+		JsonTapeNode_t *pNode = &tape.aNodes[iNode];
+		aIdToNode[sqlite3_column_int(pStmt, 3)] = iNode;
+
+		/* json_tree reports integers which do not fit into 64 bits as 'integer' with real value */
+		const char *zType = (const char *) sqlite3_column_text(pStmt, 2);
+		assert(strcmp(type_name(pNode->type), zType) == 0 ||
+		       (pNode->type == JSON_REAL && strcmp(zType, "integer") == 0));
+
+		if (sqlite3_column_type(pStmt, 4) == SQLITE_NULL)
+			assert(pNode->iParent == JSON_TAPE_NONE);
+		else
+			assert(pNode->iParent == aIdToNode[sqlite3_column_int(pStmt, 4)]);
+
+		if (pNode->zKey != NULL)
+		{
+			assert(pNode->nKey == strlen(pNode->zKey));
+			assert(strcmp(pNode->zKey, (const char *) sqlite3_column_text(pStmt, 0)) == 0);
+		}
+
+		switch (pNode->type)
+		{
+			case JSON_INT:
+				assert(pNode->v.i == sqlite3_column_int64(pStmt, 1));
+				break;
+			case JSON_REAL:
+				assert(pNode->v.d == sqlite3_column_double(pStmt, 1));
+				break;
+			case JSON_STRING:
+				assert(pNode->v.s.n == (u32) sqlite3_column_bytes(pStmt, 1));
+				assert(memcmp(pNode->v.s.z, sqlite3_column_text(pStmt, 1), pNode->v.s.n) == 0);
+				break;
+			default:
+				break;
+		}
+		iNode++;
+	}
+	assert(iNode == tape.nNodes);
+	sqlite3_finalize(pStmt);
+
+	/* Child iteration must visit direct children only, in order */
+	for (u32 ii = 0; ii < tape.nNodes; ii++)
+	{
+		u32 nChildren = 0;
+		for (u32 jj = JsonTape_firstChild(&tape, ii); jj != JSON_TAPE_NONE; jj = JsonTape_nextSibling(&tape, jj))
+		{
+			assert(tape.aNodes[jj].iParent == ii);
+			nChildren++;
+		}
+		assert(nChildren == tape.aNodes[ii].nChildren);
+	}
+
+	JsonTape_free(&tape);
+}
+
+static void
+bench_array(int nItems)
+{
+	sqlite3_stmt *pStmt;
+	JsonTape_t tape;
+	StringBuilder_t sb;
+	char zItem[128];
+	int nRows = 0;
+
+	StringBuilder_init(&sb);
+	StringBuilder_appendRaw(&sb, "[", 1);
+	for (int ii = 0; ii < nItems; ii++)
+	{
+		sqlite3_snprintf(sizeof(zItem), zItem, "%s{\"Name\":\"Item \\\"%d\\\"\",\"Price\":%d.25,\"Qty\":%d,"
+		                 "\"Tags\":[\"a\",\"b\"],\"Active\":true}", ii == 0 ? "" : ",", ii, ii, ii * 3);
+		StringBuilder_appendRaw(&sb, zItem, -1);
+	}
+	StringBuilder_appendRaw(&sb, "]", 1);
+	assert(!sb.bErr);
+	const char *zJson = sb.zBuf;
+
+	double t0 = now_ns();
+	assert(sqlite3_prepare_v2(db, "select key, value, type, atom, id, parent, fullkey, path from json_tree(:1);",
+	                          -1, &pStmt, NULL) == SQLITE_OK);
+	sqlite3_bind_text(pStmt, 1, zJson, -1, NULL);
+	while (sqlite3_step(pStmt) == SQLITE_ROW)
+	{
+		/* the same work the old upsert path did per node */
+		sqlite3_value_free(sqlite3_value_dup(sqlite3_column_value(pStmt, 1)));
+		sqlite3_free(sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0)));
+		sqlite3_free(sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 6)));
+		sqlite3_free(sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 7)));
+		nRows++;
+	}
+	sqlite3_finalize(pStmt);
+	double t1 = now_ns();
+
+	JsonTape_init(&tape);
+	assert(JsonTape_parse(&tape, zJson, -1) == SQLITE_OK);
+	double t2 = now_ns();
+
+	assert((int) tape.nNodes == nRows);
+	printf("%d items, %d nodes: json_tree %.2f ms, JsonTape %.2f ms\n", nItems, nRows, (t1 - t0) / 1e6,
+	       (t2 - t1) / 1e6);
+
+	JsonTape_free(&tape);
+	StringBuilder_clear(&sb);
+}
+
+int main()
+{
+	assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+
+	const char *aValid[] = {
+			"0", "-0", "1.5e10", "-12.25E-3", "9223372036854775807", "-9223372036854775808",
+			"9223372036854775808", "123456789012345678901234567890", "\"\"", "\"a\\\"b\\\\c\\/\\n\\u00e9\\ud83d\\ude00\"",
+			"true", "false", "null", "[]", "{}", " [ ] ", "[1,[2,[3,[]]],{}]", "{\"a\":{\"b\":{\"c\":[1,2,{}]}},\"d\":\"\"}",
+			"{\"dup\":1,\"dup\":2}"
+	};
+	const char *aInvalid[] = {
+			"", " ", "[", "]", "[1,]", "{\"a\":1,}", "{\"a\"}", "{a:1}", "01", "1.", ".5", "-", "1e", "+1",
+			"\"abc", "\"\\x\"", "\"\\u12G4\"", "tru", "nul", "[1 2]", "{\"a\":1 \"b\":2}", "[]]", "1 2"
+	};
+
+	for (int ii = 0; ii < (int) (sizeof(aValid) / sizeof(aValid[0])); ii++)
+	{
+		check_valid(aValid[ii]);
+		check_tree(aValid[ii]);
+	}
+	for (int ii = 0; ii < (int) (sizeof(aInvalid) / sizeof(aInvalid[0])); ii++)
+		check_valid(aInvalid[ii]);
+
+	printf("JsonTape tests passed\n");
+
+	bench_array(1000);
+	bench_array(100000);
+
+	sqlite3_close(db);
+	return 0;
+}
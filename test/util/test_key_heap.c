@@ -0,0 +1,146 @@
+/*
+ * Tests KeyHeap against SQLite ORDER BY on mixed type values (nulls, integers, reals, text, blobs),
+ * in both directions, partial consumption of heap (top N), heap limited to top N items (nLimit)
+ * and resuming after given item (pAfter).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sqlite3.h>
+#include <KeyHeap.h>
+
+#define ROW_COUNT 20000
+
+static sqlite3 *db;
+
+static void
+exec(const char *zSql)
+{
+	char *zErr = NULL;
+	if (sqlite3_exec(db, zSql, NULL, NULL, &zErr) != SQLITE_OK)
+	{
+		printf("%s: %s\n", zSql, zErr);
+		assert(0);
+	}
+}
+
+/*
+ * Pops nLimit items (all, if nLimit < 0) and compares them with ORDER BY v, id (or v desc, id desc).
+ * If lAfterID is not 0, heap gets only items which go after item with this ID.
+ * If nHeapLimit is not 0, heap keeps only that many items: they must be the first ones, and nothing else
+ */
+static void
+check_order(bool bDesc, int nLimit, sqlite3_int64 lAfterID, u32 nHeapLimit)
+{
+	sqlite3_stmt *pStmt;
+	sqlite3_stmt *pAfterStmt = NULL;
+	KeyHeap_t heap;
+	KeyHeapItem_t after;
+	sqlite3_int64 lID;
+	int nPopped = 0;
+	int nSkipped = 0;
+
+	KeyHeap_init(&heap, bDesc);
+	heap.nLimit = nHeapLimit;
+	if (lAfterID != 0)
+	{
+		/* Key of item refers to statement data, so statement is kept until heap is filled */
+		assert(sqlite3_prepare_v2(db, "select v from vals where id = :1;", -1, &pAfterStmt, NULL) == SQLITE_OK);
+		sqlite3_bind_int64(pAfterStmt, 1, lAfterID);
+		assert(sqlite3_step(pAfterStmt) == SQLITE_ROW);
+		KeyHeap_setItem(&after, lAfterID, sqlite3_column_value(pAfterStmt, 0));
+		heap.pAfter = &after;
+	}
+
+	assert(sqlite3_prepare_v2(db, "select id, v from vals;", -1, &pStmt, NULL) == SQLITE_OK);
+	while (sqlite3_step(pStmt) == SQLITE_ROW)
+		assert(KeyHeap_add(&heap, sqlite3_column_int64(pStmt, 0), sqlite3_column_value(pStmt, 1)) == SQLITE_OK);
+	sqlite3_finalize(pStmt);
+	sqlite3_finalize(pAfterStmt);
+	if (nHeapLimit > 0)
+		assert(heap.nCount <= nHeapLimit && heap.nAlloc <= (nHeapLimit > 64 ? nHeapLimit * 2 : 64));
+	KeyHeap_build(&heap);
+
+	assert(sqlite3_prepare_v2(db, bDesc ? "select id from vals order by v desc, id desc;"
+	                                    : "select id from vals order by v, id;", -1, &pStmt, NULL)
+	       == SQLITE_OK);
+
+	/* Skip everything up to and including lAfterID */
+	if (lAfterID != 0)
+	{
+		while (sqlite3_step(pStmt) == SQLITE_ROW && sqlite3_column_int64(pStmt, 0) != lAfterID)
+			nSkipped++;
+		nSkipped++;
+	}
+
+	while ((nLimit < 0 || nPopped < nLimit) && sqlite3_step(pStmt) == SQLITE_ROW)
+	{
+		assert(KeyHeap_pop(&heap, &lID));
+		if (lID != sqlite3_column_int64(pStmt, 0))
+		{
+			printf("Mismatch at %d: expected %lld, got %lld\n", nPopped, sqlite3_column_int64(pStmt, 0), lID);
+			assert(0);
+		}
+		nPopped++;
+	}
+	sqlite3_finalize(pStmt);
+
+	if (nHeapLimit > 0)
+		assert(!KeyHeap_pop(&heap, &lID));
+
+	if (nLimit < 0)
+	{
+		assert(nHeapLimit > 0 || nPopped + nSkipped == ROW_COUNT);
+		assert(!KeyHeap_pop(&heap, &lID));
+	}
+	else assert(nPopped == nLimit || !KeyHeap_pop(&heap, &lID));
+
+	KeyHeap_clear(&heap);
+	assert(heap.nCount == 0 && heap.bDesc == bDesc && heap.nLimit == nHeapLimit);
+}
+
+int main()
+{
+	assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+
+	/* Values of all types, with duplicates, empty strings and blobs, and text prefixes */
+	exec("create table vals(id integer primary key, v);"
+	     "with recursive c(x) as (select 1 union all select x + 1 from c limit 20000) "
+	     "insert into vals select x, case x % 7 "
+	     "when 0 then null "
+	     "when 1 then (x * 7919) % 1000 "
+	     "when 2 then ((x * 7919) % 1000) + 0.5 "
+	     "when 3 then substr(printf('k%05d', (x * 104729) % 3000), 1, 1 + x % 6) "
+	     "when 4 then '' "
+	     "when 5 then cast(printf('%04d', (x * 31) % 500) as blob) "
+	     "else -(x % 13) * 1.0 end "
+	     "from c;");
+
+	check_order(false, -1, 0, 0);
+	check_order(true, -1, 0, 0);
+	check_order(false, 25, 0, 0);
+	check_order(true, 100, 0, 0);
+	check_order(false, 0, 0, 0);
+
+	/* Limited heap (LIMIT + OFFSET known), including limit above number of rows */
+	check_order(false, 25, 0, 25);
+	check_order(true, 1, 0, 1);
+	check_order(true, 700, 0, 700);
+	check_order(false, -1, 0, ROW_COUNT * 2);
+
+	/* Resume after null, integer, real, text and blob keys */
+	for (sqlite3_int64 lAfterID = 7; lAfterID <= 13; lAfterID++)
+	{
+		check_order(false, -1, lAfterID, 0);
+		check_order(true, -1, lAfterID, 0);
+		check_order(true, 50, lAfterID, 0);
+		check_order(false, 300, lAfterID, 300);
+	}
+
+	printf("KeyHeap tests passed\n");
+
+	sqlite3_close(db);
+	return 0;
+}
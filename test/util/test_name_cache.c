@@ -0,0 +1,260 @@
+/*
+ * Tests that flexi_NameCache does not keep names inserted by rolled back transaction or savepoint.
+ * Test virtual table interns names on insert the same way as flexi_Context_insertName does (cache first, then
+ * [.sym_names]), and clears cache from xRollback and xRollbackTo as flexi_data does. After rollback, the same
+ * name ID is reused by database for another name, so stale cache entry would resolve to a wrong name.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sqlite3.h>
+#include "../../src/flexi/flexi_name_cache.h"
+
+static sqlite3 *db;
+
+static flexi_NameCache_t nameCache;
+
+/*
+ * Returns ID of name, inserting it if needed
+ */
+static int
+intern(const char *zName, sqlite3_int64 *pNameID)
+{
+	const flexi_NameEntry_t *pEntry = flexi_NameCache_findByValue(&nameCache, zName);
+	if (pEntry != NULL)
+	{
+		*pNameID = pEntry->lNameID;
+		return SQLITE_OK;
+	}
+
+	sqlite3_stmt *pStmt;
+	int result = sqlite3_prepare_v2(db, "select ID from [.sym_names] where [Value] = :1;", -1, &pStmt, NULL);
+	if (result != SQLITE_OK)
+		return result;
+	sqlite3_bind_text(pStmt, 1, zName, -1, SQLITE_STATIC);
+	result = sqlite3_step(pStmt);
+	if (result == SQLITE_ROW)
+		*pNameID = sqlite3_column_int64(pStmt, 0);
+	sqlite3_finalize(pStmt);
+
+	if (result == SQLITE_DONE)
+	{
+		result = sqlite3_prepare_v2(db, "insert into [.sym_names] ([Value]) values (:1);", -1, &pStmt, NULL);
+		if (result != SQLITE_OK)
+			return result;
+		sqlite3_bind_text(pStmt, 1, zName, -1, SQLITE_STATIC);
+		result = sqlite3_step(pStmt);
+		sqlite3_finalize(pStmt);
+		if (result != SQLITE_DONE)
+			return result;
+		*pNameID = sqlite3_last_insert_rowid(db);
+	}
+	else if (result != SQLITE_ROW)
+		return result;
+
+	return flexi_NameCache_add(&nameCache, *pNameID, zName);
+}
+
+static int
+_connect(sqlite3 *pDb, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVTab, char **pzErr)
+{
+	*ppVTab = sqlite3_malloc(sizeof(sqlite3_vtab));
+	if (*ppVTab == NULL)
+		return SQLITE_NOMEM;
+	memset(*ppVTab, 0, sizeof(sqlite3_vtab));
+	return sqlite3_declare_vtab(pDb, "create table x(name)");
+}
+
+static int
+_disconnect(sqlite3_vtab *pVTab)
+{
+	sqlite3_free(pVTab);
+	return SQLITE_OK;
+}
+
+static int
+_bestIndex(sqlite3_vtab *pVTab, sqlite3_index_info *pInfo)
+{
+	pInfo->estimatedCost = 1;
+	return SQLITE_OK;
+}
+
+/*
+ * Table has no rows, only writes are of interest
+ */
+static int
+_open(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor)
+{
+	*ppCursor = sqlite3_malloc(sizeof(sqlite3_vtab_cursor));
+	return *ppCursor == NULL ? SQLITE_NOMEM : SQLITE_OK;
+}
+
+static int
+_close(sqlite3_vtab_cursor *pCursor)
+{
+	sqlite3_free(pCursor);
+	return SQLITE_OK;
+}
+
+static int
+_filter(sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv)
+{
+	return SQLITE_OK;
+}
+
+static int
+_next(sqlite3_vtab_cursor *pCursor)
+{
+	return SQLITE_OK;
+}
+
+static int
+_eof(sqlite3_vtab_cursor *pCursor)
+{
+	return 1;
+}
+
+static int
+_column(sqlite3_vtab_cursor *pCursor, sqlite3_context *pCtx, int iCol)
+{
+	return SQLITE_OK;
+}
+
+static int
+_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid)
+{
+	return SQLITE_OK;
+}
+
+static int
+_update(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv, sqlite3_int64 *pRowid)
+{
+	assert(argc == 3 && sqlite3_value_type(argv[0]) == SQLITE_NULL);
+	return intern((const char *) sqlite3_value_text(argv[2]), pRowid);
+}
+
+static int
+_begin(sqlite3_vtab *pVTab)
+{
+	return SQLITE_OK;
+}
+
+static int
+_rollback(sqlite3_vtab *pVTab)
+{
+	flexi_NameCache_clear(&nameCache);
+	return SQLITE_OK;
+}
+
+static int
+_savepoint(sqlite3_vtab *pVTab, int iSavepoint)
+{
+	return SQLITE_OK;
+}
+
+static int
+_rollbackTo(sqlite3_vtab *pVTab, int iSavepoint)
+{
+	flexi_NameCache_clear(&nameCache);
+	return SQLITE_OK;
+}
+
+static sqlite3_module testModule = {
+		.iVersion = 2,
+		.xCreate = _connect,
+		.xConnect = _connect,
+		.xBestIndex = _bestIndex,
+		.xDisconnect = _disconnect,
+		.xDestroy = _disconnect,
+		.xOpen = _open,
+		.xClose = _close,
+		.xFilter = _filter,
+		.xNext = _next,
+		.xEof = _eof,
+		.xColumn = _column,
+		.xRowid = _rowid,
+		.xUpdate = _update,
+		.xBegin = _begin,
+		.xRollback = _rollback,
+		.xSavepoint = _savepoint,
+		.xRelease = _savepoint,
+		.xRollbackTo = _rollbackTo
+};
+
+static void
+exec(const char *zSql)
+{
+	char *zErr = NULL;
+	if (sqlite3_exec(db, zSql, NULL, NULL, &zErr) != SQLITE_OK)
+	{
+		printf("%s: %s\n", zSql, zErr);
+		assert(0);
+	}
+}
+
+/*
+ * Checks that name resolves to the same ID by cache and by database, both ways
+ */
+static sqlite3_int64
+check_name(const char *zName)
+{
+	sqlite3_int64 lNameID;
+	assert(intern(zName, &lNameID) == SQLITE_OK);
+
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, "select [Value] from [.sym_names] where ID = :1;", -1, &pStmt, NULL)
+		   == SQLITE_OK);
+	sqlite3_bind_int64(pStmt, 1, lNameID);
+	assert(sqlite3_step(pStmt) == SQLITE_ROW);
+	assert(strcmp((const char *) sqlite3_column_text(pStmt, 0), zName) == 0);
+	sqlite3_finalize(pStmt);
+
+	const flexi_NameEntry_t *pEntry = flexi_NameCache_findByID(&nameCache, lNameID);
+	assert(pEntry != NULL && strcmp(pEntry->zValue, zName) == 0);
+	return lNameID;
+}
+
+static void
+check_rollback()
+{
+	exec("begin; insert into names (name) values ('color'); rollback;");
+
+	// ID of rolled back name is taken by another name, inserted without going through cache
+	exec("insert into [.sym_names] ([Value]) values ('size');");
+
+	// Rolled back name is inserted again, with a new ID
+	exec("insert into names (name) values ('color');");
+	sqlite3_int64 lColorID = check_name("color");
+	assert(lColorID != check_name("size"));
+}
+
+static void
+check_rollback_to()
+{
+	exec("begin; insert into names (name) values ('weight'); savepoint s1; insert into names (name) values ('height'); "
+				 "rollback to s1; insert into [.sym_names] ([Value]) values ('width'); "
+				 "insert into names (name) values ('height'); commit;");
+	sqlite3_int64 lHeightID = check_name("height");
+	assert(lHeightID != check_name("width"));
+	check_name("weight");
+}
+
+int main()
+{
+	assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+	flexi_NameCache_init(&nameCache);
+	assert(sqlite3_create_module(db, "test_names", &testModule, NULL) == SQLITE_OK);
+	exec("create table [.sym_names] (ID integer primary key, [Value] text not null unique);");
+	exec("create virtual table names using test_names;");
+
+	check_rollback();
+	check_rollback_to();
+
+	printf("Name cache tests passed\n");
+
+	flexi_NameCache_free(&nameCache);
+	sqlite3_close(db);
+	return 0;
+}
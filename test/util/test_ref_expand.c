@@ -0,0 +1,254 @@
+/*
+ * Tests flexi_expand_refs SQL function (flexi_RefExpand_t): objects are loaded level by level with one statement
+ * per level, object referenced from many places is loaded once, referenced objects are embedded up to fetch
+ * depth, reference cycles are output as object IDs, and only owned objects are embedded in nested only mode.
+ * Test database has only tables and columns which are used by expander.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sqlite3.h>
+#include "../../src/flexi/flexi_ref_expand.h"
+#include "../../src/flexi/flexi_eav.h"
+
+#define CTLV_REF_STD 0x20
+
+static sqlite3 *db;
+
+/*
+ * Number of runs of statement which loads level of objects
+ */
+static int nLevelLoads = 0;
+
+static int
+trace(unsigned mask, void *pCtx, void *pStmt, void *pSql)
+{
+	if (strstr(sqlite3_sql(pStmt), "json_each") != NULL && strstr(sqlite3_sql(pStmt), "[.ref-values]") != NULL)
+		nLevelLoads++;
+	return 0;
+}
+
+static void
+exec(const char *zSql)
+{
+	char *zErr = NULL;
+	if (sqlite3_exec(db, zSql, NULL, NULL, &zErr) != SQLITE_OK)
+	{
+		printf("%s: %s\n", zSql, zErr);
+		assert(0);
+	}
+}
+
+/*
+ * Runs SQL which returns single text value and compares it with expected one
+ */
+static void
+check_json(const char *zSql, const char *zExpected, int nExpectedLoads)
+{
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) == SQLITE_OK);
+	nLevelLoads = 0;
+	assert(sqlite3_step(pStmt) == SQLITE_ROW);
+	const char *zResult = (const char *) sqlite3_column_text(pStmt, 0);
+	if (zResult == NULL ? zExpected != NULL : zExpected == NULL || strcmp(zResult, zExpected) != 0)
+	{
+		printf("%s\nExpected %s\nReturned %s\n", zSql, zExpected, zResult);
+		assert(0);
+	}
+	if (nExpectedLoads >= 0 && nLevelLoads != nExpectedLoads)
+	{
+		printf("%s\nExpected %d level loads, done %d\n", zSql, nExpectedLoads, nLevelLoads);
+		assert(0);
+	}
+	sqlite3_finalize(pStmt);
+}
+
+static void
+add_object(sqlite3_int64 lObjectID)
+{
+	char zSql[128];
+	snprintf(zSql, sizeof(zSql), "insert into [.objects] (ObjectID) values (%lld);", lObjectID);
+	exec(zSql);
+}
+
+static void
+add_value(sqlite3_int64 lObjectID, int iPropID, int iPropIndex, int ctlv, const char *zValue)
+{
+	char zSql[256];
+	snprintf(zSql, sizeof(zSql), "insert into [.ref-values] (ObjectID, PropertyID, PropIndex, ctlv, [Value]) "
+			"values (%lld, %d, %d, %d, %s);", lObjectID, iPropID, iPropIndex, ctlv, zValue);
+	exec(zSql);
+}
+
+/*
+ * Orders 1, 2, 3 -> customers 10, 11 (order 1 and 2 share customer 10) -> region 20.
+ * Region 20 has no values besides name.
+ * Customer 11 also has owned address 30, and two phones
+ */
+static void
+init_orders()
+{
+	exec("insert into [.sym_names] (ID, [Value]) values (1, 'Customer'), (2, 'Total'), (3, 'Name'), "
+				 "(4, 'Region'), (5, 'Address'), (6, 'Phone'), (7, 'Partner'), (8, 'Self');");
+	exec("insert into [.class_props] (ID, NameID) values (101, 1), (102, 2), (103, 3), (104, 4), (105, 5), "
+				 "(106, 6), (107, 7), (108, 8);");
+
+	for (int ii = 1; ii <= 3; ii++)
+		add_object(ii);
+	add_value(1, 101, 0, CTLV_REF_STD, "10");
+	add_value(1, 102, 0, 0, "9.5");
+	add_value(2, 101, 0, CTLV_REF_STD, "10");
+	add_value(2, 102, 0, 0, "20");
+	add_value(3, 101, 0, CTLV_REF_STD, "11");
+
+	add_object(10);
+	add_value(10, 103, 0, 0, "'Ann'");
+	add_value(10, 104, 0, CTLV_REF_STD, "20");
+
+	add_object(11);
+	add_value(11, 103, 0, 0, "'Bob'");
+	add_value(11, 104, 0, CTLV_REF_STD, "20");
+	add_value(11, 105, 0, CTLV_REF_DELETE_B_WHEN_A, "30");
+	add_value(11, 106, 0, 0, "'555'");
+	add_value(11, 106, 1, 0, "'777'");
+
+	add_object(20);
+	add_value(20, 103, 0, 0, "'North'");
+
+	add_object(30);
+	add_value(30, 103, 0, 0, "'Main St'");
+}
+
+/*
+ * Objects 40 and 41 reference each other, 42 references itself
+ */
+static void
+init_cycles()
+{
+	add_object(40);
+	add_value(40, 103, 0, 0, "'A'");
+	add_value(40, 107, 0, CTLV_REF_STD, "41");
+
+	add_object(41);
+	add_value(41, 103, 0, 0, "'B'");
+	add_value(41, 107, 0, CTLV_REF_STD, "40");
+
+	add_object(42);
+	add_value(42, 108, 0, CTLV_REF_DELETE_COUNTERPART, "42");
+}
+
+static void
+check_levels()
+{
+	// Depth 1: references are IDs
+	check_json("select flexi_expand_refs(1, 1);", "{\"$id\":1,\"Customer\":10,\"Total\":9.5}", 1);
+
+	// Depth 2: customer is embedded, region is ID
+	check_json("select flexi_expand_refs(1, 2);",
+			   "{\"$id\":1,\"Customer\":{\"$id\":10,\"Name\":\"Ann\",\"Region\":20},\"Total\":9.5}", 2);
+
+	// Depth 3: order -> customer -> region. Orders share customer 10 and customers share region 20,
+	// but every level is loaded by one statement, and JSON has every occurrence expanded
+	check_json("select flexi_expand_refs('[1,2,3]', 3);",
+			   "[{\"$id\":1,\"Customer\":{\"$id\":10,\"Name\":\"Ann\",\"Region\":{\"$id\":20,\"Name\":\"North\"}},"
+					   "\"Total\":9.5},"
+					   "{\"$id\":2,\"Customer\":{\"$id\":10,\"Name\":\"Ann\",\"Region\":{\"$id\":20,\"Name\":\"North\"}},"
+					   "\"Total\":20},"
+					   "{\"$id\":3,\"Customer\":{\"$id\":11,\"Name\":\"Bob\",\"Region\":{\"$id\":20,\"Name\":\"North\"},"
+					   "\"Address\":{\"$id\":30,\"Name\":\"Main St\"},\"Phone\":[\"555\",\"777\"]}}]", 3);
+
+	// Depth beyond the last level does not run more statements
+	check_json("select flexi_expand_refs(3, 10);",
+			   "{\"$id\":3,\"Customer\":{\"$id\":11,\"Name\":\"Bob\",\"Region\":{\"$id\":20,\"Name\":\"North\"},"
+					   "\"Address\":{\"$id\":30,\"Name\":\"Main St\"},\"Phone\":[\"555\",\"777\"]}}", 3);
+
+	// Only owned address is embedded in nested only mode
+	check_json("select flexi_expand_refs(11, 3, 1);",
+			   "{\"$id\":11,\"Name\":\"Bob\",\"Region\":20,\"Address\":{\"$id\":30,\"Name\":\"Main St\"},"
+					   "\"Phone\":[\"555\",\"777\"]}", 2);
+
+	// Duplicate and missing IDs
+	check_json("select flexi_expand_refs('[20,999,20]', 2);",
+			   "[{\"$id\":20,\"Name\":\"North\"},null,{\"$id\":20,\"Name\":\"North\"}]", 1);
+	check_json("select flexi_expand_refs(999, 2);", "null", 1);
+	check_json("select flexi_expand_refs('[]', 2);", "[]", 0);
+	check_json("select flexi_expand_refs(null, 2);", NULL, 0);
+}
+
+static void
+check_cycles()
+{
+	// Back reference to object which is being output is written as ID, at any depth
+	check_json("select flexi_expand_refs(40, 10);",
+			   "{\"$id\":40,\"Name\":\"A\",\"Partner\":{\"$id\":41,\"Name\":\"B\",\"Partner\":40}}", 2);
+	check_json("select flexi_expand_refs('[40,41]', 10);",
+			   "[{\"$id\":40,\"Name\":\"A\",\"Partner\":{\"$id\":41,\"Name\":\"B\",\"Partner\":40}},"
+					   "{\"$id\":41,\"Name\":\"B\",\"Partner\":{\"$id\":40,\"Name\":\"A\",\"Partner\":41}}]", 1);
+	check_json("select flexi_expand_refs(42, 10, 1);", "{\"$id\":42,\"Self\":42}", 1);
+}
+
+/*
+ * Object referenced from many objects of the same level is loaded once
+ */
+static void
+check_dedup()
+{
+	flexi_RefExpand_t expand;
+	sqlite3_int64 aIDs[] = {1, 2, 3, 2, 1};
+	flexi_RefExpand_init(&expand, db, LOAD_ROW_MODE_EMBED_REFS, 3);
+	assert(flexi_RefExpand_load(&expand, aIDs, 5) == SQLITE_OK);
+
+	// Orders 1, 2, 3, customers 10, 11, region 20, address 30
+	assert(expand.nObjects == 7);
+	for (u32 ii = 0; ii < expand.nObjects; ii++)
+	{
+		sqlite3_int64 lID = expand.aObjects[ii].lObjectID;
+		int iExpectedLevel = lID < 10 ? 0 : lID < 20 ? 1 : 2;
+		assert(expand.aObjects[ii].iLevel == iExpectedLevel);
+	}
+	flexi_RefExpand_clear(&expand);
+}
+
+static void
+check_errors()
+{
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, "select flexi_expand_refs('[1,\"x\"]', 2);", -1, &pStmt, NULL) == SQLITE_OK);
+	assert(sqlite3_step(pStmt) == SQLITE_ERROR);
+	assert(strstr(sqlite3_errmsg(db), "integers") != NULL);
+	sqlite3_finalize(pStmt);
+
+	assert(sqlite3_prepare_v2(db, "select flexi_expand_refs('{}', 2);", -1, &pStmt, NULL) == SQLITE_OK);
+	assert(sqlite3_step(pStmt) == SQLITE_ERROR);
+	assert(strstr(sqlite3_errmsg(db), "JSON array") != NULL);
+	sqlite3_finalize(pStmt);
+}
+
+int main()
+{
+	assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+	assert(flexi_RefExpand_createFunc(db) == SQLITE_OK);
+	sqlite3_trace_v2(db, SQLITE_TRACE_STMT, trace, NULL);
+
+	exec("create table [.sym_names] (ID integer primary key, [Value] text not null);");
+	exec("create table [.class_props] (ID integer primary key, NameID integer not null);");
+	exec("create table [.objects] (ObjectID integer primary key);");
+	exec("create table [.ref-values] (ObjectID integer not null, PropertyID integer not null, "
+				 "PropIndex integer not null default 0, [Value] not null, ctlv integer not null default 0, "
+				 "primary key (ObjectID, PropertyID, PropIndex)) without rowid;");
+
+	init_orders();
+	init_cycles();
+
+	check_levels();
+	check_cycles();
+	check_dedup();
+	check_errors();
+
+	printf("Reference expansion tests passed\n");
+
+	sqlite3_close(db);
+	return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Tests streamed output of StringBuilder: chunks passed to sink (push) and taken by
+ * StringBuilder_chunkLength/StringBuilder_consume (pull) must add up to the same string as built without
+ * chunking, must not exceed chunk size nor split UTF-8 characters, and buffer must stay about chunk size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sqlite3.h>
+#include <StringBuilder.h>
+
+#define ITEM_COUNT 200000
+
+typedef struct Output_t
+{
+	StringBuilder_t all;
+	uint64_t nChunkSize;
+	int nChunks;
+
+	/* Number of chunks shorter than chunk size, apart from shortening to UTF-8 character boundary */
+	int nShortChunks;
+	int nFailAfter;
+} Output_t;
+
+static void
+check_chunk(Output_t *pOut, const char *zChunk, uint64_t nBytes)
+{
+	/* Chunk is longer than chunk size only when chunk size is less than UTF-8 character */
+	assert(nBytes <= pOut->nChunkSize || nBytes <= 4);
+	assert(nBytes > 0);
+
+	if (nBytes + 4 <= pOut->nChunkSize)
+		pOut->nShortChunks++;
+
+	/* Chunk must not start with UTF-8 continuation byte */
+	assert(((unsigned char) zChunk[0] & 0xC0) != 0x80);
+
+	StringBuilder_appendRaw(&pOut->all, zChunk, (int32_t) nBytes);
+	pOut->nChunks++;
+}
+
+static int
+sink(void *pArg, const char *zChunk, uint64_t nBytes)
+{
+	Output_t *pOut = pArg;
+	if (pOut->nFailAfter > 0 && pOut->nChunks >= pOut->nFailAfter)
+		return SQLITE_ABORT;
+	check_chunk(pOut, zChunk, nBytes);
+	return SQLITE_OK;
+}
+
+/*
+ * Appends JSON array of objects with plain, escaped and multi-byte UTF-8 strings
+ */
+static void
+build(StringBuilder_t *sb, int nItems, uint64_t *pMaxAlloc)
+{
+	char zNum[32];
+	StringBuilder_appendRaw(sb, "[", 1);
+	for (int ii = 0; ii < nItems; ii++)
+	{
+		if (ii > 0)
+			StringBuilder_appendRaw(sb, ",", 1);
+		snprintf(zNum, sizeof(zNum), "{\"id\":%d,\"name\":", ii);
+		StringBuilder_appendRaw(sb, zNum, -1);
+		switch (ii % 4)
+		{
+			case 0:
+				StringBuilder_appendJsonElem(sb, "plain text", -1);
+				break;
+			case 1:
+				StringBuilder_appendJsonElem(sb, "quote \" backslash \\ tab \t", -1);
+				break;
+			case 2:
+				StringBuilder_appendJsonElem(sb, "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 \xE2\x82\xAC", -1);
+				break;
+			default:
+				StringBuilder_appendJsonElem(sb, "\xF0\x9F\x98\x80\xF0\x9F\x98\x80", -1);
+				break;
+		}
+		StringBuilder_appendRaw(sb, "}", 1);
+		if (pMaxAlloc != NULL && sb->nAlloc > *pMaxAlloc)
+			*pMaxAlloc = sb->nAlloc;
+	}
+	StringBuilder_appendRaw(sb, "]", 1);
+}
+
+static void
+check_push(const StringBuilder_t *pExpected, uint64_t nChunkSize)
+{
+	Output_t out = {.nChunkSize = nChunkSize};
+	StringBuilder_t sb;
+	uint64_t nMaxAlloc = 0;
+
+	StringBuilder_init(&out.all);
+	StringBuilder_init(&sb);
+	StringBuilder_setSink(&sb, nChunkSize, sink, &out);
+	build(&sb, ITEM_COUNT, &nMaxAlloc);
+	assert(StringBuilder_flush(&sb) == SQLITE_OK);
+	assert(sb.nUsed == 0);
+
+	assert(out.all.nUsed == pExpected->nUsed);
+	assert(memcmp(out.all.zBuf, pExpected->zBuf, pExpected->nUsed) == 0);
+	assert(nMaxAlloc <= nChunkSize * 2 + 256);
+
+	/* Only the last chunk may be short */
+	assert(out.nShortChunks <= 1);
+
+	StringBuilder_clear(&sb);
+	StringBuilder_clear(&out.all);
+}
+
+static void
+check_pull(uint64_t nChunkSize)
+{
+	Output_t out = {.nChunkSize = nChunkSize};
+	StringBuilder_t sb;
+	uint64_t nChunk;
+
+	StringBuilder_init(&out.all);
+	StringBuilder_init(&sb);
+	sb.nChunkSize = nChunkSize;
+
+	/* Whole output is appended in small steps and complete chunks are taken, as cursor would do for rows */
+	StringBuilder_appendRaw(&sb, "[", 1);
+	for (int ii = 0; ii < ITEM_COUNT; ii++)
+	{
+		StringBuilder_appendJsonElem(&sb, ii % 2 ? "\xE2\x82\xAC\xE2\x82\xAC\xE2\x82\xAC" : "abc", -1);
+		StringBuilder_appendRaw(&sb, ii + 1 < ITEM_COUNT ? "," : "]", 1);
+		while ((nChunk = StringBuilder_chunkLength(&sb, false)) > 0)
+		{
+			check_chunk(&out, sb.zBuf, nChunk);
+			StringBuilder_consume(&sb, nChunk);
+		}
+		assert(sb.nAlloc <= nChunkSize * 2 + 256);
+	}
+	while ((nChunk = StringBuilder_chunkLength(&sb, true)) > 0)
+	{
+		check_chunk(&out, sb.zBuf, nChunk);
+		StringBuilder_consume(&sb, nChunk);
+	}
+
+	StringBuilder_t expected;
+	StringBuilder_init(&expected);
+	StringBuilder_appendRaw(&expected, "[", 1);
+	for (int ii = 0; ii < ITEM_COUNT; ii++)
+	{
+		StringBuilder_appendJsonElem(&expected, ii % 2 ? "\xE2\x82\xAC\xE2\x82\xAC\xE2\x82\xAC" : "abc", -1);
+		StringBuilder_appendRaw(&expected, ii + 1 < ITEM_COUNT ? "," : "]", 1);
+	}
+	assert(out.all.nUsed == expected.nUsed);
+	assert(memcmp(out.all.zBuf, expected.zBuf, expected.nUsed) == 0);
+	assert(out.nShortChunks <= 1);
+
+	StringBuilder_clear(&expected);
+	StringBuilder_clear(&sb);
+	StringBuilder_clear(&out.all);
+}
+
+/*
+ * Error returned by sink stops output and is returned by flush
+ */
+static void
+check_sink_error()
+{
+	Output_t out = {.nChunkSize = 1000, .nFailAfter = 3};
+	StringBuilder_t sb;
+
+	StringBuilder_init(&out.all);
+	StringBuilder_init(&sb);
+	StringBuilder_setSink(&sb, out.nChunkSize, sink, &out);
+	build(&sb, 10000, NULL);
+	assert(sb.bErr && sb.iSinkResult == SQLITE_ABORT);
+	assert(sb.nUsed < out.nChunkSize * 2);
+	assert(StringBuilder_flush(&sb) == SQLITE_ABORT);
+	assert(out.nChunks == 3);
+
+	StringBuilder_clear(&sb);
+	StringBuilder_clear(&out.all);
+}
+
+int main()
+{
+	StringBuilder_t expected;
+	StringBuilder_init(&expected);
+	build(&expected, ITEM_COUNT, NULL);
+	assert(!expected.bErr);
+
+	check_push(&expected, 3);
+	check_push(&expected, 7);
+	check_push(&expected, 4096);
+	check_push(&expected, 65536);
+
+	check_pull(2);
+	check_pull(5);
+	check_pull(4096);
+
+	check_sink_error();
+
+	printf("StringBuilder tests passed\n");
+
+	StringBuilder_clear(&expected);
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Tests value_stats and value_stats_merge functions: accuracy of distinct count estimation,
+ * equi-depth histogram, min/max and merging of statistics of two halves of data set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <sqlite3.h>
+
+int value_stats_func_init(sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi);
+
+static sqlite3 *db;
+
+static void
+exec(const char *zSql)
+{
+	char *zErr = NULL;
+	if (sqlite3_exec(db, zSql, NULL, NULL, &zErr) != SQLITE_OK)
+	{
+		printf("%s: %s\n", zSql, zErr);
+		assert(0);
+	}
+}
+
+static sqlite3_int64
+query_int(const char *zSql)
+{
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) == SQLITE_OK);
+	assert(sqlite3_step(pStmt) == SQLITE_ROW);
+	sqlite3_int64 result = sqlite3_column_int64(pStmt, 0);
+	sqlite3_finalize(pStmt);
+	return result;
+}
+
+static double
+query_double(const char *zSql)
+{
+	sqlite3_stmt *pStmt;
+	assert(sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) == SQLITE_OK);
+	assert(sqlite3_step(pStmt) == SQLITE_ROW);
+	double result = sqlite3_column_double(pStmt, 0);
+	sqlite3_finalize(pStmt);
+	return result;
+}
+
+/*
+ * Every bucket of equi-depth histogram must hold approximately count / N values
+ */
+static void
+check_histogram(const char *zStatsSql, int nBuckets, double dTolerance)
+{
+	char zSql[256];
+	sqlite3_stmt *pStmt;
+	sqlite3_int64 nCount = query_int("select count(*) from vals;");
+
+	sqlite3_snprintf(sizeof(zSql), zSql, "drop table if exists stats; create table stats as select (%s) as s;",
+	                 zStatsSql);
+	exec(zSql);
+
+	assert(query_int("select json_array_length(s, '$.histogram') from stats;") == nBuckets + 1);
+	assert(query_int("select json_extract(s, '$.histogram[0]') = (select min(v) from vals) from stats;"));
+	assert(query_int("select json_extract(s, '$.histogram[#-1]') = (select max(v) from vals) from stats;"));
+	assert(query_int("select json_extract(s, '$.min') = (select min(v) from vals) from stats;"));
+	assert(query_int("select json_extract(s, '$.max') = (select max(v) from vals) from stats;"));
+
+	assert(sqlite3_prepare_v2(db, "select (select count(*) from vals where v > h.value and v <= h2.value) "
+	                              "from stats, json_each(stats.s, '$.histogram') h, json_each(stats.s, '$.histogram') h2 "
+	                              "where h2.key = h.key + 1 order by h.key;", -1, &pStmt, NULL) == SQLITE_OK);
+	while (sqlite3_step(pStmt) == SQLITE_ROW)
+	{
+		double dDepth = sqlite3_column_double(pStmt, 0) / ((double) nCount / nBuckets);
+		if (fabs(dDepth - 1) > dTolerance)
+		{
+			printf("Bucket depth is %.2f of expected\n", dDepth);
+			assert(0);
+		}
+	}
+	sqlite3_finalize(pStmt);
+}
+
+int main()
+{
+	assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+	assert(value_stats_func_init(db, NULL, NULL) == SQLITE_OK);
+
+	exec("create table n(x); insert into n values (1);");
+
+	/* Empty set and nulls */
+	assert(query_int("select json_extract(value_stats(x), '$.rows') from n where 0;") == 0);
+	assert(query_int("select json_extract(value_stats(null), '$.count') from n;") == 0);
+	assert(query_int("select json_array_length(value_stats(null), '$.histogram') from n;") == 0);
+
+	/* Distinct count */
+	{
+		int aRows[] = {10, 1000, 100000, 300000};
+		int aDistinct[] = {7, 500, 20000, 300000};
+		for (int ii = 0; ii < 4; ii++)
+		{
+			char zSql[256];
+			sqlite3_snprintf(sizeof(zSql), zSql,
+			                 "select json_extract(value_stats(value %% %d), '$.distinct') from "
+			                 "(with recursive c(value) as (select 0 union all select value + 1 from c limit %d) "
+			                 "select value from c);", aDistinct[ii], aRows[ii]);
+			double dEstimate = (double) query_int(zSql);
+			double dError = fabs(dEstimate - aDistinct[ii]) / aDistinct[ii];
+			printf("%8d rows, %8d distinct: estimate %.0f, error %.2f%%\n", aRows[ii], aDistinct[ii], dEstimate,
+			       dError * 100);
+			assert(dError < 0.1);
+		}
+	}
+
+	/* Integers and reals with the same value are the same distinct value. Text differs */
+	assert(query_int("select json_extract(value_stats(v), '$.distinct') from "
+	                 "(select 5 as v union all select 5.0 union all select '5');") == 2);
+
+	/* Histogram on skewed numeric data */
+	exec("create table vals(v); "
+	     "with recursive c(x) as (select 1 union all select x + 1 from c limit 50000) "
+	     "insert into vals select (x * x) % 100003 * 0.5 from c;");
+	check_histogram("select value_stats(v, 10) from vals", 10, 0.25);
+
+	/* Text values, mixed with numbers: numbers go first */
+	exec("delete from vals; "
+	     "with recursive c(x) as (select 1 union all select x + 1 from c limit 20000) "
+	     "insert into vals select case when x % 4 = 0 then x else printf('name %05d', (x * 7919) % 20000) end "
+	     "from c;");
+	check_histogram("select value_stats(v, 8) from vals", 8, 0.25);
+	assert(query_int("select json_type(s, '$.min') = 'integer' and json_type(s, '$.max') = 'text' from stats;"));
+
+	/* Merge of two halves is close to statistics of the whole set */
+	exec("delete from vals; "
+	     "with recursive c(x) as (select 1 union all select x + 1 from c limit 60000) "
+	     "insert into vals select (x * 31) % 45000 from c;");
+	exec("create table halves as select value_stats(v, 16) as s from vals where rowid <= 30000 "
+	     "union all select value_stats(v, 16) from vals where rowid > 30000;");
+	check_histogram("select value_stats_merge((select s from halves limit 1), (select s from halves limit 1 offset 1))",
+	                16, 0.25);
+	assert(query_int("select json_extract(s, '$.count') from stats;") == 60000);
+	assert(query_int("select json_extract(s, '$.rows') from stats;") == 60000);
+	double dDistinct = query_double("select json_extract(s, '$.distinct') from stats;");
+	printf("merged distinct: %.0f of 45000\n", dDistinct);
+	assert(fabs(dDistinct - 45000) / 45000 < 0.1);
+
+	/* Merge with null returns the other statistics */
+	assert(query_int("select value_stats_merge(null, s) = s from stats;"));
+
+	printf("value_stats tests passed\n");
+
+	sqlite3_close(db);
+	return 0;
+}
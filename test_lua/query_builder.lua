@@ -91,12 +91,25 @@ local expr_cases = {
     { expr = [[((12 <= QuantityPerUnit and (12 >= ReorderLevel and 3 < UnitPrice)))]], indexedProps = {} },
     { expr = [[(11 < QuantityPerUnit and 12 > ReorderLevel and 13 <= UnitPrice and 14 >= QuantityPerUnit)]], indexedProps = {} },
     { expr = [[CategoryID == 6 and ProductName >= 'B' and ProductName < 'C']], indexedProps = {} },
+    { expr = [[UnitPrice * UnitsInStock > 1000 and string.lower(ProductName) == 'chai']], indexedProps = {} },
+    { expr = [[ProductName:sub(1, 3) == 'Cha' or (UnitsOnOrder / 2 >= ReorderLevel and not Discontinued == 1)]], indexedProps = {} },
+    { expr = [[#QuantityPerUnit < 20 and ProductName .. '!' ~= params.ProductName]], indexedProps = {},
+      params = { ProductName = 'Chai!' } },
+    -- 'mod' is not translated to SQL - Lua sandbox is used for the second operand
+    { expr = [[ReorderLevel > 4 and UnitsInStock % 2 == 0]], indexedProps = {} },
+    -- Values are bound with full precision, not inlined with 14 significant digits
+    { expr = [[UnitPrice == 0.30000000000000004 and UnitsInStock * 1.0000000000000002 > 1]], indexedProps = {} },
 }
 
 ---@param case IndexCase
 local function generate_indexed_items(case)
     print('#Expression: '..case.expr)
     local filterDef = FilterDef(ProductClassDef, case.expr, case.params)
+    print('#SQL: ' .. tostring(filterDef:compile_to_sql()) .. (filterDef.compiledFully and '' or ' (+ Lua)'))
+    for ii = 1, filterDef.sqlParamCount or 0 do
+        local v = filterDef.sqlParams['v' .. ii]
+        print(string.format('#  :v%d = %s', ii, type(v) == 'number' and string.format('%.17g', v) or tostring(v)))
+    end
     --pretty.dump(filterDef.indexedItems)
 end
 
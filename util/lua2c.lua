@@ -0,0 +1,104 @@
+---
+--- Created by slanska.
+--- DateTime: 2026-10-17
+---
+
+--[[
+Command line utility to precompile list of .lua files to LuaJIT bytecode and
+to generate single C source file with bytecode of all modules (see src/flexi/flexi_lua_bundle.h).
+Generated file gets compiled into Flexilite library, and modules are registered in package.preload
+on extension load, so that no Lua source is read or parsed at runtime.
+
+Must be run by the same LuaJIT version as the one linked with Flexilite, as bytecode format
+is version specific.
+
+Module name is taken from file list (if specified) or derived from file path:
+src_lua/DBContext.lua -> DBContext
+lib/lua-penlight/lua/pl/path.lua -> pl.path
+lib/lua-penlight/lua/pl/init.lua -> pl
+lib/lua-prettycjson/lib/resty/prettycjson.lua -> prettycjson
+]]
+
+local path = require 'pl.path'
+local lapp = require 'pl.lapp'
+
+local cli_args = lapp [[
+Compile lua-to-C-bundle
+<filelist> (string)  Path to file list .lua module
+    -o, --output (string default 'src/resources/lua_bundle.res.c')  Output C file
+    -s, --strip  Strip debug information from bytecode
+]]
+
+-- Bytes per line in generated arrays
+local BYTES_PER_LINE = 24
+
+---@param file_name string
+---@return string
+local function module_name_from_path(file_name)
+    local name = file_name:gsub('%.lua$', '')
+    if name:find('^src_lua/') then
+        name = name:gsub('^src_lua/', '')
+    else
+        -- lib/<package>/[lua/|lib/resty/]path/to/module
+        name = name:gsub('^lib/[^/]+/', '')
+        name = name:gsub('^lua/', ''):gsub('^lib/resty/', '')
+    end
+    name = name:gsub('/', '.'):gsub('%.init$', '')
+    return name
+end
+
+local file_list = path.abspath(path.relpath(cli_args.filelist))
+local files = loadfile(file_list)()
+
+-- Sort modules by name, so that generated file is stable between builds
+local modules = {}
+for file_name, module_name in pairs(files) do
+    if type(file_name) == 'number' then
+        file_name = module_name
+        module_name = module_name_from_path(file_name)
+    end
+    table.insert(modules, { file = file_name, name = module_name })
+end
+table.sort(modules, function(a, b)
+    return a.name < b.name
+end)
+
+local out = {}
+table.insert(out, '/*\n * Generated by util/lua2c.lua from ' .. cli_args.filelist .. '. Do not edit\n */\n\n')
+table.insert(out, '#include "../flexi/flexi_lua_bundle.h"\n\n')
+
+local seen = {}
+for idx, m in ipairs(modules) do
+    if seen[m.name] then
+        error(string.format('Duplicate module name [%s] for %s and %s', m.name, seen[m.name], m.file))
+    end
+    seen[m.name] = m.file
+
+    print(string.format('Compiling %s as %s', m.file, m.name))
+
+    -- Current directory is expected to be flexilite
+    local fn, err = loadfile(path.abspath(path.relpath(m.file)))
+    if not fn then
+        error(err)
+    end
+    local bc = string.dump(fn, cli_args.strip)
+
+    table.insert(out, string.format('/* %s */\nstatic const unsigned char bc%d[] = {\n', m.file, idx))
+    for ii = 1, #bc, BYTES_PER_LINE do
+        local bytes = { bc:byte(ii, math.min(ii + BYTES_PER_LINE - 1, #bc)) }
+        table.insert(out, '        ' .. table.concat(bytes, ',') .. ',\n')
+    end
+    table.insert(out, '};\n\n')
+end
+
+table.insert(out, 'const flexi_LuaModule_t flexi_LuaBundle[] = {\n')
+for idx, m in ipairs(modules) do
+    table.insert(out, string.format('        {"%s", bc%d, sizeof(bc%d)},\n', m.name, idx, idx))
+end
+table.insert(out, '        {NULL, NULL, 0}\n};\n')
+
+local f = assert(io.open(cli_args.output, 'wb'))
+f:write(table.concat(out))
+f:close()
+
+print(string.format('%d modules written to %s', #modules, cli_args.output))